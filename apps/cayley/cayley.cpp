@@ -133,8 +133,8 @@ std::string flat_vertex_shader =
         "void\n"
         "main()\n"
         "{\n"
-        "    vec3 p, n;\n"
-        "    extractVertex( p, n );\n"
+        "    vec3 p;\n"
+        "    extractVertex( p );\n"
         "    gl_Position = gl_ModelViewProjectionMatrix * vec4( p, 1.0 );\n"
         "    gl_FrontColor = gl_Color;\n"
         "}\n";
@@ -171,7 +171,7 @@ init()
     // Enable if field is to be interpreted as a binary field
     HPMCsetFieldAsBinary( hpmc_h );
 #endif
-     // --- create traversal vertex shader --------------------------------------
+     // --- create traversal vertex shader -------------------------------------
     hpmc_th_shaded = HPMCcreateTraversalHandle( hpmc_h );
 
     char *traversal_code = HPMCgetTraversalShaderFunctions( hpmc_th_shaded );
@@ -205,6 +205,7 @@ init()
                                    0, 1, 2 );
 
     hpmc_th_flat = HPMCcreateTraversalHandle( hpmc_h );
+    HPMCsetTraversalHandlePositionOnly( hpmc_th_flat, GL_TRUE );
 
     traversal_code = HPMCgetTraversalShaderFunctions( hpmc_th_flat );
     const char* flat_src[2] =
@@ -0,0 +1,374 @@
+/* -*- mode: C++; tab-width:4; c-basic-offset: 4; indent-tabs-mode:nil -*-
+ ***********************************************************************
+ *
+ *  File: volume.cpp
+ *
+ *  Created: 17. October 2026
+ *
+ *  Version: $Id: $
+ *
+ *  Authors: Christopher Dyken <christopher.dyken@sintef.no>
+ *
+ *  This file is part of the HPMC library.
+ *  Copyright (C) 2009 by SINTEF.  All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  ("GPL") version 2 as published by the Free Software Foundation.
+ *  See the file LICENSE.GPL at the root directory of this source
+ *  distribution for additional information about the GNU GPL.
+ *
+ *  For using HPMC with software that can not be combined with the
+ *  GNU GPL, please contact SINTEF for aquiring a commercial license
+ *  and support.
+ *
+ *  SINTEF, Pb 124 Blindern, N-0314 Oslo, Norway
+ *  http://www.sintef.no
+ *********************************************************************/
+
+// Loading of 8-bit volumes for the example applications.
+//
+// The volume file is memory-mapped instead of read into memory, and the
+// volume is uploaded to a 3D texture a slab of z-slices at a time, copying
+// straight from the mapping into a pixel unpack buffer. Thus, an application
+// can start extracting surfaces from the slices uploaded so far while the rest
+// of the volume is still on disc. Besides headerless raw files, NRRD (.nrrd,
+// .nhdr) and MetaImage (.mhd, .mha) headers with uncompressed 8-bit data are
+// understood. Include after common.cpp.
+
+#include <cstring>
+#include <sstream>
+#if defined(__unix) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+struct Volume
+{
+    int             m_size[3];
+    /** Start of the samples in the mapping. */
+    const GLubyte*  m_data;
+    /** The mapping of the entire data file. */
+    void*           m_map;
+    size_t          m_map_size;
+#ifdef _WIN32
+    HANDLE          m_file;
+    HANDLE          m_mapping;
+#endif
+    GLuint          m_tex;
+    GLuint          m_pbo;
+    /** Number of z-slices uploaded to m_tex so far. */
+    int             m_slices;
+    /** Range of the samples uploaded so far. */
+    GLubyte         m_min;
+    GLubyte         m_max;
+};
+
+// --- check the extension of a filename ---------------------------------------
+bool
+hasSuffix( const string& filename, const string& suffix )
+{
+    return filename.size() >= suffix.size() &&
+           filename.compare( filename.size()-suffix.size(), suffix.size(), suffix ) == 0;
+}
+
+// --- resolve a data file name relative to the header file --------------------
+string
+dataFilePath( const string& header, const string& datafile )
+{
+    if( datafile.empty() || datafile[0] == '/' ) {
+        return datafile;
+    }
+    size_t slash = header.find_last_of( "/\\" );
+    if( slash == string::npos ) {
+        return datafile;
+    }
+    return header.substr( 0, slash+1 ) + datafile;
+}
+
+// --- parse a NRRD or MetaImage header ----------------------------------------
+//
+// On success, sets the volume size, the name of the data file, and the offset
+// of the samples in the data file.
+bool
+parseVolumeHeader( Volume&          v,
+                   const string&    filename,
+                   string&          datafile,
+                   size_t&          offset )
+{
+    std::ifstream file( filename.c_str(), std::ios::in | std::ios::binary );
+    if( !file.good() ) {
+        cerr << "Error opening \"" << filename << "\" for reading." << endl;
+        return false;
+    }
+    bool nrrd = hasSuffix( filename, ".nrrd" ) || hasSuffix( filename, ".nhdr" );
+    char separator = nrrd ? ':' : '=';
+    bool local = false;
+    bool uchar = false;
+    int dims = 0;
+
+    string line;
+    if( nrrd && ( !std::getline( file, line ) || line.compare( 0, 4, "NRRD" ) != 0 ) ) {
+        cerr << "\"" << filename << "\" is not a NRRD file." << endl;
+        return false;
+    }
+    while( std::getline( file, line ) ) {
+        if( !line.empty() && line[ line.size()-1 ] == '\r' ) {
+            line.resize( line.size()-1 );
+        }
+        if( nrrd && line.empty() ) {
+            // A blank line ends the header, the data follows if no data file.
+            local = datafile.empty();
+            break;
+        }
+        if( line.empty() || line[0] == '#' ) {
+            continue;
+        }
+        size_t sep = line.find( separator );
+        if( sep == string::npos ) {
+            continue;
+        }
+        string key = line.substr( 0, sep );
+        key.erase( key.find_last_not_of( " \t" )+1 );
+        size_t start = line.find_first_not_of( " \t", sep+1 );
+        string value = start == string::npos ? string() : line.substr( start );
+        value.erase( value.find_last_not_of( " \t" )+1 );
+        std::istringstream values( value );
+
+        if( key == "sizes" || key == "DimSize" ) {
+            values >> v.m_size[0] >> v.m_size[1] >> v.m_size[2];
+        }
+        else if( key == "dimension" || key == "NDims" ) {
+            values >> dims;
+        }
+        else if( key == "type" || key == "ElementType" ) {
+            uchar = value == "uchar" || value == "unsigned char" ||
+                    value == "uint8" || value == "uint8_t" || value == "MET_UCHAR";
+        }
+        else if( key == "encoding" ) {
+            if( value != "raw" ) {
+                cerr << "\"" << filename << "\" has unsupported encoding " << value << "." << endl;
+                return false;
+            }
+        }
+        else if( key == "CompressedData" ) {
+            if( value == "True" ) {
+                cerr << "\"" << filename << "\" has compressed data." << endl;
+                return false;
+            }
+        }
+        else if( key == "HeaderSize" || key == "byte skip" ) {
+            values >> offset;
+        }
+        else if( key == "data file" || key == "datafile" || key == "ElementDataFile" ) {
+            if( value == "LOCAL" ) {
+                // MetaImage, the data follows this line which ends the header.
+                local = true;
+                break;
+            }
+            datafile = dataFilePath( filename, value );
+            if( !nrrd ) {
+                break;
+            }
+        }
+    }
+    if( dims != 3 || !uchar ) {
+        cerr << "\"" << filename << "\" is not a 3D volume of unsigned bytes." << endl;
+        return false;
+    }
+    if( local ) {
+        datafile = filename;
+        offset += static_cast<size_t>( file.tellg() );
+    }
+    else if( datafile.empty() ) {
+        cerr << "\"" << filename << "\" does not name a data file." << endl;
+        return false;
+    }
+    return true;
+}
+
+// --- release the mapping of the volume file ----------------------------------
+void
+closeVolumeMapping( Volume& v )
+{
+    if( v.m_map == NULL ) {
+        return;
+    }
+#if defined(__unix) || defined(__APPLE__)
+    munmap( v.m_map, v.m_map_size );
+#elif defined(_WIN32)
+    UnmapViewOfFile( v.m_map );
+    CloseHandle( v.m_mapping );
+    CloseHandle( v.m_file );
+#endif
+    v.m_map = NULL;
+    v.m_data = NULL;
+}
+
+// --- memory-map a volume file ------------------------------------------------
+//
+// If filename has a NRRD or MetaImage suffix, the size is taken from the
+// header, otherwise the file is raw samples of the given size.
+bool
+openVolume( Volume&         v,
+            const string&   filename,
+            int             size_x,
+            int             size_y,
+            int             size_z )
+{
+    v.m_size[0] = size_x;
+    v.m_size[1] = size_y;
+    v.m_size[2] = size_z;
+    v.m_data = NULL;
+    v.m_map = NULL;
+    v.m_map_size = 0;
+    v.m_tex = 0;
+    v.m_pbo = 0;
+    v.m_slices = 0;
+    v.m_min = 255;
+    v.m_max = 0;
+
+    string datafile;
+    size_t offset = 0;
+    if( hasSuffix( filename, ".nrrd" ) || hasSuffix( filename, ".nhdr" ) ||
+        hasSuffix( filename, ".mhd" )  || hasSuffix( filename, ".mha" ) )
+    {
+        if( !parseVolumeHeader( v, filename, datafile, offset ) ) {
+            return false;
+        }
+    }
+    else {
+        datafile = filename;
+    }
+    if( v.m_size[0] < 2 || v.m_size[1] < 2 || v.m_size[2] < 2 ) {
+        cerr << "Volume must have at least two samples along each axis." << endl;
+        return false;
+    }
+
+#if defined(__unix) || defined(__APPLE__)
+    int fd = open( datafile.c_str(), O_RDONLY );
+    if( fd < 0 ) {
+        cerr << "Error opening \"" << datafile << "\" for reading." << endl;
+        return false;
+    }
+    struct stat st;
+    if( fstat( fd, &st ) == 0 && st.st_size > 0 ) {
+        v.m_map_size = static_cast<size_t>( st.st_size );
+        v.m_map = mmap( NULL, v.m_map_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if( v.m_map == MAP_FAILED ) {
+            v.m_map = NULL;
+        }
+        else {
+            // The slices are read once in order.
+            madvise( v.m_map, v.m_map_size, MADV_SEQUENTIAL );
+        }
+    }
+    close( fd );
+#elif defined(_WIN32)
+    v.m_file = CreateFileA( datafile.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                            OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+    if( v.m_file == INVALID_HANDLE_VALUE ) {
+        cerr << "Error opening \"" << datafile << "\" for reading." << endl;
+        return false;
+    }
+    LARGE_INTEGER size;
+    v.m_mapping = NULL;
+    if( GetFileSizeEx( v.m_file, &size ) && size.QuadPart > 0 ) {
+        v.m_map_size = static_cast<size_t>( size.QuadPart );
+        v.m_mapping = CreateFileMapping( v.m_file, NULL, PAGE_READONLY, 0, 0, NULL );
+        if( v.m_mapping != NULL ) {
+            v.m_map = MapViewOfFile( v.m_mapping, FILE_MAP_READ, 0, 0, 0 );
+        }
+    }
+#endif
+    if( v.m_map == NULL ) {
+        cerr << "Error mapping \"" << datafile << "\"." << endl;
+        return false;
+    }
+    size_t bytes = static_cast<size_t>( v.m_size[0] )*v.m_size[1]*v.m_size[2];
+    if( v.m_map_size < offset + bytes ) {
+        cerr << "\"" << datafile << "\" is too small for a "
+             << v.m_size[0] << "x" << v.m_size[1] << "x" << v.m_size[2]
+             << " volume." << endl;
+        closeVolumeMapping( v );
+        return false;
+    }
+    v.m_data = reinterpret_cast<const GLubyte*>( v.m_map ) + offset;
+    return true;
+}
+
+// --- allocate the 3D texture and the pixel unpack buffer ---------------------
+void
+createVolumeTexture( Volume& v )
+{
+    glGenTextures( 1, &v.m_tex );
+    glBindTexture( GL_TEXTURE_3D, v.m_tex );
+    glTexImage3D( GL_TEXTURE_3D, 0, GL_ALPHA,
+                  v.m_size[0], v.m_size[1], v.m_size[2], 0,
+                  GL_ALPHA, GL_UNSIGNED_BYTE, NULL );
+    glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+    glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+    glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP);
+    glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+    glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+    glBindTexture( GL_TEXTURE_3D, 0 );
+    glGenBuffers( 1, &v.m_pbo );
+}
+
+// --- upload the next slab of z-slices to the 3D texture ----------------------
+//
+// Uploads up to the given number of slices, and returns the number of slices
+// uploaded so far.
+int
+uploadVolumeSlab( Volume& v, int slices )
+{
+    int z0 = v.m_slices;
+    int z1 = min( v.m_size[2], z0 + max( 1, slices ) );
+    if( z0 >= z1 ) {
+        return v.m_slices;
+    }
+    size_t slice = static_cast<size_t>( v.m_size[0] )*v.m_size[1];
+    size_t bytes = slice*(z1-z0);
+    const GLubyte* src = v.m_data + slice*z0;
+
+    // Orphan the buffer such that the upload of the previous slab is not
+    // waited for, and copy straight from the mapping.
+    glBindBuffer( GL_PIXEL_UNPACK_BUFFER, v.m_pbo );
+    glBufferData( GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW );
+    GLubyte* dst = reinterpret_cast<GLubyte*>( glMapBuffer( GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY ) );
+    if( dst == NULL ) {
+        glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+        cerr << "Failed to map pixel unpack buffer." << endl;
+        return v.m_slices;
+    }
+    memcpy( dst, src, bytes );
+    glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+
+    for( size_t i=0; i<bytes; i++ ) {
+        v.m_min = min( v.m_min, src[i] );
+        v.m_max = max( v.m_max, src[i] );
+    }
+
+    GLint alignment;
+    glGetIntegerv( GL_UNPACK_ALIGNMENT, &alignment );
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+    glBindTexture( GL_TEXTURE_3D, v.m_tex );
+    glTexSubImage3D( GL_TEXTURE_3D, 0,
+                     0, 0, z0,
+                     v.m_size[0], v.m_size[1], z1-z0,
+                     GL_ALPHA, GL_UNSIGNED_BYTE, NULL );
+    glBindTexture( GL_TEXTURE_3D, 0 );
+    glPixelStorei( GL_UNPACK_ALIGNMENT, alignment );
+    glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+
+    v.m_slices = z1;
+    if( v.m_slices == v.m_size[2] ) {
+        // Everything is on the GPU, release the buffer and the mapping.
+        glDeleteBuffers( 1, &v.m_pbo );
+        v.m_pbo = 0;
+        closeVolumeMapping( v );
+    }
+    return v.m_slices;
+}
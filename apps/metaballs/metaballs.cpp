@@ -29,9 +29,9 @@
 // Rendering metaballs
 //
 // This example demonstrates the use of a custom fetch function and how the
-// application can get hold of program names to update uniform variables. In
-// principle, the fetch calculates the distance field defined by eight
-// metaballs, whose position is provided through uniform variables. To make
+// application can pass parameters to it through a uniform block managed by
+// HPMC. In principle, the fetch calculates the distance field defined by eight
+// metaballs, whose position is provided through the uniform block. To make
 // the example more interesting, the domain is twisted time-dependently along
 // the z and y-axes.
 
@@ -66,12 +66,21 @@ struct HPMCHistoPyramid* hpmc_h;
 struct HPMCTraversalHandle* hpmc_th_shiny;
 struct HPMCTraversalHandle* hpmc_th_flat;
 
+// layout of the HPMC_FetchParameters uniform block (std140)
+struct FetchParameters {
+    GLfloat centers[8][4];
+    GLfloat twist;
+    GLfloat padding[3];
+};
+
 
 // -----------------------------------------------------------------------------
 // a metaball evaluation shader, with domain twist
 std::string fetch_code =
-        "uniform float twist;\n"
-        "uniform vec3 centers[8];\n"
+        "layout(std140) uniform HPMC_FetchParameters {\n"
+        "    vec4  centers[8];\n"
+        "    float twist;\n"
+        "};\n"
         "float\n"
         "HPMC_fetch( vec3 p )\n"
         "{\n"
@@ -87,7 +96,7 @@ std::string fetch_code =
         "    p = 0.5*p + vec3(0.5);\n"
         "    float s = 0.0;\n"
         "    for(int i=0; i<8; i++) {\n"
-        "        vec3 r = p-centers[i];\n"
+        "        vec3 r = p-centers[i].xyz;\n"
         "        s += 0.05/dot(r,r);\n"
         "    }\n"
         "    return s;\n"
@@ -126,8 +135,8 @@ std::string flat_vertex_shader =
         "void\n"                                                               \
         "main()\n"                                                             \
         "{\n"                                                                  \
-        "    vec3 p, n;\n"                                                     \
-        "    extractVertex( p, n );\n"                                         \
+        "    vec3 p;\n"                                                        \
+        "    extractVertex( p );\n"                                            \
         "    gl_Position = gl_ModelViewProjectionMatrix * vec4( p, 1.0 );\n"   \
         "    gl_FrontColor = gl_Color;\n"                              \
         "}\n";
@@ -161,6 +170,11 @@ init()
                         0,
                         GL_FALSE );
 
+    if( !HPMCsetFieldCustomParameterBlock( hpmc_h, 0 ) ) {
+        std::cerr << "Failed to set up parameter block." << std::endl;
+        exit( EXIT_FAILURE );
+    }
+
 
     // --- shiny traversal vertex shader ---------------------------------------
     hpmc_th_shiny = HPMCcreateTraversalHandle( hpmc_h );
@@ -195,9 +209,11 @@ init()
                                    0, 1, 2 );
 
     // --- flat traversal vertex shader ----------------------------------------
+    // the flat shader ignores the normal, so skip the gradient samples
     hpmc_th_flat = HPMCcreateTraversalHandle( hpmc_h );
+    HPMCsetTraversalHandlePositionOnly( hpmc_th_flat, GL_TRUE );
 
-    traversal_code = HPMCgetTraversalShaderFunctions( hpmc_th_shiny );
+    traversal_code = HPMCgetTraversalShaderFunctions( hpmc_th_flat );
     const char* flat_src[2] =
     {
         traversal_code,
@@ -266,29 +282,17 @@ display()
     glTranslatef( -0.5f, -0.5f, -0.5f );
 
     // --- update metaballs position -------------------------------------------
-    std::vector<GLfloat> centers( 3*8 );
+    FetchParameters params;
     for( size_t i=0; i<8; i++ ) {
-        centers[3*i+0] = 0.5+0.3*sin( t+sin(0.1*t)*i );
-        centers[3*i+1] = 0.5+0.3*cos( 0.9*t+sin(0.1*t)*i );
-        centers[3*i+2] = 0.5+0.3*cos( 0.7*t+sin(0.01*t)*i );
+        params.centers[i][0] = 0.5+0.3*sin( t+sin(0.1*t)*i );
+        params.centers[i][1] = 0.5+0.3*cos( 0.9*t+sin(0.1*t)*i );
+        params.centers[i][2] = 0.5+0.3*cos( 0.7*t+sin(0.01*t)*i );
+        params.centers[i][3] = 1.0f;
     }
-    float twist = 5.0*sin(0.1*t);
+    params.twist = 5.0*sin(0.1*t);
 
-    GLuint builder = HPMCgetBuilderProgram( hpmc_h );
-
-    glUseProgram( builder );
-    glUniform1f( glGetUniformLocation( builder, "twist" ), twist );
-    glUniform3fv( glGetUniformLocation( builder, "centers" ), 8, &centers[0] );
-
-    glUseProgram( shiny_p );
-    glUniform1f( glGetUniformLocation( shiny_p, "twist" ), twist );
-    glUniform3fv( glGetUniformLocation( shiny_p, "centers" ), 8, &centers[0] );
-
-    glUseProgram( flat_p );
-    glUniform1f( glGetUniformLocation( flat_p, "twist" ), twist );
-    glUniform3fv( glGetUniformLocation( flat_p, "centers" ), 8, &centers[0] );
-
-    glUseProgram( 0 );
+    // the builder and both traversal programs share the parameter block
+    HPMCupdateFieldCustomParameters( hpmc_h, &params, 0, sizeof(params) );
 
     // --- build HistoPyramid --------------------------------------------------
     GLfloat iso = 10.0f;
@@ -30,13 +30,15 @@
 //
 // This example demonstrates using the surface generated by HPMC as input to a
 // geometry shader that emits particles randomly over the surface. The particles
-// are pulled by gravity, and uses the scalar field passed to HPMC to determine
-// when particles hit the surface, and in this case, they bounce. To test if a
-// particle hits the surface is done by evaluating the sign of the scalar field
-// at the position of the particle at the beginning of the timestep and at the
-// end. This approach is a bit too simple for these shapes, as they usually have
-// a great deal of regions with multiple zeros, and this leads to the artefact
-// of particles falling through the surface at some places.
+// are pulled by gravity, and bounce when they hit the surface. The step of
+// every particle in a frame is cast against the iso-surface in one batch using
+// HPMC's collision queries, which walk the HistoPyramid and only visit cells
+// that contain the surface. Thus, a particle cannot tunnel through thin parts
+// of the surface, as it could when just comparing the sign of the scalar field
+// at the ends of the step, which fails where these algebraic shapes have
+// multiple zeros close together. The queries interpolate the field between
+// the corners of the cells like the extracted triangles, so the particles
+// bounce off the surface that is drawn rather than the exact algebraic shape.
 //
 // The following render loop is used:
 // - Use HPMC to determine the iso-surface of the current scalar field
@@ -44,10 +46,14 @@
 //   transform feedback buffer.
 // - Pass this buffer into a geometry shader that emits particles (points) at
 //   some of the triangles, output stored in another transform feedback buffer.
-// - Pass the particles from the previous frame into a geometry shader that
-//   does a series of Euler-steps to integrate velocity and position, checking
-//   for collisions in-between. The output of this pass is concatenated at the
-//   end of the newly created particles using transform feedback.
+// - Pass the particles from the previous frame through a vertex shader that
+//   does an Euler-step and records the start and end of the step as object
+//   space segments, and cast these segments against the surface with
+//   HPMCqueryCollisions.
+// - Pass the particles and the query results into a geometry shader that
+//   moves the particles, bouncing the ones that hit the surface. The output of
+//   this pass is concatenated at the end of the newly created particles using
+//   transform feedback.
 // - Render the particles using a geometry shader that expands the point
 //   positions into quadrilateral screen-aligned billboards.
 
@@ -92,6 +98,9 @@ GLuint particles_vbo_p;  // tells which of the two buffers that are current
 GLuint particles_vbo_n;  // number of particles in buffer
 GLuint particles_vbo_N;  // size of particle buffer
 
+GLuint segments_vbo;     // step of every particle, input to collision queries
+GLuint hits_vbo;         // result of collision queries
+
 struct HPMCConstants* hpmc_c;
 struct HPMCHistoPyramid* hpmc_h;
 struct HPMCTraversalHandle* hpmc_th;
@@ -240,6 +249,29 @@ string emitter_geometry_shader =
         "    }\n"
         "}\n";
 
+// --- particle step shader program --------------------------------------------
+GLuint step_v;
+GLuint step_p;
+
+string step_vertex_shader =
+        // input from interleaved GL_T2F_N3F_V3F buffer
+        // output the step of the particle as an object space segment
+        "varying out vec4 segment_a;\n"
+        "varying out vec4 segment_b;\n"
+        "uniform float dt;\n"
+        "void\n"
+        "main()\n"
+        "{\n"
+        //   integrate, must match the animation geometry shader
+        "    vec3 vel_b_c = gl_Normal + dt*vec3( 0.0, -0.6, 0.0 );\n"
+        "    vec3 pos_b_c = gl_Vertex.xyz + dt*vel_b_c;\n"
+        "    vec4 pos_a_ho = gl_ModelViewMatrixInverse * vec4( gl_Vertex.xyz, 1.0 );\n"
+        "    vec4 pos_b_ho = gl_ModelViewMatrixInverse * vec4( pos_b_c, 1.0 );\n"
+        "    segment_a = vec4( (1.0/pos_a_ho.w)*pos_a_ho.xyz, 1.0 );\n"
+        "    segment_b = vec4( (1.0/pos_b_ho.w)*pos_b_ho.xyz, 1.0 );\n"
+        "    gl_Position = vec4( 0.0 );\n"
+        "}\n";
+
 // --- particle animation shader program ---------------------------------------
 GLuint anim_v;
 GLuint anim_g;
@@ -247,122 +279,66 @@ GLuint anim_p;
 GLuint anim_query;
 
 string anim_vertex_shader =
-        // input from interleaved GL_T2F_N3F_V3F buffer
-        // pass output to GS, position in gl_Position
+        // input from interleaved GL_T2F_N3F_V3F buffer and the result of the
+        // collision query of the particle, pass output to GS, position in
+        // gl_Position
+        "attribute vec4 hit_position;\n"
+        "attribute vec4 hit_normal;\n"
         "varying out vec3 invel;\n"
         "varying out vec2 ininfo;\n"
+        "varying out vec4 inhit_position;\n"
+        "varying out vec4 inhit_normal;\n"
         "void\n"
         "main()\n"
         "{\n"
         "    invel = gl_Normal;\n"
         "    ininfo = gl_MultiTexCoord0.xy;\n"
+        "    inhit_position = hit_position;\n"
+        "    inhit_normal = hit_normal;\n"
         "    gl_Position = gl_Vertex;\n"
         "}\n";
 
 string anim_geometry_shader =
         // input passed from VS
-        "varying in vec3 invel[1];\n"                                          \
-        "varying in vec2 ininfo[1];\n"                                         \
+        "varying in vec3 invel[1];\n"
+        "varying in vec2 ininfo[1];\n"
+        "varying in vec4 inhit_position[1];\n"
+        "varying in vec4 inhit_normal[1];\n"
         // output varyings that get fed back
-        "varying out vec3 pos;\n"                                              \
-        "varying out vec3 vel;\n"                                              \
-        "varying out vec2 info;\n"                                             \
+        "varying out vec3 pos;\n"
+        "varying out vec3 vel;\n"
+        "varying out vec2 info;\n"
         // timestep
-        "uniform float dt;\n"                                                  \
-        "uniform float iso;\n"\
-        "void\n" \
-        "main()\n" \
-        "{\n" \
-        "    info = ininfo[0] - vec2( 0.1*dt, dt );\n"\
-        "    vec3 vel_a_c = invel[0];\n"
-        "    vec3 pos_a_c = gl_PositionIn[0].xyz;\n"
-        "    vec3 acc_b_c = vec3( 0.0, -0.6, 0.0 );\n"
-        "    vec3 vel_b_c;\n"
-        "    vec3 pos_b_c;\n"
-        "    const int steps = 32;\n"
-        "    float sdt = (1.0/float(steps))*dt;\n"
-        //   object space pos of a
-        "    vec4 pos_a_ho = gl_ModelViewMatrixInverse * vec4( pos_a_c, 1.0 );\n"
-        "    vec3 pos_a_o = (1.0/pos_a_ho.w)*pos_a_ho.xyz;\n"
-        "    for( int s=0; s<steps; s++ ) {\n"
-        //       integrate
-        "        vel_b_c = vel_a_c + sdt * acc_b_c;\n"
-        "        pos_b_c = pos_a_c + sdt * vel_b_c;\n"
-        //       calc object space pos of b
-        "        vec4 pos_b_ho = gl_ModelViewMatrixInverse * vec4( pos_b_c, 1.0 );\n"
-        "        vec3 pos_b_o = (1.0/pos_b_ho.w)*pos_b_ho.xyz;\n"
-        //       surface interaction only happen inside object space unit cube
-        "        if( all( lessThan( abs(pos_b_o-vec3(0.5)), vec3(0.5) ) ) ) {\n"
-        //           First, find the direction towards the surface
-        "            vec4 gradsample_a = HPMC_fetchGrad( pos_a_o )-vec4(0.0,0.0,0.0,iso);\n"
-        "            vec3 to_surf_o = -0.01*sign(gradsample_a.w)*normalize(gradsample_a.xyz);\n"
-        "            vec3 to_surf_c = gl_NormalMatrix * to_surf_o;\n"
-        //           Check if particle is moving towards the surface
-        "            if( dot(vel_b_c, to_surf_c) > 0.0 ) {\n"
-        //              Then, check the scalar feld a small step towards the surface
-        "                vec3 to_surf_pos = pos_a_o + to_surf_o;\n"
-        "                float to_surf_field = HPMC_fetch( to_surf_pos )-iso;\n"
-        //               If field changes sign, move particle slighly backwards
-        //               to minimize the risk of the particle falling through
-        //               the surface. Note that just checking signs might have
-        //               problems at multiple zeros, which happen with these
-        //               algebraic surfaces.
-        "                if( (to_surf_field)*(gradsample_a.w) <= 0.0 ) {\n"
-        //                   Determine closest point on surface
-        "                    float t = -gradsample_a.w/(to_surf_field-gradsample_a.w);\n"
-        //                   And move the particle a small step backwards
-        "                    pos_a_o = mix( pos_a_o, to_surf_pos, t ) - to_surf_o;\n"
-        //                   Update camera-space position,
-        "                    vec4 pos_a_hc = gl_ModelViewMatrix * vec4( pos_a_o, 1.0 );\n"
-        "                    vec3 new_pos_a_c = (1.0/pos_a_hc.w)*pos_a_hc.xyz;\n"
-        //                   Find direction we pushed in camera-space
-        "                    vec3 to_surf_n_c = normalize( to_surf_c );\n"
-        //                   Determine amount of movement towards the surface
-        "                    float to_surf_vel = dot( vel_b_c, to_surf_n_c );\n"
-        //                   Kill velocity into the surface
-        "                    vel_b_c -= to_surf_vel*to_surf_n_c;\n"
-        //                   update position of a
-        "                    pos_a_c = new_pos_a_c;\n"
-        "                    pos_b_c = pos_a_c + sdt * vel_b_c;\n"
-        "                    vec4 pos_b_ho = gl_ModelViewMatrixInverse * vec4( pos_b_c, 1.0 );\n"
-        "                    pos_b_o = (1.0/pos_b_ho.w)*pos_b_ho.xyz;\n"
-        "                    info.y = 1.0;\n"
-        "                }\n"
-        "            }\n"
-        "            float field_a = HPMC_fetch( pos_a_o ) - iso;\n"
-        "            float field_b = HPMC_fetch( pos_b_o ) - iso;\n"
-        //           check for sign change
-        "            if( field_a*field_b <= 0.0 ) {\n"
-        //               determine zero-crossing
-        "                float t = -field_a/(field_b-field_a);\n"
-        //               step back to intersection
-        "                pos_b_c -= (1.0-t)*dt*vel_b_c;\n"
-        //               point of intersection in object space
-        "                vec3 pos_i_o = mix( pos_a_o, pos_b_o, t );\n"
-        //               gradient at intersection used to get surface normal
-        "                vec3 nrm_i_c = normalize( gl_NormalMatrix * HPMC_fetchGrad( pos_i_o ).xyz );\n"
-        //               reflect velocity
-        "                vel_b_c = reflect( vel_b_c, nrm_i_c );\n"
-        //               step rest of timestep in reflected direction
-        "                pos_b_c += (1.0-t)*dt*vel_b_c;\n"
-        "                vel_b_c *= 0.98;\n"
-        "                info.y = 1.0;\n"
-        "            }\n"
-        "        }\n"
-        "        vel_a_c = vel_b_c;\n"
-        "        pos_a_c = pos_b_c;\n"
-        "        pos_a_o = pos_b_o;\n"
+        "uniform float dt;\n"
+        "void\n"
+        "main()\n"
+        "{\n"
+        "    info = ininfo[0] - vec2( 0.1*dt, dt );\n"
+        //   integrate, must match the step vertex shader
+        "    vel = invel[0] + dt*vec3( 0.0, -0.6, 0.0 );\n"
+        "    pos = gl_PositionIn[0].xyz + dt*vel;\n"
+        //   w of the normal is 1 if the step hit the surface
+        "    if( (inhit_normal[0].w > 0.0) && (dot(inhit_normal[0].xyz,inhit_normal[0].xyz) > 0.0) ) {\n"
+        //       point of intersection and surface normal in camera space
+        "        vec4 pos_i_hc = gl_ModelViewMatrix * vec4( inhit_position[0].xyz, 1.0 );\n"
+        "        vec3 pos_i_c = (1.0/pos_i_hc.w)*pos_i_hc.xyz;\n"
+        "        vec3 nrm_i_c = normalize( gl_NormalMatrix * inhit_normal[0].xyz );\n"
+        //       stop the particle at the intersection, nudged slightly back to
+        //       the side it came from, and reflect its velocity. The rest of
+        //       the step is taken next frame, where it is cast again.
+        "        float side = dot( gl_PositionIn[0].xyz - pos_i_c, nrm_i_c ) < 0.0 ? -1.0 : 1.0;\n"
+        "        pos = pos_i_c + 0.002*side*nrm_i_c;\n"
+        "        vel = 0.98*reflect( vel, nrm_i_c );\n"
+        "        info.y = 1.0;\n"
         "    }\n"
-        "    vel = vel_b_c;\n"
-        "    pos = pos_b_c;\n"
         "    gl_Position = gl_ProjectionMatrix * vec4(pos, 1.0);\n"
         "    vec3 norm = (1.0/gl_Position.w)*gl_Position.xyz;\n"
         //   only emit particles inside the frustum and that are not too old
-        "    if( (info.x > 0.0) && \n" \
+        "    if( (info.x > 0.0) && \n"
         "        all( lessThan( abs(norm), vec3(1.0) ) ) )\n"
-        "    {\n"\
-        "        EmitVertex();\n"                                              \
-        "    }\n"\
+        "    {\n"
+        "        EmitVertex();\n"
+        "    }\n"
         "}\n";
 
 // --- particle billboard render shader program --------------------------------
@@ -511,6 +487,13 @@ init()
                                    0, 1, 2 );
     ASSERT_GL;
 
+    // let the traversal handle cast particle steps against the surface
+    if( !HPMCsetTraversalHandleCollisionQueries( hpmc_th, GL_TRUE ) ) {
+        cerr << "Failed to set up collision queries, OpenGL 3.0 is required, exiting." << endl;
+        exit( EXIT_FAILURE );
+    }
+    ASSERT_GL;
+
     // --- set up particle emitter program -------------------------------------
     const GLchar* emitter_v_src[1] =
     {
@@ -549,6 +532,27 @@ init()
     setFeedbackVaryings( emitter_p, 3, &emitter_varying_names[0] );
     ASSERT_GL;
 
+    // --- set up particle step program ----------------------------------------
+    const GLchar* step_v_src[1] =
+    {
+        step_vertex_shader.c_str()
+    };
+    step_v = glCreateShader( GL_VERTEX_SHADER );
+    glShaderSource( step_v,1, &step_v_src[0], NULL );
+    compileShader( step_v, "particle step vertex shader" );
+
+    const GLchar* step_varying_names[2] =
+        {
+            "segment_a",
+            "segment_b"
+        };
+    step_p = glCreateProgram();
+    glAttachShader( step_p, step_v );
+    activateVaryings( step_p, 2, &step_varying_names[0] );
+    linkProgram( step_p, "particle step program" );
+    setFeedbackVaryings( step_p, 2, &step_varying_names[0] );
+    ASSERT_GL;
+
     // --- set up particle animation program -----------------------------------
     const GLchar* anim_v_src[1] =
     {
@@ -558,13 +562,12 @@ init()
     glShaderSource( anim_v,1, &anim_v_src[0], NULL );
     compileShader( anim_v, "particle animation vertex shader" );
 
-    const GLchar* anim_g_src[2] =
+    const GLchar* anim_g_src[1] =
     {
-        fetch_code.c_str(),
         anim_geometry_shader.c_str()
     };
     anim_g = glCreateShader( GL_GEOMETRY_SHADER_EXT );
-    glShaderSource( anim_g, 2, &anim_g_src[0], NULL );
+    glShaderSource( anim_g, 1, &anim_g_src[0], NULL );
     compileShader( anim_g, "particle animation geometry shader" );
 
     const GLchar* anim_varying_names[3] =
@@ -576,6 +579,8 @@ init()
     anim_p = glCreateProgram();
     glAttachShader( anim_p, anim_v );
     glAttachShader( anim_p, anim_g );
+    glBindAttribLocation( anim_p, 6, "hit_position" );
+    glBindAttribLocation( anim_p, 7, "hit_normal" );
     glProgramParameteriEXT( anim_p,
                             GL_GEOMETRY_INPUT_TYPE_EXT, GL_POINTS );
     glProgramParameteriEXT( anim_p,
@@ -649,6 +654,21 @@ init()
                       NULL,
                       GL_DYNAMIC_COPY );
     }
+
+    // buffers to hold collision query input and output, two vec4's per
+    // particle each
+    glGenBuffers( 1, &segments_vbo );
+    glBindBuffer( GL_ARRAY_BUFFER, segments_vbo );
+    glBufferData( GL_ARRAY_BUFFER,
+                  (4+4)*particles_vbo_N * sizeof(GLfloat),
+                  NULL,
+                  GL_DYNAMIC_COPY );
+    glGenBuffers( 1, &hits_vbo );
+    glBindBuffer( GL_ARRAY_BUFFER, hits_vbo );
+    glBufferData( GL_ARRAY_BUFFER,
+                  (4+4)*particles_vbo_N * sizeof(GLfloat),
+                  NULL,
+                  GL_DYNAMIC_COPY );
     glBindBuffer( GL_ARRAY_BUFFER, 0 );
 
     // --- set up queries to track number of primitives produced ----------------
@@ -808,16 +828,37 @@ render( float t, float dt, float fps )
         threshold = min( 100000, static_cast<int>(10.1*threshold) );
     }
 
+    // --- find collisions of particles with the surface -----------------------
+    // Record the step of every particle from the previous frame as a segment,
+    // and cast all segments against the surface in one go.
+    glUseProgram( step_p );
+    glUniform1f( glGetUniformLocation( step_p, "dt"), dt );
+    glBindBufferBaseNV( GL_TRANSFORM_FEEDBACK_BUFFER_NV, 0, segments_vbo );
+    glBindBuffer( GL_ARRAY_BUFFER, particles_vbo[ particles_vbo_p ] );
+    glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+    glInterleavedArrays( GL_T2F_N3F_V3F, 0, NULL );
+    glEnable( GL_RASTERIZER_DISCARD_NV );
+    glBeginTransformFeedbackNV( GL_POINTS );
+    glDrawArrays( GL_POINTS, 0, particles_vbo_n );
+    glEndTransformFeedbackNV();
+    glDisable( GL_RASTERIZER_DISCARD_NV );
+    glPopClientAttrib();
+    glBindBuffer( GL_ARRAY_BUFFER, 0 );
+    ASSERT_GL;
+
+    // The fetch function of the collision query program needs the shape too.
+    GLuint collision = HPMCgetCollisionQueryProgram( hpmc_th );
+    glUseProgram( collision );
+    glUniform1fv( glGetUniformLocation( collision, "shape" ), 12, &CC[0] );
+    HPMCqueryCollisions( hpmc_th, segments_vbo, hits_vbo, particles_vbo_n );
+    ASSERT_GL;
+
     // --- animate and render particles ----------------------------------------
-    // We animate the particles from the previous frame, deleting the ones that
-    // is too old, and concatenate the result behind the newly created
-    // particles. We also pass the particles on to the fragment shader for
-    // rendering. To get more fancy effects, one would add a dedicated rendering
-    // pass that expanded every particle into a billboard and do some blending.
+    // We animate the particles from the previous frame, bouncing the ones that
+    // hit the surface and deleting the ones that is too old, and concatenate
+    // the result behind the newly created particles.
     glUseProgram( anim_p );
-    glUniform1fv( glGetUniformLocation( anim_p, "shape" ), 12, &CC[0] );
     glUniform1f( glGetUniformLocation( anim_p, "dt"), dt );
-    glUniform1f( glGetUniformLocation( anim_p, "iso"), iso );
 
     // Output after the results of the emitter.
     glBindBufferOffsetNV( GL_TRANSFORM_FEEDBACK_BUFFER_NV,
@@ -826,8 +867,15 @@ render( float t, float dt, float fps )
 
     // Render previous frame's particles
 
-    glBindBuffer( GL_ARRAY_BUFFER, particles_vbo[ particles_vbo_p ] );
     glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+    glBindBuffer( GL_ARRAY_BUFFER, hits_vbo );
+    glVertexAttribPointer( 6, 4, GL_FLOAT, GL_FALSE, 8*sizeof(GLfloat),
+                           reinterpret_cast<const GLvoid*>( 0 ) );
+    glVertexAttribPointer( 7, 4, GL_FLOAT, GL_FALSE, 8*sizeof(GLfloat),
+                           reinterpret_cast<const GLvoid*>( 4*sizeof(GLfloat) ) );
+    glEnableVertexAttribArray( 6 );
+    glEnableVertexAttribArray( 7 );
+    glBindBuffer( GL_ARRAY_BUFFER, particles_vbo[ particles_vbo_p ] );
     glInterleavedArrays( GL_T2F_N3F_V3F, 0, NULL );
     glEnable( GL_RASTERIZER_DISCARD_NV );
     glBeginQuery( GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN_NV, anim_query );
@@ -836,7 +884,10 @@ render( float t, float dt, float fps )
     glEndTransformFeedbackNV();
     glEndQuery( GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN_NV );
     glDisable( GL_RASTERIZER_DISCARD_NV );
+    glDisableVertexAttribArray( 6 );
+    glDisableVertexAttribArray( 7 );
     glPopClientAttrib();
+    glBindBuffer( GL_ARRAY_BUFFER, 0 );
 
     // Get hold of the number of particles that didn't die of old age.
     GLuint anim_result;
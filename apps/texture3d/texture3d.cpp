@@ -30,8 +30,12 @@
 //
 // This example demonstrates the most basic use of HPMC, providing the scalar
 // field as a 3D texture. The example gets volume dimensions and a file name of
-// a 8-bit raw dataset from the command line, reads the data into a 3D texture
-// and passes this texture to HPMC.
+// a 8-bit raw dataset (or the name of a NRRD or MetaImage header) from the
+// command line, maps the file into memory and passes a 3D texture to HPMC.
+//
+// The volume is uploaded a slab of slices per frame, and while it is loading,
+// the grid covers only the slices uploaded so far, so the first surfaces are
+// shown right away for large datasets.
 //
 // For each frame, a time-depenent iso-value is calculated, passed to HPMC which
 // analyzes the scalar field using this iso-value. Then, HPMC renders the
@@ -57,8 +61,8 @@
 #endif
 #include "hpmc.h"
 #include "../common/common.cpp"
+#include "../common/volume.cpp"
 
-using std::ifstream;
 using std::vector;
 using std::string;
 using std::cerr;
@@ -67,17 +71,23 @@ using std::endl;
 int volume_size_x;
 int volume_size_y;
 int volume_size_z;
-vector<GLubyte> dataset;
+Volume volume;
 
-GLuint volume_tex;
+// Upload at most this many bytes of the volume per frame.
+const size_t slab_bytes = 16*1024*1024;
+// Number of slices covered by the grid.
+int grid_slices = 0;
+// Distance between the lattice samples used by the grid. Large volumes start
+// out coarse and are refined when loading is done.
+int grid_stride = 1;
 
 struct HPMCConstants* hpmc_c;
 struct HPMCHistoPyramid* hpmc_h;
 
 // -----------------------------------------------------------------------------
-GLuint shaded_v;
-GLuint shaded_f;
-GLuint shaded_p;
+GLuint shaded_v = 0;
+GLuint shaded_f = 0;
+GLuint shaded_p = 0;
 struct HPMCTraversalHandle* hpmc_th_flat;
 std::string shaded_vertex_shader =
         "varying vec3 normal;\n"
@@ -112,60 +122,45 @@ std::string flat_vertex_shader =
         "void\n"
         "main()\n"
         "{\n"
-        "    vec3 p, n;\n"
-        "    extractVertex( p, n );\n"
+        "    vec3 p;\n"
+        "    extractVertex( p );\n"
         "    gl_Position = gl_ModelViewProjectionMatrix * vec4( p, 1.0 );\n"
         "    gl_FrontColor = gl_Color;\n"
         "}\n";
 
 // -----------------------------------------------------------------------------
+// Let the grid cover the slices uploaded so far using the current stride. The
+// lattice stays the same, but the layout of the HistoPyramid changes, so the
+// traversal programs must be rebuilt afterwards.
 void
-init()
+configureGrid()
 {
-    // --- upload volume ------------------------------------------------------
-
-    GLint alignment;
-    glGetIntegerv( GL_UNPACK_ALIGNMENT, &alignment );
-    glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
-    glGenTextures( 1, &volume_tex );
-    glBindTexture( GL_TEXTURE_3D, volume_tex );
-    glTexImage3D( GL_TEXTURE_3D, 0, GL_ALPHA,
-                  volume_size_x, volume_size_y, volume_size_z, 0,
-                  GL_ALPHA, GL_UNSIGNED_BYTE, &dataset[0] );
-    glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-    glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP);
-    glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP);
-    glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
-    glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
-    glBindTexture( GL_TEXTURE_3D, 0 );
-    glPixelStorei( GL_UNPACK_ALIGNMENT, alignment );
-
-    // --- create HistoPyramid -------------------------------------------------
-    hpmc_c = HPMCcreateConstants( 4, 3 );
-    hpmc_h = HPMCcreateHistoPyramid( hpmc_c );
-
-    HPMCsetLatticeSize( hpmc_h,
-                        volume_size_x,
-                        volume_size_y,
-                        volume_size_z );
-
+    float max_size = max( volume_size_x, max( volume_size_y, volume_size_z ) );
+    grid_slices = volume.m_slices;
     HPMCsetGridSize( hpmc_h,
                      volume_size_x-1,
                      volume_size_y-1,
-                     volume_size_z-1 );
-
-    float max_size = max( volume_size_x, max( volume_size_y, volume_size_z ) );
+                     grid_slices-1 );
     HPMCsetGridExtent( hpmc_h,
                        volume_size_x / max_size,
                        volume_size_y / max_size,
-                       volume_size_z / max_size );
-
-    HPMCsetFieldTexture3D( hpmc_h,
-                           volume_tex,
-                           GL_FALSE );
+                       (volume_size_z / max_size)*(grid_slices-1)/(volume_size_z-1.0f) );
+    HPMCsetSampleStride( hpmc_h, grid_stride );
+}
 
-    // --- create traversal vertex shader --------------------------------------
-    hpmc_th_shaded = HPMCcreateTraversalHandle( hpmc_h );
+// -----------------------------------------------------------------------------
+// (Re)build the traversal programs, the traversal code depends on the
+// configuration of the HistoPyramid.
+void
+buildTraversalPrograms()
+{
+    if( shaded_p != 0 ) {
+        glDeleteProgram( shaded_p );
+        glDeleteShader( shaded_v );
+        glDeleteShader( shaded_f );
+        glDeleteProgram( flat_p );
+        glDeleteShader( flat_v );
+    }
 
     char *traversal_code = HPMCgetTraversalShaderFunctions( hpmc_th_shaded );
     const char* shaded_vsrc[2] =
@@ -197,8 +192,6 @@ init()
                                    shaded_p,
                                    0, 1, 2 );
 
-    hpmc_th_flat = HPMCcreateTraversalHandle( hpmc_h );
-
     traversal_code = HPMCgetTraversalShaderFunctions( hpmc_th_flat );
     const char* flat_src[2] =
     {
@@ -219,7 +212,50 @@ init()
     HPMCsetTraversalHandleProgram( hpmc_th_flat,
                                    flat_p,
                                    0, 1, 2 );
+}
 
+// -----------------------------------------------------------------------------
+void
+init()
+{
+    // --- allocate volume and upload the first slab ---------------------------
+    createVolumeTexture( volume );
+    size_t slice = static_cast<size_t>( volume_size_x )*volume_size_y;
+    uploadVolumeSlab( volume, max( 2, (int)(slab_bytes/slice) ) );
+
+    // --- create HistoPyramid -------------------------------------------------
+    hpmc_c = HPMCcreateConstants( 4, 3 );
+    hpmc_h = HPMCcreateHistoPyramid( hpmc_c );
+
+    HPMCsetLatticeSize( hpmc_h,
+                        volume_size_x,
+                        volume_size_y,
+                        volume_size_z );
+
+    // start large volumes on a subsampled grid to get a quick preview
+    int max_size = max( volume_size_x, max( volume_size_y, volume_size_z ) );
+    if( max_size >= 512 ) {
+        grid_stride = 8;
+    }
+    else if( max_size >= 256 ) {
+        grid_stride = 4;
+    }
+    configureGrid();
+
+    HPMCsetFieldTexture3D( hpmc_h,
+                           volume.m_tex,
+                           GL_FALSE );
+
+    // let HPMC skip iso-values outside the range of the dataset
+    HPMCsetFieldRange( hpmc_h,
+                       volume.m_min/255.0f,
+                       volume.m_max/255.0f );
+
+    // --- create traversal handles and programs -------------------------------
+    hpmc_th_shaded = HPMCcreateTraversalHandle( hpmc_h );
+    hpmc_th_flat = HPMCcreateTraversalHandle( hpmc_h );
+    HPMCsetTraversalHandlePositionOnly( hpmc_th_flat, GL_TRUE );
+    buildTraversalPrograms();
 
     glPolygonOffset( 1.0, 1.0 );
 }
@@ -250,6 +286,28 @@ render( float t, float dt, float fps )
                   -0.5f*volume_size_y / max_size,
                   -0.5f*volume_size_z / max_size );
 
+    // --- upload next slab of the volume --------------------------------------
+    if( volume.m_slices < volume_size_z ) {
+        size_t slice = static_cast<size_t>( volume_size_x )*volume_size_y;
+        int slices = uploadVolumeSlab( volume, max( 2, (int)(slab_bytes/slice) ) );
+        HPMCsetFieldRange( hpmc_h,
+                           volume.m_min/255.0f,
+                           volume.m_max/255.0f );
+
+        // Grow the grid when the number of slices has doubled, such that the
+        // traversal programs are rebuilt only a few times during loading.
+        if( slices >= 2*grid_slices || slices == volume_size_z ) {
+            configureGrid();
+            buildTraversalPrograms();
+        }
+    }
+    // --- refine the grid when the whole volume is present --------------------
+    else if( grid_stride > 1 ) {
+        grid_stride = grid_stride/2;
+        configureGrid();
+        buildTraversalPrograms();
+    }
+
     // --- build HistoPyramid --------------------------------------------------
     float iso = 0.5 + 0.48*cosf( t );
     HPMCbuildHistopyramid( hpmc_h, iso );
@@ -277,15 +335,18 @@ render( float t, float dt, float fps )
     static char message[512] = "";
     if( floor(5.0*(t-dt)) != floor(5.0*(t)) ) {
         snprintf( message, 512,
-                  "%.1f fps, %dx%dx%d samples, %d mvps, %d triangles, iso=%.2f%s",
+                  "%.1f fps, %dx%dx%d samples, stride %d, %d mvps, %d triangles, iso=%.2f%s%s",
                   fps,
                   volume_size_x,
                   volume_size_y,
                   volume_size_z,
-                  (int)( ((volume_size_x-1)*(volume_size_y-1)*(volume_size_z-1)*fps)/1e6 ),
+                  grid_stride,
+                  (int)( ((volume_size_x-1)*(volume_size_y-1)*(grid_slices-1)*fps)/
+                         (1e6*grid_stride*grid_stride*grid_stride) ),
                   HPMCacquireNumberOfVertices( hpmc_h )/3,
                   iso,
-                  wireframe ? " [wireframe]" : "");
+                  wireframe ? " [wireframe]" : "",
+                  grid_slices < volume_size_z ? " [loading]" : "" );
     }
     glUseProgram( 0 );
     glMatrixMode( GL_PROJECTION );
@@ -311,37 +372,37 @@ main(int argc, char **argv)
     glewExperimental = GL_TRUE;
 #endif
 
-    if( argc != 5 ) {
+    if( argc != 5 && argc != 2 ) {
         cerr << "HPMC demo application that visualizes raw volumes."<<endl<<endl;
-        cerr << "Usage: " << argv[0] << " xsize ysize zsize rawfile"<<endl<<endl;
-        cerr << "where: xsize    The number of samples in the x-direction."<<endl;
-        cerr << "       ysize    The number of samples in the y-direction."<<endl;
-        cerr << "       zsize    The number of samples in the z-direction."<<endl;
-        cerr << "       rawfile  Filename of a raw set of bytes describing"<<endl;
-        cerr << "                the volume."<<endl<<endl;
+        cerr << "Usage: " << argv[0] << " xsize ysize zsize rawfile"<<endl;
+        cerr << "       " << argv[0] << " headerfile"<<endl<<endl;
+        cerr << "where: xsize       The number of samples in the x-direction."<<endl;
+        cerr << "       ysize       The number of samples in the y-direction."<<endl;
+        cerr << "       zsize       The number of samples in the z-direction."<<endl;
+        cerr << "       rawfile     Filename of a raw set of bytes describing"<<endl;
+        cerr << "                   the volume."<<endl;
+        cerr << "       headerfile  Filename of a NRRD (.nrrd, .nhdr) or"<<endl;
+        cerr << "                   MetaImage (.mhd, .mha) header of a volume"<<endl;
+        cerr << "                   of uncompressed bytes."<<endl<<endl;
         cerr << "Raw volumes can be found e.g. at http://www.volvis.org."<<endl<<endl;
         cerr << "Example usage:"<<endl;
         cerr << "    " << argv[0] << " 64 64 64 neghip.raw"<< endl;
         cerr << "    " << argv[0] << " 256 256 256 foot.raw"<< endl;
         cerr << "    " << argv[0] << " 256 256 178 BostonTeapot.raw"<< endl;
         cerr << "    " << argv[0] << " 301 324 56 lobster.raw"<< endl;
+        cerr << "    " << argv[0] << " engine.nhdr"<< endl;
         exit( EXIT_FAILURE );
     }
     else {
-        volume_size_x = atoi( argv[1] );
-        volume_size_y = atoi( argv[2] );
-        volume_size_z = atoi( argv[3] );
-
-        dataset.resize( volume_size_x * volume_size_y * volume_size_z );
-        ifstream datafile( argv[4], std::ios::in | std::ios::binary );
-        if( datafile.good() ) {
-            datafile.read( reinterpret_cast<char*>( &dataset[0] ),
-                           dataset.size() );
-        }
-        else {
-            cerr << "Error opening \"" << argv[4] << "\" for reading." << endl;
+        bool ok = argc == 5
+                ? openVolume( volume, argv[4], atoi( argv[1] ), atoi( argv[2] ), atoi( argv[3] ) )
+                : openVolume( volume, argv[1], 0, 0, 0 );
+        if( !ok ) {
             exit( EXIT_FAILURE );
         }
+        volume_size_x = volume.m_size[0];
+        volume_size_y = volume.m_size[1];
+        volume_size_z = volume.m_size[2];
     }
     glutInitDisplayMode( GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH );
     glutInitWindowSize( 1280, 720 );
@@ -61,6 +61,8 @@
 //
 // This example implements paths for both the NV and EXT extensions (determined
 // by a runtime check), and should run on both NVIDIA and AMD/ATI hardware.
+// With OpenGL 4.0, the example instead lets HPMC manage the feedback buffer,
+// which avoids reading the number of vertices back to the CPU every frame.
 
 #include <cstdlib>
 #include <cstdio>
@@ -82,7 +84,8 @@ using std::endl;
 using std::vector;
 using std::string;
 
-bool use_ext; // use EXT extension instead of NV extension
+bool use_ext;     // use EXT extension instead of NV extension
+bool use_managed; // use HPMC-managed output buffer (OpenGL 4.0)
 
 int volume_size_x;
 int volume_size_y;
@@ -180,7 +183,13 @@ void
 init()
 {
     // --- check for availability of transform feedback ------------------------
-    if( GLEW_NV_transform_feedback ) {
+    use_managed = false;
+    use_ext = false;
+    if( GLEW_VERSION_4_0 ) {
+        cerr << "Using OpenGL 4.0 with HPMC-managed feedback buffer." << endl;
+        use_managed = true;
+    }
+    else if( GLEW_NV_transform_feedback ) {
         cerr << "Using GL_NV_transform_feedback extension." << endl;
         use_ext = false;
     }
@@ -300,7 +309,13 @@ init()
     // first tag the varyings as active, link the program, determine the
     // varying locations of the varyings that shall be fed back, and then ship
     // this to GL.
-    if( use_ext ) {
+    if( use_managed ) {
+        glTransformFeedbackVaryings( flat_p,
+                                     2,
+                                     &flat_varying_names[0],
+                                     GL_INTERLEAVED_ATTRIBS );
+    }
+    else if( use_ext ) {
 #ifdef GL_EXT_transform_feedback
         glTransformFeedbackVaryingsEXT( flat_p,
                                         2,
@@ -319,7 +334,7 @@ init()
 
     linkProgram( flat_p, "flat program" );
 
-    if( !use_ext ) {
+    if( !use_managed && !use_ext ) {
         // determine the location of the varyings, and ship to GL.
         GLint varying_locs[2];
         for(int i=0; i<2; i++) {
@@ -339,6 +354,11 @@ init()
                                    0, 1, 2 );
 
     // --- set up buffer for feedback of MC triangles --------------------------
+    if( use_managed ) {
+        HPMCsetTraversalHandleOutputBuffer( hpmc_th_flat,
+                                            (3+3)*sizeof(GLfloat),
+                                            3*1000 );
+    }
     glGenBuffers( 1, &mc_tri_vbo );
     glBindBuffer( GL_ARRAY_BUFFER, mc_tri_vbo );
     mc_tri_vbo_N = 3*1000;
@@ -381,13 +401,38 @@ render( float t, float dt, float fps )
     glColor3f( 0.5, 0.5, 0.5 );
     glEnable( GL_DEPTH_TEST );
 
-    // if wireframe, do transform feedback capture
-    GLsizei N = HPMCacquireNumberOfVertices( hpmc_h );
+    // if wireframe, do transform feedback capture. The managed path never
+    // needs the number of vertices, so only fetch it for the text string.
+    static GLsizei N = 0;
+    bool update_message = floor(5.0*(t-dt)) != floor(5.0*(t));
+    if( !use_managed || update_message ) {
+        N = HPMCacquireNumberOfVertices( hpmc_h );
+    }
     if(!wireframe) {
         // render normally
         glColor3f( 1.0-iso, 0.0, iso );
         HPMCextractVertices( hpmc_th_shaded );
     }
+    else if( use_managed ) {
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        glColor3f(0.1, 0.1, 0.2 );
+        glEnable( GL_POLYGON_OFFSET_FILL );
+        HPMCextractVerticesToOutputBuffer( hpmc_th_flat );
+        glDisable( GL_POLYGON_OFFSET_FILL );
+
+        // --- render wireframe ------------------------------------------------
+        glUseProgram( 0 );
+        glColor3f( 1.0, 1.0, 1.0 );
+        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE );
+
+        glBindBuffer( GL_ARRAY_BUFFER, HPMCgetOutputBuffer( hpmc_th_flat ) );
+        glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+        glInterleavedArrays( GL_N3F_V3F, 0, NULL );
+        HPMCdrawOutputBuffer( hpmc_th_flat, GL_TRIANGLES );
+        glPopClientAttrib();
+        glBindBuffer( GL_ARRAY_BUFFER, 0 );
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL );
+    }
     else {
         // resize buffer if needed
         if( mc_tri_vbo_N < N ) {
@@ -436,7 +481,7 @@ render( float t, float dt, float fps )
 
     // --- render text string --------------------------------------------------
     static char message[512] = "";
-    if( floor(5.0*(t-dt)) != floor(5.0*(t)) ) {
+    if( update_message ) {
         snprintf( message, 512,
                   "%.1f fps, %dx%dx%d samples, %d mvps, %d triangles, iso=%.2f%s",
                   fps,
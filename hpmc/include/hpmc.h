@@ -154,6 +154,52 @@
   * GLuint builder = HPMCgetBuilderProgram( hpmc_h );
   * \endcode
   *
+  * The fetch function is evaluated 18 times per fragment during base level
+  * construction, and up to 8 times per vertex during traversal. For expensive
+  * fetch functions, use
+  * \code
+  * HPMCsetFieldCustomCached( hpmc_h, fetch_code, free_sampler, GL_FALSE );
+  * \endcode
+  * instead, which evaluates the fetch function once per lattice point into an
+  * internal 3D texture at the start of every build. Construction and traversal
+  * then fetch from this texture, and the traversal shader functions do not
+  * include the fetch code.
+  *
+  * Alternatively, the uniform variables of the fetch code can be placed in a
+  * uniform block named \c HPMC_FetchParameters,
+  * \code
+  * layout(std140) uniform HPMC_FetchParameters {
+  *     vec4  centers[8];
+  *     float twist;
+  * };
+  * \endcode
+  * and HPMC is told which uniform buffer binding point it may use for it,
+  * \code
+  * HPMCsetFieldCustomParameterBlock( hpmc_h, binding );
+  * \endcode
+  * HPMC then manages a uniform buffer that is shared by the builder program
+  * and all traversal programs, and the parameters are updated once per frame
+  * using
+  * \code
+  * HPMCupdateFieldCustomParameters( hpmc_h, &params, 0, sizeof(params) );
+  * \endcode
+  *
+  * \subsubsection create_hp_kernels Using a sum of radial kernels
+  *
+  * Metaballs and particle systems define the scalar field as a sum of radial
+  * kernels. Evaluating every kernel for every sample is expensive, so HPMC
+  * can handle this case directly:
+  * \code
+  * HPMCsetFieldRadialKernels( hpmc_h, 0.05f );
+  * \endcode
+  * and, every frame before building the HistoPyramid,
+  * \code
+  * HPMCsetRadialKernelCenters( hpmc_h, N, centers );
+  * \endcode
+  * where \c centers holds (x,y,z,weight) for each of the \c N kernels. HPMC
+  * sorts the kernels into a grid of bins, and only the kernels whose support
+  * overlap the bin of a sample are visited when the field is evaluated.
+  *
   * \subsection create_tr Creating and configuring the traversal
   *
   * To extract the geometry, HPMC must traverse the HistoPyramid data structure.
@@ -227,6 +273,24 @@
   * HPMCsetTraversalHandleProgram), so textures that the fetch code or the
   * display shader code uses may be bound before calling this function.
   *
+  * \subsection display_capture Capturing the triangles
+  *
+  * With OpenGL 4.0, HPMC can capture the triangles into a buffer that it
+  * manages itself,
+  * \code
+  * HPMCsetTraversalHandleOutputBuffer( th, 6*sizeof(GLfloat), 3*1000 );
+  * HPMCextractVerticesToOutputBuffer( th );
+  * HPMCdrawOutputBuffer( th, GL_TRIANGLES );
+  * \endcode
+  * without ever waiting for the number of vertices on the CPU.
+  *
+  * The captured triangles can furthermore be grouped into clusters of
+  * consecutive triangles, each with a bounding box and a normal cone that can
+  * be used for culling before the triangles are drawn,
+  * \code
+  * HPMCsetTraversalHandleOutputClusters( th, 64 );
+  * \endcode
+  *
   */
 /** \example texture3d.cpp
   * Demonstrates basic use of HPMC. It reads a raw file with bytes describing
@@ -298,6 +362,10 @@ struct HPMCHistoPyramid;
 
 struct HPMCTraversalHandle;
 
+struct HPMCStreamingMesh;
+
+struct HPMCCompaction;
+
 /** Creates a set of constants for the current context.
   *
   * HPMC needs a set of constants, in the form of various textures and buffer
@@ -305,6 +373,9 @@ struct HPMCTraversalHandle;
   * set of sharing contexts. Thus, it is highly likely that you only need one
   * instance of constants.
   *
+  * A core profile context requires OpenGL 4.3 and only supports the compute
+  * build, see HPMCsetComputeBuild.
+  *
   * \sideeffect None.
   */
 struct HPMCConstants*
@@ -319,6 +390,62 @@ HPMCcreateConstants( GLint max_gl_major, GLint max_gl_minor );
 void
 HPMCdestroyConstants( struct HPMCConstants* c );
 
+/** Limits the GPU memory of the HistoPyramids of a set of constants.
+  *
+  * The HistoPyramid textures (RGBA32F with mipmaps) and their framebuffer
+  * objects are allocated from a pool shared by all HistoPyramids created with
+  * the constants. Storage is handed out by size class, i.e. the size of the
+  * texture, and storage released when a HistoPyramid is reconfigured to
+  * another size or destroyed is kept idle for reuse instead of being deleted.
+  * This keeps applications with many HistoPyramids (e.g. one per tile of a
+  * large volume) from fragmenting GPU memory.
+  *
+  * The budget counts, in addition to these textures, the other GL memory of
+  * every HistoPyramid, of both sets if pipelined: the HP5 buffers, the field
+  * cache texture of HPMCsetFieldCustomCached, the top element PBOs and the
+  * statistics textures and PBO. The HistoPyramid textures and PBOs of the
+  * compactions created with the constants are counted too. Not counted are
+  * the scalar field and the kernel and parameter data given by the
+  * application, the buffers of traversal handles (output, cluster and
+  * collision query buffers) and the resources shared by the constants. Buffer
+  * sizes are the sizes requested from GL, the driver may allocate more.
+  *
+  * When new storage would exceed the budget, idle storage is deleted, oldest
+  * first, and then the least recently built or extracted HistoPyramids are
+  * evicted. An evicted HistoPyramid frees all of the above except its
+  * statistics, and gives no vertices until it is built again, which also sets
+  * it up again. A HistoPyramid or compaction that does not fit even if all
+  * HistoPyramids are evicted fails to build. A partial budgeted build is never
+  * evicted, and compactions are never evicted.
+  *
+  * \param c      Pointer to an existing constant instance.
+  * \param bytes  The budget in bytes, or zero for no limit (the default).
+  * \return       True if the current storage fits in the budget, possibly
+  *               after evictions.
+  */
+bool
+HPMCsetPyramidPoolBudget( struct HPMCConstants*  c,
+                          GLsizeiptr             bytes );
+
+/** Reports the memory usage of the pyramid pool of a set of constants.
+  *
+  * \param c           Pointer to an existing constant instance.
+  * \param bytes       If not NULL, receives the bytes counted in the budget,
+  *                    i.e. all HistoPyramid textures, in use and idle, and
+  *                    the other resources listed in HPMCsetPyramidPoolBudget.
+  * \param idle_bytes  If not NULL, receives the bytes of idle textures.
+  * \param evictions   If not NULL, receives the number of evictions so far.
+  */
+void
+HPMCgetPyramidPoolUsage( struct HPMCConstants*  c,
+                         GLsizeiptr*            bytes,
+                         GLsizeiptr*            idle_bytes,
+                         GLsizei*               evictions );
+
+/** Deletes the idle storage of the pyramid pool of a set of constants. */
+void
+HPMCtrimPyramidPool( struct HPMCConstants* c );
+
 /** Creates a new HistoPyramid instance on the current context.
   *
   * \param s  A pointer to a constant instance residing on a context sharing
@@ -354,6 +481,27 @@ HPMCsetFieldAsBinary( struct HPMCHistoPyramid* h );
 void
 HPMCsetFieldAsContinuous( struct HPMCHistoPyramid* h );
 
+/** Specify bounds of the values of the scalar field.
+  *
+  * If the threshold passed to HPMCbuildHistopyramid is outside the range,
+  * the iso-surface is empty, and the build passes and the extraction are
+  * skipped. All levels of the HistoPyramid are cleared instead, so ray
+  * casting, collision queries and statistics see the empty surface too.
+  * The bounds need not be tight, but must be conservative. Call
+  * this when the field has been updated, e.g. with the min and max found when
+  * uploading a volume texture. A radial kernel field computes its bounds in
+  * HPMCsetRadialKernelCenters. The bounds are forgotten when the type of
+  * field changes, and passing min_value > max_value marks them as unknown.
+  *
+  * \param h          Pointer to an existing HistoPyramid instance.
+  * \param min_value  Lower bound of the field values.
+  * \param max_value  Upper bound of the field values.
+  */
+void
+HPMCsetFieldRange( struct HPMCHistoPyramid*  h,
+                   GLfloat                   min_value,
+                   GLfloat                   max_value );
+
 
 /** Specify the number of cells in the grid of Marching Cubes cells.
   *
@@ -394,6 +542,27 @@ HPMCsetGridExtent( struct HPMCHistoPyramid*  h,
                    GLfloat                   y_extent,
                    GLfloat                   z_extent );
 
+/** Let the HistoPyramid use only every stride'th sample of the lattice.
+  *
+  * The cells of the grid are merged stride x stride x stride, giving a
+  * HistoPyramid that is about stride^3 times cheaper to build, over the same
+  * scalar field. This is intended for progressive extraction: build and render
+  * a coarse surface first, and then reduce the stride over the following
+  * frames until the full-resolution surface is shown. The stride is clamped
+  * such that the grid has at least one cell along each axis, and if the stride
+  * does not divide the grid size, the remaining cells are left out. Since the
+  * layout of the HistoPyramid changes, traversal shaders must be regenerated.
+  *
+  * \param h       Pointer to an existing HistoPyramid instance.
+  * \param stride  Sample stride, 1 (the default) uses every sample.
+  * \return        True on success, false on failure.
+  *
+  * \sideeffect Triggers rebuilding of shaders and textures.
+  */
+bool
+HPMCsetSampleStride( struct HPMCHistoPyramid*  h,
+                     GLsizei                   stride );
+
 /** Sets that a Texture3D shall define the scalar field lattice.
   *
   * \param h                Pointer to an existing HistoPyramid instance.
@@ -443,11 +612,347 @@ HPMCsetFieldCustom( struct HPMCHistoPyramid*  h,
                     GLuint                    builder_texunit,
                     GLboolean                 gradient );
 
+/** Specify a custom fetch function that is cached in a texture.
+  *
+  * Same as HPMCsetFieldCustom, except that the fetch function is evaluated
+  * once for each lattice point into an internal 3D texture at the start of
+  * HPMCbuildHistopyramid. Construction and traversal then fetch from this
+  * texture, which trades memory (4 bytes per lattice point, 16 if gradients
+  * are provided) for evaluating the fetch function only once per sample.
+  *
+  * The texture is only evaluated again when the field may have changed, so
+  * building with a new threshold only runs the HistoPyramid passes. HPMC
+  * knows that the field changed when the fetch function, the parameter block
+  * or its contents (see HPMCupdateFieldCustomParameters) change. If the
+  * fetch function depends on other state, e.g. uniforms of the builder
+  * program or textures, use HPMCinvalidateFieldCache when it changes.
+  *
+  * HPMCgetBuilderProgram returns the program that evaluates the fetch
+  * function, and the traversal shader functions fetch from the cache and do
+  * not contain the fetch function. Requires OpenGL 3.0 or newer.
+  *
+  * \param h                Pointer to an existing HistoPyramid instance.
+  * \param shader_source    A string containing the custom fetch shader source.
+  * \param builder_texunit  A texunit that HPMC can use during baselevel
+  *                         construction that does not interfere with any
+  *                         texunits that the custom fetch shader uses.
+  * \param gradient         True if fetch shader provides gradients, otherwise
+  *                         the gradient is approximated using forward differences.
+  */
+void
+HPMCsetFieldCustomCached( struct HPMCHistoPyramid*  h,
+                          const char*               shader_source,
+                          GLuint                    builder_texunit,
+                          GLboolean                 gradient );
+
+/** Specify that the custom fetch function reads its parameters from a uniform block.
+  *
+  * The custom fetch shader source declares a uniform block named
+  * \c HPMC_FetchParameters. HPMC creates a uniform buffer with the size of
+  * this block, and binds it to \c binding whenever the HistoPyramid is built
+  * or traversed. The block of the builder program and of the traversal
+  * programs passed to HPMCsetTraversalHandleProgram are associated with this
+  * binding point, so the application only has to update the buffer using
+  * HPMCupdateFieldCustomParameters. The binding point is reserved for HPMC.
+  *
+  * Must be invoked after HPMCsetFieldCustom or HPMCsetFieldCustomCached.
+  * Requires OpenGL 3.1 or GL_ARB_uniform_buffer_object.
+  *
+  * \param h        Pointer to an existing HistoPyramid instance.
+  * \param binding  The uniform buffer binding point to use.
+  * \return         True on success, false on failure.
+  *
+  * \sideeffect GL_UNIFORM_BUFFER binding and the binding at \c binding during
+  *             HPMCbuildHistopyramid and extraction of vertices.
+  */
+bool
+HPMCsetFieldCustomParameterBlock( struct HPMCHistoPyramid*  h,
+                                  GLuint                    binding );
+
+/** Update the contents of the custom fetch parameter block.
+  *
+  * The data is copied into the uniform buffer using the layout declared in
+  * the shader, e.g. std140.
+  *
+  * \param h       Pointer to an existing HistoPyramid instance configured by
+  *                HPMCsetFieldCustomParameterBlock.
+  * \param data    Pointer to the data to copy.
+  * \param offset  Offset in bytes into the block.
+  * \param size    Number of bytes to copy.
+  * \return        True on success, false on failure.
+  */
+bool
+HPMCupdateFieldCustomParameters( struct HPMCHistoPyramid*  h,
+                                 const GLvoid*             data,
+                                 GLintptr                  offset,
+                                 GLsizeiptr                size );
+
+/** Tell HPMC that the cached custom fetch function has changed.
+  *
+  * The field cache of HPMCsetFieldCustomCached is evaluated again by the next
+  * build. Needed when the fetch function depends on state that HPMC does not
+  * manage, e.g. uniforms of the builder program or textures.
+  *
+  * \param h  Pointer to an existing HistoPyramid instance.
+  */
+void
+HPMCinvalidateFieldCache( struct HPMCHistoPyramid*  h );
+
+/** Sets that the scalar field is a sum of compactly supported radial kernels.
+  *
+  * The scalar field is defined as
+  * \f[ f(p) = \sum_i w_i \left(1-\frac{|p-c_i|^2}{r^2}\right)^3, \f]
+  * where the sum is taken over the centers \f$c_i\f$ closer than \f$r\f$ to
+  * \f$p\f$, and \f$p\f$ is in [0,1]^3 (same parameterization as for custom
+  * fetch functions). The centers are sorted into a uniform grid of bins, so
+  * that the generated fetch code only visits the centers whose support overlap
+  * the bin of the sample. The analytic gradient is used for normal vectors.
+  *
+  * The number of bins is derived from the radius, so changing the radius
+  * triggers rebuilding of shaders. The centers are specified using
+  * HPMCsetRadialKernelCenters.
+  *
+  * HPMC uses texture units 0 and 1 during base level construction. Requires
+  * OpenGL 3.0 or newer.
+  *
+  * \param h       Pointer to an existing HistoPyramid instance.
+  * \param radius  The support radius of the kernels in [0,1]^3 coordinates.
+  */
+void
+HPMCsetFieldRadialKernels( struct HPMCHistoPyramid*  h,
+                           GLfloat                   radius );
+
+/** Specify the centers of the radial kernels.
+  *
+  * Sorts the centers into bins and uploads the result to the GPU, intended to
+  * be invoked once per frame before HPMCbuildHistopyramid.
+  *
+  * \param h        Pointer to an existing HistoPyramid instance configured by
+  *                 HPMCsetFieldRadialKernels.
+  * \param count    The number of centers.
+  * \param centers  Pointer to 4*count floats, (x,y,z,weight) per center.
+  * \return         True on success, false on failure.
+  */
+bool
+HPMCsetRadialKernelCenters( struct HPMCHistoPyramid*  h,
+                            GLsizei                   count,
+                            const GLfloat*            centers );
+
 GLuint
 HPMCgetBuilderProgram( struct HPMCHistoPyramid*  h );
 
 
-/** Free the resources associated with a handle. */
+/** Pipeline the build of the HistoPyramid with the extraction of vertices.
+  *
+  * If enabled, the HistoPyramid holds two sets of textures, and every call
+  * to HPMCbuildHistopyramid builds into one set while extraction uses the
+  * set built by the previous call. Thus, the surface lags one build behind,
+  * but the GPU is free to overlap the build with the extraction. The first
+  * extraction after enabling yields no vertices. The texture given by
+  * HPMCsetFieldTexture3D is sampled by the extraction, so if the scalar field
+  * is time-varying, alternate between two textures.
+  *
+  * \param h        Pointer to an existing HistoPyramid instance.
+  * \param enable   GL_TRUE to enable, GL_FALSE to disable.
+  *
+  * \sideeffect Triggers rebuilding of shaders and textures.
+  */
+void
+HPMCsetPipelinedBuild( struct HPMCHistoPyramid*  h,
+                       GLboolean                 enable );
+
+/** Lay out the slices of the base level in Z-order.
+  *
+  * The base level of the HistoPyramid holds one tile per slice of the cell
+  * grid, and is traversed in Z-order. By default, the tiles are laid out row
+  * by row, so the traversal jumps back and forth between slices at tile
+  * boundaries. With Z-order tiling, the traversal visits the slices in order,
+  * which improves locality of the scalar field fetches during extraction and
+  * of the vertices in captured buffers. The layout is the same, only the
+  * assignment of slices to tiles changes.
+  *
+  * \param h        Pointer to an existing HistoPyramid instance.
+  * \param enable   GL_TRUE to enable, GL_FALSE to disable.
+  *
+  * \sideeffect Triggers rebuilding of shaders.
+  */
+void
+HPMCsetMortonTiling( struct HPMCHistoPyramid*  h,
+                     GLboolean                 enable );
+
+/** Gather statistics of the active cells when building the HistoPyramid.
+  *
+  * If enabled, HPMCbuildHistopyramid runs an extra pass over the base level
+  * that counts the active cells per marching cubes case and finds the bounds
+  * of the active cells. The result is read back asynchronously and retrieved
+  * with HPMCacquireStatistics. Requires OpenGL 3.0.
+  *
+  * With OpenGL 4.3, the pass is a compute shader that reduces each block of
+  * base level texels in shared memory before adding to global counters.
+  * Otherwise, the cells are blended into rows of partial results, which a
+  * second pass gathers.
+  *
+  * \param h        Pointer to an existing HistoPyramid instance.
+  * \param enable   GL_TRUE to enable, GL_FALSE to disable.
+  * \return         True on success, false on failure.
+  *
+  * \sideeffect Triggers rebuilding of shaders and textures.
+  */
+bool
+HPMCsetStatistics( struct HPMCHistoPyramid*  h,
+                   GLboolean                 enable );
+
+/** Build the HistoPyramid using compute shaders.
+  *
+  * If enabled, the base level and the reductions are computed by compute
+  * shaders that write the levels of the HistoPyramid texture through image
+  * units, separated by memory barriers, and one dispatch reduces up to three
+  * levels using shared memory. This avoids the per-level framebuffer binds
+  * and quad rendering of the fragment shader build. Extraction is unchanged.
+  * Requires OpenGL 4.3.
+  *
+  * This is the only explicit compute backend of HPMC, there is no Vulkan
+  * backend. A cached custom fetch is evaluated into the field cache by a
+  * compute shader as well, so the build uses no fixed-function state.
+  *
+  * In a core profile context, the compute build is enabled by
+  * HPMCcreateHistoPyramid and can not be disabled. The compute shaders are
+  * then compiled as "#version 430 core" and the generated fetch code uses
+  * texture instead of texture3D, so custom fetch code must be core GLSL too.
+  * A field set by HPMCsetFieldTexture3D is read from the alpha channel, so a
+  * single channel texture needs GL_TEXTURE_SWIZZLE_A set to GL_RED. The
+  * build saves and restores the texture bindings explicitly instead of using
+  * the attribute stacks. Autotuning and traversal still require a
+  * compatibility profile context.
+  *
+  * When a custom fetch uses uniforms, set them on the program returned by
+  * HPMCgetBuilderProgram, which is the compute program when enabled.
+  *
+  * \param h        Pointer to an existing HistoPyramid instance.
+  * \param enable   GL_TRUE to enable, GL_FALSE to disable.
+  * \return         True on success, false on failure.
+  *
+  * \sideeffect Triggers rebuilding of shaders. The build modifies the
+  *             bindings of image units 0 to 3.
+  */
+bool
+HPMCsetComputeBuild( struct HPMCHistoPyramid*  h,
+                     GLboolean                 enable );
+
+/** Use a HistoPyramid where each element has five children.
+  *
+  * If enabled, the texels of the base level are reduced five at a time into
+  * a buffer texture, where each element stores the counts of its first four
+  * children, the count of the fifth is implied by the count of the element.
+  * Compared to the default four-to-one reduction, the HistoPyramid has fewer
+  * levels, traversal does one buffer fetch and no branching per level, and
+  * the reduction is one compute dispatch per level. The base level is built
+  * as before, and may use HPMCsetComputeBuild. Requires OpenGL 4.3.
+  *
+  * The sampler HPMC_histopyramid of the traversal shader becomes a
+  * samplerBuffer, so traversal programs must be rebuilt after changing this.
+  *
+  * \param h        Pointer to an existing HistoPyramid instance.
+  * \param enable   GL_TRUE to enable, GL_FALSE to disable.
+  * \return         True on success, false on failure.
+  *
+  * \sideeffect Triggers rebuilding of shaders and textures. The build
+  *             modifies the bindings of image units 0 to 3.
+  */
+bool
+HPMCsetHP5Layout( struct HPMCHistoPyramid*  h,
+                  GLboolean                 enable );
+
+/** Use constant arrays instead of textures for the Marching Cubes tables.
+  *
+  * If enabled, the vertex count and edge decode tables are packed into
+  * integers, four bits per edge, and emitted as constant arrays into the
+  * generated shaders, so the base level pass and traversal look them up
+  * without texture fetches. The traversal program then has no HPMC_edge_table
+  * sampler, and the second texture unit passed to
+  * HPMCsetTraversalHandleProgram is left untouched and may be used by the
+  * application. For binary fields, the edge decode texture also holds the
+  * normals, and only the vertex count table is constant. Requires OpenGL 3.0.
+  *
+  * The shader functions from HPMCgetTraversalShaderFunctions change, so
+  * traversal programs must be rebuilt after changing this.
+  *
+  * \param h        Pointer to an existing HistoPyramid instance.
+  * \param enable   GL_TRUE to enable, GL_FALSE to disable.
+  * \return         True on success, false on failure.
+  *
+  * \sideeffect Triggers rebuilding of shaders.
+  */
+bool
+HPMCsetConstantTables( struct HPMCHistoPyramid*  h,
+                       GLboolean                 enable );
+
+/** Measure the GPU time spent building the HistoPyramid.
+  *
+  * If enabled, timestamp queries are issued before and after the build
+  * passes of HPMCbuildHistopyramid and HPMCbuildHistopyramidBudgeted, and the
+  * time is retrieved with HPMCacquireBuildTime. Requires OpenGL 3.3.
+  *
+  * \param h        Pointer to an existing HistoPyramid instance.
+  * \param enable   GL_TRUE to enable, GL_FALSE to disable.
+  * \return         True on success, false on failure.
+  */
+bool
+HPMCsetBuildTimer( struct HPMCHistoPyramid*  h,
+                   GLboolean                 enable );
+
+/** Choose the fastest build and traversal variant by measurement.
+  *
+  * If enabled, HPMC chooses whether to use Z-order tiling, compute shader
+  * build and the HP5 layout, as far as the target supports them, along with
+  * choices of the generated shaders that don't change the results: whether
+  * traversal selects sub-pyramids using masks or branches, whether the
+  * reduction passes use textureLod or texelFetch, and the number of vertices
+  * spawned per batch during extraction. The choice is made the next time the
+  * HistoPyramid is set up, i.e. at the first build, traversal handle or
+  * builder program after the configuration changes, and is looked up in a
+  * profile file, keyed by the GL vendor, renderer and version, the target,
+  * the fetch mode, the grid size, the sample stride and the explicit
+  * settings. If the profile has no entry, every combination of the build
+  * variants is set up, built and extracted a few times using timestamp
+  * queries, then each of the shader choices is tried on top of the fastest,
+  * and the result is appended to the profile, so the measurement is done
+  * once per machine and configuration. Requires OpenGL 3.3.
+  *
+  * Settings made explicitly with HPMCsetMortonTiling, HPMCsetComputeBuild
+  * and HPMCsetHP5Layout are kept and only the others are tuned. The variant
+  * stays in effect if autotuning is disabled.
+  *
+  * A custom fetch function (HPMCsetFieldCustom and HPMCsetFieldCustomCached)
+  * typically depends on uniforms of the builder program and on textures that
+  * the application sets up after the setup. If the profile has no entry,
+  * the setup therefore keeps the current settings, and the measurement takes
+  * place at the first HPMCbuildHistopyramid or
+  * HPMCbuildHistopyramidBudgeted, with the values of the uniforms of the
+  * builder program and of the parameter block copied, and the textures that
+  * are bound. It uses a separate HistoPyramid, so the builder program and
+  * the traversal programs of the application stay valid, and the result is
+  * used from the next time the HistoPyramid is set up, e.g. the next run.
+  * Uniforms of types other than float, int, unsigned int and bool scalars
+  * and vectors, square float matrices and samplers are not copied.
+  *
+  * \param h             Pointer to an existing HistoPyramid instance.
+  * \param profile_path  Path of the profile file, created if it does not
+  *                      exist, or NULL to disable autotuning.
+  * \return              True on success, false on failure.
+  *
+  * \sideeffect Triggers rebuilding of shaders and textures.
+  */
+bool
+HPMCsetAutotuning( struct HPMCHistoPyramid*  h,
+                   const char*               profile_path );
+
+/** Free the resources associated with a handle.
+  *
+  * The HistoPyramid texture is returned to the pyramid pool of the
+  * constants, see HPMCsetPyramidPoolBudget. Traversal handles of the
+  * HistoPyramid must be destroyed first.
+  */
 void
 HPMCdestroyHandle( struct HPMCHistoPyramid* handle );
 
@@ -461,6 +966,42 @@ void
 HPMCbuildHistopyramid( struct HPMCHistoPyramid*  h,
                        GLfloat                   threshold );
 
+/** Builds the histopyramid over several calls, bounding the work per call.
+  *
+  * Intended to be called once per frame instead of HPMCbuildHistopyramid when
+  * a full build takes longer than a frame. Each call builds a range of the
+  * base level covering at most budget cells, and when the whole base level is
+  * built, the reductions are run and extraction switches to the new
+  * HistoPyramid. Until then, extraction keeps using the previously built one.
+  * Requires pipelined build (see HPMCsetPipelinedBuild), the build targets the
+  * set not used by extraction.
+  *
+  * The threshold and the scalar field are captured by the call that starts a
+  * build, and the field should not change until the build is complete. The
+  * slices of a cached custom field are evaluated by the calls that build the
+  * rows which use them, and count towards the budget with one cell per
+  * sample. Calling HPMCbuildHistopyramid abandons a partial build by
+  * building its HistoPyramid in full, which extraction uses after the next
+  * call to HPMCbuildHistopyramid, as for any pipelined build.
+  *
+  * \param h          Pointer to an existing HistoPyramid instance.
+  * \param threshold  The iso-value, used if this call starts a new build.
+  * \param budget     Maximum number of cells processed by this call, at least
+  *                   one row of the base level is processed.
+  * \param progress   Receives the fraction of the base level built, 1.0 when
+  *                   the new HistoPyramid is used by extraction. May be NULL.
+  * \return           True on success, false on failure.
+  *
+  * \sideeffect GL_CURRENT_PROGRAM,
+  *             GL_TEXTURE_2D_BINDING,
+  *             GL_FRAMEBUFFER_BINDING
+  */
+bool
+HPMCbuildHistopyramidBudgeted( struct HPMCHistoPyramid*  h,
+                               GLfloat                   threshold,
+                               GLuint                    budget,
+                               GLfloat*                  progress );
+
 /** Returns the number of vertices in the histopyramid.
   *
   * \note Must be called after HPMCbuildHistopyramd*().
@@ -468,6 +1009,42 @@ HPMCbuildHistopyramid( struct HPMCHistoPyramid*  h,
 GLuint
 HPMCacquireNumberOfVertices( struct HPMCHistoPyramid* handle );
 
+/** Retrieves the GPU time of the last timed build.
+  *
+  * Waits for the timestamp queries issued by the last call to
+  * HPMCbuildHistopyramid or HPMCbuildHistopyramidBudgeted, so to avoid a
+  * stall, call it as late as possible before the next build.
+  *
+  * \param milliseconds  Receives the GPU time of the build passes.
+  * \return              True on success, false if no timed build has been
+  *                      issued.
+  */
+bool
+HPMCacquireBuildTime( struct HPMCHistoPyramid*  h,
+                      GLfloat*                  milliseconds );
+
+/** Retrieves the statistics of the active cells gathered by the last build.
+  *
+  * Active cells are the cells that the iso-surface passes through. The
+  * statistics always refer to the most recent HPMCbuildHistopyramid, also
+  * when the build is pipelined. Like HPMCacquireNumberOfVertices, this
+  * function waits for the readback to complete.
+  *
+  * \param active_cells  Receives the number of active cells, may be NULL.
+  * \param histogram     Receives the number of active cells for each of the
+  *                      256 marching cubes cases, may be NULL.
+  * \param bounds        Receives the minimum and maximum corner (six floats)
+  *                      of the axis-aligned bounding box of the active cells,
+  *                      in the coordinates of the grid extent. Zero if there
+  *                      are no active cells. May be NULL.
+  * \return              True on success, false on failure.
+  */
+bool
+HPMCacquireStatistics( struct HPMCHistoPyramid*  h,
+                       GLuint*                   active_cells,
+                       GLuint*                   histogram,
+                       GLfloat*                  bounds );
+
 
 /** Create a new traversal handle instance.
   *
@@ -495,6 +1072,172 @@ HPMCdestroyTraversalHandle( struct HPMCTraversalHandle* th );
 char*
 HPMCgetTraversalShaderFunctions( struct HPMCTraversalHandle* th );
 
+/** Let the traversal shader functions pack vertices for capture.
+  *
+  * Must be called before HPMCgetTraversalShaderFunctions, which then also
+  * provides
+  * \code
+  * uvec3 extractVertexPacked();
+  * \endcode
+  * that calls extractVertex and packs position and normal into 12 bytes,
+  * half the size of two vec3's. Capture the result with transform feedback
+  * and decode it using the function from HPMCgetVertexUnpackShaderFunctions.
+  *
+  * \param th    The traversal handle.
+  * \param type  GL_FLOAT for no packing (the default), GL_HALF_FLOAT for
+  *              half-float position and normal, or GL_UNSIGNED_SHORT for
+  *              16-bit fixed-point position relative to the grid extent and
+  *              an octahedron-encoded normal of two 16-bit components.
+  *              The packed formats require OpenGL 4.2.
+  * \return      True on success, false on failure.
+  */
+bool
+HPMCsetTraversalHandleVertexFormat( struct HPMCTraversalHandle*  th,
+                                    GLenum                       type );
+
+/** Let extractVertex compute positions only.
+  *
+  * Must be called before HPMCgetTraversalShaderFunctions. The position of a
+  * vertex is then found from the two samples at the end-points of its edge,
+  * skipping the forward differences (or gradient fetches) of the normal, and
+  * n is zero for continuous fields. This suits depth pre-passes, shadow maps
+  * and wireframe overlays. The shader functions additionally provide
+  * \code
+  * void extractVertex( out vec3 p );
+  * vec3 extractNormal( vec3 p );
+  * \endcode
+  * where extractNormal computes the normal of a vertex p on demand, which
+  * for continuous fields is the same as the normal of a full traversal.
+  *
+  * \param th      The traversal handle.
+  * \param enable  GL_TRUE for positions only, GL_FALSE for positions and
+  *                normals (the default).
+  * \return        True on success, false on failure.
+  */
+bool
+HPMCsetTraversalHandlePositionOnly( struct HPMCTraversalHandle*  th,
+                                    GLboolean                    enable );
+
+/** Extract one triangle per geometry shader invocation.
+  *
+  * Must be called before HPMCgetTraversalShaderFunctions. The shader
+  * functions then provide
+  * \code
+  * void extractTriangle( out vec3 p0, out vec3 n0,
+  *                       out vec3 p1, out vec3 n1,
+  *                       out vec3 p2, out vec3 n2 );
+  * \endcode
+  * (and extractTriangle( out vec3 p0, out vec3 p1, out vec3 p2 ) with
+  * HPMCsetTraversalHandlePositionOnly) instead of extractVertex. It must be
+  * called from a geometry shader with points as input and a triangle strip
+  * of at most three vertices as output, and the vertex shader of the
+  * program may be empty. HPMCextractVertices then draws one point per
+  * triangle, so the HistoPyramid is traversed once per triangle instead of
+  * once per vertex. Not supported with HPMCsetTraversalHandleOutputBuffer.
+  *
+  * \param th      The traversal handle.
+  * \param enable  GL_TRUE for one invocation per triangle, GL_FALSE for one
+  *                invocation per vertex (the default).
+  * \return        True on success, false on failure (requires OpenGL 3.2).
+  */
+bool
+HPMCsetTraversalHandleTriangles( struct HPMCTraversalHandle*  th,
+                                 GLboolean                    enable );
+
+/** Extract all triangles of a cell in one geometry shader invocation.
+  *
+  * Must be called before HPMCgetTraversalShaderFunctions, and takes
+  * precedence over HPMCsetTraversalHandleTriangles. The shader functions
+  * then provide
+  * \code
+  * int  extractCell();
+  * void extractCellTriangle( int i, out vec3 p0, out vec3 n0,
+  *                                  out vec3 p1, out vec3 n1,
+  *                                  out vec3 p2, out vec3 n2 );
+  * \endcode
+  * (and extractCellTriangle( int i, out vec3 p0, out vec3 p1, out vec3 p2 )
+  * with HPMCsetTraversalHandlePositionOnly) instead of extractVertex. They
+  * must be called from a geometry shader with points as input and a
+  * triangle strip of at most 15 vertices as output, typically
+  * \code
+  * int m = extractCell();
+  * for(int i=0; i<m; i++) {
+  *     extractCellTriangle( i, p0, n0, p1, n1, p2, n2 );
+  *     // emit p0, p1 and p2, then EndPrimitive()
+  * }
+  * \endcode
+  * HPMCextractVertices draws one point per triangle as with
+  * HPMCsetTraversalHandleTriangles. extractCell walks the HistoPyramid and
+  * returns zero unless the point is the first triangle of its cell, in
+  * which case it fetches the field at the eight corners of the cell once
+  * (with the forward samples or gradients needed for normals) and returns
+  * the number of triangles in the cell. extractCellTriangle then only
+  * decodes edges and interpolates, so shared edges and corners are not
+  * fetched again. The triangles are the same, and in the same order, as
+  * those of extractTriangle. The HistoPyramid counts vertices and not
+  * cells, so the walk is still done once per triangle. Not supported with
+  * HPMCsetTraversalHandleOutputBuffer.
+  *
+  * \param th      The traversal handle.
+  * \param enable  GL_TRUE for one emitting invocation per cell, GL_FALSE to
+  *                disable (the default).
+  * \return        True on success, false on failure (requires OpenGL 3.2).
+  */
+bool
+HPMCsetTraversalHandleCells( struct HPMCTraversalHandle*  th,
+                             GLboolean                    enable );
+
+/** Get shader functions that decode vertices packed by extractVertexPacked.
+  *
+  * The returned source defines
+  * \code
+  * void unpackVertex( uvec3 v, out vec3 p, out vec3 n );
+  * \endcode
+  * and does not depend on the traversal shader functions, so it can be used
+  * in any shader that reads the captured vertices. The normal is of unit
+  * length in the GL_UNSIGNED_SHORT format.
+  *
+  * \return A string that the application must free, or NULL on failure.
+  */
+char*
+HPMCgetVertexUnpackShaderFunctions( struct HPMCTraversalHandle* th );
+
+/** Let the traversal shader functions render the iso-surface by ray casting.
+  *
+  * Must be called before HPMCgetTraversalShaderFunctions, which then provides
+  * \code
+  * bool castRay( vec3 origin, vec3 direction, out vec3 p, out vec3 n );
+  * bool castSegment( vec3 a, vec3 b, out float t, out vec3 p, out vec3 n );
+  * \endcode
+  * for use in a fragment shader instead of extractVertex. The ray is given in
+  * the coordinates of the vertices of extractVertex, and castRay returns
+  * true and the first intersection in front of origin if the ray hits the
+  * iso-surface, with p and n as given by extractVertex. castSegment does the
+  * same for the segment from a to b, with p = mix(a,b,t). No triangles are
+  * produced, so the cost per pixel does not depend on the number of
+  * triangles.
+  *
+  * The ray skips empty space using the levels of the HistoPyramid as an
+  * occupancy hierarchy: within a slice of the grid, a texel of level l is
+  * empty if no cell in a square of 2^(l+1) by 2^(l+1) cells is intersected
+  * by the iso-surface, and the ray jumps across the largest empty square
+  * around it. In an intersected cell, the field is sampled at the eight
+  * corners and interpolated trilinearly, which along the cell edges is the
+  * linear interpolation of extractVertex, and the crossing is refined by
+  * bisection. The normal is interpolated the same way from the normals of
+  * extractVertex at the corners. Hence the hit lies on a surface through the
+  * vertices of extractVertex, also if the field texture is point sampled.
+  * With the HP5 layout, only the base level is used. Requires OpenGL 3.0.
+  *
+  * \param th      The traversal handle.
+  * \param enable  GL_TRUE for castRay, GL_FALSE for extractVertex (the
+  *                default).
+  * \return        True on success, false on failure.
+  */
+bool
+HPMCsetTraversalHandleRayCasting( struct HPMCTraversalHandle*  th,
+                                  GLboolean                    enable );
+
 /** Associates a linked shader program with a traversal handle.
   *
   * \param program         A successfully linked program including the source
@@ -505,7 +1248,8 @@ HPMCgetTraversalShaderFunctions( struct HPMCTraversalHandle* th );
   *                        program.
   * \param tex_unit_work2  A unique texture unit that HPMC may use during
   *                        traversal without interfering with the rest of the
-  *                        program.
+  *                        program, unused if the edge decode table is
+  *                        constant, see HPMCsetConstantTables.
   * \param tex_unit_work3  A unique texture unit that HPMC may use during
   *                        traversal without interfering with the rest of the
   *                        program. Not used with custom scalar field fetch
@@ -543,6 +1287,421 @@ HPMCextractVerticesTransformFeedbackNV( struct HPMCTraversalHandle* th );
 bool
 HPMCextractVerticesTransformFeedbackEXT( struct HPMCTraversalHandle* th );
 
+/** Render the iso-surface by ray casting.
+  *
+  * Draws the back faces of the bounding box of the grid, [0,x_extent] x
+  * [0,y_extent] x [0,z_extent], as GL_QUADS using the program of a traversal
+  * handle set up with HPMCsetTraversalHandleRayCasting. gl_Vertex is in the
+  * coordinates of castRay, so the vertex shader typically passes gl_Vertex
+  * on, and the fragment shader casts a ray from the eye through it and
+  * discards the fragment if castRay returns false.
+  *
+  * \return True on success, false on failure.
+  *
+  * \sideeffect None.
+  */
+bool
+HPMCrayCast( struct HPMCTraversalHandle* th );
+
+/** Let a traversal handle answer batched segment collision queries.
+  *
+  * Builds a program that casts segments against the iso-surface like
+  * castSegment (see HPMCsetTraversalHandleRayCasting), skipping empty cells
+  * using the HistoPyramid. As the field is interpolated trilinearly from the
+  * corners of the cells, the segments hit the surface through the vertices
+  * of extractVertex, i.e. the surface that is drawn, also if the field
+  * texture is point sampled. It uses the texture units given to
+  * HPMCsetTraversalHandleProgram, which must be called first. Call again if
+  * the HistoPyramid configuration changes. Requires OpenGL 3.0.
+  *
+  * \param th      The traversal handle.
+  * \param enable  GL_TRUE builds the query program, GL_FALSE frees it.
+  * \return        True on success, false on failure.
+  */
+bool
+HPMCsetTraversalHandleCollisionQueries( struct HPMCTraversalHandle*  th,
+                                        GLboolean                    enable );
+
+/** Get the program used by HPMCqueryCollisions.
+  *
+  * With a custom fetch function, the application must set the uniforms of
+  * the fetch function on this program, as with HPMCgetBuilderProgram.
+  */
+GLuint
+HPMCgetCollisionQueryProgram( struct HPMCTraversalHandle* th );
+
+/** Find the first intersection of a batch of segments with the iso-surface.
+  *
+  * Segment i is read as two vec4's from segment_buffer, the start point a
+  * and the end point b in xyz, in the coordinates of the vertices of
+  * extractVertex. Two vec4's per segment are written to result_buffer:
+  * - the intersection point p in xyz and the parameter t in w, where
+  *   p = mix(a,b,t),
+  * - the normal n as given by extractVertex in xyz and 1 in w.
+  * A segment that does not intersect the iso-surface gives b and t = 1, and
+  * a zero normal and w. The intersections use the HistoPyramid of the last
+  * build, so one typically moves particles with a large time step and casts
+  * the step of every particle in one call, instead of sampling the field at
+  * the end points of many small steps.
+  *
+  * \param segment_buffer  Buffer with 8 floats per segment.
+  * \param result_buffer   Buffer with room for 8 floats per segment.
+  * \param count           Number of segments.
+  * \return                True on success, false on failure.
+  *
+  * \sideeffect GL_TRANSFORM_FEEDBACK_BUFFER binding and binding point 0.
+  */
+bool
+HPMCqueryCollisions( struct HPMCTraversalHandle*  th,
+                     GLuint                       segment_buffer,
+                     GLuint                       result_buffer,
+                     GLsizei                      count );
+
+/** Set up extraction with a compute shader for a traversal handle.
+  *
+  * Builds a compute program that extracts one triangle per invocation and
+  * writes the vertices directly into shader storage buffers, see
+  * HPMCextractVerticesCompute. This avoids the vertex pipeline and transform
+  * feedback, so extraction can be scheduled independently of rendering.
+  * The upper levels of the HistoPyramid are cached in shared memory by each
+  * work group. Requires OpenGL 4.3 and a traversal handle with an associated
+  * program, whose texture units are used. With a custom fetch function, the
+  * application must set the uniforms of the fetch function on the program
+  * from HPMCgetComputeExtractionProgram. Call again if the HistoPyramid
+  * configuration changes.
+  *
+  * \param th      The traversal handle.
+  * \param enable  GL_TRUE builds the compute program, GL_FALSE frees it.
+  * \return        True on success, false on failure.
+  */
+bool
+HPMCsetTraversalHandleComputeExtraction( struct HPMCTraversalHandle*  th,
+                                         GLboolean                    enable );
+
+/** Get the program used by HPMCextractVerticesCompute. */
+GLuint
+HPMCgetComputeExtractionProgram( struct HPMCTraversalHandle* th );
+
+/** Extract the vertices of the iso-surface with a compute shader.
+  *
+  * Vertex i is written as three floats at offset 3i of position_buffer and,
+  * if normal_buffer is non-zero, of normal_buffer, using the same positions,
+  * normals and triangle order as extractVertex. Triangles that do not fit in
+  * the capacity are dropped; the number of vertices is given by
+  * HPMCacquireNumberOfVertices. If the vertex count has not been read back,
+  * enough work groups for the capacity are launched and the surplus
+  * invocations exit early, so the extraction never waits for the GPU.
+  *
+  * If index_buffer is non-zero, one GLuint per vertex is written to it. It
+  * is i for vertex i, except for a vertex on the same edge of the same cell
+  * as an earlier vertex i', which is given index i' since both have the same
+  * position and normal. Vertices on edges shared with other cells are not
+  * welded. If indirect_buffer is non-zero, the five GLuint's count, 1, 0, 0,
+  * 0 are written to it, where count is the number of vertices written. This
+  * is a command for both glDrawArraysIndirect and glDrawElementsIndirect, so
+  * the result can be drawn without reading the count back. A memory barrier
+  * for vertex attribute, element, indirect command and buffer access is
+  * issued afterwards.
+  *
+  * \param position_buffer  Buffer with room for 3 floats per vertex.
+  * \param normal_buffer    Buffer with room for 3 floats per vertex, or 0.
+  * \param index_buffer     Buffer with room for 1 GLuint per vertex, or 0.
+  * \param indirect_buffer  Buffer with room for 5 GLuint's, or 0.
+  * \param capacity         Capacity of the buffers in vertices.
+  * \return                 True on success, false on failure.
+  *
+  * \sideeffect GL_SHADER_STORAGE_BUFFER binding and binding points 0 to 3.
+  */
+bool
+HPMCextractVerticesCompute( struct HPMCTraversalHandle*  th,
+                            GLuint                       position_buffer,
+                            GLuint                       normal_buffer,
+                            GLuint                       index_buffer,
+                            GLuint                       indirect_buffer,
+                            GLsizei                      capacity );
+
+/** Let HPMC manage a transform feedback output buffer for a traversal handle.
+  *
+  * The program of the traversal handle must record its varyings interleaved
+  * into a single buffer, \c vertex_size bytes per vertex. The buffer grows
+  * geometrically when an extraction overflows, which is detected without
+  * stalling using a query that is checked on subsequent extractions. An
+  * extraction that overflows is truncated to the capacity of the buffer.
+  * Requires OpenGL 4.0.
+  *
+  * \param th                A traversal handle with an associated program.
+  * \param vertex_size       Size in bytes of one captured vertex.
+  * \param initial_vertices  Initial capacity of the buffer in vertices.
+  * \return                  True on success, false on failure.
+  */
+bool
+HPMCsetTraversalHandleOutputBuffer( struct HPMCTraversalHandle*  th,
+                                    GLsizei                      vertex_size,
+                                    GLsizei                      initial_vertices );
+
+/** Extract the triangles of the iso-surface into the output buffer.
+  *
+  * The number of vertices is never read back to the CPU: the extraction is
+  * driven by indirect draw commands that are written on the GPU from the top
+  * element of the HistoPyramid.
+  *
+  * \return True on success, false on failure.
+  *
+  * \sideeffect GL_TRANSFORM_FEEDBACK_BUFFER binding and binding point 0.
+  */
+bool
+HPMCextractVerticesToOutputBuffer( struct HPMCTraversalHandle* th );
+
+/** Get the buffer name of the output buffer.
+  *
+  * The buffer name stays the same when the buffer grows, so vertex array
+  * pointers into the buffer remain valid.
+  */
+GLuint
+HPMCgetOutputBuffer( struct HPMCTraversalHandle* th );
+
+/** Draw the vertices captured in the output buffer.
+  *
+  * Issues an indirect draw with the number of vertices captured by the last
+  * HPMCextractVerticesToOutputBuffer, using the vertex arrays and program
+  * currently set up by the application.
+  *
+  * \param mode  The primitive type, typically GL_TRIANGLES.
+  * \return      True on success, false on failure.
+  */
+bool
+HPMCdrawOutputBuffer( struct HPMCTraversalHandle*  th,
+                      GLenum                       mode );
+
+/** Let the output buffer be divided into clusters with per-cluster bounds.
+  *
+  * Cluster i holds the triangles from 3*i*triangles_per_cluster and onwards
+  * in the output buffer. Since the HistoPyramid traversal order follows the
+  * spatial subdivision of the volume, consecutive triangles are spatially
+  * coherent. HPMCextractVerticesToOutputBuffer writes three vec4's per cluster
+  * into the cluster buffer:
+  * - the minimum corner of the bounding box, and the number of triangles in w,
+  * - the maximum corner of the bounding box,
+  * - the normal cone axis, and in w the cosine cutoff; a viewing direction v
+  *   (from the eye) sees no front faces of the cluster if dot(v,axis) is
+  *   larger than sqrt(1-cutoff^2) and cutoff is positive.
+  *
+  * The bounds are found by traversing the HistoPyramid for the captured
+  * vertices a second time, and the custom fetch (if any) must take its
+  * parameters from the HPMC fetch parameter block, as application uniforms
+  * are not set. Call again if the HistoPyramid configuration changes.
+  *
+  * \param triangles_per_cluster  Triangles per cluster, typically 64 or 128.
+  *                               Zero disables clusters.
+  * \return                       True on success, false on failure.
+  */
+bool
+HPMCsetTraversalHandleOutputClusters( struct HPMCTraversalHandle*  th,
+                                      GLsizei                      triangles_per_cluster );
+
+/** Get the buffer name of the cluster buffer.
+  *
+  * The buffer name stays the same when the buffer grows.
+  */
+GLuint
+HPMCgetOutputClusterBuffer( struct HPMCTraversalHandle* th );
+
+/** Draw one point per cluster of the last extraction.
+  *
+  * Issues an indirect draw of GL_POINTS using the vertex arrays and program
+  * currently set up by the application, typically with the cluster buffer as
+  * input to a culling pass.
+  *
+  * \return True on success, false on failure.
+  */
+bool
+HPMCdrawOutputClusters( struct HPMCTraversalHandle* th );
+
+/** Callback that fetches one z-slice of a lattice for HPMCextractStreaming.
+  *
+  * \param slice  Receives size_x*size_y samples, x running fastest.
+  * \param z      The index of the slice to fetch.
+  * \param data   The data pointer passed to HPMCextractStreaming.
+  * \return       True on success, false aborts the extraction.
+  */
+typedef bool (*HPMCSliceFetchFunc)( GLfloat* slice, GLsizei z, void* data );
+
+/** Extract an iso-surface on the CPU, streaming the lattice slice by slice.
+  *
+  * This is a reference path for volumes that do not fit in memory, and does
+  * not need an OpenGL context. Only a window of three z-slices is resident per
+  * slab, and the intersections on each plane of edges are cached such that
+  * every vertex is computed once. The z-range is divided into the given number
+  * of slabs which are processed in parallel if HPMC is built with OpenMP; the
+  * callback must then be thread-safe. Vertices on the planes between slabs are
+  * shared by the slabs on both sides.
+  *
+  * The vertices follow the convention of the GPU path with a continuous field,
+  * where the grid has size_x-1 x size_y-1 x size_z-1 cells spanning the given
+  * extent, and the normals are found using forward differences that are
+  * clamped to the lattice, as when sampling a clamped 3D texture. Like the
+  * normals of extractVertex, they are not normalized.
+  *
+  * \param size_x     The number of samples along x of the lattice.
+  * \param size_y     The number of samples along y of the lattice.
+  * \param size_z     The number of slices of the lattice.
+  * \param extent_x   The extent along x of the grid.
+  * \param extent_y   The extent along y of the grid.
+  * \param extent_z   The extent along z of the grid.
+  * \param threshold  The iso-value.
+  * \param fetch      Callback that fetches one slice.
+  * \param data       Passed on to fetch.
+  * \param slabs      The number of slabs to divide the z-range into.
+  * \return           A mesh that must be destroyed with
+  *                   HPMCdestroyStreamingMesh, or NULL on failure.
+  */
+struct HPMCStreamingMesh*
+HPMCextractStreaming( GLsizei             size_x,
+                      GLsizei             size_y,
+                      GLsizei             size_z,
+                      GLfloat             extent_x,
+                      GLfloat             extent_y,
+                      GLfloat             extent_z,
+                      GLfloat             threshold,
+                      HPMCSliceFetchFunc  fetch,
+                      void*               data,
+                      GLsizei             slabs );
+
+void
+HPMCdestroyStreamingMesh( struct HPMCStreamingMesh* m );
+
+/** Get the number of vertices of a mesh from HPMCextractStreaming. */
+GLsizei
+HPMCgetStreamingMeshVertexCount( struct HPMCStreamingMesh* m );
+
+/** Get the vertices of a mesh, six floats per vertex (as GL_N3F_V3F). */
+const GLfloat*
+HPMCgetStreamingMeshVertices( struct HPMCStreamingMesh* m );
+
+/** Get the number of triangles of a mesh from HPMCextractStreaming. */
+GLsizei
+HPMCgetStreamingMeshTriangleCount( struct HPMCStreamingMesh* m );
+
+/** Get the vertex indices of a mesh, three per triangle. */
+const GLuint*
+HPMCgetStreamingMeshIndices( struct HPMCStreamingMesh* m );
+
+/** Creates a HistoPyramid for stream compaction and expansion over a 2D domain.
+  *
+  * The caller supplies a shader function that gives the number of outputs of
+  * every element of the domain, HPMCbuildCompaction builds a HistoPyramid of
+  * the counts using the same reduction as the iso-surface extraction, and the
+  * shader functions from HPMCgetCompactionShaderFunctions map an output index
+  * to the element that produced it and which of its outputs it is. Elements
+  * with a count of zero are culled, and elements with a count larger than one
+  * are expanded, e.g. for point-cloud culling, particle spawning or sparse
+  * voxel compaction. Outputs are ordered by the Z-order of their elements.
+  * Requires OpenGL 3.0.
+  *
+  * \param s  A pointer to a constant instance residing on a context sharing
+  *           resources with the current context.
+  * \return   A new compaction instance, or NULL on failure.
+  *
+  * \sideeffect None.
+  */
+struct HPMCCompaction*
+HPMCcreateCompaction( struct HPMCConstants* s );
+
+/** Free the resources associated with a compaction instance. */
+void
+HPMCdestroyCompaction( struct HPMCCompaction* c );
+
+/** Specify the size of the domain.
+  *
+  * \param c       Pointer to an existing compaction instance.
+  * \param width   Number of elements along x.
+  * \param height  Number of elements along y.
+  * \return        True on success, false on failure.
+  *
+  * \sideeffect Triggers rebuilding of shaders and textures.
+  */
+bool
+HPMCsetCompactionDomain( struct HPMCCompaction*  c,
+                         GLsizei                 width,
+                         GLsizei                 height );
+
+/** Specify the count function.
+  *
+  * The shader source must define int HPMC_count( ivec2 p ), which returns the
+  * number of outputs of element p of the domain. Negative counts are treated
+  * as zero. It is evaluated in a fragment shader, and may use uniforms set on
+  * the program returned by HPMCgetCompactionBuilderProgram and textures bound
+  * by the caller.
+  *
+  * \param c              Pointer to an existing compaction instance.
+  * \param shader_source  The source of the count function.
+  * \return               True on success, false on failure.
+  *
+  * \sideeffect Triggers rebuilding of shaders.
+  */
+bool
+HPMCsetCompactionCountFunction( struct HPMCCompaction*  c,
+                                const char*             shader_source );
+
+/** Get the program that evaluates the count function, to set its uniforms.
+  *
+  * \sideeffect GL_CURRENT_PROGRAM, GL_TEXTURE_2D_BINDING and
+  *             GL_FRAMEBUFFER_BINDING if shaders and textures are rebuilt.
+  */
+GLuint
+HPMCgetCompactionBuilderProgram( struct HPMCCompaction* c );
+
+/** Evaluates the count function over the domain and builds the HistoPyramid.
+  *
+  * The total number of outputs is read back asynchronously, see
+  * HPMCacquireCompactionCount.
+  *
+  * \return True on success, false on failure.
+  *
+  * \sideeffect None, all state is restored.
+  */
+bool
+HPMCbuildCompaction( struct HPMCCompaction* c );
+
+/** Get the total number of outputs of the last build.
+  *
+  * \sideeffect Waits for the build to finish.
+  */
+GLuint
+HPMCacquireCompactionCount( struct HPMCCompaction* c );
+
+/** Get the shader functions that traverse the compaction HistoPyramid.
+  *
+  * The source declares uniform sampler2D HPMC_compaction and defines
+  *
+  * - void HPMC_compactionLookup( int index, out ivec2 p, out int sub_index ),
+  *   which finds the element p that produced output number index, and which
+  *   of the outputs of p it is, with 0 <= sub_index < HPMC_count( p ).
+  * - int HPMC_compactionCount(), the total number of outputs, which allows
+  *   indirect or instanced draws without reading the count back.
+  *
+  * The functions are valid for the current domain. The string must be freed
+  * by the caller.
+  */
+char*
+HPMCgetCompactionShaderFunctions( struct HPMCCompaction* c );
+
+/** Binds the compaction HistoPyramid for use by a program.
+  *
+  * \param c         Pointer to an existing compaction instance.
+  * \param program   A program that includes the shader functions from
+  *                  HPMCgetCompactionShaderFunctions.
+  * \param tex_unit  The texture unit to bind the HistoPyramid to.
+  * \return          True on success, false on failure.
+  *
+  * \sideeffect The GL_TEXTURE_2D binding of tex_unit and the active texture
+  *             unit, and the HPMC_compaction uniform of program.
+  */
+bool
+HPMCbindCompaction( struct HPMCCompaction*  c,
+                    GLuint                  program,
+                    GLuint                  tex_unit );
+
 
 #ifdef __cplusplus
 } // of extern "C"
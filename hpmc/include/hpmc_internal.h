@@ -46,7 +46,15 @@
 // -----------------------------------------------------------------------------
 enum HPMCVolumeLayout {
     HPMC_VOLUME_LAYOUT_CUSTOM,
-    HPMC_VOLUME_LAYOUT_TEXTURE_3D
+    HPMC_VOLUME_LAYOUT_TEXTURE_3D,
+    HPMC_VOLUME_LAYOUT_RADIAL_KERNELS,
+    HPMC_VOLUME_LAYOUT_CUSTOM_CACHED
+};
+
+enum HPMCVertexFormat {
+    HPMC_VERTEX_FORMAT_FLOAT,
+    HPMC_VERTEX_FORMAT_HALF,
+    HPMC_VERTEX_FORMAT_QUANTIZED
 };
 
 enum HPMCTarget {
@@ -69,10 +77,69 @@ struct HPMCConstants
     GLuint            m_vertex_count_tex;
     GLuint            m_edge_decode_tex;
     GLuint            m_edge_decode_normal_tex;
+    /** The vertex count and edge decode tables packed into words, emitted
+      * as constant arrays when HPMCsetConstantTables is enabled.
+      *
+      * Two words per (remapped) MC code, word 0 holds the edges of vertex
+      * 0 to 7 and word 1 the edges of vertex 8 to 14, four bits each, and the
+      * vertex count in bits 28 to 31 of word 1. An edge is packed as its
+      * x,y,z-shift in bits 0 to 2 and its axis in bits 3 and 4.
+      */
+    GLuint            m_packed_cells[2*256];
+    GLuint            m_packed_edges[12];
     GLuint            m_enumerate_vbo;
     GLsizei           m_enumerate_vbo_n;
     GLuint            m_gpgpu_quad_vbo;
     HPMCTarget        m_target;
+    /** True if created on a core profile context, which lacks the fixed-
+      * function pipeline and the attribute stacks. Only the compute build is
+      * available then, see HPMCsetComputeBuild.
+      */
+    bool              m_core_profile;
+
+    /** Pass that writes indirect draw commands for extraction into output
+      * buffers, built on first use (requires OpenGL 4.0).
+      */
+    struct IndirectCommands {
+        GLuint            m_vertex_shader;
+        GLuint            m_program;
+        GLint             m_loc_histopyramid;
+        GLint             m_loc_src_level;
+        GLint             m_loc_capacity;
+        GLint             m_loc_batch;
+        GLint             m_loc_cluster_vertices;
+    }
+    m_indirect;
+
+    /** Pool of HistoPyramid textures shared by the HistoPyramids of these
+      * constants, see HPMCsetPyramidPoolBudget.
+      *
+      * A HistoPyramid texture and its per-level FBOs are handed out by size
+      * class, which is the two-log of the texture size. Storage released by
+      * a HistoPyramid is kept idle for reuse, oldest first.
+      */
+    struct PyramidPool {
+        struct Storage {
+            GLsizei               m_size_l2;
+            GLuint                m_tex;
+            std::vector<GLuint>   m_fbos;
+        };
+        /** Idle storage, in the order it was released. */
+        std::vector<Storage>      m_idle;
+        /** All HistoPyramids created with these constants. */
+        std::vector<struct HPMCHistoPyramid*> m_pyramids;
+        /** Bytes of all storage, in use and idle, plus the other resources
+          * of the HistoPyramids and the compactions.
+          */
+        GLsizeiptr                m_bytes;
+        /** Upper bound on m_bytes, zero if unlimited. */
+        GLsizeiptr                m_budget;
+        /** Number of HistoPyramids evicted to stay within budget. */
+        GLsizei                   m_evictions;
+        /** Incremented on every use of a HistoPyramid, for LRU eviction. */
+        GLuint                    m_clock;
+    }
+    m_pool;
 };
 
 // -----------------------------------------------------------------------------
@@ -89,6 +156,12 @@ struct HPMCHistoPyramid
     struct HPMCConstants*  m_constants;
     /** Cache to hold the threshold value used to build the HP. */
     GLfloat                m_threshold;
+    /** Value of the pyramid pool clock at the last build or extraction. */
+    GLuint                 m_last_use;
+    /** Bytes of the resources other than the HP textures that are currently
+      * counted in the pyramid pool, see HPMCaccountPyramidResources.
+      */
+    GLsizeiptr             m_pool_bytes;
 
     // -------------------------------------------------------------------------
     /** Specifies how the base level of the HistoPyramid is laid out. */
@@ -97,6 +170,10 @@ struct HPMCHistoPyramid
         GLsizei       m_tile_size[2];
         /** The number of tiles in the base level along the x and y direction. */
         GLsizei       m_layout[2];
+        /** If true, slices are placed in Z-order instead of row by row, see
+          * HPMCgenerateTileSlice.
+          */
+        bool          m_morton;
     }
     m_tiling;
 
@@ -123,9 +200,75 @@ struct HPMCHistoPyramid
         GLsizei              m_top_count;
         /** Tag that the cached result is valid, so PBO need not to be consulted. */
         GLsizei              m_top_count_updated;
+        /** Threshold used when this HP was built. */
+        GLfloat              m_threshold;
+        /** Texture3D of the scalar field used when this HP was built. */
+        GLuint               m_field_tex;
+        /** Radial kernel texture used when this HP was built. */
+        GLuint               m_kernels_tex;
+        /** Custom fetch parameter buffer used when this HP was built. */
+        GLuint               m_parameters_buf;
+        /** Buffer and RGBA32F buffer texture of the HP5 layout (if HP5). */
+        GLuint               m_hp5_buf;
+        GLuint               m_hp5_tex;
+        /** Buffer and R32F buffer texture with the count of every HP5
+          * element, only used during the build (if HP5).
+          */
+        GLuint               m_hp5_sums_buf;
+        GLuint               m_hp5_sums_tex;
+        /** Bytes of the two HP5 buffers, counted in the pyramid pool. */
+        GLsizeiptr           m_hp5_bytes;
     }
     m_histopyramid;
 
+    // -------------------------------------------------------------------------
+    /** Layout of the HP5 (five-to-one) HistoPyramid, see HPMCsetHP5Layout.
+      *
+      * The texels of the base level are visited in Z-order and reduced five
+      * at a time until one element remains. A level is stored as one texel
+      * per element, holding the counts of its first four children; the count
+      * of the fifth child is implied by the count of the element. Texel 0 of
+      * the buffer texture holds the total count, followed by the levels from
+      * the top down and a copy of the base level texels in Z-order.
+      */
+    struct HP5 {
+        /** True if the HP5 layout is built and traversed (requires OpenGL 4.3). */
+        bool                 m_enabled;
+        /** Number of elements in each level, m_count[0] is the number of
+          * base level texels and the top level has one element.
+          */
+        std::vector<GLsizei> m_count;
+        /** Offset in texels of each level in the buffer texture. */
+        std::vector<GLsizei> m_offset;
+    }
+    m_hp5;
+
+    /** True if the vertex count and edge decode tables are constant arrays
+      * in the shaders instead of textures, see HPMCsetConstantTables.
+      */
+    bool                     m_constant_tables;
+
+    // -------------------------------------------------------------------------
+    /** Code generation choices that don't change the results, chosen by
+      * HPMCautotune. Only used by targets of OpenGL 3.0 and newer, older
+      * targets always traverse using masks and reduce using texture2D.
+      */
+    struct Codegen {
+        /** If true, traversal selects children using float masks instead of
+          * branches, see HPMCgenerateExtractVertexFunction.
+          */
+        bool          m_mask_traversal;
+        /** If true, the reduction passes sample using textureLod and offsets
+          * instead of texelFetch, see HPMCgenerateReductionShader.
+          */
+        bool          m_sampled_reduction;
+        /** Number of vertices spawned per draw or instance of the enumeration
+          * VBO, at most HPMCConstants::m_enumerate_vbo_n.
+          */
+        GLsizei       m_batch;
+    }
+    m_codegen;
+
     // -------------------------------------------------------------------------
     /** Specifies the layout of the scalar field. */
     struct Field {
@@ -137,6 +280,24 @@ struct HPMCHistoPyramid
         GLfloat       m_extent[3];
         
         bool          m_binary;
+        /** Bounds of the scalar field values, unknown if m_range[0] > m_range[1]. */
+        GLfloat       m_range[2];
+        /** Use every m_stride'th lattice sample, see HPMCsetSampleStride. */
+        GLsizei       m_stride;
+
+        /** The lattice and grid as seen by the HistoPyramid when subsampled.
+          *
+          * Derived from the above by HPMCdetermineLayout. The stride is
+          * clamped per axis such that the grid has at least one cell, and the
+          * extent is shrunk if the stride does not divide the grid size.
+          */
+        struct Sampled {
+            GLsizei   m_stride[3];
+            GLsizei   m_size[3];
+            GLsizei   m_cells[3];
+            GLfloat   m_extent[3];
+        }
+        m_sampled;
     }
     m_field;
 
@@ -159,15 +320,196 @@ struct HPMCHistoPyramid
           * it not, forward differences are used.
           */
         bool              m_gradient;
+
+        /** Binned kernel centers (if fetch from a sum of radial kernels).
+          *
+          * The bin table and the binned centers share one RGBA32F 2D texture
+          * of width HPMC_KERNEL_TEX_WIDTH. The first m_bins^3 texels hold
+          * (offset,count) into the texture for every bin, and the following
+          * texels hold (x,y,z,weight) of the centers, grouped by bin.
+          */
+        struct RadialKernels {
+            /** Support radius of the kernels in normalized coordinates. */
+            GLfloat       m_radius;
+            /** Number of bins along each axis of the unit cube. */
+            GLsizei       m_bins;
+            /** Number of rows currently allocated in m_tex. */
+            GLsizei       m_rows;
+            /** Texture name of the bin and center texture. */
+            GLuint        m_tex;
+            /** Staging memory for the bin and center texture. */
+            std::vector<GLfloat> m_texels;
+        }
+        m_kernels;
+
+        /** Cache of the custom fetch function (if cached custom fetch).
+          *
+          * The custom fetch function is evaluated once per lattice point into
+          * a Texture3D of the same size as the lattice at the start of a
+          * build, unless the cache already holds the current version of the
+          * field. The texture is R32F, or RGBA32F with the gradient in xyz and
+          * the scalar value in w if gradients are provided.
+          */
+        struct FieldCache {
+            /** Texture name of the cache texture. */
+            GLuint               m_tex;
+            /** A set of FBOs, one FBO per slice of the cache texture. */
+            std::vector<GLuint>  m_fbos;
+            /** The m_version of the field held by the cache, 0 if none. */
+            GLuint               m_version;
+            /** Bytes of the cache texture, counted in the pyramid pool. */
+            GLsizeiptr           m_bytes;
+        }
+        m_cache;
+
+        /** Version of the field, incremented whenever the field may have
+          * changed, see HPMCinvalidateFieldCache.
+          */
+        GLuint        m_version;
+
+        /** Uniform block holding the parameters of a custom fetch function.
+          *
+          * The block is named HPMC_FetchParameters, and the same buffer is
+          * bound to the builder program and all traversal programs.
+          */
+        struct Parameters {
+            /** Uniform buffer binding point of the block, -1 if no block. */
+            GLint         m_binding;
+            /** Size of the block in bytes, as reported by the builder program. */
+            GLint         m_size;
+            /** Buffer object name of the uniform buffer. */
+            GLuint        m_buf;
+        }
+        m_parameters;
     }
     m_fetch;
 
+    // -------------------------------------------------------------------------
+    /** Second set of resources for pipelined build and extraction.
+      *
+      * If enabled, HPMCbuildHistopyramid builds into m_histopyramid and then
+      * swaps it with the HP here, so traversal uses the HP built by the
+      * previous call while the GPU is free to overlap it with the build. The
+      * field cache is swapped along with the HP. The radial kernel texture
+      * and the custom fetch parameter buffer are only swapped (copy-on-write)
+      * when updated while the HP here still refers to them.
+      */
+    struct Pipeline {
+        /** True if build and extraction is pipelined. */
+        bool                 m_enabled;
+        /** The HP that is currently not the build target. */
+        HistoPyramid         m_histopyramid;
+        /** The field cache that belongs to m_histopyramid. */
+        Fetch::FieldCache    m_cache;
+        /** Spare radial kernel texture and its allocated rows. */
+        GLuint               m_kernels_tex;
+        GLsizei              m_kernels_rows;
+        /** Spare custom fetch parameter buffer. */
+        GLuint               m_parameters_buf;
+    }
+    m_pipeline;
+
+    // -------------------------------------------------------------------------
+    /** State of a build spread over several calls to
+      * HPMCbuildHistopyramidBudgeted. The build targets the pipeline set, the
+      * base level is built a range of texel rows at a time, and with a cached
+      * custom fetch, the slices of the field cache are evaluated as the rows
+      * need them.
+      */
+    struct BudgetedBuild {
+        /** True if the base level of the pipeline set is partially built. */
+        bool                 m_active;
+        /** Number of texel rows of the base level built so far. */
+        GLsizei              m_rows;
+        /** The slices of the field cache that hold the field of this build. */
+        std::vector<bool>    m_cached;
+        /** The m_version of the field when the build started. */
+        GLuint               m_version;
+    }
+    m_budget;
+
+    // -------------------------------------------------------------------------
+    /** GPU timing of the build passes, using timestamp queries. */
+    struct Timer {
+        /** True if the build passes are timed (requires OpenGL 3.3). */
+        bool                 m_enabled;
+        /** Timestamps before and after the build passes. */
+        GLuint               m_queries[2];
+        /** True if the queries have been issued. */
+        bool                 m_issued;
+    }
+    m_timer;
+
+    // -------------------------------------------------------------------------
+    /** Statistics of the active cells, gathered after the base level pass.
+      *
+      * With OpenGL 4.3, a compute shader reduces the base level into integer
+      * counters in m_pbo: 256 histogram bins, followed by the maximum cell
+      * index and the negated minimum cell index as four ints each.
+      *
+      * Otherwise, the cells are scattered into HPMC_STATISTICS_ROWS rows of
+      * m_tex to spread the blending, and a gather pass reduces the rows into
+      * m_sum_tex: pixels 0 to 255 hold the number of active cells of each MC
+      * case, pixel 256 the maximum cell index and pixel 257 the negated
+      * minimum cell index. m_sum_tex is read back asynchronously into m_pbo.
+      */
+    struct Statistics {
+        /** True if statistics are gathered (requires OpenGL 3.0). */
+        bool                 m_enabled;
+        /** True if the last build skipped the passes, i.e. no active cells. */
+        bool                 m_empty;
+        /** True if a compute shader gathers the statistics (OpenGL 4.3). */
+        bool                 m_compute;
+        GLuint               m_tex;
+        GLuint               m_fbo;
+        GLuint               m_sum_tex;
+        GLuint               m_sum_fbo;
+        GLuint               m_pbo;
+    }
+    m_statistics;
+
+    // -------------------------------------------------------------------------
+    /** Choice of build and traversal variant by measurement, see
+      * HPMCsetAutotuning and HPMCautotune.
+      */
+    struct Autotune {
+        /** True if HPMCsetup lets HPMCautotune choose the variant. */
+        bool                 m_enabled;
+        /** True while the variants are measured, so HPMCsetup doesn't recurse. */
+        bool                 m_active;
+        /** True if the measurement waits for the next build, see
+          * HPMCautotuneDeferred.
+          */
+        bool                 m_pending;
+        /** Variant bits set explicitly by the application, which are kept. */
+        int                  m_fixed;
+        /** Path of the profile file. */
+        std::string          m_profile;
+        /** Profile key of the configuration tuned last, and its variant. */
+        std::string          m_key;
+        int                  m_variant;
+    }
+    m_autotune;
+
     /** State during HistoPyramid construction */
     struct HistoPyramidBuild {
         GLuint           m_tex_unit_1;          ///< Bound to vertex count in base level pass, bound to HP in other passes.
         GLuint           m_tex_unit_2;          ///< Bound to volume texture if HPMC handles texturing of scalar field.
         GLuint           m_gpgpu_vertex_shader; ///< Common GPGPU pass-through vertex shader.
 
+        /** Evaluation of custom fetch into field cache (if cached custom fetch).
+          *
+          * With the compute build, the program is a compute shader writing
+          * a slice of the cache through image unit 0.
+          */
+        struct FieldCacheEvaluation {
+            GLuint            m_fragment_shader;
+            GLuint            m_compute_shader;
+            GLuint            m_program;
+            GLint             m_loc_slice;
+        }
+        m_cache;
+
         /** Base level construction pass. */
         struct BaseConstruction {
             GLuint            m_fragment_shader;
@@ -194,6 +536,53 @@ struct HPMCHistoPyramid
         }
         m_upper;
 
+        /** Statistics pass, either points scattered into rows followed by a
+          * gather of the rows, or a compute shader reduction.
+          */
+        struct StatisticsPass {
+            GLuint            m_vertex_shader;
+            GLuint            m_fragment_shader;
+            GLuint            m_program;
+            GLint             m_loc_bounds;
+            GLuint            m_gather_shader;
+            GLuint            m_gather_program;
+            GLuint            m_compute_shader;
+            GLuint            m_compute_program;
+        }
+        m_statistics;
+
+        /** Compute shader build (requires OpenGL 4.3).
+          *
+          * The base level and the reductions write the levels of the HP tex
+          * through image units, and a reduction dispatch produces up to three
+          * levels using shared memory.
+          */
+        struct ComputeBuild {
+            /** True if the HP is built by compute shaders. */
+            bool              m_enabled;
+            GLuint            m_base_shader;
+            GLuint            m_base_program;
+            GLint             m_base_loc_threshold;
+            GLint             m_base_loc_rows;
+            GLuint            m_reduction_shader;
+            GLuint            m_reduction_program;
+            GLint             m_reduction_loc_levels;
+            GLint             m_reduction_loc_dst_size;
+        }
+        m_compute;
+
+        /** HP5 reduction, one compute dispatch per level (if HP5). */
+        struct HP5Reduction {
+            GLuint            m_shader;
+            GLuint            m_program;
+            GLint             m_loc_level;
+            GLint             m_loc_src_offset;
+            GLint             m_loc_src_count;
+            GLint             m_loc_dst_offset;
+            GLint             m_loc_dst_count;
+        }
+        m_hp5;
+
     }
     m_hp_build;
 };
@@ -208,6 +597,132 @@ struct HPMCTraversalHandle
     GLuint                    m_edge_decode_unit;
     GLint                     m_offset_loc;
     GLint                     m_threshold_loc;
+    /** Format of vertices packed by extractVertexPacked, if not float. */
+    HPMCVertexFormat          m_vertex_format;
+    /** True if the shader functions provide castRay instead of extractVertex. */
+    bool                      m_ray_cast;
+    /** True if extractVertex skips the normal, see HPMCsetTraversalHandlePositionOnly. */
+    bool                      m_position_only;
+    /** True if a geometry shader extracts a triangle per point, see HPMCsetTraversalHandleTriangles. */
+    bool                      m_triangles;
+    /** True if a geometry shader extracts a cell per point, see HPMCsetTraversalHandleCells. */
+    bool                      m_cells;
+
+    /** Library-managed transform feedback output buffer (requires OpenGL 4.0). */
+    struct OutputBuffer {
+        /** Size in bytes of one captured vertex, zero if no output buffer. */
+        GLsizei               m_vertex_size;
+        /** Capacity of m_buf in vertices, always a multiple of three. */
+        GLsizei               m_capacity;
+        /** Buffer that receives the captured vertices. */
+        GLuint                m_buf;
+        /** Indirect draw commands, see HPMCgenerateIndirectCommandShader. */
+        GLuint                m_indirect_buf;
+        /** GL_PRIMITIVES_GENERATED query used to detect overflow. */
+        GLuint                m_query;
+        /** True if the result of m_query has not been checked yet. */
+        bool                  m_query_pending;
+    }
+    m_output;
+
+    /** Per-cluster bounds of the output buffer, see HPMCgenerateClusterShader. */
+    struct OutputClusters {
+        /** Triangles per cluster, zero if clusters are disabled. */
+        GLsizei               m_triangles;
+        /** Capacity of m_buf in clusters. */
+        GLsizei               m_capacity;
+        /** Buffer that receives three vec4's per cluster. */
+        GLuint                m_buf;
+        GLuint                m_vertex_shader;
+        GLuint                m_program;
+        GLint                 m_loc_histopyramid;
+        GLint                 m_loc_scalarfield;
+        GLint                 m_loc_edge_table;
+        GLint                 m_loc_threshold;
+        GLint                 m_loc_capacity;
+    }
+    m_clusters;
+
+    /** Program used by HPMCqueryCollisions. */
+    struct CollisionQueries {
+        GLuint                m_vertex_shader;
+        GLuint                m_program;
+        GLint                 m_loc_histopyramid;
+        GLint                 m_loc_scalarfield;
+        GLint                 m_loc_threshold;
+    }
+    m_collisions;
+
+    /** Program used by HPMCextractVerticesCompute. */
+    struct ComputeExtraction {
+        GLuint                m_compute_shader;
+        GLuint                m_program;
+        GLint                 m_loc_histopyramid;
+        GLint                 m_loc_edge_table;
+        GLint                 m_loc_scalarfield;
+        GLint                 m_loc_threshold;
+        GLint                 m_loc_capacity;
+        GLint                 m_loc_write_normals;
+        GLint                 m_loc_write_indices;
+        GLint                 m_loc_write_command;
+    }
+    m_compute;
+};
+
+// -----------------------------------------------------------------------------
+/** Indexed triangle mesh produced by HPMCextractStreaming. */
+struct HPMCStreamingMesh
+{
+    /** Interleaved normal and position, six floats per vertex. */
+    std::vector<GLfloat>      m_vertices;
+    /** Three vertex indices per triangle. */
+    std::vector<GLuint>       m_indices;
+};
+
+// -----------------------------------------------------------------------------
+/** A HistoPyramid over a 2D domain of elements with a custom count function.
+  *
+  * Each texel of the base level holds the counts of a 2x2 block of elements,
+  * in the order (0,0), (1,0), (0,1), (1,1), which is the order the reduction
+  * and traversal use for the children of a texel.
+  */
+struct HPMCCompaction
+{
+    /** Tag that shaders and textures must be rebuilt. */
+    bool                   m_tainted;
+    /** Tag that we have had an error, cleared when reconfigured. */
+    bool                   m_broken;
+    struct HPMCConstants*  m_constants;
+    /** Number of elements along x and y. */
+    GLsizei                m_domain[2];
+    /** Source of the custom count function. */
+    std::string            m_count_source;
+    /** Size and two-log of the size of the HP tex. */
+    GLsizei                m_size;
+    GLsizei                m_size_l2;
+    /** Texture name of the HP tex and one FBO per mipmap level. */
+    GLuint                 m_tex;
+    std::vector<GLuint>    m_fbos;
+    /** Pixel pack buffer for async readback of HP top element. */
+    GLuint                 m_top_pbo;
+    GLsizei                m_top_count;
+    bool                   m_top_count_updated;
+    /** Bytes of the HP tex and PBO counted in the pyramid pool. */
+    GLsizeiptr             m_pool_bytes;
+    GLuint                 m_vertex_shader;
+    /** Evaluation of the count function into the base level. */
+    struct BaseConstruction {
+        GLuint             m_fragment_shader;
+        GLuint             m_program;
+    }
+    m_base;
+    /** Reduction of the levels above the base level. */
+    struct Reduction {
+        GLuint             m_fragment_shader;
+        GLuint             m_program;
+        GLint              m_loc_src_level;
+    }
+    m_reduction;
 };
 
 /** \} */
@@ -216,6 +731,34 @@ struct HPMCTraversalHandle
   * \{
   */
 
+/** Width of the texture holding binned radial kernel centers. */
+static const GLsizei HPMC_KERNEL_TEX_WIDTH = 1024;
+
+/** Width and height of the work groups of the compute shader build. */
+static const GLsizei HPMC_COMPUTE_GROUP_SIZE = 8;
+
+/** Number of invocations in the work groups of the HP5 reduction. */
+static const GLsizei HPMC_HP5_GROUP_SIZE = 64;
+
+/** Number of rows of partial statistics scattered into before they are gathered. */
+static const GLsizei HPMC_STATISTICS_ROWS = 64;
+
+/** Width and height of the work groups of the statistics compute shader. */
+static const GLsizei HPMC_STATISTICS_GROUP_SIZE = 16;
+
+/** Number of upper HistoPyramid texels cached in shared memory by compute traversal. */
+static const GLsizei HPMC_TRAVERSAL_CACHE_SIZE = 512;
+
+/** Variant bits of HPMCautotune, the settings of HPMCsetMortonTiling,
+  * HPMCsetComputeBuild and HPMCsetHP5Layout, and of HPMCHistoPyramid::Codegen.
+  */
+static const int HPMC_AUTOTUNE_MORTON      = 1;
+static const int HPMC_AUTOTUNE_COMPUTE     = 2;
+static const int HPMC_AUTOTUNE_HP5         = 4;
+static const int HPMC_AUTOTUNE_MASK        = 8;
+static const int HPMC_AUTOTUNE_SAMPLED     = 16;
+static const int HPMC_AUTOTUNE_SMALL_BATCH = 32;
+
 
 extern int      HPMC_triangle_table[256][16];
 
@@ -242,6 +785,43 @@ HPMCsetup( struct HPMCHistoPyramid* h );
 bool
 HPMCdetermineLayout( struct HPMCHistoPyramid* h );
 
+/** True if traversal decodes edges from constant arrays, i.e. constant tables
+  * are enabled and the field is not binary, as the edge decode texture of
+  * binary fields also holds the normals.
+  *
+  * \sideeffect None.
+  */
+bool
+HPMCuseConstantEdgeTable( struct HPMCHistoPyramid* h );
+
+/** Chooses the variant of the HistoPyramid, see HPMC_AUTOTUNE_MORTON.
+  *
+  * Looks up the current configuration in the profile, and if it is missing,
+  * sets up, builds and extracts the variants supported by the target, and
+  * appends the fastest to the profile. Variant bits in m_fixed are kept.
+  * With a custom fetch, the measurement is left to HPMCautotuneDeferred.
+  * Invoked by HPMCsetup if autotuning is enabled, which then sets up the
+  * chosen variant.
+  *
+  * \sideeffect See HPMCbuildHistopyramid.
+  */
+bool
+HPMCautotune( struct HPMCHistoPyramid* h );
+
+/** Measures the variants of a HistoPyramid with a custom fetch.
+  *
+  * Invoked by the build functions when HPMCautotune deferred the
+  * measurement, so the builder program has its uniforms set and the
+  * textures of the fetch are bound. The variants are measured on a separate
+  * HistoPyramid with the same configuration and copies of the uniforms, so
+  * the programs of h stay valid. The fastest is appended to the profile and
+  * used the next time h is set up.
+  *
+  * \sideeffect See HPMCbuildHistopyramid.
+  */
+bool
+HPMCautotuneDeferred( struct HPMCHistoPyramid* h, GLfloat threshold );
+
 /** Creates the HistoPyramid texture and framebuffer object.
   *
   * \sideeffect GL_TEXTURE_2D_BINDING, GL_FRAMEBUFFER_BINDING
@@ -249,6 +829,84 @@ HPMCdetermineLayout( struct HPMCHistoPyramid* h );
 bool
 HPMCsetupTexAndFBOs( struct HPMCHistoPyramid* h );
 
+/** Deletes the resources created by HPMCsetupTexAndFBOs for both sets, the
+  * HP textures and their fbos are returned to the pyramid pool.
+  *
+  * \sideeffect None.
+  */
+void
+HPMCfreeTexAndFBOs( struct HPMCHistoPyramid* h );
+
+/** Deletes the top PBO, HP5 buffers and field cache of one set, and returns
+  * its HP texture and fbos to the pyramid pool.
+  *
+  * \sideeffect None.
+  */
+void
+HPMCfreePyramidSet( struct HPMCConstants* c,
+                    HPMCHistoPyramid::HistoPyramid& hp,
+                    HPMCHistoPyramid::Fetch::FieldCache& cache );
+
+/** Size in bytes of a HistoPyramid texture of size 2^size_l2, with mipmaps. */
+GLsizeiptr
+HPMCpyramidStorageBytes( GLsizei size_l2 );
+
+/** Takes idle storage of the size class of hp from the pyramid pool.
+  *
+  * \return True if hp got the texture and FBOs of idle storage, false if
+  *         the pool has none of that size class.
+  */
+bool
+HPMCreusePyramidStorage( struct HPMCHistoPyramid* h,
+                         HPMCHistoPyramid::HistoPyramid& hp );
+
+/** Accounts for new storage in the pyramid pool.
+  *
+  * Frees idle storage, oldest first, and then evicts the least recently used
+  * HistoPyramids other than h until the storage fits in the budget.
+  *
+  * \return False if the storage does not fit even with all other
+  *         HistoPyramids evicted.
+  */
+bool
+HPMCreservePyramidStorage( struct HPMCHistoPyramid* h,
+                           GLsizeiptr bytes );
+
+/** Returns the texture and FBOs of hp to the pyramid pool as idle storage. */
+void
+HPMCreleasePyramidStorage( struct HPMCConstants* c,
+                           HPMCHistoPyramid::HistoPyramid& hp );
+
+/** Counts the resources of h other than the HP textures in the pyramid pool.
+  *
+  * The HP5 buffers, field caches and top PBOs of both sets and the statistics
+  * textures and PBO are counted as currently allocated. If that grows the
+  * pool beyond its budget, other HistoPyramids are evicted as in
+  * HPMCreservePyramidStorage.
+  *
+  * 
+eturn False if the resources do not fit even with all other
+  *         HistoPyramids evicted.
+  */
+bool
+HPMCaccountPyramidResources( struct HPMCHistoPyramid* h );
+
+/** Counts the HP tex and PBO of a compaction of the given size in the pyramid
+  * pool, evicting HistoPyramids if needed. Zero bytes removes the compaction
+  * from the count.
+  *
+  * 
+eturn False if the compaction does not fit even with all HistoPyramids
+  *         evicted.
+  */
+bool
+HPMCaccountCompactionStorage( struct HPMCCompaction* c,
+                              GLsizeiptr bytes );
+
+/** Marks a HistoPyramid as the most recently used one of its pool. */
+void
+HPMCtouchPyramid( struct HPMCHistoPyramid* h );
+
 bool
 HPMCfreeHPBuildShaders( struct HPMCHistoPyramid* h );
 
@@ -259,6 +917,49 @@ HPMCfreeHPBuildShaders( struct HPMCHistoPyramid* h );
 bool
 HPMCbuildHPBuildShaders( struct HPMCHistoPyramid* h );
 
+/** Build the fragment shader build programs, invoked by HPMCbuildHPBuildShaders.
+  *
+  * \sideeffect GL_CURRENT_PROGRAM
+  */
+bool
+HPMCbuildFragmentBuildShaders( struct HPMCHistoPyramid* h );
+
+/** Build the compute shader build programs, invoked by HPMCbuildHPBuildShaders.
+  *
+  * \sideeffect GL_CURRENT_PROGRAM
+  */
+bool
+HPMCbuildComputeBuildShaders( struct HPMCHistoPyramid* h );
+
+/** Build the HP5 reduction program, invoked by HPMCbuildHPBuildShaders.
+  *
+  * \sideeffect GL_CURRENT_PROGRAM
+  */
+bool
+HPMCbuildHP5BuildShaders( struct HPMCHistoPyramid* h );
+
+/** Swaps the HistoPyramid and field cache with the pipeline set.
+  *
+  * \sideeffect None.
+  */
+void
+HPMCswapPipelineSet( struct HPMCHistoPyramid* h );
+
+/** Deletes the textures, fbos and buffers of the pipeline set, the HP
+  * texture and its fbos are returned to the pyramid pool.
+  *
+  * \sideeffect None.
+  */
+void
+HPMCfreePipelineSet( struct HPMCHistoPyramid* h );
+
+/** Creates or deletes the statistics texture, fbo and pbo.
+  *
+  * \sideeffect GL_TEXTURE_2D_BINDING, GL_FRAMEBUFFER_BINDING
+  */
+bool
+HPMCsetupStatistics( struct HPMCHistoPyramid* h );
+
 
 bool
 HPMCcheckGL( const std::string& file, const int line );
@@ -278,20 +979,115 @@ HPMCgetUniformLocation( GLuint program, const std::string& name );
 std::string
 HPMCgenerateDefines( struct HPMCHistoPyramid* h );
 
+/** Expression converting a sample position p to normalized lattice coordinates.
+  *
+  * p.xy is normalized texture coordinates and p.z the slice number of the
+  * lattice seen by the HistoPyramid, which is subsampled if the sample stride
+  * is larger than one.
+  */
+std::string
+HPMCgenerateLatticePosition( struct HPMCHistoPyramid* h, const std::string& p );
+
 std::string
 HPMCgenerateScalarFieldFetch( struct HPMCHistoPyramid* h );
 
+std::string
+HPMCgenerateTileSlice( struct HPMCHistoPyramid* h, const std::string& tile );
+
+std::string
+HPMCgenerateFieldCacheShader( struct HPMCHistoPyramid* h );
+
+std::string
+HPMCgenerateFieldCacheComputeShader( struct HPMCHistoPyramid* h );
+
+/** Version line of the compute shaders, the core profile if the constants
+  * were created on a core profile context and the compatibility profile
+  * otherwise.
+  */
+std::string
+HPMCgenerateComputeVersion( struct HPMCConstants* c );
+
 std::string
 HPMCgenerateBaselevelShader( struct HPMCHistoPyramid* h );
 
 std::string
 HPMCgenerateReductionShader( struct HPMCHistoPyramid* h, const std::string& filter="" );
 
+/** Reduction shader for a given target, also used by HPMCCompaction.
+  *
+  * If sampled, targets of OpenGL 3.0 and newer sample the source level using
+  * textureLod and the HPMC_delta offsets, as older targets do, instead of
+  * using texelFetch, see HPMCHistoPyramid::Codegen.
+  */
+std::string
+HPMCgenerateReductionShader( HPMCTarget target, const std::string& filter, bool sampled=false );
+
+/** Function HPMC_baseLevel shared by the base level shaders. */
+std::string
+HPMCgenerateBaselevelFunction( struct HPMCHistoPyramid* h );
+
+std::string
+HPMCgenerateBaselevelComputeShader( struct HPMCHistoPyramid* h );
+
 std::string
-HPMCgenerateGPGPUVertexPassThroughShader( struct HPMCHistoPyramid* h );
+HPMCgenerateReductionComputeShader();
 
+/** Returns GLSL ivec2 HPMC_mortonDecode(int), which maps a Z-order index of
+  * the base level to a texel position.
+  */
 std::string
-HPMCgenerateExtractVertexFunction( struct HPMCHistoPyramid* h );
+HPMCgenerateMortonDecodeFunction();
+
+std::string
+HPMCgenerateHP5ReductionShader();
+
+std::string
+HPMCgenerateGPGPUVertexPassThroughShader();
+
+/** extractVertex, without normals if position_only, see
+  * HPMCsetTraversalHandlePositionOnly. extractTriangle instead if triangles,
+  * and extractCell and extractCellTriangle instead if cells, see
+  * HPMCsetTraversalHandleTriangles and HPMCsetTraversalHandleCells. */
+std::string
+HPMCgenerateExtractVertexFunction( struct HPMCHistoPyramid* h, bool position_only, bool triangles, bool cells, bool compute );
+
+std::string
+HPMCgenerateIndirectCommandShader();
+
+/** Functions castRay and castSegment, see HPMCsetTraversalHandleRayCasting. */
+std::string
+HPMCgenerateRayCastFunction( struct HPMCHistoPyramid* h );
+
+/** Vertex shader that casts one segment per vertex, see HPMCqueryCollisions. */
+std::string
+HPMCgenerateCollisionQueryShader();
+
+/** Compute shader that extracts one triangle per invocation, see HPMCextractVerticesCompute. */
+std::string
+HPMCgenerateComputeExtractionShader();
+
+std::string
+HPMCgenerateVertexPackFunction( HPMCVertexFormat format );
+
+std::string
+HPMCgenerateVertexUnpackFunction( struct HPMCHistoPyramid* h, HPMCVertexFormat format );
+
+std::string
+HPMCgenerateClusterShader( GLsizei triangles );
+
+std::string
+HPMCgenerateStatisticsVertexShader( struct HPMCHistoPyramid* h );
+
+std::string
+HPMCgenerateStatisticsFragmentShader();
+
+/** Fragment shader that reduces the rows of scattered statistics into one. */
+std::string
+HPMCgenerateStatisticsGatherShader();
+
+/** Compute shader that reduces the base level into statistics counters. */
+std::string
+HPMCgenerateStatisticsComputeShader( struct HPMCHistoPyramid* h );
 
 
 /** Trigger computations that build the Histopyramid.
@@ -313,6 +1109,87 @@ HPMCgenerateExtractVertexFunction( struct HPMCHistoPyramid* h );
 bool
 HPMCtriggerHistopyramidBuildPasses( struct HPMCHistoPyramid* h );
 
+/** Trigger one step of a budgeted build of the Histopyramid.
+  *
+  * Builds at most budget cells worth of texel rows of the base level, and
+  * the reductions when the base level is complete, which clears
+  * h->m_budget.m_active.
+  *
+  * \sideeffect See HPMCtriggerHistopyramidBuildPasses.
+  */
+bool
+HPMCtriggerBudgetedBuildPasses( struct HPMCHistoPyramid* h,
+                                GLuint                   budget );
+
+/** Clears the HP top element, used when there are no active cells.
+  *
+  * \sideeffect GL_FRAMEBUFFER_BINDING
+  */
+bool
+HPMCtriggerClearPass( struct HPMCHistoPyramid* h );
+
+/** Evaluates the custom fetch into the slices of the field cache for which
+  * slices is true.
+  *
+  * \sideeffect See HPMCtriggerHistopyramidBuildPasses.
+  */
+bool
+HPMCtriggerFieldCachePass( struct HPMCHistoPyramid*  h,
+                           const std::vector<bool>&  slices );
+
+/** Builds the texel rows [row_begin,row_end) of the HP base level.
+  *
+  * With a cached custom fetch, the field cache slices used by the rows must
+  * have been evaluated.
+  *
+  * \sideeffect See HPMCtriggerHistopyramidBuildPasses.
+  */
+bool
+HPMCtriggerBaseLevelPass( struct HPMCHistoPyramid* h,
+                          GLsizei                  row_begin,
+                          GLsizei                  row_end );
+
+/** Gathers statistics, reduces the HP base level and triggers readback.
+  *
+  * \sideeffect See HPMCtriggerHistopyramidBuildPasses.
+  */
+bool
+HPMCtriggerReductionPasses( struct HPMCHistoPyramid* h );
+
+/** Reduces the HP base level using compute shaders and triggers readback.
+  *
+  * \sideeffect GL_CURRENT_PROGRAM,
+  *             GL_TEXTURE_2D_BINDING,
+  *             image units 0 to 3,
+  *             GL_PIXEL_PACK_BUFFER binding
+  */
+bool
+HPMCtriggerComputeReductionPasses( struct HPMCHistoPyramid* h );
+
+/** Reduces the HP base level into the HP5 layout and triggers readback.
+  *
+  * The final dispatch also writes the total count to the top level of the HP
+  * tex, which is read back and used for indirect extraction as usual.
+  *
+  * \sideeffect GL_CURRENT_PROGRAM,
+  *             GL_TEXTURE_2D_BINDING,
+  *             image units 0 to 3,
+  *             GL_PIXEL_PACK_BUFFER binding
+  */
+bool
+HPMCtriggerHP5ReductionPasses( struct HPMCHistoPyramid* h );
+
+/** Gathers statistics from the HP base level and triggers readback.
+  *
+  * \sideeffect GL_CURRENT_PROGRAM,
+  *             GL_FRAMEBUFFER_BINDING,
+  *             GL_VIEWPORT,
+  *             GL_VERTEX_ARRAY,
+  *             GL_PIXEL_PACK_BUFFER binding
+  */
+bool
+HPMCtriggerStatisticsPass( struct HPMCHistoPyramid* h );
+
 
 void
 HPMCsetLayout( struct HPMCHistoPyramid* h );
@@ -328,6 +1205,19 @@ HPMCsetLayout( struct HPMCHistoPyramid* h );
 void
 HPMCrenderGPGPUQuad( struct HPMCHistoPyramid* h );
 
+void
+HPMCrenderGPGPUQuad( struct HPMCConstants* c );
+
+/** Count function source of a compaction, see HPMCsetCompactionCountFunction.
+  */
+std::string
+HPMCgenerateCompactionBaseShader( struct HPMCCompaction* c );
+
+/** Traversal functions of a compaction, see HPMCgetCompactionShaderFunctions.
+  */
+std::string
+HPMCgenerateCompactionTraversalFunctions( struct HPMCCompaction* c );
+
 /** \} */
 
 #endif // _HPMC_INTERNAL_H_
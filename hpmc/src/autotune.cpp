@@ -0,0 +1,688 @@
+/* -*- mode: C++; tab-width:4; c-basic-offset: 4; indent-tabs-mode:nil -*-
+ ***********************************************************************
+ *
+ *  File: autotune.cpp
+ *
+ *  Created: 17. October 2026
+ *
+ *  Version: $Id: $
+ *
+ *  Authors: Christopher Dyken <christopher.dyken@sintef.no>
+ *
+ *  This file is part of the HPMC library.
+ *  Copyright (C) 2009 by SINTEF.  All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  ("GPL") version 2 as published by the Free Software Foundation.
+ *  See the file LICENSE.GPL at the root directory of this source
+ *  distribution for additional information about the GNU GPL.
+ *
+ *  For using HPMC with software that can not be combined with the
+ *  GNU GPL, please contact SINTEF for aquiring a commercial license
+ *  and support.
+ *
+ *  SINTEF, Pb 124 Blindern, N-0314 Oslo, Norway
+ *  http://www.sintef.no
+ *********************************************************************/
+
+
+#include <cstdlib>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <hpmc.h>
+#include <hpmc_internal.h>
+
+using std::cerr;
+using std::endl;
+using std::string;
+
+/** Number of timed builds and extractions per variant, after one warm-up. */
+static const int HPMC_AUTOTUNE_RUNS = 4;
+
+/** Value of a uniform of the builder program of the application, or of an
+  * element if it is an array, see HPMCautotuneDeferred.
+  */
+struct HPMCAutotuneUniform {
+    string                m_name;
+    /** 'f' for floats, 'm' for square float matrices, 'i' for ints, bools
+      * and samplers, and 'u' for unsigned ints.
+      */
+    char                  m_kind;
+    GLint                 m_components;
+    std::vector<GLfloat>  m_floats;
+    std::vector<GLint>    m_ints;
+};
+
+// -----------------------------------------------------------------------------
+/** Variant bits of the current settings of h. */
+static int
+HPMCautotuneVariant( struct HPMCHistoPyramid* h )
+{
+    return ( h->m_tiling.m_morton                 ? HPMC_AUTOTUNE_MORTON  : 0 ) |
+           ( h->m_hp_build.m_compute.m_enabled    ? HPMC_AUTOTUNE_COMPUTE : 0 ) |
+           ( h->m_hp5.m_enabled                   ? HPMC_AUTOTUNE_HP5     : 0 ) |
+           ( h->m_codegen.m_mask_traversal        ? HPMC_AUTOTUNE_MASK    : 0 ) |
+           ( h->m_codegen.m_sampled_reduction     ? HPMC_AUTOTUNE_SAMPLED : 0 ) |
+           ( h->m_codegen.m_batch < h->m_constants->m_enumerate_vbo_n
+                                                  ? HPMC_AUTOTUNE_SMALL_BATCH : 0 );
+}
+
+// -----------------------------------------------------------------------------
+/** Sets the settings of h to the variant bits. */
+static void
+HPMCautotuneSet( struct HPMCHistoPyramid* h, int variant )
+{
+    const GLsizei n = h->m_constants->m_enumerate_vbo_n;
+    h->m_tiling.m_morton = (variant & HPMC_AUTOTUNE_MORTON) != 0;
+    h->m_hp_build.m_compute.m_enabled = (variant & HPMC_AUTOTUNE_COMPUTE) != 0;
+    h->m_hp5.m_enabled = (variant & HPMC_AUTOTUNE_HP5) != 0;
+    h->m_codegen.m_mask_traversal = (variant & HPMC_AUTOTUNE_MASK) != 0;
+    h->m_codegen.m_sampled_reduction = (variant & HPMC_AUTOTUNE_SAMPLED) != 0;
+    // a multiple of three, as batches of vertices are drawn as triangles
+    h->m_codegen.m_batch = (variant & HPMC_AUTOTUNE_SMALL_BATCH) != 0 ? 3*(n/12) : n;
+}
+
+// -----------------------------------------------------------------------------
+/** Sets the settings of h to the variant, except those set explicitly. */
+static void
+HPMCautotuneApply( struct HPMCHistoPyramid* h, int variant )
+{
+    const int fixed = h->m_autotune.m_fixed;
+    HPMCautotuneSet( h, (variant & ~fixed) | (HPMCautotuneVariant( h ) & fixed) );
+}
+
+// -----------------------------------------------------------------------------
+/** Key of the profile entry for the current machine and configuration. */
+static string
+HPMCautotuneKey( struct HPMCHistoPyramid* h )
+{
+    const GLenum names[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+    std::stringstream key;
+    for( int i=0; i<3; i++ ) {
+        const GLubyte* str = glGetString( names[i] );
+        key << ( str != NULL ? reinterpret_cast<const char*>( str ) : "unknown" ) << "; ";
+    }
+    // explicit settings are part of the configuration
+    const int fixed = h->m_autotune.m_fixed;
+    key << "target=" << h->m_constants->m_target
+        << " fetch=" << h->m_fetch.m_mode
+        << " cells=" << h->m_field.m_cells[0]
+        << "x" << h->m_field.m_cells[1]
+        << "x" << h->m_field.m_cells[2]
+        << " stride=" << h->m_field.m_stride
+        << " fixed=" << fixed << ":" << (HPMCautotuneVariant( h ) & fixed);
+    string k = key.str();
+    // one entry per line
+    for( size_t i=0; i<k.size(); i++ ) {
+        if( k[i] == '\n' || k[i] == '\r' ) {
+            k[i] = ' ';
+        }
+    }
+    return k;
+}
+
+// -----------------------------------------------------------------------------
+/** Finds the variant of key in the profile, later entries take precedence.
+  *
+  * An entry is a line with the variant bit mask followed by the key.
+  */
+static bool
+HPMCautotuneLookup( const string& profile, const string& key, int& variant )
+{
+    std::ifstream in( profile.c_str() );
+    bool found = false;
+    string line;
+    while( std::getline( in, line ) ) {
+        std::istringstream entry( line );
+        int v;
+        string k;
+        if( (entry >> v) && std::getline( entry >> std::ws, k ) && (k == key) ) {
+            variant = v;
+            found = true;
+        }
+    }
+    return found;
+}
+
+// -----------------------------------------------------------------------------
+/** Appends an entry to the profile. */
+static void
+HPMCautotuneStore( const string& profile, const string& key, int variant )
+{
+    std::ofstream out( profile.c_str(), std::ios::app );
+    out << variant << " " << key << endl;
+#ifdef DEBUG
+    if( !out ) {
+        cerr << "HPMC warning: failed to write autotuning profile '"
+             << profile << "'." << endl;
+    }
+#endif
+}
+
+// -----------------------------------------------------------------------------
+/** Number of components of a uniform type and how it is copied, zero if the
+  * type is not copied.
+  */
+static GLint
+HPMCautotuneUniformComponents( GLenum type, char& kind )
+{
+    switch( type ) {
+    case GL_FLOAT:             kind = 'f'; return 1;
+    case GL_FLOAT_VEC2:        kind = 'f'; return 2;
+    case GL_FLOAT_VEC3:        kind = 'f'; return 3;
+    case GL_FLOAT_VEC4:        kind = 'f'; return 4;
+    case GL_FLOAT_MAT2:        kind = 'm'; return 4;
+    case GL_FLOAT_MAT3:        kind = 'm'; return 9;
+    case GL_FLOAT_MAT4:        kind = 'm'; return 16;
+    case GL_INT:
+    case GL_BOOL:              kind = 'i'; return 1;
+    case GL_INT_VEC2:
+    case GL_BOOL_VEC2:         kind = 'i'; return 2;
+    case GL_INT_VEC3:
+    case GL_BOOL_VEC3:         kind = 'i'; return 3;
+    case GL_INT_VEC4:
+    case GL_BOOL_VEC4:         kind = 'i'; return 4;
+    case GL_UNSIGNED_INT:      kind = 'u'; return 1;
+    case GL_UNSIGNED_INT_VEC2: kind = 'u'; return 2;
+    case GL_UNSIGNED_INT_VEC3: kind = 'u'; return 3;
+    case GL_UNSIGNED_INT_VEC4: kind = 'u'; return 4;
+    case GL_FLOAT_MAT2x3:
+    case GL_FLOAT_MAT2x4:
+    case GL_FLOAT_MAT3x2:
+    case GL_FLOAT_MAT3x4:
+    case GL_FLOAT_MAT4x2:
+    case GL_FLOAT_MAT4x3:
+    case GL_DOUBLE:
+    case GL_DOUBLE_VEC2:
+    case GL_DOUBLE_VEC3:
+    case GL_DOUBLE_VEC4:       kind = 0; return 0;
+    default:
+        // samplers and images, which are set as an int
+        kind = 'i';
+        return 1;
+    }
+}
+
+// -----------------------------------------------------------------------------
+/** Reads the values of the uniforms of a program that are not set by HPMC. */
+static void
+HPMCautotuneGetUniforms( GLuint program, std::vector<HPMCAutotuneUniform>& uniforms )
+{
+    GLint count = 0;
+    GLint length = 0;
+    glGetProgramiv( program, GL_ACTIVE_UNIFORMS, &count );
+    glGetProgramiv( program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &length );
+    std::vector<GLchar> buffer( length+1 );
+    for( GLint i=0; i<count; i++ ) {
+        GLuint index = i;
+        GLint block;
+        GLint size;
+        GLenum type;
+        glGetActiveUniformsiv( program, 1, &index, GL_UNIFORM_BLOCK_INDEX, &block );
+        glGetActiveUniform( program, index, length+1, NULL, &size, &type, &buffer[0] );
+        string name( &buffer[0] );
+        // members of the parameter block are copied with the buffer
+        if( (block != -1) ||
+            (name.compare( 0, 5, "HPMC_" ) == 0) ||
+            (name.compare( 0, 3, "gl_" ) == 0) )
+        {
+            continue;
+        }
+        char kind;
+        GLint components = HPMCautotuneUniformComponents( type, kind );
+        if( components == 0 ) {
+#ifdef DEBUG
+            cerr << "HPMC warning: autotuning does not copy uniform '" << name
+                 << "' of the builder program." << endl;
+#endif
+            continue;
+        }
+        // arrays are reported as the first element
+        bool array = (name.size() > 3) && (name.compare( name.size()-3, 3, "[0]" ) == 0);
+        if( array ) {
+            name.erase( name.size()-3 );
+        }
+        for( GLint k=0; k<size; k++ ) {
+            HPMCAutotuneUniform u;
+            u.m_name = name;
+            if( array ) {
+                std::stringstream element;
+                element << name << "[" << k << "]";
+                u.m_name = element.str();
+            }
+            u.m_kind = kind;
+            u.m_components = components;
+            GLint loc = glGetUniformLocation( program, u.m_name.c_str() );
+            if( loc == -1 ) {
+                continue;
+            }
+            if( (kind == 'f') || (kind == 'm') ) {
+                u.m_floats.resize( components );
+                glGetUniformfv( program, loc, &u.m_floats[0] );
+            }
+            else if( kind == 'u' ) {
+                std::vector<GLuint> values( components );
+                glGetUniformuiv( program, loc, &values[0] );
+                u.m_ints.assign( values.begin(), values.end() );
+            }
+            else {
+                u.m_ints.resize( components );
+                glGetUniformiv( program, loc, &u.m_ints[0] );
+            }
+            uniforms.push_back( u );
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+/** Sets the uniforms of a program that have a name in uniforms. */
+static void
+HPMCautotuneSetUniforms( GLuint program, const std::vector<HPMCAutotuneUniform>& uniforms )
+{
+    glUseProgram( program );
+    for( size_t i=0; i<uniforms.size(); i++ ) {
+        const HPMCAutotuneUniform& u = uniforms[i];
+        GLint loc = glGetUniformLocation( program, u.m_name.c_str() );
+        if( loc == -1 ) {
+            continue;
+        }
+        if( u.m_kind == 'f' ) {
+            switch( u.m_components ) {
+            case 1: glUniform1fv( loc, 1, &u.m_floats[0] ); break;
+            case 2: glUniform2fv( loc, 1, &u.m_floats[0] ); break;
+            case 3: glUniform3fv( loc, 1, &u.m_floats[0] ); break;
+            case 4: glUniform4fv( loc, 1, &u.m_floats[0] ); break;
+            }
+        }
+        else if( u.m_kind == 'm' ) {
+            switch( u.m_components ) {
+            case 4:  glUniformMatrix2fv( loc, 1, GL_FALSE, &u.m_floats[0] ); break;
+            case 9:  glUniformMatrix3fv( loc, 1, GL_FALSE, &u.m_floats[0] ); break;
+            case 16: glUniformMatrix4fv( loc, 1, GL_FALSE, &u.m_floats[0] ); break;
+            }
+        }
+        else if( u.m_kind == 'u' ) {
+            std::vector<GLuint> values( u.m_ints.begin(), u.m_ints.end() );
+            switch( u.m_components ) {
+            case 1: glUniform1uiv( loc, 1, &values[0] ); break;
+            case 2: glUniform2uiv( loc, 1, &values[0] ); break;
+            case 3: glUniform3uiv( loc, 1, &values[0] ); break;
+            case 4: glUniform4uiv( loc, 1, &values[0] ); break;
+            }
+        }
+        else {
+            switch( u.m_components ) {
+            case 1: glUniform1iv( loc, 1, &u.m_ints[0] ); break;
+            case 2: glUniform2iv( loc, 1, &u.m_ints[0] ); break;
+            case 3: glUniform3iv( loc, 1, &u.m_ints[0] ); break;
+            case 4: glUniform4iv( loc, 1, &u.m_ints[0] ); break;
+            }
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+/** Creates a HistoPyramid with the configuration and variant of h, to measure
+  * variants without touching the programs of h.
+  */
+static struct HPMCHistoPyramid*
+HPMCautotuneCreateScratch( struct HPMCHistoPyramid* h )
+{
+    struct HPMCHistoPyramid* s = HPMCcreateHistoPyramid( h->m_constants );
+    if( s == NULL ) {
+        return NULL;
+    }
+    s->m_field = h->m_field;
+    s->m_fetch.m_mode = h->m_fetch.m_mode;
+    s->m_fetch.m_shader_source = h->m_fetch.m_shader_source;
+    s->m_fetch.m_gradient = h->m_fetch.m_gradient;
+    s->m_fetch.m_parameters.m_binding = h->m_fetch.m_parameters.m_binding;
+    s->m_hp_build.m_tex_unit_1 = h->m_hp_build.m_tex_unit_1;
+    s->m_hp_build.m_tex_unit_2 = h->m_hp_build.m_tex_unit_2;
+    s->m_constant_tables = h->m_constant_tables;
+    s->m_autotune.m_fixed = h->m_autotune.m_fixed;
+    HPMCautotuneSet( s, HPMCautotuneVariant( h ) );
+    s->m_tainted = true;
+    s->m_broken = false;
+    return s;
+}
+
+// -----------------------------------------------------------------------------
+/** Copies the fetch state of the application from source into h, i.e. the
+  * uniforms of the builder program and the contents of the parameter block.
+  */
+static void
+HPMCautotuneCopyFetchState( struct HPMCHistoPyramid*                  h,
+                            struct HPMCHistoPyramid*                  source,
+                            const std::vector<HPMCAutotuneUniform>&   uniforms )
+{
+    HPMCautotuneSetUniforms( HPMCgetBuilderProgram( h ), uniforms );
+    const HPMCHistoPyramid::Fetch::Parameters& src = source->m_fetch.m_parameters;
+    const HPMCHistoPyramid::Fetch::Parameters& dst = h->m_fetch.m_parameters;
+    if( (src.m_buf != 0) && (dst.m_buf != 0) && (src.m_size == dst.m_size) ) {
+        glBindBuffer( GL_COPY_READ_BUFFER, src.m_buf );
+        glBindBuffer( GL_COPY_WRITE_BUFFER, dst.m_buf );
+        glCopyBufferSubData( GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, dst.m_size );
+        glBindBuffer( GL_COPY_READ_BUFFER, 0 );
+        glBindBuffer( GL_COPY_WRITE_BUFFER, 0 );
+    }
+}
+
+// -----------------------------------------------------------------------------
+/** Sets up the current variant and measures the GPU time of a build and an
+  * extraction with a minimal traversal program, the fastest of a few runs.
+  *
+  * If source is not NULL, its fetch state is copied into h, see
+  * HPMCautotuneDeferred.
+  */
+static bool
+HPMCautotuneMeasure( struct HPMCHistoPyramid*                  h,
+                     struct HPMCHistoPyramid*                  source,
+                     const std::vector<HPMCAutotuneUniform>&   uniforms,
+                     GLuint64&                                 nanoseconds )
+{
+    if( !HPMCsetup( h ) ) {
+        return false;
+    }
+    if( source != NULL ) {
+        HPMCautotuneCopyFetchState( h, source, uniforms );
+    }
+    struct HPMCTraversalHandle* th = HPMCcreateTraversalHandle( h );
+    if( th == NULL ) {
+        return false;
+    }
+    char* functions = HPMCgetTraversalShaderFunctions( th );
+    if( functions == NULL ) {
+        HPMCdestroyTraversalHandle( th );
+        return false;
+    }
+    string src = string( functions ) +
+                 "void\n"
+                 "main()\n"
+                 "{\n"
+                 "    vec3 p, n;\n"
+                 "    extractVertex( p, n );\n"
+                 "    gl_Position = vec4( p+n, 1.0 );\n"
+                 "}\n";
+    free( functions );
+
+    // use the last texture units, which are least likely to be used by a
+    // custom fetch.
+    GLint units;
+    glGetIntegerv( GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS, &units );
+
+    GLuint shader = HPMCcompileShader( src, GL_VERTEX_SHADER );
+    GLuint program = glCreateProgram();
+    bool ok = shader != 0;
+    if( ok ) {
+        glAttachShader( program, shader );
+        ok = HPMClinkProgram( program ) &&
+             HPMCsetTraversalHandleProgram( th, program, units-3, units-2, units-1 );
+    }
+    // an uncached custom fetch is also evaluated by the traversal
+    if( ok && (source != NULL) ) {
+        HPMCautotuneSetUniforms( program, uniforms );
+    }
+
+    // --- time builds and extractions -----------------------------------------
+    // only the extraction is discarded, the build renders into textures.
+    GLboolean discard = glIsEnabled( GL_RASTERIZER_DISCARD );
+    GLuint queries[4];
+    glGenQueries( 4, queries );
+    GLfloat threshold = h->m_field.m_range[0] <= h->m_field.m_range[1]
+                      ? 0.5f*(h->m_field.m_range[0] + h->m_field.m_range[1])
+                      : h->m_threshold;
+    for( int i=0; ok && i<=HPMC_AUTOTUNE_RUNS; i++ ) {
+        glDisable( GL_RASTERIZER_DISCARD );
+        glQueryCounter( queries[0], GL_TIMESTAMP );
+        HPMCbuildHistopyramid( h, threshold );
+        glQueryCounter( queries[1], GL_TIMESTAMP );
+        glEnable( GL_RASTERIZER_DISCARD );
+        glQueryCounter( queries[2], GL_TIMESTAMP );
+        ok = !h->m_broken && HPMCextractVertices( th );
+        glQueryCounter( queries[3], GL_TIMESTAMP );
+
+        GLuint64 t[4];
+        for( int j=0; j<4; j++ ) {
+            glGetQueryObjectui64v( queries[j], GL_QUERY_RESULT, &t[j] );
+        }
+        GLuint64 time = (t[1]-t[0]) + (t[3]-t[2]);
+        // the first run compiles and allocates lazily, and is not counted
+        if( i == 1 || (i > 1 && time < nanoseconds) ) {
+            nanoseconds = time;
+        }
+    }
+    glDeleteQueries( 4, queries );
+    if( discard == GL_FALSE ) {
+        glDisable( GL_RASTERIZER_DISCARD );
+    }
+    else {
+        glEnable( GL_RASTERIZER_DISCARD );
+    }
+
+    HPMCdestroyTraversalHandle( th );
+    glDeleteProgram( program );
+    if( shader != 0 ) {
+        glDeleteShader( shader );
+    }
+    return ok;
+}
+
+// -----------------------------------------------------------------------------
+/** Sets up and measures a variant, and keeps it if it is the fastest so far. */
+static void
+HPMCautotuneTry( struct HPMCHistoPyramid*                  h,
+                 struct HPMCHistoPyramid*                  source,
+                 const std::vector<HPMCAutotuneUniform>&   uniforms,
+                 int                                       v,
+                 int&                                      best,
+                 GLuint64&                                 best_time,
+                 bool&                                     found )
+{
+    HPMCautotuneSet( h, v );
+    h->m_tainted = true;
+    h->m_broken = false;
+    GLuint64 time = 0;
+    if( !HPMCautotuneMeasure( h, source, uniforms, time ) ) {
+#ifdef DEBUG
+        cerr << "HPMC warning: autotuning failed to measure variant " << v << "." << endl;
+#endif
+        return;
+    }
+#ifdef DEBUG
+    cerr << "HPMC info: autotuning variant " << v << " took "
+         << (time*1e-6) << " ms." << endl;
+#endif
+    if( !found || time < best_time ) {
+        best_time = time;
+        best = v;
+        found = true;
+    }
+}
+
+// -----------------------------------------------------------------------------
+/** Measures the variants of h supported by the target and finds the fastest.
+  *
+  * Every combination of the build variants is measured with the default
+  * code generation, and then each code generation choice is tried on top of
+  * the fastest. Bits set explicitly by the application are kept.
+  */
+static bool
+HPMCautotuneSearch( struct HPMCHistoPyramid*                  h,
+                    struct HPMCHistoPyramid*                  source,
+                    const std::vector<HPMCAutotuneUniform>&   uniforms,
+                    int&                                      variant )
+{
+    HPMCHistoPyramid::Autotune& at = h->m_autotune;
+    int build = HPMC_AUTOTUNE_MORTON;
+    if( h->m_constants->m_target >= HPMC_TARGET_GL43_GLSL430 ) {
+        build |= HPMC_AUTOTUNE_COMPUTE | HPMC_AUTOTUNE_HP5;
+    }
+    build &= ~at.m_fixed;
+    const int base = HPMCautotuneVariant( h ) & at.m_fixed;
+
+    bool timer = h->m_timer.m_enabled;
+    h->m_timer.m_enabled = false;
+    at.m_active = true;
+    glPushAttrib( GL_TEXTURE_BIT );
+
+    GLuint64 best_time = 0;
+    bool found = false;
+    for( int v=0; v<=build; v++ ) {
+        if( (v & ~build) == 0 ) {
+            HPMCautotuneTry( h, source, uniforms, base | v, variant, best_time, found );
+        }
+    }
+    const int codegen[3] = { HPMC_AUTOTUNE_MASK,
+                             HPMC_AUTOTUNE_SAMPLED,
+                             HPMC_AUTOTUNE_SMALL_BATCH };
+    for( int i=0; found && i<3; i++ ) {
+        // only the fragment shader reduction samples
+        if( (codegen[i] == HPMC_AUTOTUNE_SAMPLED) &&
+            ((variant & (HPMC_AUTOTUNE_COMPUTE | HPMC_AUTOTUNE_HP5)) != 0) )
+        {
+            continue;
+        }
+        HPMCautotuneTry( h, source, uniforms, variant | codegen[i], variant, best_time, found );
+    }
+
+    glPopAttrib();
+    at.m_active = false;
+    h->m_timer.m_enabled = timer;
+    h->m_tainted = true;
+    h->m_broken = false;
+    if( !found ) {
+#ifdef DEBUG
+        cerr << "HPMC error: autotuning failed to measure any variant." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+#ifdef DEBUG
+/** Prints the settings of a variant. */
+static void
+HPMCautotunePrint( int variant, const char* when )
+{
+    cerr << "HPMC info: autotuned variant is morton=" << (variant & HPMC_AUTOTUNE_MORTON ? 1 : 0)
+         << " compute=" << (variant & HPMC_AUTOTUNE_COMPUTE ? 1 : 0)
+         << " hp5=" << (variant & HPMC_AUTOTUNE_HP5 ? 1 : 0)
+         << " mask=" << (variant & HPMC_AUTOTUNE_MASK ? 1 : 0)
+         << " sampled=" << (variant & HPMC_AUTOTUNE_SAMPLED ? 1 : 0)
+         << " small_batch=" << (variant & HPMC_AUTOTUNE_SMALL_BATCH ? 1 : 0)
+         << when << "." << endl;
+}
+#endif
+
+// -----------------------------------------------------------------------------
+bool
+HPMCautotune( struct HPMCHistoPyramid* h )
+{
+    HPMCHistoPyramid::Autotune& at = h->m_autotune;
+    at.m_pending = false;
+    string key = HPMCautotuneKey( h );
+
+    // --- same configuration as last time, or found in profile ----------------
+    int variant = 0;
+    if( key == at.m_key ) {
+        variant = at.m_variant;
+    }
+    else if( !HPMCautotuneLookup( at.m_profile, key, variant ) ) {
+
+        // --- a custom fetch is complete at the first build -------------------
+        // its uniforms are set by the application after the setup.
+        if( (h->m_fetch.m_mode == HPMC_VOLUME_LAYOUT_CUSTOM) ||
+            (h->m_fetch.m_mode == HPMC_VOLUME_LAYOUT_CUSTOM_CACHED) )
+        {
+            at.m_pending = true;
+            return true;
+        }
+
+        // --- measure the variants supported by the target --------------------
+        if( !HPMCautotuneSearch( h, NULL, std::vector<HPMCAutotuneUniform>(), variant ) ) {
+            return false;
+        }
+        HPMCautotuneStore( at.m_profile, key, variant );
+    }
+#ifdef DEBUG
+    HPMCautotunePrint( variant, "" );
+#endif
+    HPMCautotuneApply( h, variant );
+    at.m_key = key;
+    at.m_variant = HPMCautotuneVariant( h );
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCautotuneDeferred( struct HPMCHistoPyramid* h, GLfloat threshold )
+{
+    HPMCHistoPyramid::Autotune& at = h->m_autotune;
+    at.m_pending = false;
+    string key = HPMCautotuneKey( h );
+
+    std::vector<HPMCAutotuneUniform> uniforms;
+    HPMCautotuneGetUniforms( HPMCgetBuilderProgram( h ), uniforms );
+
+    // h keeps its texture while the scratch HistoPyramid is set up
+    struct HPMCHistoPyramid* s = HPMCautotuneCreateScratch( h );
+    if( s == NULL ) {
+        return false;
+    }
+    s->m_threshold = threshold;
+    at.m_active = true;
+    int variant = 0;
+    bool ok = HPMCautotuneSearch( s, h, uniforms, variant );
+    at.m_active = false;
+    HPMCdestroyHandle( s );
+    if( !ok ) {
+        return false;
+    }
+    HPMCautotuneStore( at.m_profile, key, variant );
+#ifdef DEBUG
+    HPMCautotunePrint( variant, ", used from the next setup" );
+#endif
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCsetAutotuning( struct HPMCHistoPyramid*  h,
+                   const char*               profile_path )
+{
+    if( h == NULL ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setAutotuning called with h == NULL." << endl;
+#endif
+        return false;
+    }
+    if( profile_path == NULL ) {
+        h->m_autotune.m_enabled = false;
+        h->m_autotune.m_pending = false;
+        return true;
+    }
+    if( h->m_constants->m_target < HPMC_TARGET_GL33_GLSL330 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: autotuning requires OpenGL 3.3." << endl;
+#endif
+        return false;
+    }
+    if( h->m_constants->m_core_profile ) {
+#ifdef DEBUG
+        cerr << "HPMC error: autotuning requires a compatibility profile context." << endl;
+#endif
+        return false;
+    }
+    h->m_autotune.m_enabled = true;
+    h->m_autotune.m_profile = profile_path;
+    h->m_autotune.m_key = "";
+    h->m_tainted = true;
+    h->m_broken = false;
+    return true;
+}
@@ -38,6 +38,90 @@
 using std::cerr;
 using std::endl;
 
+// -----------------------------------------------------------------------------
+/** Records what the HP is built from, used by traversal. */
+static void
+HPMCrecordBuildInput( struct HPMCHistoPyramid* h )
+{
+    HPMCHistoPyramid::HistoPyramid& hp = h->m_histopyramid;
+    hp.m_threshold = h->m_threshold;
+    hp.m_field_tex = h->m_fetch.m_tex;
+    hp.m_kernels_tex = h->m_fetch.m_kernels.m_tex;
+    hp.m_parameters_buf = h->m_fetch.m_parameters.m_buf;
+}
+
+// -----------------------------------------------------------------------------
+/** True if the threshold is outside the range of the field, no active cells. */
+static bool
+HPMCthresholdOutsideRange( struct HPMCHistoPyramid* h )
+{
+    const GLfloat* range = h->m_field.m_range;
+    return !h->m_field.m_binary &&
+           (range[0] <= range[1]) &&
+           ( (h->m_threshold < range[0]) || (range[1] < h->m_threshold) );
+}
+
+// -----------------------------------------------------------------------------
+/** The cell slice of a tile of the base level, see HPMCgenerateTileSlice. */
+static GLsizei
+HPMCtileSlice( struct HPMCHistoPyramid* h, GLsizei tx, GLsizei ty )
+{
+    if( !h->m_tiling.m_morton ) {
+        return tx + h->m_tiling.m_layout[0]*ty;
+    }
+    int p = 0;
+    int q = 0;
+    int a = 0;
+    int b = 0;
+    while( (1<<p) < h->m_tiling.m_tile_size[0] ) p++;
+    while( (1<<q) < h->m_tiling.m_tile_size[1] ) q++;
+    while( (1<<a) < h->m_tiling.m_layout[0] ) a++;
+    while( (1<<b) < h->m_tiling.m_layout[1] ) b++;
+    GLsizei slice = 0;
+    for(int i=0; i<a; i++) {
+        slice += ((tx>>i)&1) << ( i + std::max( 0, i+p-q ) );
+    }
+    for(int i=0; i<b; i++) {
+        slice += ((ty>>i)&1) << ( i + std::max( 0, i+q-p+1 ) );
+    }
+    return slice;
+}
+
+// -----------------------------------------------------------------------------
+/** Marks the field cache slices used by a row of tiles that are not cached.
+  *
+  * A cell slice uses the lattice slices between its corners, and one more on
+  * either side for the forward differences and texture filtering.
+  *
+  * \return The number of slices marked.
+  */
+static GLsizei
+HPMCmarkTileRowSlices( struct HPMCHistoPyramid*  h,
+                       GLsizei                   ty,
+                       const std::vector<bool>&  cached,
+                       std::vector<bool>&        marked )
+{
+    const HPMCHistoPyramid::Field::Sampled& sampled = h->m_field.m_sampled;
+    const GLsizei stride = sampled.m_stride[2];
+    const GLsizei last = h->m_field.m_size[2]-1;
+    GLsizei n = 0;
+    for( GLsizei tx=0; tx<h->m_tiling.m_layout[0]; tx++ ) {
+        GLsizei slice = HPMCtileSlice( h, tx, ty );
+        if( slice >= sampled.m_cells[2] ) {
+            continue;
+        }
+        GLsizei z0 = std::max( (GLsizei)0, slice*stride-1 );
+        GLsizei z1 = std::min( last, (slice+1)*stride+1 );
+        for( GLsizei z=z0; z<=z1; z++ ) {
+            if( !cached[z] && !marked[z] ) {
+                marked[z] = true;
+                n++;
+            }
+        }
+    }
+    return n;
+}
+
 // -----------------------------------------------------------------------------
 bool
 HPMCtriggerHistopyramidBuildPasses( struct HPMCHistoPyramid* h )
@@ -45,11 +129,6 @@ HPMCtriggerHistopyramidBuildPasses( struct HPMCHistoPyramid* h )
     if( h == NULL ) {
         return false;
     }
-    HPMCHistoPyramid::HistoPyramid& hp = h->m_histopyramid;
-    HPMCHistoPyramid::HistoPyramidBuild& hpb = h->m_hp_build;
-    HPMCHistoPyramid::HistoPyramidBuild::BaseConstruction& base = hpb.m_base;
-    HPMCHistoPyramid::HistoPyramidBuild::FirstReduction& first = hpb.m_first;
-    HPMCHistoPyramid::HistoPyramidBuild::UpperReduction& upper = hpb.m_upper;
 
     // --- if we have errors already on state, we fail -------------------------
     if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
@@ -59,34 +138,316 @@ HPMCtriggerHistopyramidBuildPasses( struct HPMCHistoPyramid* h )
         return false;
     }
 
+    HPMCrecordBuildInput( h );
+
+    // --- if the threshold is outside the range of the field, skip passes -----
+    if( HPMCthresholdOutsideRange( h ) ) {
+        return HPMCtriggerClearPass( h );
+    }
+
+    // --- evaluate custom fetch into field cache ------------------------------
+    // skipped if the field is unchanged since the cache was evaluated, e.g.
+    // if only the threshold changed.
+    HPMCHistoPyramid::Fetch::FieldCache& cache = h->m_fetch.m_cache;
+    if( (h->m_fetch.m_mode == HPMC_VOLUME_LAYOUT_CUSTOM_CACHED) &&
+        (cache.m_version != h->m_fetch.m_version) )
+    {
+        if( !HPMCtriggerFieldCachePass( h, std::vector<bool>( h->m_field.m_size[2], true ) ) ) {
+            return false;
+        }
+        cache.m_version = h->m_fetch.m_version;
+    }
+
+    if( !HPMCtriggerBaseLevelPass( h, 0, h->m_histopyramid.m_size ) ) {
+        return false;
+    }
+    return HPMCtriggerReductionPasses( h );
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCtriggerBudgetedBuildPasses( struct HPMCHistoPyramid* h,
+                                GLuint                   budget )
+{
+    HPMCHistoPyramid::BudgetedBuild& b = h->m_budget;
+
+    // --- if we have errors already on state, we fail -------------------------
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: triggerBudgetedBuildPasses called with GL errors." << endl;
+#endif
+        return false;
+    }
+
+    // --- start a new build, the input is fixed until it is done --------------
+    const bool cached = h->m_fetch.m_mode == HPMC_VOLUME_LAYOUT_CUSTOM_CACHED;
+    HPMCHistoPyramid::Fetch::FieldCache& cache = h->m_fetch.m_cache;
+    if( !b.m_active ) {
+        HPMCrecordBuildInput( h );
+        if( HPMCthresholdOutsideRange( h ) ) {
+            b.m_rows = h->m_histopyramid.m_size;
+            return HPMCtriggerClearPass( h );
+        }
+        b.m_active = true;
+        b.m_rows = 0;
+        // unless the cache holds the field, it is invalid until the build is
+        // done, which also covers abandoning the build.
+        if( cached ) {
+            bool valid = cache.m_version == h->m_fetch.m_version;
+            b.m_cached.assign( h->m_field.m_size[2], valid );
+            b.m_version = h->m_fetch.m_version;
+            if( !valid ) {
+                cache.m_version = 0;
+            }
+        }
+    }
+
+    // --- base level, each row of texels holds four cells per texel -----------
+    // rows are added while within budget, including the samples of the cache
+    // slices that the rows need, but at least one row is built.
+    const GLsizei size = h->m_histopyramid.m_size;
+    const GLuint slice_cost = h->m_field.m_size[0]*h->m_field.m_size[1];
+    std::vector<bool> slices;
+    std::vector<bool> row_slices;
+    if( cached ) {
+        slices.assign( b.m_cached.size(), false );
+    }
+    GLuint cost = 0;
+    GLsizei end = b.m_rows;
+    while( end < size ) {
+        GLuint row_cost = 4u*size;
+        GLsizei ty = end/h->m_tiling.m_tile_size[1];
+        bool new_tile_row = cached && ( (end == b.m_rows) || (end % h->m_tiling.m_tile_size[1] == 0) );
+        if( new_tile_row ) {
+            row_slices = slices;
+            row_cost += slice_cost*HPMCmarkTileRowSlices( h, ty, b.m_cached, row_slices );
+        }
+        if( (end > b.m_rows) && (cost + row_cost > budget) ) {
+            break;
+        }
+        if( new_tile_row ) {
+            slices.swap( row_slices );
+        }
+        cost += row_cost;
+        end++;
+    }
+
+    // the last step evaluates any slices not used by cells
+    if( cached ) {
+        for( size_t z=0; z<slices.size(); z++ ) {
+            if( end == size && !b.m_cached[z] ) {
+                slices[z] = true;
+            }
+            if( slices[z] ) {
+                b.m_cached[z] = true;
+            }
+        }
+        if( !HPMCtriggerFieldCachePass( h, slices ) ) {
+            b.m_active = false;
+            return false;
+        }
+    }
+    if( !HPMCtriggerBaseLevelPass( h, b.m_rows, end ) ) {
+        b.m_active = false;
+        return false;
+    }
+    b.m_rows = end;
+
+    // --- all rows done, reduce -----------------------------------------------
+    if( b.m_rows == size ) {
+        b.m_active = false;
+        if( cached ) {
+            cache.m_version = b.m_version;
+        }
+        return HPMCtriggerReductionPasses( h );
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCtriggerClearPass( struct HPMCHistoPyramid* h )
+{
+    HPMCHistoPyramid::HistoPyramid& hp = h->m_histopyramid;
+
+    // Clear every level, so that indirect extraction and everything that
+    // reads below the top element, like ray casting, sees zero too. The
+    // state is restored explicitly, core profile contexts have no stacks.
+    GLboolean old_scissor = glIsEnabled( GL_SCISSOR_TEST );
+    GLboolean old_mask[4];
+    GLfloat old_clear[4];
+    glGetBooleanv( GL_COLOR_WRITEMASK, old_mask );
+    glGetFloatv( GL_COLOR_CLEAR_VALUE, old_clear );
+    glDisable( GL_SCISSOR_TEST );
+    glColorMask( GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE );
+    glClearColor( 0.0f, 0.0f, 0.0f, 0.0f );
+    for( GLsizei m=0; m<=hp.m_size_l2; m++ ) {
+        if( h->m_constants->m_target < HPMC_TARGET_GL30_GLSL130 ) {
+            glBindFramebufferEXT( GL_FRAMEBUFFER_EXT, hp.m_fbos[m] );
+        }
+        else {
+            glBindFramebuffer( GL_FRAMEBUFFER, hp.m_fbos[m] );
+        }
+        glClear( GL_COLOR_BUFFER_BIT );
+    }
+    if( old_scissor ) {
+        glEnable( GL_SCISSOR_TEST );
+    }
+    glColorMask( old_mask[0], old_mask[1], old_mask[2], old_mask[3] );
+    glClearColor( old_clear[0], old_clear[1], old_clear[2], old_clear[3] );
+    if( h->m_hp5.m_enabled ) {
+        const GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        glBindBuffer( GL_TEXTURE_BUFFER, hp.m_hp5_buf );
+        glClearBufferData( GL_TEXTURE_BUFFER, GL_RGBA32F,
+                           GL_RGBA, GL_FLOAT, zero );
+        glBindBuffer( GL_TEXTURE_BUFFER, 0 );
+    }
+
+    hp.m_top_count = 0;
+    hp.m_top_count_updated = true;
+    h->m_statistics.m_empty = true;
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: triggerClearPass produced GL errors." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCtriggerFieldCachePass( struct HPMCHistoPyramid*  h,
+                           const std::vector<bool>&  slices )
+{
+    HPMCHistoPyramid::HistoPyramidBuild& hpb = h->m_hp_build;
+    HPMCHistoPyramid::Fetch::FieldCache& cache = h->m_fetch.m_cache;
+
+    if( h->m_fetch.m_parameters.m_binding >= 0 ) {
+        glBindBufferBase( GL_UNIFORM_BUFFER,
+                          h->m_fetch.m_parameters.m_binding,
+                          h->m_histopyramid.m_parameters_buf );
+    }
+
+    // --- one pass per slice --------------------------------------------------
+    glUseProgram( hpb.m_cache.m_program );
+    if( hpb.m_compute.m_enabled ) {
+        // or one dispatch per slice, writing the cache as an image
+        glBindImageTexture( 0, cache.m_tex, 0, GL_TRUE, 0, GL_WRITE_ONLY,
+                            h->m_fetch.m_gradient ? GL_RGBA32F : GL_R32F );
+        const GLsizei n = HPMC_COMPUTE_GROUP_SIZE;
+        for( GLsizei z=0; z<(GLsizei)slices.size(); z++ ) {
+            if( slices[z] ) {
+                glUniform1f( hpb.m_cache.m_loc_slice, static_cast<GLfloat>( z ) );
+                glDispatchCompute( (h->m_field.m_size[0]+n-1)/n,
+                                   (h->m_field.m_size[1]+n-1)/n, 1 );
+            }
+        }
+        glMemoryBarrier( GL_TEXTURE_FETCH_BARRIER_BIT );
+    }
+    else {
+        glViewport( 0, 0, h->m_field.m_size[0], h->m_field.m_size[1] );
+        for( GLsizei z=0; z<(GLsizei)slices.size(); z++ ) {
+            if( slices[z] ) {
+                glBindFramebuffer( GL_FRAMEBUFFER, cache.m_fbos[z] );
+                glUniform1f( hpb.m_cache.m_loc_slice, static_cast<GLfloat>( z ) );
+                HPMCrenderGPGPUQuad( h );
+            }
+        }
+    }
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: triggerFieldCachePass produced GL errors." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCtriggerBaseLevelPass( struct HPMCHistoPyramid* h,
+                          GLsizei                  row_begin,
+                          GLsizei                  row_end )
+{
+    HPMCHistoPyramid::HistoPyramid& hp = h->m_histopyramid;
+    HPMCHistoPyramid::HistoPyramidBuild& hpb = h->m_hp_build;
+    HPMCHistoPyramid::HistoPyramidBuild::BaseConstruction& base = hpb.m_base;
+
+    // --- bind custom fetch parameters ----------------------------------------
+    if( h->m_fetch.m_parameters.m_binding >= 0 ) {
+        glBindBufferBase( GL_UNIFORM_BUFFER,
+                          h->m_fetch.m_parameters.m_binding,
+                          hp.m_parameters_buf );
+    }
+
     // --- build base level ----------------------------------------------------
-    glUseProgram( base.m_program );
+    if( hpb.m_compute.m_enabled ) {
+        glUseProgram( hpb.m_compute.m_base_program );
+    }
+    else {
+        glUseProgram( base.m_program );
+    }
 
     // unless custom, HPMC handles fetching from the scalar field texture. We
     // bind the scalar field to the unit given by h->m_hp_build.m_tex_unit_2.
     if( h->m_fetch.m_mode == HPMC_VOLUME_LAYOUT_TEXTURE_3D ) {
-        glActiveTextureARB( GL_TEXTURE0_ARB + hpb.m_tex_unit_2 );
-        glBindTexture( GL_TEXTURE_3D, h->m_fetch.m_tex );
+        glActiveTexture( GL_TEXTURE0 + hpb.m_tex_unit_2 );
+        glBindTexture( GL_TEXTURE_3D, hp.m_field_tex );
+    }
+    else if( h->m_fetch.m_mode == HPMC_VOLUME_LAYOUT_CUSTOM_CACHED ) {
+        glActiveTexture( GL_TEXTURE0 + hpb.m_tex_unit_2 );
+        glBindTexture( GL_TEXTURE_3D, h->m_fetch.m_cache.m_tex );
+    }
+    else if( h->m_fetch.m_mode == HPMC_VOLUME_LAYOUT_RADIAL_KERNELS ) {
+        glActiveTexture( GL_TEXTURE0 + hpb.m_tex_unit_2 );
+        glBindTexture( GL_TEXTURE_2D, hp.m_kernels_tex );
     }
 
     // Switch to texture unit given by h->m_hp_build.m_tex_unit_1.
-    glActiveTextureARB( GL_TEXTURE0_ARB + hpb.m_tex_unit_1 );
+    glActiveTexture( GL_TEXTURE0 + hpb.m_tex_unit_1 );
 
     // To avoid getting GL errors when we bind base level FBOs, we set mipmap
     // levels of the HP texture to zero.
-    glBindTexture( GL_TEXTURE_2D, h->m_histopyramid.m_tex );
+    glBindTexture( GL_TEXTURE_2D, hp.m_tex );
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0 );
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
 
-    // Then bind the vertex count texture to unit h->m_hp_build.m_tex_unit_1.
-    glBindTexture( GL_TEXTURE_1D, h->m_constants->m_vertex_count_tex );
+    // Then bind the vertex count texture to unit h->m_hp_build.m_tex_unit_1,
+    // unless the shaders have the table as a constant array.
+    if( !h->m_constant_tables ) {
+        glBindTexture( GL_TEXTURE_1D, h->m_constants->m_vertex_count_tex );
+    }
+
+    // --- or dispatch compute shader, writing the base level as an image ------
+    if( hpb.m_compute.m_enabled ) {
+        HPMCHistoPyramid::HistoPyramidBuild::ComputeBuild& compute = hpb.m_compute;
+        if( !h->m_field.m_binary ) {
+            glUniform1f( compute.m_base_loc_threshold, hp.m_threshold );
+        }
+        glUniform2i( compute.m_base_loc_rows, row_begin, row_end );
+        glBindImageTexture( 0, hp.m_tex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F );
+        const GLsizei n = HPMC_COMPUTE_GROUP_SIZE;
+        glDispatchCompute( (hp.m_size+n-1)/n, (row_end-row_begin+n-1)/n, 1 );
+        glMemoryBarrier( GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT );
+
+        if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+            cerr << "HPMC error: triggerBaseLevelPass produced GL errors." << endl;
+#endif
+            return false;
+        }
+        return true;
+    }
 
     // Update the threshold uniform
     if( !h->m_field.m_binary ) {
-        glUniform1f( base.m_loc_threshold, h->m_threshold );
+        glUniform1f( base.m_loc_threshold, hp.m_threshold );
     }
 
-    // And trigger computation.
+    // And trigger computation, restricted to the given rows of texels.
     if( h->m_constants->m_target < HPMC_TARGET_GL30_GLSL130 ) {
         glBindFramebufferEXT( GL_FRAMEBUFFER_EXT, hp.m_fbos[0] );
     }
@@ -94,13 +455,64 @@ HPMCtriggerHistopyramidBuildPasses( struct HPMCHistoPyramid* h )
         glBindFramebuffer( GL_FRAMEBUFFER, hp.m_fbos[0] );
     }
     glViewport( 0, 0, hp.m_size, hp.m_size );
-    HPMCrenderGPGPUQuad( h );
+    if( (row_begin == 0) && (row_end == hp.m_size) ) {
+        HPMCrenderGPGPUQuad( h );
+    }
+    else {
+        glPushAttrib( GL_SCISSOR_BIT );
+        glEnable( GL_SCISSOR_TEST );
+        glScissor( 0, row_begin, hp.m_size, row_end-row_begin );
+        HPMCrenderGPGPUQuad( h );
+        glPopAttrib();
+    }
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: triggerBaseLevelPass produced GL errors." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCtriggerReductionPasses( struct HPMCHistoPyramid* h )
+{
+    HPMCHistoPyramid::HistoPyramid& hp = h->m_histopyramid;
+    HPMCHistoPyramid::HistoPyramidBuild& hpb = h->m_hp_build;
+    HPMCHistoPyramid::HistoPyramidBuild::FirstReduction& first = hpb.m_first;
+    HPMCHistoPyramid::HistoPyramidBuild::UpperReduction& upper = hpb.m_upper;
+
+    // bind histopyramid to texture unit h->m_hp_build.m_tex_unit_1, with
+    // mipmap levels set to the base level.
+    glActiveTexture( GL_TEXTURE0 + hpb.m_tex_unit_1 );
+    glBindTexture( GL_TEXTURE_2D, hp.m_tex );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0 );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0 );
+
+    // --- gather statistics from base level -----------------------------------
+    if( h->m_statistics.m_enabled ) {
+        if( !HPMCtriggerStatisticsPass( h ) ) {
+            return false;
+        }
+    }
+
+    // --- reduce into the HP5 layout, which has at least one level ------------
+    if( h->m_hp5.m_enabled ) {
+        return HPMCtriggerHP5ReductionPasses( h );
+    }
 
     // If HP is only 1x1 texels big, we are finished.
     if( hp.m_size_l2 < 1 ) {
         return true;
     }
 
+    // --- or reduce using compute shaders -------------------------------------
+    if( hpb.m_compute.m_enabled ) {
+        return HPMCtriggerComputeReductionPasses( h );
+    }
+
     // --- first reduction of HP -----------------------------------------------
     glUseProgram( first.m_program );
 
@@ -118,6 +530,8 @@ HPMCtriggerHistopyramidBuildPasses( struct HPMCHistoPyramid* h )
     else {
         glBindFramebuffer( GL_FRAMEBUFFER, h->m_histopyramid.m_fbos[1] );
         glUniform1i( first.m_loc_src_level, 0 );
+        // only used by the sampled reduction, see HPMCHistoPyramid::Codegen
+        glUniform2f( first.m_loc_delta, -0.5f/hp.m_size, 0.5f/hp.m_size );
     }
     glViewport( 0, 0, hp.m_size/2, hp.m_size/2 );
     HPMCrenderGPGPUQuad( h );
@@ -153,6 +567,7 @@ HPMCtriggerHistopyramidBuildPasses( struct HPMCHistoPyramid* h )
             glBindFramebuffer( GL_FRAMEBUFFER, h->m_histopyramid.m_fbos[m] );
             glViewport( 0, 0, 1<<(hp.m_size_l2-m), 1<<(hp.m_size_l2-m) );
             glUniform1i( upper.m_loc_src_level, m-1 );
+            glUniform2f( upper.m_loc_delta, -0.5f/(1<<(hp.m_size_l2+1-m)), 0.5f/(1<<(hp.m_size_l2+1-m)) );
             HPMCrenderGPGPUQuad( h );
         }
 
@@ -170,7 +585,204 @@ HPMCtriggerHistopyramidBuildPasses( struct HPMCHistoPyramid* h )
     // --- if we have created errors, we fail ----------------------------------
     if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
 #ifdef DEBUG
-        cerr << "HPMC error: triggerHistopyramidBuildPasses produced GL errors." << endl;
+        cerr << "HPMC error: triggerReductionPasses produced GL errors." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCtriggerComputeReductionPasses( struct HPMCHistoPyramid* h )
+{
+    HPMCHistoPyramid::HistoPyramid& hp = h->m_histopyramid;
+    HPMCHistoPyramid::HistoPyramidBuild::ComputeBuild& compute = h->m_hp_build.m_compute;
+    const GLsizei n = HPMC_COMPUTE_GROUP_SIZE;
+
+    // all levels must be within the mipmap range for image access
+    glBindTexture( GL_TEXTURE_2D, hp.m_tex );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0 );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, hp.m_size_l2 );
+
+    // --- reduce up to three levels per dispatch ------------------------------
+    glUseProgram( compute.m_reduction_program );
+    for( GLsizei m=0; m<hp.m_size_l2; ) {
+        GLsizei levels = std::min( (GLsizei)3, hp.m_size_l2-m );
+        GLsizei dst_size = 1<<(hp.m_size_l2-m-1);
+        glBindImageTexture( 0, hp.m_tex, m, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F );
+        for( GLsizei i=1; i<=3; i++ ) {
+            // unused destinations are bound to the last level produced
+            GLsizei level = m + std::min( i, levels );
+            glBindImageTexture( i, hp.m_tex, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F );
+        }
+        glUniform1i( compute.m_reduction_loc_levels, levels );
+        glUniform1i( compute.m_reduction_loc_dst_size, dst_size );
+        glDispatchCompute( (dst_size+n-1)/n, (dst_size+n-1)/n, 1 );
+        glMemoryBarrier( GL_SHADER_IMAGE_ACCESS_BARRIER_BIT );
+        m += levels;
+    }
+    glMemoryBarrier( GL_TEXTURE_FETCH_BARRIER_BIT |
+                     GL_TEXTURE_UPDATE_BARRIER_BIT |
+                     GL_PIXEL_BUFFER_BARRIER_BIT );
+
+    // --- trigger readback ----------------------------------------------------
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, hp.m_top_pbo );
+    glGetTexImage( GL_TEXTURE_2D, hp.m_size_l2, GL_RGBA, GL_FLOAT, NULL );
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+    hp.m_top_count_updated = false;
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: triggerComputeReductionPasses produced GL errors." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCtriggerHP5ReductionPasses( struct HPMCHistoPyramid* h )
+{
+    HPMCHistoPyramid::HistoPyramid& hp = h->m_histopyramid;
+    HPMCHistoPyramid::HistoPyramidBuild::HP5Reduction& reduction = h->m_hp_build.m_hp5;
+    const HPMCHistoPyramid::HP5& hp5 = h->m_hp5;
+    const GLsizei n = HPMC_HP5_GROUP_SIZE;
+
+    // the top level must be within the mipmap range for image access
+    glBindTexture( GL_TEXTURE_2D, hp.m_tex );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0 );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, hp.m_size_l2 );
+
+    glUseProgram( reduction.m_program );
+    glBindImageTexture( 0, hp.m_tex, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F );
+    glBindImageTexture( 1, hp.m_hp5_tex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F );
+    glBindImageTexture( 2, hp.m_hp5_sums_tex, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32F );
+    glBindImageTexture( 3, hp.m_tex, hp.m_size_l2, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F );
+
+    // --- one dispatch per level, bottom up -----------------------------------
+    for( GLsizei k=1; k<(GLsizei)hp5.m_count.size(); k++ ) {
+        glUniform1i( reduction.m_loc_level, k );
+        glUniform1i( reduction.m_loc_src_offset, hp5.m_offset[k-1] );
+        glUniform1i( reduction.m_loc_src_count, hp5.m_count[k-1] );
+        glUniform1i( reduction.m_loc_dst_offset, hp5.m_offset[k] );
+        glUniform1i( reduction.m_loc_dst_count, hp5.m_count[k] );
+        glDispatchCompute( (hp5.m_count[k]+n-1)/n, 1, 1 );
+        glMemoryBarrier( GL_SHADER_IMAGE_ACCESS_BARRIER_BIT );
+    }
+    glMemoryBarrier( GL_TEXTURE_FETCH_BARRIER_BIT |
+                     GL_TEXTURE_UPDATE_BARRIER_BIT |
+                     GL_PIXEL_BUFFER_BARRIER_BIT );
+
+    // --- trigger readback ----------------------------------------------------
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, hp.m_top_pbo );
+    glGetTexImage( GL_TEXTURE_2D, hp.m_size_l2, GL_RGBA, GL_FLOAT, NULL );
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+    hp.m_top_count_updated = false;
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: triggerHP5ReductionPasses produced GL errors." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCtriggerStatisticsPass( struct HPMCHistoPyramid* h )
+{
+    HPMCHistoPyramid::HistoPyramid& hp = h->m_histopyramid;
+    HPMCHistoPyramid::Statistics& stats = h->m_statistics;
+    HPMCHistoPyramid::HistoPyramidBuild::StatisticsPass& pass = h->m_hp_build.m_statistics;
+
+    // the level of the HP tex bound to the current unit is already zero
+    glBindTexture( GL_TEXTURE_2D, hp.m_tex );
+
+    // --- or reduce with a compute shader into the counters -------------------
+    if( stats.m_compute ) {
+        // the histogram starts at zero, the bounds at the smallest int
+        const GLuint zero = 0;
+        const GLint  lowest[8] = { -2147483647, -2147483647, -2147483647, -2147483647,
+                                   -2147483647, -2147483647, -2147483647, -2147483647 };
+        glBindBuffer( GL_SHADER_STORAGE_BUFFER, stats.m_pbo );
+        glClearBufferSubData( GL_SHADER_STORAGE_BUFFER, GL_R32UI,
+                              0, sizeof(GLuint)*256,
+                              GL_RED_INTEGER, GL_UNSIGNED_INT, &zero );
+        glBufferSubData( GL_SHADER_STORAGE_BUFFER,
+                         sizeof(GLuint)*256, sizeof(lowest), lowest );
+        glBindBuffer( GL_SHADER_STORAGE_BUFFER, 0 );
+
+        glUseProgram( pass.m_compute_program );
+        glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 0, stats.m_pbo );
+        const GLsizei n = HPMC_STATISTICS_GROUP_SIZE;
+        glDispatchCompute( (hp.m_size+n-1)/n, (hp.m_size+n-1)/n, 1 );
+        glMemoryBarrier( GL_BUFFER_UPDATE_BARRIER_BIT );
+        glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 0, 0 );
+        stats.m_empty = false;
+
+        if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+            cerr << "HPMC error: triggerStatisticsPass produced GL errors." << endl;
+#endif
+            return false;
+        }
+        return true;
+    }
+
+    glPushAttrib( GL_COLOR_BUFFER_BIT | GL_SCISSOR_BIT | GL_POINT_BIT | GL_ENABLE_BIT );
+    glBindFramebuffer( GL_FRAMEBUFFER, stats.m_fbo );
+    glViewport( 0, 0, 256+2, HPMC_STATISTICS_ROWS );
+    glColorMask( GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE );
+    glDisable( GL_RASTERIZER_DISCARD );
+    glDisable( GL_PROGRAM_POINT_SIZE );
+    glPointSize( 1.0f );
+
+    // the histogram starts at zero, the bounds at -inf
+    glDisable( GL_SCISSOR_TEST );
+    glClearColor( 0.0f, 0.0f, 0.0f, 0.0f );
+    glClear( GL_COLOR_BUFFER_BIT );
+    glEnable( GL_SCISSOR_TEST );
+    glScissor( 256, 0, 2, HPMC_STATISTICS_ROWS );
+    glClearColor( -1e30f, -1e30f, -1e30f, -1e30f );
+    glClear( GL_COLOR_BUFFER_BIT );
+    glDisable( GL_SCISSOR_TEST );
+
+    glUseProgram( pass.m_program );
+    glDisableClientState( GL_VERTEX_ARRAY );
+    glEnable( GL_BLEND );
+    glBlendFunc( GL_ONE, GL_ONE );
+
+    // one point per cell for the histogram, spread over the rows
+    glBlendEquation( GL_FUNC_ADD );
+    glUniform1i( pass.m_loc_bounds, 0 );
+    glDrawArrays( GL_POINTS, 0, 4*hp.m_size*hp.m_size );
+
+    // two points per texel for the bounds, spread over the rows
+    glBlendEquation( GL_MAX );
+    glUniform1i( pass.m_loc_bounds, 1 );
+    glDrawArrays( GL_POINTS, 0, 2*hp.m_size*hp.m_size );
+    glDisable( GL_BLEND );
+
+    // --- gather the rows into one --------------------------------------------
+    glBindFramebuffer( GL_FRAMEBUFFER, stats.m_sum_fbo );
+    glViewport( 0, 0, 256+2, 1 );
+    glBindTexture( GL_TEXTURE_2D, stats.m_tex );
+    glUseProgram( pass.m_gather_program );
+    HPMCrenderGPGPUQuad( h );
+    glPopAttrib();
+
+    // --- trigger readback ----------------------------------------------------
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, stats.m_pbo );
+    glReadPixels( 0, 0, 256+2, 1, GL_RGBA, GL_FLOAT, NULL );
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+    stats.m_empty = false;
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: triggerStatisticsPass produced GL errors." << endl;
 #endif
         return false;
     }
@@ -0,0 +1,485 @@
+/* -*- mode: C++; tab-width:4; c-basic-offset: 4; indent-tabs-mode:nil -*-
+ ***********************************************************************
+ *
+ *  File: compaction.cpp
+ *
+ *  Created: 17. October 2026
+ *
+ *  Version: $Id: $
+ *
+ *  Authors: Christopher Dyken <christopher.dyken@sintef.no>
+ *
+ *  This file is part of the HPMC library.
+ *  Copyright (C) 2009 by SINTEF.  All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  ("GPL") version 2 as published by the Free Software Foundation.
+ *  See the file LICENSE.GPL at the root directory of this source
+ *  distribution for additional information about the GNU GPL.
+ *
+ *  For using HPMC with software that can not be combined with the
+ *  GNU GPL, please contact SINTEF for aquiring a commercial license
+ *  and support.
+ *
+ *  SINTEF, Pb 124 Blindern, N-0314 Oslo, Norway
+ *  http://www.sintef.no
+ *********************************************************************/
+
+
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <hpmc.h>
+#include <hpmc_internal.h>
+
+using std::cerr;
+using std::endl;
+using std::max;
+
+// -----------------------------------------------------------------------------
+/** Frees the shaders and programs of a compaction. */
+static void
+HPMCfreeCompactionShaders( struct HPMCCompaction* c )
+{
+    if( c->m_base.m_program != 0 ) {
+        glDeleteProgram( c->m_base.m_program );
+        c->m_base.m_program = 0;
+    }
+    if( c->m_base.m_fragment_shader != 0 ) {
+        glDeleteShader( c->m_base.m_fragment_shader );
+        c->m_base.m_fragment_shader = 0;
+    }
+    if( c->m_reduction.m_program != 0 ) {
+        glDeleteProgram( c->m_reduction.m_program );
+        c->m_reduction.m_program = 0;
+    }
+    if( c->m_reduction.m_fragment_shader != 0 ) {
+        glDeleteShader( c->m_reduction.m_fragment_shader );
+        c->m_reduction.m_fragment_shader = 0;
+    }
+    if( c->m_vertex_shader != 0 ) {
+        glDeleteShader( c->m_vertex_shader );
+        c->m_vertex_shader = 0;
+    }
+}
+
+// -----------------------------------------------------------------------------
+/** Builds a GPGPU program from the pass-through vertex shader and a fragment shader. */
+static GLuint
+HPMCbuildCompactionProgram( struct HPMCCompaction* c, GLuint fragment_shader )
+{
+    GLuint program = glCreateProgram();
+    glAttachShader( program, c->m_vertex_shader );
+    glAttachShader( program, fragment_shader );
+    if( !HPMClinkProgram( program ) ) {
+        glDeleteProgram( program );
+        return 0;
+    }
+    return program;
+}
+
+// -----------------------------------------------------------------------------
+/** Sets up the HP tex, FBOs and shaders of a compaction if tainted.
+  *
+  * \sideeffect GL_CURRENT_PROGRAM,
+  *             GL_TEXTURE_2D_BINDING,
+  *             GL_FRAMEBUFFER_BINDING
+  */
+static bool
+HPMCsetupCompaction( struct HPMCCompaction* c )
+{
+    if( !c->m_tainted ) {
+        return true;
+    }
+    if( (c->m_domain[0] < 1) || (c->m_domain[1] < 1) || c->m_count_source.empty() ) {
+#ifdef DEBUG
+        cerr << "HPMC error: compaction needs a domain and a count function." << endl;
+#endif
+        return false;
+    }
+
+    // --- a texel holds 2x2 elements ------------------------------------------
+    GLsizei texels = max( (c->m_domain[0]+1)/2, (c->m_domain[1]+1)/2 );
+    c->m_size_l2 = 0;
+    while( (1<<c->m_size_l2) < texels ) {
+        c->m_size_l2++;
+    }
+    c->m_size = 1<<c->m_size_l2;
+
+    // --- the hp texture and pbo are counted in the pyramid pool --------------
+    if( !HPMCaccountCompactionStorage( c, HPMCpyramidStorageBytes( c->m_size_l2 )
+                                          + 4*sizeof(GLfloat) ) )
+    {
+        return false;
+    }
+
+    // --- create hp texture ---------------------------------------------------
+    if( c->m_tex == 0 ) {
+        glGenTextures( 1, &c->m_tex );
+    }
+    glBindTexture( GL_TEXTURE_2D, c->m_tex );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0 );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, c->m_size_l2 );
+    for( GLsizei i=0; i<=c->m_size_l2; i++ ) {
+        GLsizei w = c->m_size>>i;
+        glTexImage2D( GL_TEXTURE_2D, i, GL_RGBA32F, w, w, 0, GL_RGBA, GL_FLOAT, NULL );
+    }
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+
+    // --- create one fbo per level --------------------------------------------
+    if( !c->m_fbos.empty() ) {
+        glDeleteFramebuffers( c->m_fbos.size(), c->m_fbos.data() );
+    }
+    c->m_fbos.resize( c->m_size_l2+1 );
+    glGenFramebuffers( c->m_fbos.size(), c->m_fbos.data() );
+    for( GLuint m=0; m<c->m_fbos.size(); m++ ) {
+        glBindFramebuffer( GL_FRAMEBUFFER, c->m_fbos[m] );
+        glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                GL_TEXTURE_2D, c->m_tex, m );
+        glDrawBuffer( GL_COLOR_ATTACHMENT0 );
+        GLenum status = glCheckFramebufferStatus( GL_FRAMEBUFFER );
+        if( status != GL_FRAMEBUFFER_COMPLETE ) {
+#ifdef DEBUG
+            cerr << "HPMC error: compaction framebuffer is incomplete, status = 0x"
+                 << std::hex << status << std::dec << "." << endl;
+#endif
+            return false;
+        }
+    }
+
+    // --- setup pbo for async readback of top element -------------------------
+    if( c->m_top_pbo == 0 ) {
+        glGenBuffers( 1, &c->m_top_pbo );
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, c->m_top_pbo );
+        glBufferData( GL_PIXEL_PACK_BUFFER,
+                      sizeof(GLfloat)*4,
+                      NULL,
+                      GL_DYNAMIC_READ );
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+    }
+    c->m_top_count = 0;
+    c->m_top_count_updated = true;
+
+    // --- build programs ------------------------------------------------------
+    HPMCfreeCompactionShaders( c );
+    c->m_vertex_shader = HPMCcompileShader( HPMCgenerateGPGPUVertexPassThroughShader(),
+                                            GL_VERTEX_SHADER );
+    c->m_base.m_fragment_shader = HPMCcompileShader( HPMCgenerateCompactionBaseShader( c ),
+                                                     GL_FRAGMENT_SHADER );
+    c->m_reduction.m_fragment_shader = HPMCcompileShader( HPMCgenerateReductionShader( c->m_constants->m_target, "" ),
+                                                          GL_FRAGMENT_SHADER );
+    if( (c->m_vertex_shader == 0) ||
+        (c->m_base.m_fragment_shader == 0) ||
+        (c->m_reduction.m_fragment_shader == 0) )
+    {
+#ifdef DEBUG
+        cerr << "HPMC error: Failed to build compaction shaders." << endl;
+#endif
+        return false;
+    }
+    c->m_base.m_program = HPMCbuildCompactionProgram( c, c->m_base.m_fragment_shader );
+    c->m_reduction.m_program = HPMCbuildCompactionProgram( c, c->m_reduction.m_fragment_shader );
+    if( (c->m_base.m_program == 0) || (c->m_reduction.m_program == 0) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: Failed to link compaction programs." << endl;
+#endif
+        return false;
+    }
+
+    // --- configure reduction program, the HP is bound to unit 0 --------------
+    glUseProgram( c->m_reduction.m_program );
+    GLint loc_hp = HPMCgetUniformLocation( c->m_reduction.m_program, "HPMC_histopyramid" );
+    c->m_reduction.m_loc_src_level = HPMCgetUniformLocation( c->m_reduction.m_program, "HPMC_src_level" );
+    if( (loc_hp == -1) || (c->m_reduction.m_loc_src_level == -1) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: Failed to locate uniforms in compaction reduction program." << endl;
+#endif
+        return false;
+    }
+    glUniform1i( loc_hp, 0 );
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setupCompaction produced GL errors." << endl;
+#endif
+        return false;
+    }
+    c->m_tainted = false;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+struct HPMCCompaction*
+HPMCcreateCompaction( struct HPMCConstants* s )
+{
+    if( s == NULL ) {
+#ifdef DEBUG
+        cerr << "HPMC error: createCompaction called with NULL constants." << endl;
+#endif
+        return NULL;
+    }
+    if( s->m_target < HPMC_TARGET_GL30_GLSL130 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: compaction requires OpenGL 3.0." << endl;
+#endif
+        return NULL;
+    }
+    HPMCCompaction* c = new HPMCCompaction;
+    c->m_tainted = true;
+    c->m_broken = false;
+    c->m_constants = s;
+    c->m_domain[0] = 0;
+    c->m_domain[1] = 0;
+    c->m_size = 0;
+    c->m_size_l2 = 0;
+    c->m_tex = 0;
+    c->m_top_pbo = 0;
+    c->m_top_count = 0;
+    c->m_top_count_updated = true;
+    c->m_pool_bytes = 0;
+    c->m_vertex_shader = 0;
+    c->m_base.m_fragment_shader = 0;
+    c->m_base.m_program = 0;
+    c->m_reduction.m_fragment_shader = 0;
+    c->m_reduction.m_program = 0;
+    c->m_reduction.m_loc_src_level = -1;
+    return c;
+}
+
+// -----------------------------------------------------------------------------
+void
+HPMCdestroyCompaction( struct HPMCCompaction* c )
+{
+    if( c == NULL ) {
+        return;
+    }
+    HPMCfreeCompactionShaders( c );
+    if( !c->m_fbos.empty() ) {
+        glDeleteFramebuffers( c->m_fbos.size(), c->m_fbos.data() );
+    }
+    if( c->m_tex != 0 ) {
+        glDeleteTextures( 1, &c->m_tex );
+    }
+    if( c->m_top_pbo != 0 ) {
+        glDeleteBuffers( 1, &c->m_top_pbo );
+    }
+    HPMCaccountCompactionStorage( c, 0 );
+    delete c;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCsetCompactionDomain( struct HPMCCompaction*  c,
+                         GLsizei                 width,
+                         GLsizei                 height )
+{
+    if( c == NULL || width < 1 || height < 1 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setCompactionDomain called with illegal arguments." << endl;
+#endif
+        return false;
+    }
+    c->m_domain[0] = width;
+    c->m_domain[1] = height;
+    c->m_tainted = true;
+    c->m_broken = false;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCsetCompactionCountFunction( struct HPMCCompaction*  c,
+                                const char*             shader_source )
+{
+    if( c == NULL || shader_source == NULL ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setCompactionCountFunction called with illegal arguments." << endl;
+#endif
+        return false;
+    }
+    c->m_count_source = shader_source;
+    c->m_tainted = true;
+    c->m_broken = false;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+GLuint
+HPMCgetCompactionBuilderProgram( struct HPMCCompaction* c )
+{
+    if( c == NULL || c->m_broken ) {
+        return 0;
+    }
+    if( c->m_tainted && !HPMCsetupCompaction( c ) ) {
+        c->m_broken = true;
+        return 0;
+    }
+    return c->m_base.m_program;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCbuildCompaction( struct HPMCCompaction* c )
+{
+    if( c == NULL || c->m_broken ) {
+        return false;
+    }
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: buildCompaction called with errors on state." << endl;
+#endif
+        return false;
+    }
+
+    // --- store state ---------------------------------------------------------
+    glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+    glPushAttrib( GL_VIEWPORT_BIT | GL_TEXTURE_BIT );
+    GLuint old_pbo;
+    GLuint old_prog;
+    GLuint old_fbo;
+    glGetIntegerv( GL_PIXEL_PACK_BUFFER_BINDING,
+                   reinterpret_cast<GLint*>(&old_pbo) );
+    glGetIntegerv( GL_CURRENT_PROGRAM,
+                   reinterpret_cast<GLint*>(&old_prog) );
+    glGetIntegerv( GL_FRAMEBUFFER_BINDING,
+                   reinterpret_cast<GLint*>(&old_fbo) );
+
+    bool ok = HPMCsetupCompaction( c );
+    if( ok ) {
+        // --- evaluate count function into base level -------------------------
+        glUseProgram( c->m_base.m_program );
+        glBindFramebuffer( GL_FRAMEBUFFER, c->m_fbos[0] );
+        glViewport( 0, 0, c->m_size, c->m_size );
+        HPMCrenderGPGPUQuad( c->m_constants );
+
+        // --- reduce, reading the previous level only -------------------------
+        glUseProgram( c->m_reduction.m_program );
+        glActiveTexture( GL_TEXTURE0 );
+        glBindTexture( GL_TEXTURE_2D, c->m_tex );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0 );
+        for( GLsizei m=1; m<=c->m_size_l2; m++ ) {
+            glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, m-1 );
+            glBindFramebuffer( GL_FRAMEBUFFER, c->m_fbos[m] );
+            glViewport( 0, 0, c->m_size>>m, c->m_size>>m );
+            glUniform1i( c->m_reduction.m_loc_src_level, m-1 );
+            HPMCrenderGPGPUQuad( c->m_constants );
+        }
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, c->m_size_l2 );
+
+        // --- trigger readback ------------------------------------------------
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, c->m_top_pbo );
+        glGetTexImage( GL_TEXTURE_2D, c->m_size_l2, GL_RGBA, GL_FLOAT, NULL );
+        c->m_top_count_updated = false;
+    }
+
+    // --- restore state -------------------------------------------------------
+    glBindFramebuffer( GL_FRAMEBUFFER, old_fbo );
+    glUseProgram( old_prog );
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, old_pbo );
+    glPopAttrib();
+    glPopClientAttrib();
+
+    if( !ok || !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: buildCompaction failed." << endl;
+#endif
+        c->m_broken = true;
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+GLuint
+HPMCacquireCompactionCount( struct HPMCCompaction* c )
+{
+    if( c == NULL || c->m_broken ) {
+        return 0;
+    }
+    if( !c->m_top_count_updated ) {
+        GLuint old_pbo;
+        glGetIntegerv( GL_PIXEL_PACK_BUFFER_BINDING,
+                       reinterpret_cast<GLint*>(&old_pbo) );
+        GLfloat mem[4];
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, c->m_top_pbo );
+        glGetBufferSubData( GL_PIXEL_PACK_BUFFER,
+                            0, sizeof(GLfloat)*4,
+                            &mem[0] );
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, old_pbo );
+        c->m_top_count = static_cast<GLsizei>( mem[0] + mem[1] + mem[2] + mem[3] );
+        c->m_top_count_updated = true;
+    }
+    return c->m_top_count;
+}
+
+// -----------------------------------------------------------------------------
+char*
+HPMCgetCompactionShaderFunctions( struct HPMCCompaction* c )
+{
+    if( c == NULL || c->m_broken ) {
+        return NULL;
+    }
+    // the traversal depends on the size of the HP tex
+    if( c->m_tainted ) {
+        GLuint old_prog;
+        GLuint old_fbo;
+        glGetIntegerv( GL_CURRENT_PROGRAM,
+                       reinterpret_cast<GLint*>(&old_prog) );
+        glGetIntegerv( GL_FRAMEBUFFER_BINDING,
+                       reinterpret_cast<GLint*>(&old_fbo) );
+        glPushAttrib( GL_TEXTURE_BIT );
+        bool ok = HPMCsetupCompaction( c );
+        glPopAttrib();
+        glBindFramebuffer( GL_FRAMEBUFFER, old_fbo );
+        glUseProgram( old_prog );
+        if( !ok ) {
+            c->m_broken = true;
+            return NULL;
+        }
+    }
+    return strdup( HPMCgenerateCompactionTraversalFunctions( c ).c_str() );
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCbindCompaction( struct HPMCCompaction*  c,
+                    GLuint                  program,
+                    GLuint                  tex_unit )
+{
+    if( c == NULL || c->m_broken || c->m_tainted ) {
+#ifdef DEBUG
+        cerr << "HPMC error: bindCompaction called before the compaction is built." << endl;
+#endif
+        return false;
+    }
+    GLint loc = glGetUniformLocation( program, "HPMC_compaction" );
+    if( loc == -1 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: cannot find compaction sampler uniform." << endl;
+#endif
+        return false;
+    }
+    GLuint old_prog;
+    glGetIntegerv( GL_CURRENT_PROGRAM,
+                   reinterpret_cast<GLint*>(&old_prog) );
+    glUseProgram( program );
+    glUniform1i( loc, tex_unit );
+    glUseProgram( old_prog );
+    glActiveTexture( GL_TEXTURE0 + tex_unit );
+    glBindTexture( GL_TEXTURE_2D, c->m_tex );
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: bindCompaction produced GL errors." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
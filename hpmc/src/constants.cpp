@@ -108,6 +108,12 @@ HPMCcreateConstants( GLint max_gl_major, GLint max_gl_minor )
     s->m_edge_decode_normal_tex = 0;
     s->m_vertex_count_tex = 0;
     s->m_gpgpu_quad_vbo = 0;
+    s->m_indirect.m_vertex_shader = 0;
+    s->m_indirect.m_program = 0;
+    s->m_pool.m_bytes = 0;
+    s->m_pool.m_budget = 0;
+    s->m_pool.m_evictions = 0;
+    s->m_pool.m_clock = 0;
 
 
     if( gl_major == 2 ) {
@@ -190,9 +196,31 @@ HPMCcreateConstants( GLint max_gl_major, GLint max_gl_minor )
 #endif
 
 
-    // --- store state ---------------------------------------------------------
-    glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
-    glPushAttrib( GL_TEXTURE_BIT );
+    // --- a core profile context only has the compute build -------------------
+    s->m_core_profile = false;
+    if( s->m_target >= HPMC_TARGET_GL32_GLSL150 ) {
+        GLint mask = 0;
+        glGetIntegerv( GL_CONTEXT_PROFILE_MASK, &mask );
+        s->m_core_profile = (mask & GL_CONTEXT_CORE_PROFILE_BIT) != 0;
+    }
+    if( s->m_core_profile && (s->m_target < HPMC_TARGET_GL43_GLSL430) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: a core profile context requires OpenGL 4.3." << endl;
+#endif
+        delete s;
+        return NULL;
+    }
+
+    // --- store state, explicitly since core profiles have no attrib stacks ---
+    GLuint old_vbo;
+    GLuint old_tex_1d;
+    GLuint old_tex_2d;
+    glGetIntegerv( GL_ARRAY_BUFFER_BINDING,
+                   reinterpret_cast<GLint*>(&old_vbo) );
+    glGetIntegerv( GL_TEXTURE_BINDING_1D,
+                   reinterpret_cast<GLint*>(&old_tex_1d) );
+    glGetIntegerv( GL_TEXTURE_BINDING_2D,
+                   reinterpret_cast<GLint*>(&old_tex_2d) );
 
     // --- build enumeration VBO, used to spawn a batch of vertices  -----------
     s->m_enumerate_vbo_n = 3*1000;
@@ -281,8 +309,8 @@ HPMCcreateConstants( GLint max_gl_major, GLint max_gl_minor )
                   GL_RGBA32F_ARB, 16, 256,0,
                   GL_RGBA, GL_FLOAT,
                   edge_decode.data() );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
 
@@ -295,8 +323,8 @@ HPMCcreateConstants( GLint max_gl_major, GLint max_gl_minor )
                   GL_RGBA32F_ARB, 16, 256,0,
                   GL_RGBA, GL_FLOAT,
                   edge_decode_normal.data() );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
     
@@ -317,29 +345,60 @@ HPMCcreateConstants( GLint max_gl_major, GLint max_gl_minor )
     glBindTexture( GL_TEXTURE_1D, s->m_vertex_count_tex );
     glTexParameteri( GL_TEXTURE_1D, GL_TEXTURE_BASE_LEVEL, 0 );
     glTexParameteri( GL_TEXTURE_1D, GL_TEXTURE_MAX_LEVEL, 0 );
-    glTexImage1D( GL_TEXTURE_1D, 0,
-                  GL_ALPHA32F_ARB, 256, 0,
-                  GL_ALPHA, GL_FLOAT,
-                  &tricount[0] );
-    glTexParameteri( GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP);
+    if( s->m_core_profile ) {
+        // alpha formats are gone, the shaders still read the count from alpha
+        glTexImage1D( GL_TEXTURE_1D, 0,
+                      GL_R32F, 256, 0,
+                      GL_RED, GL_FLOAT,
+                      &tricount[0] );
+        glTexParameteri( GL_TEXTURE_1D, GL_TEXTURE_SWIZZLE_A, GL_RED );
+    }
+    else {
+        glTexImage1D( GL_TEXTURE_1D, 0,
+                      GL_ALPHA32F_ARB, 256, 0,
+                      GL_ALPHA, GL_FLOAT,
+                      &tricount[0] );
+    }
+    glTexParameteri( GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
     glTexParameteri( GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
     glTexParameteri( GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
 
+    // --- pack tables for constant arrays -------------------------------------
+    for(size_t j=0; j<256; j++) {
+        GLuint words[2] = { 0u, 0u };
+        for(size_t i=0; i<15; i++) {
+            int edge = HPMC_triangle_table[j][i];
+            if( edge != -1 ) {
+                words[i/8] |= static_cast<GLuint>( edge ) << (4*(i%8));
+            }
+        }
+        words[1] |= static_cast<GLuint>( tricount[ remapCode(j) ] ) << 28;
+        s->m_packed_cells[ 2*remapCode(j)+0 ] = words[0];
+        s->m_packed_cells[ 2*remapCode(j)+1 ] = words[1];
+    }
+    for(size_t e=0; e<12; e++) {
+        s->m_packed_edges[e] = ( static_cast<GLuint>( HPMC_edge_table[e][0] ) << 0 ) |
+                               ( static_cast<GLuint>( HPMC_edge_table[e][1] ) << 1 ) |
+                               ( static_cast<GLuint>( HPMC_edge_table[e][2] ) << 2 ) |
+                               ( static_cast<GLuint>( HPMC_edge_table[e][3] ) << 3 );
+    }
+
     // --- build GPGPU quad vbo ------------------------------------------------
     glGenBuffers( 1, &s->m_gpgpu_quad_vbo );
     glBindBuffer( GL_ARRAY_BUFFER, s->m_gpgpu_quad_vbo );
     glBufferData( GL_ARRAY_BUFFER, sizeof(GLfloat)*3*4, &HPMC_gpgpu_quad_vertices[0], GL_STATIC_DRAW );
 
     // --- restore state -------------------------------------------------------
-    glPopClientAttrib();
-    glPopAttrib();
+    glBindBuffer( GL_ARRAY_BUFFER, old_vbo );
+    glBindTexture( GL_TEXTURE_1D, old_tex_1d );
+    glBindTexture( GL_TEXTURE_2D, old_tex_2d );
 
     if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
 #ifdef DEBUG
         cerr << "HPMC error: createConstants created GL errors." << endl;
 #endif
+        // deletes s too, unless more errors are pending
         HPMCdestroyConstants( s );
-        delete s;
 
         return NULL;
     }
@@ -381,6 +440,22 @@ HPMCdestroyConstants( struct HPMCConstants* s )
         glDeleteBuffers( 1, &s->m_gpgpu_quad_vbo );
     }
 
+    if( s->m_indirect.m_program != 0 ) {
+        glDeleteProgram( s->m_indirect.m_program );
+    }
+
+    if( s->m_indirect.m_vertex_shader != 0 ) {
+        glDeleteShader( s->m_indirect.m_vertex_shader );
+    }
+
+#ifdef DEBUG
+    if( !s->m_pool.m_pyramids.empty() ) {
+        cerr << "HPMC warning: destroyConstants called with "
+             << s->m_pool.m_pyramids.size() << " HistoPyramids left." << endl;
+    }
+#endif
+    HPMCtrimPyramidPool( s );
+
     if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
 #ifdef DEBUG
         cerr << "HPMC error: destroyConstants introduced GL errors." << endl;
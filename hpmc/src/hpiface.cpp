@@ -28,9 +28,11 @@
 
 #include <cstdlib>
 #include <cmath>
+#include <cstring>
 #include <iostream>
 #include <algorithm>
 #include <string>
+#include <vector>
 #include <cstdarg>
 #include <hpmc.h>
 #include <hpmc_internal.h>
@@ -56,16 +58,36 @@ HPMCcreateHistoPyramid( struct HPMCConstants* constants )
     h->m_tainted = true;
     h->m_broken = true;
     h->m_constants = constants;
+    h->m_threshold = 0.0f;
+    h->m_last_use = 0;
+    h->m_pool_bytes = 0;
 
     h->m_tiling.m_tile_size[0] = 0;
     h->m_tiling.m_tile_size[1] = 0;
     h->m_tiling.m_layout[0] = 0;
     h->m_tiling.m_layout[1] = 0;
+    h->m_tiling.m_morton = false;
 
     h->m_histopyramid.m_size = 0;
     h->m_histopyramid.m_size_l2 = 0;
     h->m_histopyramid.m_tex = 0;
     h->m_histopyramid.m_top_pbo = 0;
+    h->m_histopyramid.m_threshold = 0.0f;
+    h->m_histopyramid.m_field_tex = 0;
+    h->m_histopyramid.m_kernels_tex = 0;
+    h->m_histopyramid.m_parameters_buf = 0;
+    h->m_histopyramid.m_hp5_buf = 0;
+    h->m_histopyramid.m_hp5_tex = 0;
+    h->m_histopyramid.m_hp5_sums_buf = 0;
+    h->m_histopyramid.m_hp5_sums_tex = 0;
+    h->m_histopyramid.m_hp5_bytes = 0;
+
+    h->m_hp5.m_enabled = false;
+    h->m_constant_tables = false;
+
+    h->m_codegen.m_mask_traversal = false;
+    h->m_codegen.m_sampled_reduction = false;
+    h->m_codegen.m_batch = constants->m_enumerate_vbo_n;
 
     h->m_field.m_size[0] = 0;
     h->m_field.m_size[1] = 0;
@@ -76,26 +98,134 @@ HPMCcreateHistoPyramid( struct HPMCConstants* constants )
     h->m_field.m_extent[0] = 1.0f;
     h->m_field.m_extent[1] = 1.0f;
     h->m_field.m_extent[2] = 1.0f;
+    h->m_field.m_stride = 1;
     h->m_field.m_binary = false;
+    h->m_field.m_range[0] = 1.0f;
+    h->m_field.m_range[1] = 0.0f;
 
     h->m_fetch.m_mode = HPMC_VOLUME_LAYOUT_TEXTURE_3D;
     h->m_fetch.m_shader_source = "";
     h->m_fetch.m_tex = 0;
     h->m_fetch.m_gradient = false;
+    h->m_fetch.m_kernels.m_radius = 0.0f;
+    h->m_fetch.m_kernels.m_bins = 0;
+    h->m_fetch.m_kernels.m_rows = 0;
+    h->m_fetch.m_kernels.m_tex = 0;
+    h->m_fetch.m_cache.m_tex = 0;
+    h->m_fetch.m_cache.m_version = 0;
+    h->m_fetch.m_cache.m_bytes = 0;
+    h->m_fetch.m_version = 1;
+    h->m_fetch.m_parameters.m_binding = -1;
+    h->m_fetch.m_parameters.m_size = 0;
+    h->m_fetch.m_parameters.m_buf = 0;
+
+    h->m_pipeline.m_enabled = false;
+    h->m_pipeline.m_histopyramid = h->m_histopyramid;
+    h->m_pipeline.m_cache.m_tex = 0;
+    h->m_pipeline.m_cache.m_version = 0;
+    h->m_pipeline.m_cache.m_bytes = 0;
+    h->m_pipeline.m_kernels_tex = 0;
+    h->m_pipeline.m_kernels_rows = 0;
+    h->m_pipeline.m_parameters_buf = 0;
+
+    h->m_budget.m_active = false;
+    h->m_budget.m_rows = 0;
+    h->m_budget.m_version = 0;
+
+    h->m_statistics.m_enabled = false;
+    h->m_statistics.m_empty = true;
+    h->m_statistics.m_compute = false;
+    h->m_statistics.m_tex = 0;
+    h->m_statistics.m_fbo = 0;
+    h->m_statistics.m_sum_tex = 0;
+    h->m_statistics.m_sum_fbo = 0;
+    h->m_statistics.m_pbo = 0;
 
     h->m_hp_build.m_tex_unit_1 = 0;
     h->m_hp_build.m_tex_unit_2 = 1;
     h->m_hp_build.m_gpgpu_vertex_shader = 0;
+    h->m_hp_build.m_cache.m_fragment_shader = 0;
+    h->m_hp_build.m_cache.m_compute_shader = 0;
+    h->m_hp_build.m_cache.m_program = 0;
     h->m_hp_build.m_base.m_fragment_shader = 0;
     h->m_hp_build.m_base.m_program = 0;
     h->m_hp_build.m_first.m_fragment_shader = 0;
     h->m_hp_build.m_first.m_program = 0;
     h->m_hp_build.m_upper.m_fragment_shader = 0;
     h->m_hp_build.m_upper.m_program = 0;
+    h->m_hp_build.m_statistics.m_vertex_shader = 0;
+    h->m_hp_build.m_statistics.m_fragment_shader = 0;
+    h->m_hp_build.m_statistics.m_program = 0;
+    h->m_hp_build.m_statistics.m_gather_shader = 0;
+    h->m_hp_build.m_statistics.m_gather_program = 0;
+    h->m_hp_build.m_statistics.m_compute_shader = 0;
+    h->m_hp_build.m_statistics.m_compute_program = 0;
+    // a core profile context has no fragment shader build
+    h->m_hp_build.m_compute.m_enabled = constants->m_core_profile;
+    h->m_hp_build.m_compute.m_base_shader = 0;
+    h->m_hp_build.m_compute.m_base_program = 0;
+    h->m_hp_build.m_compute.m_reduction_shader = 0;
+    h->m_hp_build.m_compute.m_reduction_program = 0;
+    h->m_hp_build.m_hp5.m_shader = 0;
+    h->m_hp_build.m_hp5.m_program = 0;
+
+    h->m_timer.m_enabled = false;
+    h->m_timer.m_queries[0] = 0;
+    h->m_timer.m_queries[1] = 0;
+    h->m_timer.m_issued = false;
 
+    h->m_autotune.m_enabled = false;
+    h->m_autotune.m_active = false;
+    h->m_autotune.m_pending = false;
+    h->m_autotune.m_fixed = constants->m_core_profile ? HPMC_AUTOTUNE_COMPUTE : 0;
+    h->m_autotune.m_variant = 0;
+
+    constants->m_pool.m_pyramids.push_back( h );
     return h;
 }
 
+// -----------------------------------------------------------------------------
+void
+HPMCdestroyHandle( struct HPMCHistoPyramid* h )
+{
+    if( h == NULL ) {
+#ifdef DEBUG
+        cerr << "HPMC error: destroyHandle called with h == NULL." << endl;
+#endif
+        return;
+    }
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: destroyHandle called with GL errors." << endl;
+#endif
+        return;
+    }
+    HPMCfreeHPBuildShaders( h );
+    HPMCfreeTexAndFBOs( h );
+    h->m_statistics.m_enabled = false;
+    HPMCsetupStatistics( h );
+    HPMCaccountPyramidResources( h );
+    if( h->m_fetch.m_kernels.m_tex != 0 ) {
+        glDeleteTextures( 1, &h->m_fetch.m_kernels.m_tex );
+    }
+    if( h->m_fetch.m_parameters.m_buf != 0 ) {
+        glDeleteBuffers( 1, &h->m_fetch.m_parameters.m_buf );
+    }
+    if( h->m_timer.m_queries[0] != 0 ) {
+        glDeleteQueries( 2, h->m_timer.m_queries );
+    }
+
+    std::vector<struct HPMCHistoPyramid*>& pyramids = h->m_constants->m_pool.m_pyramids;
+    pyramids.erase( std::remove( pyramids.begin(), pyramids.end(), h ), pyramids.end() );
+    delete h;
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: destroyHandle produced GL errors." << endl;
+#endif
+    }
+}
+
 // -----------------------------------------------------------------------------
 void
 HPMCsetLatticeSize( struct HPMCHistoPyramid*  h,
@@ -141,6 +271,16 @@ HPMCsetFieldAsContinuous( struct HPMCHistoPyramid* h )
     h->m_field.m_binary = false;    
 }
 
+// -----------------------------------------------------------------------------
+void
+HPMCsetFieldRange( struct HPMCHistoPyramid*  h,
+                   GLfloat                   min_value,
+                   GLfloat                   max_value )
+{
+    h->m_field.m_range[0] = min_value;
+    h->m_field.m_range[1] = max_value;
+}
+
 // -----------------------------------------------------------------------------
 void
 HPMCsetGridExtent( struct HPMCHistoPyramid*  h,
@@ -160,6 +300,170 @@ HPMCsetGridExtent( struct HPMCHistoPyramid*  h,
 #endif
 }
 
+// -----------------------------------------------------------------------------
+bool
+HPMCsetSampleStride( struct HPMCHistoPyramid*  h,
+                     GLsizei                   stride )
+{
+    if( h == NULL ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setSampleStride called with h == NULL." << endl;
+#endif
+        return false;
+    }
+    if( stride < 1 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setSampleStride called with stride less than one." << endl;
+#endif
+        return false;
+    }
+    if( h->m_field.m_stride != stride ) {
+        h->m_field.m_stride = stride;
+        h->m_tainted = true;
+        h->m_broken = false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+void
+HPMCsetPipelinedBuild( struct HPMCHistoPyramid*  h,
+                       GLboolean                 enable )
+{
+    bool pipelined = ( enable==GL_TRUE? true : false );
+    if( h->m_pipeline.m_enabled != pipelined ) {
+        h->m_pipeline.m_enabled = pipelined;
+        h->m_tainted = true;
+        h->m_broken = false;
+    }
+}
+
+// -----------------------------------------------------------------------------
+void
+HPMCsetMortonTiling( struct HPMCHistoPyramid*  h,
+                     GLboolean                 enable )
+{
+    bool morton = ( enable==GL_TRUE? true : false );
+    h->m_autotune.m_fixed |= HPMC_AUTOTUNE_MORTON;
+    if( h->m_tiling.m_morton != morton ) {
+        h->m_tiling.m_morton = morton;
+        h->m_tainted = true;
+        h->m_broken = false;
+    }
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCsetStatistics( struct HPMCHistoPyramid*  h,
+                   GLboolean                 enable )
+{
+    bool stats = ( enable==GL_TRUE? true : false );
+    if( stats && (h->m_constants->m_target < HPMC_TARGET_GL30_GLSL130) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: statistics require OpenGL 3.0." << endl;
+#endif
+        return false;
+    }
+    if( h->m_statistics.m_enabled != stats ) {
+        h->m_statistics.m_enabled = stats;
+        h->m_tainted = true;
+        h->m_broken = false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCsetComputeBuild( struct HPMCHistoPyramid*  h,
+                     GLboolean                 enable )
+{
+    bool compute = ( enable==GL_TRUE? true : false );
+    if( compute && (h->m_constants->m_target < HPMC_TARGET_GL43_GLSL430) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: compute build requires OpenGL 4.3." << endl;
+#endif
+        return false;
+    }
+    if( !compute && h->m_constants->m_core_profile ) {
+#ifdef DEBUG
+        cerr << "HPMC error: a core profile context requires the compute build." << endl;
+#endif
+        return false;
+    }
+    h->m_autotune.m_fixed |= HPMC_AUTOTUNE_COMPUTE;
+    if( h->m_hp_build.m_compute.m_enabled != compute ) {
+        h->m_hp_build.m_compute.m_enabled = compute;
+        h->m_tainted = true;
+        h->m_broken = false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCsetHP5Layout( struct HPMCHistoPyramid*  h,
+                  GLboolean                 enable )
+{
+    bool hp5 = ( enable==GL_TRUE? true : false );
+    if( hp5 && (h->m_constants->m_target < HPMC_TARGET_GL43_GLSL430) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: HP5 layout requires OpenGL 4.3." << endl;
+#endif
+        return false;
+    }
+    h->m_autotune.m_fixed |= HPMC_AUTOTUNE_HP5;
+    if( h->m_hp5.m_enabled != hp5 ) {
+        h->m_hp5.m_enabled = hp5;
+        h->m_tainted = true;
+        h->m_broken = false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCsetConstantTables( struct HPMCHistoPyramid*  h,
+                       GLboolean                 enable )
+{
+    bool constant = ( enable==GL_TRUE? true : false );
+    if( constant && (h->m_constants->m_target < HPMC_TARGET_GL30_GLSL130) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: constant tables require OpenGL 3.0." << endl;
+#endif
+        return false;
+    }
+    if( h->m_constant_tables != constant ) {
+        h->m_constant_tables = constant;
+        h->m_tainted = true;
+        h->m_broken = false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCuseConstantEdgeTable( struct HPMCHistoPyramid* h )
+{
+    return h->m_constant_tables && !h->m_field.m_binary;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCsetBuildTimer( struct HPMCHistoPyramid*  h,
+                   GLboolean                 enable )
+{
+    bool timer = ( enable==GL_TRUE? true : false );
+    if( timer && (h->m_constants->m_target < HPMC_TARGET_GL33_GLSL330) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: build timer requires OpenGL 3.3." << endl;
+#endif
+        return false;
+    }
+    h->m_timer.m_enabled = timer;
+    h->m_timer.m_issued = false;
+    return true;
+}
+
 // -----------------------------------------------------------------------------
 void
 HPMCsetFieldTexture3D( struct HPMCHistoPyramid*  h,
@@ -176,6 +480,9 @@ HPMCsetFieldTexture3D( struct HPMCHistoPyramid*  h,
     {
         h->m_fetch.m_mode = HPMC_VOLUME_LAYOUT_TEXTURE_3D;
         h->m_fetch.m_gradient = grad;
+        h->m_field.m_range[0] = 1.0f;
+        h->m_field.m_range[1] = 0.0f;
+        h->m_fetch.m_parameters.m_binding = -1;
         h->m_hp_build.m_tex_unit_1 = 0;
         h->m_hp_build.m_tex_unit_2 = 1;
         h->m_tainted = true;
@@ -192,13 +499,170 @@ HPMCsetFieldCustom( struct HPMCHistoPyramid*  h,
 {
     h->m_fetch.m_mode = HPMC_VOLUME_LAYOUT_CUSTOM;
     h->m_fetch.m_shader_source = shader_source;
+    h->m_field.m_range[0] = 1.0f;
+    h->m_field.m_range[1] = 0.0f;
     h->m_fetch.m_gradient = ( gradient==GL_TRUE? true : false );
+    h->m_fetch.m_version++;
     h->m_hp_build.m_tex_unit_1 = builder_texunit;
     h->m_hp_build.m_tex_unit_2 = builder_texunit+1;
     h->m_tainted = true;
     h->m_broken = false;
 }
 
+// -----------------------------------------------------------------------------
+void
+HPMCsetFieldCustomCached( struct HPMCHistoPyramid*  h,
+                          const char*               shader_source,
+                          GLuint                    builder_texunit,
+                          GLboolean                 gradient )
+{
+    if( h->m_constants->m_target < HPMC_TARGET_GL30_GLSL130 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: cached custom fetch requires OpenGL 3.0." << endl;
+#endif
+        h->m_broken = true;
+        return;
+    }
+    HPMCsetFieldCustom( h, shader_source, builder_texunit, gradient );
+    h->m_fetch.m_mode = HPMC_VOLUME_LAYOUT_CUSTOM_CACHED;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCsetFieldCustomParameterBlock( struct HPMCHistoPyramid*  h,
+                                  GLuint                    binding )
+{
+    if( h == NULL ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setFieldCustomParameterBlock called with h == NULL." << endl;
+#endif
+        return false;
+    }
+    if( (h->m_fetch.m_mode != HPMC_VOLUME_LAYOUT_CUSTOM) &&
+        (h->m_fetch.m_mode != HPMC_VOLUME_LAYOUT_CUSTOM_CACHED) )
+    {
+#ifdef DEBUG
+        cerr << "HPMC error: setFieldCustomParameterBlock called without custom fetch." << endl;
+#endif
+        return false;
+    }
+    if( (h->m_constants->m_target < HPMC_TARGET_GL31_GLSL140) &&
+        !GLEW_ARB_uniform_buffer_object )
+    {
+#ifdef DEBUG
+        cerr << "HPMC error: parameter block requires OpenGL 3.1 or ARB_uniform_buffer_object." << endl;
+#endif
+        return false;
+    }
+    GLint max_bindings;
+    glGetIntegerv( GL_MAX_UNIFORM_BUFFER_BINDINGS, &max_bindings );
+    if( (GLint)binding >= max_bindings ) {
+#ifdef DEBUG
+        cerr << "HPMC error: uniform buffer binding " << binding
+             << " exceeds GL_MAX_UNIFORM_BUFFER_BINDINGS." << endl;
+#endif
+        return false;
+    }
+    h->m_fetch.m_parameters.m_binding = binding;
+    h->m_fetch.m_version++;
+    h->m_tainted = true;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCupdateFieldCustomParameters( struct HPMCHistoPyramid*  h,
+                                 const GLvoid*             data,
+                                 GLintptr                  offset,
+                                 GLsizeiptr                size )
+{
+    if( h == NULL || h->m_broken ) {
+        return false;
+    }
+    HPMCHistoPyramid::Fetch::Parameters& params = h->m_fetch.m_parameters;
+    if( params.m_binding < 0 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: updateFieldCustomParameters called without parameter block." << endl;
+#endif
+        return false;
+    }
+    // the buffer is sized when the builder program is linked
+    if( h->m_tainted ) {
+        HPMCsetup( h );
+    }
+    if( (offset < 0) || (size < 0) || (offset + size > params.m_size) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: updateFieldCustomParameters called with range ["
+             << offset << ", " << (offset+size) << ") outside block of size "
+             << params.m_size << "." << endl;
+#endif
+        return false;
+    }
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: updateFieldCustomParameters called with GL errors." << endl;
+#endif
+        return false;
+    }
+
+    // --- store state ---------------------------------------------------------
+    GLuint old_ubo;
+    glGetIntegerv( GL_UNIFORM_BUFFER_BINDING,
+                   reinterpret_cast<GLint*>(&old_ubo) );
+
+    // --- if pipelined, copy-on-write if in use by the HP built last ----------
+    HPMCHistoPyramid::Pipeline& p = h->m_pipeline;
+    if( p.m_enabled && (params.m_buf == p.m_histopyramid.m_parameters_buf) ) {
+        GLuint old_read;
+        GLuint old_write;
+        glGetIntegerv( GL_COPY_READ_BUFFER_BINDING,
+                       reinterpret_cast<GLint*>(&old_read) );
+        glGetIntegerv( GL_COPY_WRITE_BUFFER_BINDING,
+                       reinterpret_cast<GLint*>(&old_write) );
+        if( p.m_parameters_buf == 0 ) {
+            glGenBuffers( 1, &p.m_parameters_buf );
+            glBindBuffer( GL_COPY_WRITE_BUFFER, p.m_parameters_buf );
+            glBufferData( GL_COPY_WRITE_BUFFER, params.m_size, NULL, GL_DYNAMIC_DRAW );
+        }
+        glBindBuffer( GL_COPY_READ_BUFFER, params.m_buf );
+        glBindBuffer( GL_COPY_WRITE_BUFFER, p.m_parameters_buf );
+        glCopyBufferSubData( GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                             0, 0, params.m_size );
+        glBindBuffer( GL_COPY_READ_BUFFER, old_read );
+        glBindBuffer( GL_COPY_WRITE_BUFFER, old_write );
+        std::swap( params.m_buf, p.m_parameters_buf );
+    }
+
+    // --- update --------------------------------------------------------------
+    glBindBuffer( GL_UNIFORM_BUFFER, params.m_buf );
+    glBufferSubData( GL_UNIFORM_BUFFER, offset, size, data );
+    h->m_fetch.m_version++;
+
+    // --- restore state -------------------------------------------------------
+    glBindBuffer( GL_UNIFORM_BUFFER, old_ubo );
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: updateFieldCustomParameters produced GL errors." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+void
+HPMCinvalidateFieldCache( struct HPMCHistoPyramid*  h )
+{
+    if( h == NULL ) {
+#ifdef DEBUG
+        cerr << "HPMC error: invalidateFieldCache called with h == NULL." << endl;
+#endif
+        return;
+    }
+    h->m_fetch.m_version++;
+}
+
 // -----------------------------------------------------------------------------
 GLuint
 HPMCgetBuilderProgram( struct HPMCHistoPyramid*  h )
@@ -218,9 +682,131 @@ HPMCgetBuilderProgram( struct HPMCHistoPyramid*  h )
     if( h->m_tainted ) {
         HPMCsetup( h );
     }
+    // with a field cache, the custom fetch is only used when filling the cache
+    if( h->m_fetch.m_mode == HPMC_VOLUME_LAYOUT_CUSTOM_CACHED ) {
+        return h->m_hp_build.m_cache.m_program;
+    }
+    if( h->m_hp_build.m_compute.m_enabled ) {
+        return h->m_hp_build.m_compute.m_base_program;
+    }
     return h->m_hp_build.m_base.m_program;
 }
 
+// -----------------------------------------------------------------------------
+/** GL state saved over a build, see HPMCstoreBuildState. */
+struct HPMCBuildState
+{
+    GLuint      m_pbo;
+    GLuint      m_prog;
+    GLuint      m_fbo;
+    /** Active unit and the 1D, 2D and 3D bindings of the active unit and the
+      * two build units, only stored on a core profile context.
+      */
+    GLuint      m_active_unit;
+    GLuint      m_units[3];
+    GLuint      m_textures[3][3];
+};
+
+static const GLenum HPMC_build_state_targets[3] = {
+    GL_TEXTURE_1D, GL_TEXTURE_2D, GL_TEXTURE_3D
+};
+static const GLenum HPMC_build_state_bindings[3] = {
+    GL_TEXTURE_BINDING_1D, GL_TEXTURE_BINDING_2D, GL_TEXTURE_BINDING_3D
+};
+
+// -----------------------------------------------------------------------------
+/** Stores the GL state changed by the build functions.
+  *
+  * A core profile context has no attribute stacks, but only the compute build,
+  * which changes the texture bindings and no other state covered by them.
+  */
+static void
+HPMCstoreBuildState( struct HPMCHistoPyramid* h, HPMCBuildState& s )
+{
+    if( h->m_constants->m_core_profile ) {
+        glGetIntegerv( GL_ACTIVE_TEXTURE,
+                       reinterpret_cast<GLint*>(&s.m_active_unit) );
+        s.m_units[0] = s.m_active_unit;
+        s.m_units[1] = GL_TEXTURE0 + h->m_hp_build.m_tex_unit_1;
+        s.m_units[2] = GL_TEXTURE0 + h->m_hp_build.m_tex_unit_2;
+        for( int i=0; i<3; i++ ) {
+            glActiveTexture( s.m_units[i] );
+            for( int k=0; k<3; k++ ) {
+                glGetIntegerv( HPMC_build_state_bindings[k],
+                               reinterpret_cast<GLint*>(&s.m_textures[i][k]) );
+            }
+        }
+        glActiveTexture( s.m_active_unit );
+    }
+    else {
+        glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+        glPushAttrib( GL_VIEWPORT_BIT | GL_TEXTURE_BIT );
+    }
+    glGetIntegerv( GL_PIXEL_PACK_BUFFER_BINDING,
+                   reinterpret_cast<GLint*>(&s.m_pbo) );
+    glGetIntegerv( GL_CURRENT_PROGRAM,
+                   reinterpret_cast<GLint*>(&s.m_prog) );
+    if( h->m_constants->m_target < HPMC_TARGET_GL30_GLSL130 ) {
+        glGetIntegerv( GL_FRAMEBUFFER_BINDING_EXT, reinterpret_cast<GLint*>(&s.m_fbo) );
+    }
+    else {
+        glGetIntegerv( GL_FRAMEBUFFER_BINDING, reinterpret_cast<GLint*>(&s.m_fbo) );
+    }
+}
+
+// -----------------------------------------------------------------------------
+/** Restores the GL state stored by HPMCstoreBuildState. */
+static void
+HPMCrestoreBuildState( struct HPMCHistoPyramid* h, const HPMCBuildState& s )
+{
+    if( h->m_constants->m_target < HPMC_TARGET_GL30_GLSL130 ) {
+        glBindFramebufferEXT( GL_FRAMEBUFFER_EXT, s.m_fbo );
+    }
+    else {
+        glBindFramebuffer( GL_FRAMEBUFFER, s.m_fbo );
+    }
+    glUseProgram( s.m_prog );
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, s.m_pbo );
+    if( h->m_constants->m_core_profile ) {
+        // in reverse, so the bindings of the active unit win if units coincide
+        for( int i=2; i>=0; i-- ) {
+            glActiveTexture( s.m_units[i] );
+            for( int k=0; k<3; k++ ) {
+                glBindTexture( HPMC_build_state_targets[k], s.m_textures[i][k] );
+            }
+        }
+        glActiveTexture( s.m_active_unit );
+    }
+    else {
+        glPopAttrib();
+        glPopClientAttrib();
+    }
+}
+
+// -----------------------------------------------------------------------------
+/** Issues the timestamp query before the build passes, if timed. */
+static void
+HPMCbeginBuildTimer( struct HPMCHistoPyramid* h )
+{
+    if( h->m_timer.m_enabled ) {
+        if( h->m_timer.m_queries[0] == 0 ) {
+            glGenQueries( 2, h->m_timer.m_queries );
+        }
+        glQueryCounter( h->m_timer.m_queries[0], GL_TIMESTAMP );
+    }
+}
+
+// -----------------------------------------------------------------------------
+/** Issues the timestamp query after the build passes, if timed. */
+static void
+HPMCendBuildTimer( struct HPMCHistoPyramid* h )
+{
+    if( h->m_timer.m_enabled ) {
+        glQueryCounter( h->m_timer.m_queries[1], GL_TIMESTAMP );
+        h->m_timer.m_issued = true;
+    }
+}
+
 // -----------------------------------------------------------------------------
 void
 HPMCbuildHistopyramid( struct   HPMCHistoPyramid* h,
@@ -238,46 +824,46 @@ HPMCbuildHistopyramid( struct   HPMCHistoPyramid* h,
     }
 
     // --- store state ---------------------------------------------------------
-    glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
-    glPushAttrib( GL_VIEWPORT_BIT | GL_TEXTURE_BIT );
-    GLuint old_pbo;
-    GLuint old_prog;
-    GLuint old_fbo;
-    glGetIntegerv( GL_PIXEL_PACK_BUFFER_BINDING,
-                   reinterpret_cast<GLint*>(&old_pbo) );
-    glGetIntegerv( GL_CURRENT_PROGRAM,
-                   reinterpret_cast<GLint*>(&old_prog) );
-    if( h->m_constants->m_target < HPMC_TARGET_GL30_GLSL130 ) {
-        glGetIntegerv( GL_FRAMEBUFFER_BINDING_EXT, reinterpret_cast<GLint*>(&old_fbo) );
-    }
-    else {
-        glGetIntegerv( GL_FRAMEBUFFER_BINDING, reinterpret_cast<GLint*>(&old_fbo) );
-    }
+    HPMCBuildState state;
+    HPMCstoreBuildState( h, state );
 
     // --- if HP is reconfigured, setup shaders and fbo's ----------------------
     if( h->m_tainted ) {
         HPMCsetup( h );
     }
 
+    // --- measure the variants now that the fetch is complete -----------------
+    if( !h->m_tainted && h->m_autotune.m_pending ) {
+        HPMCautotuneDeferred( h, threshold );
+    }
+
     // --- if everything is O.K., do construction pass -------------------------
     if(!h->m_tainted ) {
+        HPMCtouchPyramid( h );
         h->m_threshold = threshold;
-        if(! HPMCtriggerHistopyramidBuildPasses( h ) ) {
+        HPMCbeginBuildTimer( h );
+        // a partial budgeted build is abandoned by building its set in full,
+        // while traversal keeps using the set of the last complete build.
+        if( h->m_budget.m_active ) {
+            h->m_budget.m_active = false;
+            HPMCswapPipelineSet( h );
+            if( !HPMCtriggerHistopyramidBuildPasses( h ) ) {
+                h->m_broken = true;
+            }
+            HPMCswapPipelineSet( h );
+        }
+        else if( !HPMCtriggerHistopyramidBuildPasses( h ) ) {
             h->m_broken = true;
         }
+        // traversal uses the HP built by the previous call
+        else if( h->m_pipeline.m_enabled ) {
+            HPMCswapPipelineSet( h );
+        }
+        HPMCendBuildTimer( h );
     }
 
     // --- restore state -------------------------------------------------------
-    if( h->m_constants->m_target < HPMC_TARGET_GL30_GLSL130 ) {
-        glBindFramebufferEXT( GL_FRAMEBUFFER_EXT, old_fbo );
-    }
-    else {
-        glBindFramebuffer( GL_FRAMEBUFFER, old_fbo );
-    }
-    glUseProgram( old_prog );
-    glBindBuffer( GL_PIXEL_PACK_BUFFER, old_pbo );
-    glPopAttrib();
-    glPopClientAttrib();
+    HPMCrestoreBuildState( h, state );
 
     // -------------------------------------------------------------------------
     if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
@@ -289,6 +875,87 @@ HPMCbuildHistopyramid( struct   HPMCHistoPyramid* h,
     }
 }
 
+// -----------------------------------------------------------------------------
+bool
+HPMCbuildHistopyramidBudgeted( struct   HPMCHistoPyramid* h,
+                               GLfloat  threshold,
+                               GLuint   budget,
+                               GLfloat* progress )
+{
+    if( h == NULL || h->m_broken ) {
+        return false;
+    }
+    if( !h->m_pipeline.m_enabled ) {
+#ifdef DEBUG
+        cerr << "HPMC error: buildHistopyramidBudgeted requires pipelined build." << endl;
+#endif
+        return false;
+    }
+    // -------------------------------------------------------------------------
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: buildHistopyramidBudgeted called with errors on state." << endl;
+#endif
+        return false;
+    }
+
+    // --- store state ---------------------------------------------------------
+    HPMCBuildState state;
+    HPMCstoreBuildState( h, state );
+
+    // --- if HP is reconfigured, setup shaders and fbo's ----------------------
+    if( h->m_tainted ) {
+        HPMCsetup( h );
+    }
+
+    // --- measure the variants now that the fetch is complete -----------------
+    if( !h->m_tainted && h->m_autotune.m_pending ) {
+        HPMCautotuneDeferred( h, threshold );
+    }
+
+    // --- if everything is O.K., do a step of the build -----------------------
+    bool done = false;
+    if(!h->m_tainted ) {
+        HPMCtouchPyramid( h );
+        // the threshold is only used when a new build starts
+        if( !h->m_budget.m_active ) {
+            h->m_threshold = threshold;
+        }
+        // build into the set not used by traversal, and when complete, let
+        // traversal use it while the old set becomes the next build target.
+        HPMCbeginBuildTimer( h );
+        HPMCswapPipelineSet( h );
+        if(! HPMCtriggerBudgetedBuildPasses( h, budget ) ) {
+            h->m_broken = true;
+        }
+        HPMCendBuildTimer( h );
+        done = !h->m_budget.m_active;
+        if( !done ) {
+            HPMCswapPipelineSet( h );
+        }
+    }
+
+    // --- restore state -------------------------------------------------------
+    HPMCrestoreBuildState( h, state );
+
+    // -------------------------------------------------------------------------
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: buildHistopyramidBudgeted produced GL errors." << endl;
+#endif
+        h->m_broken = true;
+    }
+    if( h->m_broken || h->m_tainted ) {
+        return false;
+    }
+    if( progress != NULL ) {
+        *progress = done
+                  ? 1.0f
+                  : static_cast<GLfloat>( h->m_budget.m_rows )/h->m_histopyramid.m_size;
+    }
+    return true;
+}
+
 // -----------------------------------------------------------------------------
 GLuint
 HPMCacquireNumberOfVertices( struct HPMCHistoPyramid* h )
@@ -344,3 +1011,124 @@ HPMCacquireNumberOfVertices( struct HPMCHistoPyramid* h )
     return h->m_histopyramid.m_top_count;
 }
 
+// -----------------------------------------------------------------------------
+bool
+HPMCacquireStatistics( struct HPMCHistoPyramid*  h,
+                       GLuint*                   active_cells,
+                       GLuint*                   histogram,
+                       GLfloat*                  bounds )
+{
+    if( h == NULL || h->m_broken || !h->m_statistics.m_enabled ) {
+#ifdef DEBUG
+        cerr << "HPMC error: acquireStatistics called without statistics enabled." << endl;
+#endif
+        return false;
+    }
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: acquireStatistics called with GL errors." << endl;
+#endif
+        return false;
+    }
+
+    // --- read histogram and bounds (forcing a sync) --------------------------
+    std::vector<GLfloat> mem( 4*(256+2), 0.0f );
+    if( !h->m_statistics.m_empty ) {
+        GLuint old_pbo;
+        glGetIntegerv( GL_PIXEL_PACK_BUFFER_BINDING,
+                       reinterpret_cast<GLint*>(&old_pbo) );
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, h->m_statistics.m_pbo );
+        glGetBufferSubData( GL_PIXEL_PACK_BUFFER,
+                            0, sizeof(GLfloat)*mem.size(),
+                            &mem[0] );
+        glBindBuffer( GL_PIXEL_PACK_BUFFER, old_pbo );
+    }
+
+    // the compute shader counts into ints, the gather pass into float pixels
+    GLuint counts[256];
+    GLfloat max_cell[3];
+    GLfloat neg_min_cell[3];
+    if( h->m_statistics.m_compute && !h->m_statistics.m_empty ) {
+        std::vector<GLint> ints( 256+8 );
+        memcpy( &ints[0], &mem[0], sizeof(GLint)*ints.size() );
+        for( int i=0; i<256; i++ ) {
+            counts[i] = static_cast<GLuint>( ints[i] );
+        }
+        for( int i=0; i<3; i++ ) {
+            max_cell[i] = static_cast<GLfloat>( ints[256+i] );
+            neg_min_cell[i] = static_cast<GLfloat>( ints[260+i] );
+        }
+    }
+    else {
+        for( int i=0; i<256; i++ ) {
+            counts[i] = static_cast<GLuint>( mem[4*i] + 0.5f );
+        }
+        for( int i=0; i<3; i++ ) {
+            max_cell[i] = mem[4*256+i];
+            neg_min_cell[i] = mem[4*257+i];
+        }
+    }
+
+    GLuint active = 0;
+    for( int i=0; i<256; i++ ) {
+        if( histogram != NULL ) {
+            histogram[i] = counts[i];
+        }
+        active += counts[i];
+    }
+    if( active_cells != NULL ) {
+        *active_cells = active;
+    }
+
+    // --- convert cell index bounds to grid extent ----------------------------
+    if( bounds != NULL ) {
+        for( int i=0; i<3; i++ ) {
+            GLfloat scale = h->m_field.m_sampled.m_extent[i]/h->m_field.m_sampled.m_cells[i];
+            if( active == 0 ) {
+                bounds[i] = 0.0f;
+                bounds[i+3] = 0.0f;
+            }
+            else {
+                bounds[i] = -neg_min_cell[i]*scale;
+                bounds[i+3] = (max_cell[i]+1.0f)*scale;
+            }
+        }
+    }
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: acquireStatistics produced GL errors." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCacquireBuildTime( struct HPMCHistoPyramid*  h,
+                      GLfloat*                  milliseconds )
+{
+    if( h == NULL || !h->m_timer.m_enabled || !h->m_timer.m_issued ) {
+#ifdef DEBUG
+        cerr << "HPMC error: acquireBuildTime called without a timed build." << endl;
+#endif
+        return false;
+    }
+
+    // --- read timestamps (forcing a sync) ------------------------------------
+    GLuint64 t0, t1;
+    glGetQueryObjectui64v( h->m_timer.m_queries[0], GL_QUERY_RESULT, &t0 );
+    glGetQueryObjectui64v( h->m_timer.m_queries[1], GL_QUERY_RESULT, &t1 );
+    if( milliseconds != NULL ) {
+        *milliseconds = static_cast<GLfloat>( (t1-t0)*1e-6 );
+    }
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: acquireBuildTime produced GL errors." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
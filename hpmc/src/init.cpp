@@ -52,12 +52,42 @@ HPMCsetup( struct HPMCHistoPyramid* h )
     if( !h->m_tainted ) {
         return true;
     }
+    // the textures are recreated, a partial budgeted build is lost.
+    h->m_budget.m_active = false;
+    if( h->m_autotune.m_enabled && !h->m_autotune.m_active ) {
+        if( !HPMCautotune(h) ) {
+            return false;
+        }
+    }
     if( !HPMCdetermineLayout(h) ) {
         return false;
     }
     if( !HPMCsetupTexAndFBOs(h) ) {
         return false;
     }
+    if( h->m_pipeline.m_enabled ) {
+        // the second set has the same layout, but has never been built
+        HPMCHistoPyramid::HistoPyramid& other = h->m_pipeline.m_histopyramid;
+        other.m_size = h->m_histopyramid.m_size;
+        other.m_size_l2 = h->m_histopyramid.m_size_l2;
+        other.m_top_count = 0;
+        other.m_top_count_updated = true;
+        HPMCswapPipelineSet( h );
+        bool ok = HPMCsetupTexAndFBOs(h);
+        HPMCswapPipelineSet( h );
+        if( !ok ) {
+            return false;
+        }
+    }
+    else {
+        HPMCfreePipelineSet( h );
+    }
+    if( !HPMCsetupStatistics(h) ) {
+        return false;
+    }
+    if( !HPMCaccountPyramidResources(h) ) {
+        return false;
+    }
     if( !HPMCfreeHPBuildShaders( h ) ) {
         return false;
     }
@@ -102,13 +132,33 @@ HPMCdetermineLayout( struct HPMCHistoPyramid* h )
         return false;
     }
 
+    // --- determine subsampled lattice and grid -------------------------------
+    HPMCHistoPyramid::Field::Sampled& sampled = h->m_field.m_sampled;
+    for(int i=0; i<3; i++) {
+        GLsizei s = max( (GLsizei)1, min( h->m_field.m_stride, h->m_field.m_cells[i] ) );
+        sampled.m_stride[i] = s;
+        sampled.m_size[i] = (h->m_field.m_size[i]-1)/s + 1;
+        sampled.m_cells[i] = max( (GLsizei)1, h->m_field.m_cells[i]/s );
+        sampled.m_extent[i] = h->m_field.m_extent[i]
+                            * static_cast<GLfloat>( sampled.m_cells[i]*s )
+                            / static_cast<GLfloat>( max( (GLsizei)1, h->m_field.m_cells[i] ) );
+    }
+#ifdef DEBUG
+    if( h->m_field.m_stride > 1 ) {
+        cerr << "HPMC info: m_field.m_sampled.m_cells = ["
+             << sampled.m_cells[0] << "x"
+             << sampled.m_cells[1] << "x"
+             << sampled.m_cells[2] << "]." << endl;
+    }
+#endif
+
     // --- determine tiling ----------------------------------------------------
     h->m_tiling.m_tile_size[0] =
             1u<<(GLsizei)ceilf( log2f(
-                    static_cast<float>(h->m_field.m_cells[0])/2.0f ) );
+                    static_cast<float>(sampled.m_cells[0])/2.0f ) );
     h->m_tiling.m_tile_size[1] =
             1u<<(GLsizei)ceilf( log2f(
-                    static_cast<float>(h->m_field.m_cells[1])/2.0f ) );
+                    static_cast<float>(sampled.m_cells[1])/2.0f ) );
     float aspect =
             static_cast<float>(h->m_tiling.m_tile_size[0]) /
             static_cast<float>(h->m_tiling.m_tile_size[1]);
@@ -116,9 +166,9 @@ HPMCdetermineLayout( struct HPMCHistoPyramid* h )
     h->m_tiling.m_layout[0] =
             1u<<(GLsizei)max( 0.0f,
                               ceilf( log2f( sqrt(
-                                      static_cast<float>(h->m_field.m_cells[2])/aspect ) ) ) );
+                                      static_cast<float>(sampled.m_cells[2])/aspect ) ) ) );
     h->m_tiling.m_layout[1] =
-            (h->m_field.m_cells[2]+h->m_tiling.m_layout[0]-1)/h->m_tiling.m_layout[0];
+            (sampled.m_cells[2]+h->m_tiling.m_layout[0]-1)/h->m_tiling.m_layout[0];
 
     h->m_histopyramid.m_size_l2 =
             (GLsizei)ceilf( log2f(
@@ -142,6 +192,25 @@ HPMCdetermineLayout( struct HPMCHistoPyramid* h )
          << h->m_histopyramid.m_size << "." << endl;
 #endif
 
+    // --- determine HP5 levels, reducing base level texels by five ------------
+    HPMCHistoPyramid::HP5& hp5 = h->m_hp5;
+    hp5.m_count.clear();
+    hp5.m_count.push_back( h->m_histopyramid.m_size*h->m_histopyramid.m_size );
+    do {
+        hp5.m_count.push_back( (hp5.m_count.back()+4)/5 );
+    } while( hp5.m_count.back() > 1 );
+    hp5.m_offset.resize( hp5.m_count.size() );
+    GLsizei offset = 1;
+    for( GLsizei k=(GLsizei)hp5.m_count.size()-1; k>=0; k-- ) {
+        hp5.m_offset[k] = offset;
+        offset += hp5.m_count[k];
+    }
+#ifdef DEBUG
+    if( hp5.m_enabled ) {
+        cerr << "HPMC info: HP5 levels = " << (hp5.m_count.size()-1) << "." << endl;
+    }
+#endif
+
     // --- initialize vertex count to zero -------------------------------------
     h->m_histopyramid.m_top_count = 0;
     h->m_histopyramid.m_top_count_updated = true;
@@ -0,0 +1,247 @@
+/* -*- mode: C++; tab-width:4; c-basic-offset: 4; indent-tabs-mode:nil -*-
+ ***********************************************************************
+ *
+ *  File: kernels.cpp
+ *
+ *  Created: 17. October 2026
+ *
+ *  Version: $Id: $
+ *
+ *  Authors: Christopher Dyken <christopher.dyken@sintef.no>
+ *
+ *  This file is part of the HPMC library.
+ *  Copyright (C) 2009 by SINTEF.  All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  ("GPL") version 2 as published by the Free Software Foundation.
+ *  See the file LICENSE.GPL at the root directory of this source
+ *  distribution for additional information about the GNU GPL.
+ *
+ *  For using HPMC with software that can not be combined with the
+ *  GNU GPL, please contact SINTEF for aquiring a commercial license
+ *  and support.
+ *
+ *  SINTEF, Pb 124 Blindern, N-0314 Oslo, Norway
+ *  http://www.sintef.no
+ *********************************************************************/
+
+#include <cstdlib>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <hpmc.h>
+#include <hpmc_internal.h>
+
+using std::cerr;
+using std::endl;
+using std::min;
+using std::max;
+using std::vector;
+
+// -----------------------------------------------------------------------------
+void
+HPMCsetFieldRadialKernels( struct HPMCHistoPyramid*  h,
+                           GLfloat                   radius )
+{
+    if( h == NULL ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setFieldRadialKernels called with h == NULL." << endl;
+#endif
+        return;
+    }
+    if( !(radius > 0.0f) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setFieldRadialKernels called with non-positive radius." << endl;
+#endif
+        h->m_broken = true;
+        return;
+    }
+    if( h->m_constants->m_target < HPMC_TARGET_GL30_GLSL130 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: radial kernel fields require OpenGL 3.0." << endl;
+#endif
+        h->m_broken = true;
+        return;
+    }
+
+    // Bins are at least as wide as the kernel radius, so a kernel overlaps at
+    // most three bins along each axis.
+    GLsizei bins = max( (GLsizei)1, min( (GLsizei)64, (GLsizei)floorf( 1.0f/radius ) ) );
+
+    h->m_fetch.m_kernels.m_radius = radius;
+    if( (h->m_fetch.m_mode != HPMC_VOLUME_LAYOUT_RADIAL_KERNELS) ||
+        (h->m_fetch.m_kernels.m_bins != bins ) )
+    {
+        h->m_fetch.m_mode = HPMC_VOLUME_LAYOUT_RADIAL_KERNELS;
+        h->m_fetch.m_kernels.m_bins = bins;
+        h->m_field.m_range[0] = 1.0f;
+        h->m_field.m_range[1] = 0.0f;
+        h->m_fetch.m_gradient = true;
+        h->m_fetch.m_parameters.m_binding = -1;
+        h->m_hp_build.m_tex_unit_1 = 0;
+        h->m_hp_build.m_tex_unit_2 = 1;
+    }
+    // the radius is compiled into the fetch code.
+    h->m_tainted = true;
+    h->m_broken = false;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCsetRadialKernelCenters( struct HPMCHistoPyramid*  h,
+                            GLsizei                   count,
+                            const GLfloat*            centers )
+{
+    if( h == NULL || h->m_broken ) {
+        return false;
+    }
+    if( h->m_fetch.m_mode != HPMC_VOLUME_LAYOUT_RADIAL_KERNELS ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setRadialKernelCenters called on a field that is not a sum of radial kernels." << endl;
+#endif
+        return false;
+    }
+    if( count < 0 || (count > 0 && centers == NULL) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setRadialKernelCenters called with illegal centers." << endl;
+#endif
+        return false;
+    }
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setRadialKernelCenters called with GL errors." << endl;
+#endif
+        return false;
+    }
+    HPMCHistoPyramid::Fetch::RadialKernels& k = h->m_fetch.m_kernels;
+    const GLsizei B = k.m_bins;
+    const GLsizei bins = B*B*B;
+    const GLfloat r = k.m_radius;
+
+    // --- determine the range of bins that each kernel overlaps ---------------
+    vector<GLsizei> range( 6*count );
+    vector<GLsizei> bin_count( bins, 0 );
+    for( GLsizei i=0; i<count; i++ ) {
+        const GLfloat* c = centers + 4*i;
+        GLsizei* lo = &range[6*i];
+        GLsizei* hi = &range[6*i+3];
+        for( int j=0; j<3; j++ ) {
+            lo[j] = max( (GLsizei)0, (GLsizei)floorf( (c[j]-r)*B ) );
+            hi[j] = min( B-1,        (GLsizei)floorf( (c[j]+r)*B ) );
+        }
+        // kernels with zero weight or entirely outside the domain are skipped
+        if( c[3] == 0.0f ) {
+            hi[0] = lo[0]-1;
+        }
+        for( GLsizei z=lo[2]; z<=hi[2]; z++ ) {
+            for( GLsizei y=lo[1]; y<=hi[1]; y++ ) {
+                for( GLsizei x=lo[0]; x<=hi[0]; x++ ) {
+                    bin_count[ x + B*(y + B*z) ]++;
+                }
+            }
+        }
+    }
+
+    // --- bin table, offsets are relative to start of texture -----------------
+    GLsizei total = bins;
+    for( GLsizei b=0; b<bins; b++ ) {
+        GLsizei n = bin_count[b];
+        bin_count[b] = total;
+        total += n;
+    }
+    GLsizei rows = (total + HPMC_KERNEL_TEX_WIDTH - 1)/HPMC_KERNEL_TEX_WIDTH;
+    k.m_texels.resize( 4*rows*HPMC_KERNEL_TEX_WIDTH );
+    for( GLsizei b=0; b<bins; b++ ) {
+        GLsizei end = ( b+1 < bins ? bin_count[b+1] : total );
+        k.m_texels[4*b+0] = static_cast<GLfloat>( bin_count[b] );
+        k.m_texels[4*b+1] = static_cast<GLfloat>( end - bin_count[b] );
+        k.m_texels[4*b+2] = 0.0f;
+        k.m_texels[4*b+3] = 0.0f;
+    }
+
+    // --- scatter centers into bins -------------------------------------------
+    for( GLsizei i=0; i<count; i++ ) {
+        const GLfloat* c = centers + 4*i;
+        const GLsizei* lo = &range[6*i];
+        const GLsizei* hi = &range[6*i+3];
+        for( GLsizei z=lo[2]; z<=hi[2]; z++ ) {
+            for( GLsizei y=lo[1]; y<=hi[1]; y++ ) {
+                for( GLsizei x=lo[0]; x<=hi[0]; x++ ) {
+                    GLsizei o = bin_count[ x + B*(y + B*z) ]++;
+                    std::copy( c, c+4, &k.m_texels[4*o] );
+                }
+            }
+        }
+    }
+
+    // --- bound the field, each kernel contributes between zero and weight ----
+    GLfloat field_min = 0.0f;
+    GLfloat field_max = 0.0f;
+    for( GLsizei b=0; b<bins; b++ ) {
+        GLsizei o = static_cast<GLsizei>( k.m_texels[4*b+0] );
+        GLsizei n = static_cast<GLsizei>( k.m_texels[4*b+1] );
+        GLfloat lo = 0.0f;
+        GLfloat hi = 0.0f;
+        for( GLsizei i=o; i<o+n; i++ ) {
+            GLfloat w = k.m_texels[4*i+3];
+            lo += min( 0.0f, w );
+            hi += max( 0.0f, w );
+        }
+        field_min = min( field_min, lo );
+        field_max = max( field_max, hi );
+    }
+    h->m_field.m_range[0] = field_min;
+    h->m_field.m_range[1] = field_max;
+
+    // --- upload --------------------------------------------------------------
+    GLuint old_pbo;
+    GLuint old_tex;
+    glGetIntegerv( GL_PIXEL_UNPACK_BUFFER_BINDING,
+                   reinterpret_cast<GLint*>(&old_pbo) );
+    glGetIntegerv( GL_TEXTURE_BINDING_2D,
+                   reinterpret_cast<GLint*>(&old_tex) );
+    glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+
+    // if pipelined, the texture may still be needed by the traversal of the
+    // HP built last, so upload into the spare texture instead.
+    HPMCHistoPyramid::Pipeline& p = h->m_pipeline;
+    if( p.m_enabled && (k.m_tex != 0) && (k.m_tex == p.m_histopyramid.m_kernels_tex) ) {
+        std::swap( k.m_tex, p.m_kernels_tex );
+        std::swap( k.m_rows, p.m_kernels_rows );
+    }
+    if( k.m_tex == 0 ) {
+        glGenTextures( 1, &k.m_tex );
+        k.m_rows = 0;
+    }
+    glBindTexture( GL_TEXTURE_2D, k.m_tex );
+    if( k.m_rows < rows ) {
+        // grow geometrically to avoid reallocation every frame
+        k.m_rows = 1;
+        while( k.m_rows < rows ) {
+            k.m_rows *= 2;
+        }
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0 );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0 );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+        glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+        glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA32F,
+                      HPMC_KERNEL_TEX_WIDTH, k.m_rows, 0,
+                      GL_RGBA, GL_FLOAT, NULL );
+    }
+    glTexSubImage2D( GL_TEXTURE_2D, 0,
+                     0, 0, HPMC_KERNEL_TEX_WIDTH, rows,
+                     GL_RGBA, GL_FLOAT, &k.m_texels[0] );
+
+    glBindBuffer( GL_PIXEL_UNPACK_BUFFER, old_pbo );
+    glBindTexture( GL_TEXTURE_2D, old_tex );
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setRadialKernelCenters produced GL errors." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,370 @@
+/* -*- mode: C++; tab-width:4; c-basic-offset: 4; indent-tabs-mode:nil -*-
+ ***********************************************************************
+ *
+ *  File: pool.cpp
+ *
+ *  Created: 17. October 2026
+ *
+ *  Version: $Id: $
+ *
+ *  Authors: Christopher Dyken <christopher.dyken@sintef.no>
+ *
+ *  This file is part of the HPMC library.
+ *  Copyright (C) 2009 by SINTEF.  All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  ("GPL") version 2 as published by the Free Software Foundation.
+ *  See the file LICENSE.GPL at the root directory of this source
+ *  distribution for additional information about the GNU GPL.
+ *
+ *  For using HPMC with software that can not be combined with the
+ *  GNU GPL, please contact SINTEF for aquiring a commercial license
+ *  and support.
+ *
+ *  SINTEF, Pb 124 Blindern, N-0314 Oslo, Norway
+ *  http://www.sintef.no
+ *********************************************************************/
+
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <hpmc.h>
+#include <hpmc_internal.h>
+
+using std::cerr;
+using std::endl;
+
+// -----------------------------------------------------------------------------
+GLsizeiptr
+HPMCpyramidStorageBytes( GLsizei size_l2 )
+{
+    // RGBA32F texels of all levels, 4^l2 + 4^(l2-1) + ... + 1
+    GLsizeiptr texels = ( (GLsizeiptr(1)<<(2*size_l2+2)) - 1 )/3;
+    return 4*sizeof(GLfloat)*texels;
+}
+
+// -----------------------------------------------------------------------------
+/** Bytes of the currently allocated resources of h other than the HP textures. */
+static GLsizeiptr
+HPMCpyramidResourceBytes( struct HPMCHistoPyramid* h )
+{
+    const HPMCHistoPyramid::HistoPyramid* sets[2] = { &h->m_histopyramid,
+                                                      &h->m_pipeline.m_histopyramid };
+    GLsizeiptr bytes = h->m_fetch.m_cache.m_bytes + h->m_pipeline.m_cache.m_bytes;
+    for( int i=0; i<2; i++ ) {
+        if( sets[i]->m_top_pbo != 0 ) {
+            bytes += 4*sizeof(GLfloat);
+        }
+        bytes += sets[i]->m_hp5_bytes;
+    }
+    // RGBA32F textures and readback PBO of 256+2 columns
+    const HPMCHistoPyramid::Statistics& stats = h->m_statistics;
+    const GLsizeiptr row = 4*sizeof(GLfloat)*(256+2);
+    if( stats.m_tex != 0 ) {
+        bytes += row*HPMC_STATISTICS_ROWS;
+    }
+    if( stats.m_sum_tex != 0 ) {
+        bytes += row;
+    }
+    if( stats.m_pbo != 0 ) {
+        bytes += row;
+    }
+    return bytes;
+}
+
+// -----------------------------------------------------------------------------
+/** Updates the pool byte count with the current resources of h. */
+static void
+HPMCupdatePyramidResources( struct HPMCHistoPyramid* h )
+{
+    GLsizeiptr bytes = HPMCpyramidResourceBytes( h );
+    h->m_constants->m_pool.m_bytes += bytes - h->m_pool_bytes;
+    h->m_pool_bytes = bytes;
+}
+
+// -----------------------------------------------------------------------------
+/** Deletes the texture and FBOs of storage and removes it from the byte count. */
+static void
+HPMCdeletePyramidStorage( struct HPMCConstants* c,
+                          HPMCConstants::PyramidPool::Storage& storage )
+{
+    if( !storage.m_fbos.empty() ) {
+        if( c->m_target < HPMC_TARGET_GL30_GLSL130 ) {
+            glDeleteFramebuffersEXT( storage.m_fbos.size(), storage.m_fbos.data() );
+        }
+        else {
+            glDeleteFramebuffers( storage.m_fbos.size(), storage.m_fbos.data() );
+        }
+        storage.m_fbos.clear();
+    }
+    if( storage.m_tex != 0 ) {
+        glDeleteTextures( 1, &storage.m_tex );
+        storage.m_tex = 0;
+    }
+    c->m_pool.m_bytes -= HPMCpyramidStorageBytes( storage.m_size_l2 );
+}
+
+// -----------------------------------------------------------------------------
+/** Deletes idle storage until the pool holds at most the given bytes. */
+static void
+HPMCtrimIdleStorage( struct HPMCConstants* c, GLsizeiptr bytes )
+{
+    HPMCConstants::PyramidPool& pool = c->m_pool;
+    GLsizei n = 0;
+    while( (n < (GLsizei)pool.m_idle.size()) && (pool.m_bytes > bytes) ) {
+        HPMCdeletePyramidStorage( c, pool.m_idle[n] );
+        n++;
+    }
+    pool.m_idle.erase( pool.m_idle.begin(), pool.m_idle.begin() + n );
+}
+
+// -----------------------------------------------------------------------------
+/** Releases the storage of both HistoPyramid sets of h, and deletes their top
+  * PBOs, HP5 buffers and field caches.
+  *
+  * The HistoPyramid is tainted, such that the next build sets it up again,
+  * and is empty until then. The statistics are kept, they are part of the
+  * results of the last build.
+  */
+static void
+HPMCevictPyramid( struct HPMCHistoPyramid* h )
+{
+    HPMCfreePyramidSet( h->m_constants, h->m_histopyramid, h->m_fetch.m_cache );
+    HPMCfreePyramidSet( h->m_constants, h->m_pipeline.m_histopyramid, h->m_pipeline.m_cache );
+    HPMCHistoPyramid::HistoPyramid* sets[2] = { &h->m_histopyramid,
+                                                &h->m_pipeline.m_histopyramid };
+    for( int i=0; i<2; i++ ) {
+        sets[i]->m_top_count = 0;
+        sets[i]->m_top_count_updated = true;
+    }
+    HPMCupdatePyramidResources( h );
+    h->m_tainted = true;
+    h->m_constants->m_pool.m_evictions++;
+#ifdef DEBUG
+    cerr << "HPMC info: evicted HistoPyramid from pyramid pool." << endl;
+#endif
+}
+
+// -----------------------------------------------------------------------------
+/** Evicts the least recently used HistoPyramids other than keep, and frees
+  * idle storage, until the pool holds at most the given bytes.
+  */
+static bool
+HPMCfitPyramidPool( struct HPMCConstants* c,
+                    struct HPMCHistoPyramid* keep,
+                    GLsizeiptr bytes )
+{
+    HPMCConstants::PyramidPool& pool = c->m_pool;
+    HPMCtrimIdleStorage( c, bytes );
+    while( pool.m_bytes > bytes ) {
+        struct HPMCHistoPyramid* lru = NULL;
+        for( size_t i=0; i<pool.m_pyramids.size(); i++ ) {
+            struct HPMCHistoPyramid* h = pool.m_pyramids[i];
+            // a partial budgeted build or a HistoPyramid being autotuned
+            // must not lose its texture
+            if( (h == keep) ||
+                (h->m_budget.m_active) ||
+                (h->m_autotune.m_active) ||
+                (h->m_histopyramid.m_tex == 0 && h->m_pipeline.m_histopyramid.m_tex == 0) )
+            {
+                continue;
+            }
+            if( (lru == NULL) || (pool.m_clock - h->m_last_use > pool.m_clock - lru->m_last_use) ) {
+                lru = h;
+            }
+        }
+        if( lru == NULL ) {
+            return false;
+        }
+        HPMCevictPyramid( lru );
+        HPMCtrimIdleStorage( c, bytes );
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCreusePyramidStorage( struct HPMCHistoPyramid* h,
+                         HPMCHistoPyramid::HistoPyramid& hp )
+{
+    HPMCConstants::PyramidPool& pool = h->m_constants->m_pool;
+    // the most recently released storage of the size class
+    for( size_t i=pool.m_idle.size(); i>0; i-- ) {
+        HPMCConstants::PyramidPool::Storage& storage = pool.m_idle[i-1];
+        if( storage.m_size_l2 == hp.m_size_l2 ) {
+            hp.m_tex = storage.m_tex;
+            hp.m_fbos.swap( storage.m_fbos );
+            pool.m_idle.erase( pool.m_idle.begin() + (i-1) );
+            return true;
+        }
+    }
+    return false;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCreservePyramidStorage( struct HPMCHistoPyramid* h,
+                           GLsizeiptr bytes )
+{
+    HPMCConstants::PyramidPool& pool = h->m_constants->m_pool;
+    if( pool.m_budget > 0 ) {
+        if( (bytes > pool.m_budget) ||
+            !HPMCfitPyramidPool( h->m_constants, h, pool.m_budget - bytes ) )
+        {
+#ifdef DEBUG
+            cerr << "HPMC error: HistoPyramid of " << bytes
+                 << " bytes does not fit in pyramid pool budget of "
+                 << pool.m_budget << " bytes." << endl;
+#endif
+            return false;
+        }
+    }
+    pool.m_bytes += bytes;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+void
+HPMCreleasePyramidStorage( struct HPMCConstants* c,
+                           HPMCHistoPyramid::HistoPyramid& hp )
+{
+    if( hp.m_tex == 0 ) {
+        return;
+    }
+    HPMCConstants::PyramidPool::Storage storage;
+    // the texture has one FBO per level
+    storage.m_size_l2 = (GLsizei)hp.m_fbos.size()-1;
+    storage.m_tex = hp.m_tex;
+    storage.m_fbos.swap( hp.m_fbos );
+    c->m_pool.m_idle.push_back( storage );
+    hp.m_tex = 0;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCaccountPyramidResources( struct HPMCHistoPyramid* h )
+{
+    HPMCConstants::PyramidPool& pool = h->m_constants->m_pool;
+    GLsizeiptr grown = HPMCpyramidResourceBytes( h ) - h->m_pool_bytes;
+    HPMCupdatePyramidResources( h );
+    if( (grown > 0) && (pool.m_budget > 0) && (pool.m_bytes > pool.m_budget) &&
+        !HPMCfitPyramidPool( h->m_constants, h, pool.m_budget ) )
+    {
+#ifdef DEBUG
+        cerr << "HPMC error: HistoPyramid resources of " << h->m_pool_bytes
+             << " bytes do not fit in pyramid pool budget of "
+             << pool.m_budget << " bytes." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCaccountCompactionStorage( struct HPMCCompaction* c,
+                              GLsizeiptr bytes )
+{
+    HPMCConstants::PyramidPool& pool = c->m_constants->m_pool;
+    if( (bytes > c->m_pool_bytes) && (pool.m_budget > 0) ) {
+        GLsizeiptr grown = bytes - c->m_pool_bytes;
+        if( (grown > pool.m_budget) ||
+            !HPMCfitPyramidPool( c->m_constants, NULL, pool.m_budget - grown ) )
+        {
+#ifdef DEBUG
+            cerr << "HPMC error: compaction of " << bytes
+                 << " bytes does not fit in pyramid pool budget of "
+                 << pool.m_budget << " bytes." << endl;
+#endif
+            return false;
+        }
+    }
+    pool.m_bytes += bytes - c->m_pool_bytes;
+    c->m_pool_bytes = bytes;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+void
+HPMCtouchPyramid( struct HPMCHistoPyramid* h )
+{
+    h->m_last_use = ++h->m_constants->m_pool.m_clock;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCsetPyramidPoolBudget( struct HPMCConstants*  c,
+                          GLsizeiptr             bytes )
+{
+    if( c == NULL || bytes < 0 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setPyramidPoolBudget called with invalid arguments." << endl;
+#endif
+        return false;
+    }
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setPyramidPoolBudget called with GL errors." << endl;
+#endif
+        return false;
+    }
+    c->m_pool.m_budget = bytes;
+    bool fits = true;
+    if( bytes > 0 ) {
+        fits = HPMCfitPyramidPool( c, NULL, bytes );
+#ifdef DEBUG
+        if( !fits ) {
+            cerr << "HPMC error: pyramid pool exceeds new budget." << endl;
+        }
+#endif
+    }
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setPyramidPoolBudget produced GL errors." << endl;
+#endif
+        return false;
+    }
+    return fits;
+}
+
+// -----------------------------------------------------------------------------
+void
+HPMCgetPyramidPoolUsage( struct HPMCConstants*  c,
+                         GLsizeiptr*            bytes,
+                         GLsizeiptr*            idle_bytes,
+                         GLsizei*               evictions )
+{
+    if( c == NULL ) {
+#ifdef DEBUG
+        cerr << "HPMC error: getPyramidPoolUsage called with c == NULL." << endl;
+#endif
+        return;
+    }
+    const HPMCConstants::PyramidPool& pool = c->m_pool;
+    if( bytes != NULL ) {
+        *bytes = pool.m_bytes;
+    }
+    if( idle_bytes != NULL ) {
+        *idle_bytes = 0;
+        for( size_t i=0; i<pool.m_idle.size(); i++ ) {
+            *idle_bytes += HPMCpyramidStorageBytes( pool.m_idle[i].m_size_l2 );
+        }
+    }
+    if( evictions != NULL ) {
+        *evictions = pool.m_evictions;
+    }
+}
+
+// -----------------------------------------------------------------------------
+void
+HPMCtrimPyramidPool( struct HPMCConstants* c )
+{
+    if( c == NULL ) {
+#ifdef DEBUG
+        cerr << "HPMC error: trimPyramidPool called with c == NULL." << endl;
+#endif
+        return;
+    }
+    HPMCtrimIdleStorage( c, 0 );
+}
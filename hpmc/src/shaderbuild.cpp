@@ -81,6 +81,76 @@ HPMCfreeHPBuildShaders( struct HPMCHistoPyramid* h )
         glDeleteShader( h->m_hp_build.m_upper.m_fragment_shader );
         h->m_hp_build.m_upper.m_fragment_shader = 0;
     }
+    // --- statistics pass -----------------------------------------------------
+    if( h->m_hp_build.m_statistics.m_program != 0 ) {
+        glDeleteProgram( h->m_hp_build.m_statistics.m_program );
+        h->m_hp_build.m_statistics.m_program = 0;
+    }
+    if( h->m_hp_build.m_statistics.m_vertex_shader != 0 ) {
+        glDeleteShader( h->m_hp_build.m_statistics.m_vertex_shader );
+        h->m_hp_build.m_statistics.m_vertex_shader = 0;
+    }
+    if( h->m_hp_build.m_statistics.m_fragment_shader != 0 ) {
+        glDeleteShader( h->m_hp_build.m_statistics.m_fragment_shader );
+        h->m_hp_build.m_statistics.m_fragment_shader = 0;
+    }
+    if( h->m_hp_build.m_statistics.m_gather_program != 0 ) {
+        glDeleteProgram( h->m_hp_build.m_statistics.m_gather_program );
+        h->m_hp_build.m_statistics.m_gather_program = 0;
+    }
+    if( h->m_hp_build.m_statistics.m_gather_shader != 0 ) {
+        glDeleteShader( h->m_hp_build.m_statistics.m_gather_shader );
+        h->m_hp_build.m_statistics.m_gather_shader = 0;
+    }
+    if( h->m_hp_build.m_statistics.m_compute_program != 0 ) {
+        glDeleteProgram( h->m_hp_build.m_statistics.m_compute_program );
+        h->m_hp_build.m_statistics.m_compute_program = 0;
+    }
+    if( h->m_hp_build.m_statistics.m_compute_shader != 0 ) {
+        glDeleteShader( h->m_hp_build.m_statistics.m_compute_shader );
+        h->m_hp_build.m_statistics.m_compute_shader = 0;
+    }
+    // --- compute shader build ------------------------------------------------
+    HPMCHistoPyramid::HistoPyramidBuild::ComputeBuild& compute = h->m_hp_build.m_compute;
+    if( compute.m_base_program != 0 ) {
+        glDeleteProgram( compute.m_base_program );
+        compute.m_base_program = 0;
+    }
+    if( compute.m_base_shader != 0 ) {
+        glDeleteShader( compute.m_base_shader );
+        compute.m_base_shader = 0;
+    }
+    if( compute.m_reduction_program != 0 ) {
+        glDeleteProgram( compute.m_reduction_program );
+        compute.m_reduction_program = 0;
+    }
+    if( compute.m_reduction_shader != 0 ) {
+        glDeleteShader( compute.m_reduction_shader );
+        compute.m_reduction_shader = 0;
+    }
+    // --- HP5 reduction -------------------------------------------------------
+    HPMCHistoPyramid::HistoPyramidBuild::HP5Reduction& hp5 = h->m_hp_build.m_hp5;
+    if( hp5.m_program != 0 ) {
+        glDeleteProgram( hp5.m_program );
+        hp5.m_program = 0;
+    }
+    if( hp5.m_shader != 0 ) {
+        glDeleteShader( hp5.m_shader );
+        hp5.m_shader = 0;
+    }
+    // --- field cache evaluation ----------------------------------------------
+    if( h->m_hp_build.m_cache.m_program != 0 ) {
+        glDeleteProgram( h->m_hp_build.m_cache.m_program );
+        h->m_hp_build.m_cache.m_program = 0;
+    }
+    if( h->m_hp_build.m_cache.m_fragment_shader != 0 ) {
+        glDeleteShader( h->m_hp_build.m_cache.m_fragment_shader );
+        h->m_hp_build.m_cache.m_fragment_shader = 0;
+    }
+    if( h->m_hp_build.m_cache.m_compute_shader != 0 ) {
+        glDeleteShader( h->m_hp_build.m_cache.m_compute_shader );
+        h->m_hp_build.m_cache.m_compute_shader = 0;
+    }
     // --- common gpgpu vertex shader ------------------------------------------
     if( h->m_hp_build.m_gpgpu_vertex_shader != 0 ) {
         glDeleteShader( h->m_hp_build.m_gpgpu_vertex_shader );
@@ -98,34 +168,13 @@ HPMCfreeHPBuildShaders( struct HPMCHistoPyramid* h )
 
 // -----------------------------------------------------------------------------
 bool
-HPMCbuildHPBuildShaders( struct HPMCHistoPyramid* h )
+HPMCbuildFragmentBuildShaders( struct HPMCHistoPyramid* h )
 {
-    if( h == NULL ) {
-        return false;
-    }
     HPMCHistoPyramid::HistoPyramidBuild& hpb = h->m_hp_build;
     HPMCHistoPyramid::HistoPyramidBuild::BaseConstruction& base = hpb.m_base;
     HPMCHistoPyramid::HistoPyramidBuild::FirstReduction& first = hpb.m_first;
     HPMCHistoPyramid::HistoPyramidBuild::UpperReduction& upper = hpb.m_upper;
 
-    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
-#ifdef DEBUG
-        cerr << "HPMC warning: buildHPBuildShaders called with GL errors." << endl;
-#endif
-        return false;
-    }
-
-    // --- build base level construction shader --------------------------------
-    hpb.m_gpgpu_vertex_shader = HPMCcompileShader( HPMCgenerateDefines( h ) +
-                                                   HPMCgenerateGPGPUVertexPassThroughShader( h ),
-                                                   GL_VERTEX_SHADER );
-    if( hpb.m_gpgpu_vertex_shader == 0 ) {
-#ifdef DEBUG
-        cerr << "HPMC error: Failed to build base level gpgpu vertex shader." << endl;
-#endif
-        return false;
-    }
-
     // --- build base level construction shader --------------------------------
     base.m_fragment_shader = HPMCcompileShader( HPMCgenerateDefines( h ) +
                                                 HPMCgenerateScalarFieldFetch( h ) +
@@ -156,15 +205,17 @@ HPMCbuildHPBuildShaders( struct HPMCHistoPyramid* h )
     else {
         base.m_loc_threshold = HPMCgetUniformLocation( base.m_program, "HPMC_threshold" );
     }
-    GLint loc_vertex_count = HPMCgetUniformLocation( base.m_program, "HPMC_vertex_count" );
-    if( loc_vertex_count != -1 ) {
-        glUniform1i( loc_vertex_count, hpb.m_tex_unit_1 );
-    }
-    else {
+    if( !h->m_constant_tables ) {
+        GLint loc_vertex_count = HPMCgetUniformLocation( base.m_program, "HPMC_vertex_count" );
+        if( loc_vertex_count != -1 ) {
+            glUniform1i( loc_vertex_count, hpb.m_tex_unit_1 );
+        }
+        else {
 #ifdef DEBUG
-        cerr << "HPMC error: Failed to locate vertex count texture uniform in base level construction program." << endl;
+            cerr << "HPMC error: Failed to locate vertex count texture uniform in base level construction program." << endl;
 #endif
-        return false;
+            return false;
+        }
     }
 
     if( h->m_fetch.m_mode != HPMC_VOLUME_LAYOUT_CUSTOM ) {
@@ -264,3 +315,462 @@ HPMCbuildHPBuildShaders( struct HPMCHistoPyramid* h )
     }
     return true;
 }
+
+// -----------------------------------------------------------------------------
+bool
+HPMCbuildHPBuildShaders( struct HPMCHistoPyramid* h )
+{
+    if( h == NULL ) {
+        return false;
+    }
+    HPMCHistoPyramid::HistoPyramidBuild& hpb = h->m_hp_build;
+    HPMCHistoPyramid::HistoPyramidBuild::BaseConstruction& base = hpb.m_base;
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC warning: buildHPBuildShaders called with GL errors." << endl;
+#endif
+        return false;
+    }
+
+    // --- build common gpgpu vertex shader, the compute build has none --------
+    if( !hpb.m_compute.m_enabled ) {
+        hpb.m_gpgpu_vertex_shader = HPMCcompileShader( HPMCgenerateDefines( h ) +
+                                                       HPMCgenerateGPGPUVertexPassThroughShader(),
+                                                       GL_VERTEX_SHADER );
+        if( hpb.m_gpgpu_vertex_shader == 0 ) {
+#ifdef DEBUG
+            cerr << "HPMC error: Failed to build base level gpgpu vertex shader." << endl;
+#endif
+            return false;
+        }
+    }
+
+    // --- build field cache evaluation program --------------------------------
+    if( h->m_fetch.m_mode == HPMC_VOLUME_LAYOUT_CUSTOM_CACHED ) {
+        HPMCHistoPyramid::HistoPyramidBuild::FieldCacheEvaluation& cache = hpb.m_cache;
+
+        if( hpb.m_compute.m_enabled ) {
+            cache.m_compute_shader = HPMCcompileShader( HPMCgenerateComputeVersion( h->m_constants ) +
+                                                        HPMCgenerateDefines( h ) +
+                                                        h->m_fetch.m_shader_source + "\n" +
+                                                        HPMCgenerateFieldCacheComputeShader( h ),
+                                                        GL_COMPUTE_SHADER );
+            if( cache.m_compute_shader == 0 ) {
+#ifdef DEBUG
+                cerr << "HPMC error: Failed to build field cache compute shader." << endl;
+#endif
+                return false;
+            }
+            cache.m_program = glCreateProgram();
+            glAttachShader( cache.m_program, cache.m_compute_shader );
+            if(! HPMClinkProgram( cache.m_program ) ) {
+#ifdef DEBUG
+                cerr << "HPMC error: Failed to link field cache compute program." << endl;
+#endif
+                return false;
+            }
+            glUseProgram( cache.m_program );
+            GLint loc_cache = HPMCgetUniformLocation( cache.m_program, "HPMC_cache" );
+            if( loc_cache == -1 ) {
+#ifdef DEBUG
+                cerr << "HPMC error: Failed to locate image uniform in field cache compute program." << endl;
+#endif
+                return false;
+            }
+            glUniform1i( loc_cache, 0 );
+        }
+        else {
+            cache.m_fragment_shader = HPMCcompileShader( HPMCgenerateDefines( h ) +
+                                                         h->m_fetch.m_shader_source + "\n" +
+                                                         HPMCgenerateFieldCacheShader( h ),
+                                                         GL_FRAGMENT_SHADER );
+            if( cache.m_fragment_shader == 0 ) {
+#ifdef DEBUG
+                cerr << "HPMC error: Failed to build field cache fragment shader." << endl;
+#endif
+                return false;
+            }
+            cache.m_program = glCreateProgram();
+            glAttachShader( cache.m_program, hpb.m_gpgpu_vertex_shader );
+            glAttachShader( cache.m_program, cache.m_fragment_shader );
+            if(! HPMClinkProgram( cache.m_program ) ) {
+#ifdef DEBUG
+                cerr << "HPMC error: Failed to link field cache program." << endl;
+#endif
+                return false;
+            }
+        }
+        cache.m_loc_slice = HPMCgetUniformLocation( cache.m_program, "HPMC_cache_slice" );
+        if( cache.m_loc_slice == -1 ) {
+#ifdef DEBUG
+            cerr << "HPMC error: Failed to locate slice uniform in field cache program." << endl;
+#endif
+            return false;
+        }
+    }
+
+    // --- build base level construction and reduction programs ----------------
+    if( hpb.m_compute.m_enabled ) {
+        if( !HPMCbuildComputeBuildShaders( h ) ) {
+            return false;
+        }
+    }
+    else if( !HPMCbuildFragmentBuildShaders( h ) ) {
+        return false;
+    }
+
+    // --- associate custom fetch parameter block with binding point -----------
+    HPMCHistoPyramid::Fetch::Parameters& params = h->m_fetch.m_parameters;
+    if( params.m_binding >= 0 ) {
+        // the custom fetch is only part of the cache program if cached
+        GLuint prog = hpb.m_compute.m_enabled ? hpb.m_compute.m_base_program
+                                              : base.m_program;
+        if( h->m_fetch.m_mode == HPMC_VOLUME_LAYOUT_CUSTOM_CACHED ) {
+            prog = hpb.m_cache.m_program;
+        }
+        GLuint block = glGetUniformBlockIndex( prog, "HPMC_FetchParameters" );
+        if( block == GL_INVALID_INDEX ) {
+#ifdef DEBUG
+            cerr << "HPMC error: Failed to locate uniform block HPMC_FetchParameters in custom fetch." << endl;
+#endif
+            return false;
+        }
+        glUniformBlockBinding( prog, block, params.m_binding );
+
+        GLint size;
+        glGetActiveUniformBlockiv( prog, block, GL_UNIFORM_BLOCK_DATA_SIZE, &size );
+        if( params.m_buf == 0 ) {
+            glGenBuffers( 1, &params.m_buf );
+            params.m_size = 0;
+        }
+        if( params.m_size != size ) {
+            GLuint old_ubo;
+            glGetIntegerv( GL_UNIFORM_BUFFER_BINDING,
+                           reinterpret_cast<GLint*>(&old_ubo) );
+            glBindBuffer( GL_UNIFORM_BUFFER, params.m_buf );
+            glBufferData( GL_UNIFORM_BUFFER, size, NULL, GL_DYNAMIC_DRAW );
+            glBindBuffer( GL_UNIFORM_BUFFER, old_ubo );
+            params.m_size = size;
+            // the spare buffer of the pipeline is reallocated on demand
+            if( h->m_pipeline.m_parameters_buf != 0 ) {
+                glDeleteBuffers( 1, &h->m_pipeline.m_parameters_buf );
+                h->m_pipeline.m_parameters_buf = 0;
+            }
+        }
+        if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+            cerr << "HPMC error: GL errors while setting up custom fetch parameter block." << endl;
+#endif
+            return false;
+        }
+    }
+
+    // --- build HP5 reduction program -----------------------------------------
+    if( h->m_hp5.m_enabled ) {
+        if( !HPMCbuildHP5BuildShaders( h ) ) {
+            return false;
+        }
+    }
+
+    // --- build statistics compute program ------------------------------------
+    if( h->m_statistics.m_enabled && h->m_statistics.m_compute ) {
+        HPMCHistoPyramid::HistoPyramidBuild::StatisticsPass& stats = hpb.m_statistics;
+
+        stats.m_compute_shader = HPMCcompileShader( HPMCgenerateComputeVersion( h->m_constants ) +
+                                                    HPMCgenerateDefines( h ) +
+                                                    HPMCgenerateStatisticsComputeShader( h ),
+                                                    GL_COMPUTE_SHADER );
+        if( stats.m_compute_shader == 0 ) {
+#ifdef DEBUG
+            cerr << "HPMC error: Failed to build statistics compute shader." << endl;
+#endif
+            return false;
+        }
+        stats.m_compute_program = glCreateProgram();
+        glAttachShader( stats.m_compute_program, stats.m_compute_shader );
+        if(! HPMClinkProgram( stats.m_compute_program ) ) {
+#ifdef DEBUG
+            cerr << "HPMC error: Failed to link statistics compute program." << endl;
+#endif
+            return false;
+        }
+        glUseProgram( stats.m_compute_program );
+        GLint st_hp_loc = HPMCgetUniformLocation( stats.m_compute_program, "HPMC_histopyramid" );
+        if( st_hp_loc == -1 ) {
+#ifdef DEBUG
+            cerr << "HPMC error: Can't find uniforms in statistics compute program." << endl;
+#endif
+            return false;
+        }
+        glUniform1i( st_hp_loc, hpb.m_tex_unit_1 );
+
+        if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+            cerr << "HPMC error: GL errors configuring statistics compute program." << endl;
+#endif
+            return false;
+        }
+    }
+
+    // --- build statistics scatter and gather programs ------------------------
+    else if( h->m_statistics.m_enabled ) {
+        HPMCHistoPyramid::HistoPyramidBuild::StatisticsPass& stats = hpb.m_statistics;
+
+        stats.m_vertex_shader = HPMCcompileShader( HPMCgenerateDefines( h ) +
+                                                   HPMCgenerateStatisticsVertexShader( h ),
+                                                   GL_VERTEX_SHADER );
+        stats.m_fragment_shader = HPMCcompileShader( HPMCgenerateStatisticsFragmentShader(),
+                                                     GL_FRAGMENT_SHADER );
+        stats.m_gather_shader = HPMCcompileShader( HPMCgenerateStatisticsGatherShader(),
+                                                   GL_FRAGMENT_SHADER );
+        if( (stats.m_vertex_shader == 0) || (stats.m_fragment_shader == 0) || (stats.m_gather_shader == 0) ) {
+#ifdef DEBUG
+            cerr << "HPMC error: Failed to build statistics shaders." << endl;
+#endif
+            return false;
+        }
+        stats.m_program = glCreateProgram();
+        glAttachShader( stats.m_program, stats.m_vertex_shader );
+        glAttachShader( stats.m_program, stats.m_fragment_shader );
+        if(! HPMClinkProgram( stats.m_program ) ) {
+#ifdef DEBUG
+            cerr << "HPMC error: Failed to link statistics program." << endl;
+#endif
+            return false;
+        }
+        glUseProgram( stats.m_program );
+        stats.m_loc_bounds = HPMCgetUniformLocation( stats.m_program, "HPMC_bounds" );
+        GLint st_hp_loc = HPMCgetUniformLocation( stats.m_program, "HPMC_histopyramid" );
+        if( (stats.m_loc_bounds == -1) || (st_hp_loc == -1) ) {
+#ifdef DEBUG
+            cerr << "HPMC error: Can't find uniforms in statistics program." << endl;
+#endif
+            return false;
+        }
+        glUniform1i( st_hp_loc, hpb.m_tex_unit_1 );
+
+        stats.m_gather_program = glCreateProgram();
+        glAttachShader( stats.m_gather_program, hpb.m_gpgpu_vertex_shader );
+        glAttachShader( stats.m_gather_program, stats.m_gather_shader );
+        if(! HPMClinkProgram( stats.m_gather_program ) ) {
+#ifdef DEBUG
+            cerr << "HPMC error: Failed to link statistics gather program." << endl;
+#endif
+            return false;
+        }
+        glUseProgram( stats.m_gather_program );
+        GLint st_stats_loc = HPMCgetUniformLocation( stats.m_gather_program, "HPMC_statistics" );
+        if( st_stats_loc == -1 ) {
+#ifdef DEBUG
+            cerr << "HPMC error: Can't find uniforms in statistics gather program." << endl;
+#endif
+            return false;
+        }
+        glUniform1i( st_stats_loc, hpb.m_tex_unit_1 );
+
+        if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+            cerr << "HPMC error: GL errors configuring statistics program." << endl;
+#endif
+            return false;
+        }
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCbuildComputeBuildShaders( struct HPMCHistoPyramid* h )
+{
+    HPMCHistoPyramid::HistoPyramidBuild& hpb = h->m_hp_build;
+    HPMCHistoPyramid::HistoPyramidBuild::ComputeBuild& compute = hpb.m_compute;
+
+    // compute shaders need an explicit version, see HPMCgenerateComputeVersion
+    const std::string version = HPMCgenerateComputeVersion( h->m_constants );
+
+    // --- build base level construction program -------------------------------
+    compute.m_base_shader = HPMCcompileShader( version +
+                                               HPMCgenerateDefines( h ) +
+                                               HPMCgenerateScalarFieldFetch( h ) +
+                                               HPMCgenerateBaselevelComputeShader( h ),
+                                               GL_COMPUTE_SHADER );
+    if( compute.m_base_shader == 0 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: Failed to build base level compute shader." << endl;
+#endif
+        return false;
+    }
+    compute.m_base_program = glCreateProgram();
+    glAttachShader( compute.m_base_program, compute.m_base_shader );
+    if(! HPMClinkProgram( compute.m_base_program ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: Failed to link base level compute program." << endl;
+#endif
+        return false;
+    }
+
+    // --- configure base level construction program ---------------------------
+    glUseProgram( compute.m_base_program );
+    if( h->m_field.m_binary ) {
+        compute.m_base_loc_threshold = -1;
+    }
+    else {
+        compute.m_base_loc_threshold = HPMCgetUniformLocation( compute.m_base_program, "HPMC_threshold" );
+    }
+    compute.m_base_loc_rows = HPMCgetUniformLocation( compute.m_base_program, "HPMC_rows" );
+    GLint loc_vertex_count = -1;
+    if( !h->m_constant_tables ) {
+        loc_vertex_count = HPMCgetUniformLocation( compute.m_base_program, "HPMC_vertex_count" );
+    }
+    GLint loc_base_level = HPMCgetUniformLocation( compute.m_base_program, "HPMC_base_level" );
+    if( (compute.m_base_loc_rows == -1) ||
+        ((loc_vertex_count == -1) && !h->m_constant_tables) ||
+        (loc_base_level == -1) )
+    {
+#ifdef DEBUG
+        cerr << "HPMC error: Failed to locate uniforms in base level compute program." << endl;
+#endif
+        return false;
+    }
+    if( loc_vertex_count != -1 ) {
+        glUniform1i( loc_vertex_count, hpb.m_tex_unit_1 );
+    }
+    glUniform1i( loc_base_level, 0 );
+    if( h->m_fetch.m_mode != HPMC_VOLUME_LAYOUT_CUSTOM ) {
+        GLint loc_field = HPMCgetUniformLocation( compute.m_base_program, "HPMC_scalarfield" );
+        if( loc_field == -1 ) {
+#ifdef DEBUG
+            cerr << "HPMC error: Failed to locate scalar field texture uniform in base level compute program." << endl;
+#endif
+            return false;
+        }
+        glUniform1i( loc_field, hpb.m_tex_unit_2 );
+    }
+    if( (h->m_fetch.m_parameters.m_binding >= 0) &&
+        (h->m_fetch.m_mode != HPMC_VOLUME_LAYOUT_CUSTOM_CACHED) )
+    {
+        GLuint block = glGetUniformBlockIndex( compute.m_base_program, "HPMC_FetchParameters" );
+        if( block == GL_INVALID_INDEX ) {
+#ifdef DEBUG
+            cerr << "HPMC error: Failed to locate uniform block HPMC_FetchParameters in base level compute program." << endl;
+#endif
+            return false;
+        }
+        glUniformBlockBinding( compute.m_base_program, block, h->m_fetch.m_parameters.m_binding );
+    }
+
+    // --- build reduction program ---------------------------------------------
+    compute.m_reduction_shader = HPMCcompileShader( version +
+                                                    HPMCgenerateDefines( h ) +
+                                                    HPMCgenerateReductionComputeShader(),
+                                                    GL_COMPUTE_SHADER );
+    if( compute.m_reduction_shader == 0 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: Failed to build reduction compute shader." << endl;
+#endif
+        return false;
+    }
+    compute.m_reduction_program = glCreateProgram();
+    glAttachShader( compute.m_reduction_program, compute.m_reduction_shader );
+    if(! HPMClinkProgram( compute.m_reduction_program ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: Failed to link reduction compute program." << endl;
+#endif
+        return false;
+    }
+
+    // --- configure reduction program, images are bound to units 0 to 3 -------
+    glUseProgram( compute.m_reduction_program );
+    compute.m_reduction_loc_levels = HPMCgetUniformLocation( compute.m_reduction_program, "HPMC_levels" );
+    compute.m_reduction_loc_dst_size = HPMCgetUniformLocation( compute.m_reduction_program, "HPMC_dst_size" );
+    const char* images[4] = { "HPMC_src", "HPMC_dst1", "HPMC_dst2", "HPMC_dst3" };
+    for( int i=0; i<4; i++ ) {
+        GLint loc = HPMCgetUniformLocation( compute.m_reduction_program, images[i] );
+        if( loc == -1 ) {
+#ifdef DEBUG
+            cerr << "HPMC error: Failed to locate " << images[i] << " in reduction compute program." << endl;
+#endif
+            return false;
+        }
+        glUniform1i( loc, i );
+    }
+    if( (compute.m_reduction_loc_levels == -1) || (compute.m_reduction_loc_dst_size == -1) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: Failed to locate uniforms in reduction compute program." << endl;
+#endif
+        return false;
+    }
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: GL errors configuring compute build programs." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCbuildHP5BuildShaders( struct HPMCHistoPyramid* h )
+{
+    HPMCHistoPyramid::HistoPyramidBuild::HP5Reduction& hp5 = h->m_hp_build.m_hp5;
+
+    hp5.m_shader = HPMCcompileShader( HPMCgenerateComputeVersion( h->m_constants ) +
+                                      HPMCgenerateDefines( h ) +
+                                      HPMCgenerateHP5ReductionShader(),
+                                      GL_COMPUTE_SHADER );
+    if( hp5.m_shader == 0 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: Failed to build HP5 reduction compute shader." << endl;
+#endif
+        return false;
+    }
+    hp5.m_program = glCreateProgram();
+    glAttachShader( hp5.m_program, hp5.m_shader );
+    if(! HPMClinkProgram( hp5.m_program ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: Failed to link HP5 reduction compute program." << endl;
+#endif
+        return false;
+    }
+
+    // --- configure program, images are bound to units 0 to 3 -----------------
+    glUseProgram( hp5.m_program );
+    hp5.m_loc_level = HPMCgetUniformLocation( hp5.m_program, "HPMC_level" );
+    hp5.m_loc_src_offset = HPMCgetUniformLocation( hp5.m_program, "HPMC_src_offset" );
+    hp5.m_loc_src_count = HPMCgetUniformLocation( hp5.m_program, "HPMC_src_count" );
+    hp5.m_loc_dst_offset = HPMCgetUniformLocation( hp5.m_program, "HPMC_dst_offset" );
+    hp5.m_loc_dst_count = HPMCgetUniformLocation( hp5.m_program, "HPMC_dst_count" );
+    const char* images[4] = { "HPMC_base_level", "HPMC_hp5", "HPMC_hp5_sums", "HPMC_top" };
+    for( int i=0; i<4; i++ ) {
+        GLint loc = HPMCgetUniformLocation( hp5.m_program, images[i] );
+        if( loc == -1 ) {
+#ifdef DEBUG
+            cerr << "HPMC error: Failed to locate " << images[i] << " in HP5 reduction program." << endl;
+#endif
+            return false;
+        }
+        glUniform1i( loc, i );
+    }
+    if( (hp5.m_loc_level == -1) ||
+        (hp5.m_loc_src_offset == -1) ||
+        (hp5.m_loc_src_count == -1) ||
+        (hp5.m_loc_dst_offset == -1) ||
+        (hp5.m_loc_dst_count == -1) )
+    {
+#ifdef DEBUG
+        cerr << "HPMC error: Failed to locate uniforms in HP5 reduction program." << endl;
+#endif
+        return false;
+    }
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: GL errors configuring HP5 reduction program." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
@@ -41,6 +41,19 @@ using std::string;
 using std::stringstream;
 using std::cerr;
 
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateComputeVersion( struct HPMCConstants* c )
+{
+    //      The compatibility profile keeps the fixed-function era texture
+    //      functions that custom fetch code written for the fragment shader
+    //      build may use, a core profile context has no such profile.
+    if( c->m_core_profile ) {
+        return "#version 430 core\n";
+    }
+    return "#version 430 compatibility\n";
+}
+
 // -----------------------------------------------------------------------------
 std::string
 HPMCgenerateDefines( struct HPMCHistoPyramid* h )
@@ -48,24 +61,36 @@ HPMCgenerateDefines( struct HPMCHistoPyramid* h )
     stringstream src;
 
     src << "// generated by HPMCgenerateDefines" << endl;
-    //      voxel sizes of scalar function
-    src << "#define HPMC_FUNC_X        " << h->m_field.m_size[0] << endl;
+    if( h->m_fetch.m_parameters.m_binding >= 0 ) {
+        src << "#extension GL_ARB_uniform_buffer_object : enable" << endl;
+    }
+    const HPMCHistoPyramid::Field::Sampled& sampled = h->m_field.m_sampled;
+    //      voxel sizes of scalar function, as seen by the HistoPyramid
+    src << "#define HPMC_FUNC_X        " << sampled.m_size[0] << endl;
     src << "#define HPMC_FUNC_X_F      float(HPMC_FUNC_X)" << endl;
-    src << "#define HPMC_FUNC_Y        " << h->m_field.m_size[1] << endl;
+    src << "#define HPMC_FUNC_Y        " << sampled.m_size[1] << endl;
     src << "#define HPMC_FUNC_Y_F      float(HPMC_FUNC_Y)" << endl;
-    src << "#define HPMC_FUNC_Z        " << h->m_field.m_size[2] << endl;
+    src << "#define HPMC_FUNC_Z        " << sampled.m_size[2] << endl;
     src << "#define HPMC_FUNC_Z_F      float(HPMC_FUNC_Z)" << endl;
+    //      voxel sizes of the lattice and the sample stride
+    src << "#define HPMC_LATTICE_X_F   float(" << h->m_field.m_size[0] << ")" << endl;
+    src << "#define HPMC_LATTICE_Y_F   float(" << h->m_field.m_size[1] << ")" << endl;
+    src << "#define HPMC_LATTICE_Z_F   float(" << h->m_field.m_size[2] << ")" << endl;
+    src << "#define HPMC_STRIDE        vec3( "
+        << sampled.m_stride[0] << ".0, "
+        << sampled.m_stride[1] << ".0, "
+        << sampled.m_stride[2] << ".0 )" << endl;
     //      cell grid dimension
-    src << "#define HPMC_CELLS_X       " << h->m_field.m_cells[0] << endl;
+    src << "#define HPMC_CELLS_X       " << sampled.m_cells[0] << endl;
     src << "#define HPMC_CELLS_X_F     float(HPMC_CELLS_X)" << endl;
-    src << "#define HPMC_CELLS_Y       " << h->m_field.m_cells[1] << endl;
+    src << "#define HPMC_CELLS_Y       " << sampled.m_cells[1] << endl;
     src << "#define HPMC_CELLS_Y_F     float(HPMC_CELLS_Y)" << endl;
-    src << "#define HPMC_CELLS_Z       " << h->m_field.m_cells[2] << endl;
+    src << "#define HPMC_CELLS_Z       " << sampled.m_cells[2] << endl;
     src << "#define HPMC_CELLS_Z_F     float(HPMC_CELLS_Z)" << endl;
     //      cell grid extent
-    src << "#define HPMC_GRID_EXT_X_F  float("<<h->m_field.m_extent[0]<<")"<<endl;
-    src << "#define HPMC_GRID_EXT_Y_F  float("<<h->m_field.m_extent[1]<<")"<<endl;
-    src << "#define HPMC_GRID_EXT_Z_F  float("<<h->m_field.m_extent[2]<<")"<<endl;
+    src << "#define HPMC_GRID_EXT_X_F  float("<<sampled.m_extent[0]<<")"<<endl;
+    src << "#define HPMC_GRID_EXT_Y_F  float("<<sampled.m_extent[1]<<")"<<endl;
+    src << "#define HPMC_GRID_EXT_Z_F  float("<<sampled.m_extent[2]<<")"<<endl;
     //      tiling in base layer
     src << "#define HPMC_TILES_X       " << h->m_tiling.m_layout[0] << endl;
     src << "#define HPMC_TILES_X_F     float(HPMC_TILES_X)" << endl;
@@ -84,24 +109,185 @@ HPMCgenerateDefines( struct HPMCHistoPyramid* h )
 
 // -----------------------------------------------------------------------------
 std::string
-HPMCgenerateBaselevelShader( struct HPMCHistoPyramid* h )
+HPMCgenerateTileSlice( struct HPMCHistoPyramid* h, const std::string& tile )
 {
     stringstream src;
 
-    src << "// generated by HPMCgenerateBaselevelShader" << endl;
-    src << "uniform sampler1D  HPMC_vertex_count;" << endl;
-    if( !h->m_field.m_binary ) {
-        src << "uniform float      HPMC_threshold;" << endl;
+    if( !h->m_tiling.m_morton ) {
+        //      slices are laid out row by row
+        src << "dot( vec2( 1.0, HPMC_TILES_X_F ), " << tile << " )";
+        return src.str();
+    }
+
+    //      The HistoPyramid traversal visits the base level in Z-order of the
+    //      texels, and slices are numbered by the Z-order of the first texel of
+    //      their tile. As tile sizes are powers of two, this is the bits of
+    //      the tile index interleaved, except that the lowest bits along the
+    //      narrower tile dimension come first. Evaluated bit by bit in float
+    //      arithmetic, which works for all targets.
+    int p = 0;
+    int q = 0;
+    int a = 0;
+    int b = 0;
+    while( (1<<p) < h->m_tiling.m_tile_size[0] ) p++;
+    while( (1<<q) < h->m_tiling.m_tile_size[1] ) q++;
+    while( (1<<a) < h->m_tiling.m_layout[0] ) a++;
+    while( (1<<b) < h->m_tiling.m_layout[1] ) b++;
+    src << "floor( 0.5";
+    for(int i=0; i<a; i++) {
+        int w = i + std::max( 0, i+p-q );
+        src << " + " << (1<<w) << ".0*mod( floor( (" << tile << ".x+0.5)*(1.0/"
+            << (1<<i) << ".0) ), 2.0 )";
+    }
+    for(int i=0; i<b; i++) {
+        int w = i + std::max( 0, i+q-p+1 );
+        src << " + " << (1<<w) << ".0*mod( floor( (" << tile << ".y+0.5)*(1.0/"
+            << (1<<i) << ".0) ), 2.0 )";
+    }
+    src << " )";
+    return src.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateFieldCacheShader( struct HPMCHistoPyramid* h )
+{
+    stringstream src;
+
+    src << "// generated by HPMCgenerateFieldCacheShader" << endl;
+    src << "uniform float      HPMC_cache_slice;" << endl;
+    src << "void" << endl;
+    src << "main()" << endl;
+    src << "{" << endl;
+    //      one fragment per lattice point in the slice, and p is the texel
+    //      center, i.e. the same parameterization as HPMC_fetch gets otherwise.
+    src << "    vec3 p = vec3( gl_FragCoord.x * (1.0/HPMC_LATTICE_X_F)," << endl;
+    src << "                   gl_FragCoord.y * (1.0/HPMC_LATTICE_Y_F)," << endl;
+    src << "                   (HPMC_cache_slice+0.5) * (1.0/HPMC_LATTICE_Z_F) );" << endl;
+    if( h->m_fetch.m_gradient ) {
+        src << "    gl_FragColor = HPMC_fetchGrad( p );" << endl;
+    }
+    else {
+        src << "    gl_FragColor = vec4( HPMC_fetch( p ) );" << endl;
     }
+    src << "}" << endl;
+    return src.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateFieldCacheComputeShader( struct HPMCHistoPyramid* h )
+{
+    stringstream src;
+
+    src << "// generated by HPMCgenerateFieldCacheComputeShader" << endl;
+    src << "layout(local_size_x=" << HPMC_COMPUTE_GROUP_SIZE
+        << ", local_size_y=" << HPMC_COMPUTE_GROUP_SIZE << ") in;" << endl;
+    src << "layout(" << (h->m_fetch.m_gradient ? "rgba32f" : "r32f")
+        << ") uniform writeonly image3D HPMC_cache;" << endl;
+    src << "uniform float      HPMC_cache_slice;" << endl;
     src << "void" << endl;
     src << "main()" << endl;
     src << "{" << endl;
+    //      one invocation per lattice point in the slice, with the same
+    //      parameterization of p as HPMCgenerateFieldCacheShader.
+    src << "    ivec2 q = ivec2( gl_GlobalInvocationID.xy );" << endl;
+    src << "    if( (float(q.x) < HPMC_LATTICE_X_F) && (float(q.y) < HPMC_LATTICE_Y_F) ) {" << endl;
+    src << "        vec3 p = vec3( (float(q.x)+0.5) * (1.0/HPMC_LATTICE_X_F)," << endl;
+    src << "                       (float(q.y)+0.5) * (1.0/HPMC_LATTICE_Y_F)," << endl;
+    src << "                       (HPMC_cache_slice+0.5) * (1.0/HPMC_LATTICE_Z_F) );" << endl;
+    src << "        ivec3 t = ivec3( q, int( HPMC_cache_slice ) );" << endl;
+    if( h->m_fetch.m_gradient ) {
+        src << "        imageStore( HPMC_cache, t, HPMC_fetchGrad( p ) );" << endl;
+    }
+    else {
+        src << "        imageStore( HPMC_cache, t, vec4( HPMC_fetch( p ) ) );" << endl;
+    }
+    src << "    }" << endl;
+    src << "}" << endl;
+    return src.str();
+}
+
+// -----------------------------------------------------------------------------
+/** Constant arrays of the packed tables, see HPMCConstants::m_packed_cells.
+  *
+  * Declares HPMC_packed_cells with the lookup HPMC_cellVertexCount, and if
+  * edges is set, HPMC_packed_edges with the lookup HPMC_cellEdge.
+  */
+static std::string
+HPMCgenerateConstantTables( struct HPMCHistoPyramid* h, bool edges )
+{
+    stringstream src;
+    const HPMCConstants* c = h->m_constants;
+
+    src << "// generated by HPMCgenerateConstantTables" << endl;
+    src << "const uint HPMC_packed_cells[512] = uint[512](" << endl;
+    for(int i=0; i<512; i+=8) {
+        src << "   ";
+        for(int k=i; k<i+8; k++) {
+            src << " " << c->m_packed_cells[k] << "u" << (k<511 ? "," : "");
+        }
+        src << endl;
+    }
+    src << ");" << endl;
+    //      The vertex count is stored in the top nibble of the second word.
+    src << "float" << endl;
+    src << "HPMC_cellVertexCount( float code )" << endl;
+    src << "{" << endl;
+    src << "    return float( HPMC_packed_cells[ 2*int(256.0*code)+1 ] >> 28u );" << endl;
+    src << "}" << endl;
+    if( edges ) {
+        src << "const uint HPMC_packed_edges[12] = uint[12](" << endl;
+        src << "   ";
+        for(int i=0; i<12; i++) {
+            src << " " << c->m_packed_edges[i] << "u" << (i<11 ? "," : "");
+        }
+        src << endl;
+        src << ");" << endl;
+        //      Same layout as the edge decode texture: xyz is the shift of the
+        //      edge's first corner, and w is the axis of the edge.
+        src << "vec4" << endl;
+        src << "HPMC_cellEdge( float code, float key_ix )" << endl;
+        src << "{" << endl;
+        src << "    int k = int( key_ix );" << endl;
+        src << "    uint word = HPMC_packed_cells[ 2*int(256.0*code) + (k>>3) ];" << endl;
+        src << "    uint e = HPMC_packed_edges[ (word >> uint(4*(k&7))) & 0xFu ];" << endl;
+        src << "    return vec4( float( e & 1u )," << endl;
+        src << "                 float( (e>>1u) & 1u )," << endl;
+        src << "                 float( (e>>2u) & 1u )," << endl;
+        src << "                 float( e>>3u ) );" << endl;
+        src << "}" << endl;
+    }
+    return src.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateBaselevelFunction( struct HPMCHistoPyramid* h )
+{
+    stringstream src;
+
+    src << "// generated by HPMCgenerateBaselevelFunction" << endl;
+    if( h->m_constant_tables ) {
+        src << HPMCgenerateConstantTables( h, false );
+    }
+    else {
+        src << "uniform sampler1D  HPMC_vertex_count;" << endl;
+    }
+    if( !h->m_field.m_binary ) {
+        src << "uniform float      HPMC_threshold;" << endl;
+    }
+    //      tc is the texel center in normalized coordinates of the base level
+    src << "vec4" << endl;
+    src << "HPMC_baseLevel( vec2 tc )" << endl;
+    src << "{" << endl;
     if( h->m_field.m_binary ) {
         src << "    const float HPMC_threshold = 0.5;" << endl;
     }
     //          determine which tile we're in, and thus which slice
-    src << "    vec2 stp = vec2( HPMC_TILES_X, HPMC_TILES_Y ) * gl_TexCoord[0].xy;"<< endl;
-    src << "    float slice = dot( vec2( 1.0, HPMC_TILES_X ), floor( stp ) );"<<endl;
+    src << "    vec2 stp = vec2( HPMC_TILES_X, HPMC_TILES_Y ) * tc;"<< endl;
+    src << "    vec2 tile = floor( stp );"<<endl;
+    src << "    float slice = " << HPMCgenerateTileSlice( h, "tile" ) << ";"<<endl;
     //          skip slices that don't contain cells
     src << "    if( slice < float(HPMC_CELLS_Z) ) {"<<endl;
     src << "        vec3 tp = vec3( fract(stp), slice );"<<endl;
@@ -152,31 +338,91 @@ HPMCgenerateBaselevelShader( struct HPMCHistoPyramid* h )
     src << "            l1.y+2.0*l1.z+4.0*l2.y +8.0*l2.z+0.5" << endl;
     src << "        );" << endl;
     //              fetch the triangle count for the 2x2x1 set of voxels
-    src << "        vec4 counts = vec4(" << endl;
-    src << "            texture1D( HPMC_vertex_count, codes.x ).a," << endl;
-    src << "            texture1D( HPMC_vertex_count, codes.y ).a," << endl;
-    src << "            texture1D( HPMC_vertex_count, codes.z ).a," << endl;
-    src << "            texture1D( HPMC_vertex_count, codes.w ).a" << endl;
-    src << "        );" << endl;
+    if( h->m_constant_tables ) {
+        src << "        vec4 counts = vec4(" << endl;
+        src << "            HPMC_cellVertexCount( codes.x )," << endl;
+        src << "            HPMC_cellVertexCount( codes.y )," << endl;
+        src << "            HPMC_cellVertexCount( codes.z )," << endl;
+        src << "            HPMC_cellVertexCount( codes.w )" << endl;
+        src << "        );" << endl;
+    }
+    else {
+        const char* tex = h->m_constants->m_core_profile ? "texture" : "texture1D";
+        src << "        vec4 counts = vec4(" << endl;
+        src << "            " << tex << "( HPMC_vertex_count, codes.x ).a," << endl;
+        src << "            " << tex << "( HPMC_vertex_count, codes.y ).a," << endl;
+        src << "            " << tex << "( HPMC_vertex_count, codes.z ).a," << endl;
+        src << "            " << tex << "( HPMC_vertex_count, codes.w ).a" << endl;
+        src << "        );" << endl;
+    }
 
     // encode the vertex count in the integer part and the code in the fractional part.
-    src << "        gl_FragColor = mask*( counts + codes);" << endl;
+    src << "        return mask*( counts + codes);" << endl;
     src << "    } " << endl;
     src << "    else {" << endl;
-    src << "        gl_FragColor = vec4(0.0, 0.0, 0.4, 0.0);" << endl;
+    src << "        return vec4(0.0, 0.0, 0.4, 0.0);" << endl;
     src << "    }" << endl;
     src << "}" << endl;
 
     return src.str();
 }
 
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateBaselevelShader( struct HPMCHistoPyramid* h )
+{
+    stringstream src;
+
+    src << HPMCgenerateBaselevelFunction( h );
+    src << "// generated by HPMCgenerateBaselevelShader" << endl;
+    src << "void" << endl;
+    src << "main()" << endl;
+    src << "{" << endl;
+    src << "    gl_FragColor = HPMC_baseLevel( gl_TexCoord[0].xy );" << endl;
+    src << "}" << endl;
+    return src.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateBaselevelComputeShader( struct HPMCHistoPyramid* h )
+{
+    stringstream src;
+
+    src << HPMCgenerateBaselevelFunction( h );
+    src << "// generated by HPMCgenerateBaselevelComputeShader" << endl;
+    src << "layout(local_size_x=" << HPMC_COMPUTE_GROUP_SIZE
+        << ", local_size_y=" << HPMC_COMPUTE_GROUP_SIZE << ") in;" << endl;
+    src << "layout(rgba32f) uniform writeonly image2D HPMC_base_level;" << endl;
+    //      first and one past last row of texels to build
+    src << "uniform ivec2      HPMC_rows;" << endl;
+    src << "void" << endl;
+    src << "main()" << endl;
+    src << "{" << endl;
+    src << "    ivec2 p = ivec2( gl_GlobalInvocationID.xy ) + ivec2( 0, HPMC_rows.x );" << endl;
+    src << "    if( (p.x < (1<<HPMC_HP_SIZE_L2)) && (p.y < HPMC_rows.y) ) {" << endl;
+    src << "        vec2 tc = (vec2(p)+vec2(0.5))*(1.0/float(1<<HPMC_HP_SIZE_L2));" << endl;
+    src << "        imageStore( HPMC_base_level, p, HPMC_baseLevel( tc ) );" << endl;
+    src << "    }" << endl;
+    src << "}" << endl;
+    return src.str();
+}
+
 // -----------------------------------------------------------------------------
 std::string
 HPMCgenerateReductionShader( struct HPMCHistoPyramid* h, const std::string& filter  )
+{
+    return HPMCgenerateReductionShader( h->m_constants->m_target, filter,
+                                        h->m_codegen.m_sampled_reduction );
+}
+
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateReductionShader( HPMCTarget target, const std::string& filter, bool sampled )
 {
     stringstream src;
 
-    if( h->m_constants->m_target < HPMC_TARGET_GL30_GLSL130 ) {
+    if( target < HPMC_TARGET_GL30_GLSL130 ) {
         src << "// generated by HPMCgenerateReductionShader with filter=\""<<filter<<"\"" << endl;
         src << "uniform sampler2D  HPMC_histopyramid;" << endl;
         src << "uniform vec2       HPMC_delta;" << endl;
@@ -202,6 +448,26 @@ HPMCgenerateReductionShader( struct HPMCHistoPyramid* h, const std::string& filt
         src << "    gl_FragColor = sums;" << endl;
         src << "}" << endl;
     }
+    else if( sampled ) {
+        //      Same as above, with the source level selected explicitly
+        //      instead of by the base and max level of the texture.
+        src << "// generated by HPMCgenerateReductionShader with filter=\""<<filter<<"\", sampled" << endl;
+        src << "uniform sampler2D  HPMC_histopyramid;" << endl;
+        src << "uniform int        HPMC_src_level;" << endl;
+        src << "uniform vec2       HPMC_delta;" << endl;
+        src << "void" << endl;
+        src << "main()" << endl;
+        src << "{" << endl;
+        src << "    float l = float( HPMC_src_level );" << endl;
+        src << "    vec4 sums = vec4(" << endl;
+        src << "        dot( vec4(1.0), " << filter << "( textureLod( HPMC_histopyramid, gl_TexCoord[0].xy+HPMC_delta.xx, l ) ) )," << std::endl;
+        src << "        dot( vec4(1.0), " << filter << "( textureLod( HPMC_histopyramid, gl_TexCoord[0].xy+HPMC_delta.yx, l ) ) )," << std::endl;
+        src << "        dot( vec4(1.0), " << filter << "( textureLod( HPMC_histopyramid, gl_TexCoord[0].xy+HPMC_delta.xy, l ) ) )," << std::endl;
+        src << "        dot( vec4(1.0), " << filter << "( textureLod( HPMC_histopyramid, gl_TexCoord[0].xy+HPMC_delta.yy, l ) ) )" << std::endl;
+        src << "    );" << endl;
+        src << "    gl_FragColor = sums;" << endl;
+        src << "}" << endl;
+    }
     else {
         src << "// generated by HPMCgenerateReductionShader with filter=\""<<filter<<"\"" << endl;
         src << "uniform sampler2D  HPMC_histopyramid;" << endl;
@@ -226,7 +492,150 @@ HPMCgenerateReductionShader( struct HPMCHistoPyramid* h, const std::string& filt
 
 // -----------------------------------------------------------------------------
 std::string
-HPMCgenerateGPGPUVertexPassThroughShader( struct HPMCHistoPyramid* h )
+HPMCgenerateReductionComputeShader()
+{
+    stringstream src;
+    const int n = HPMC_COMPUTE_GROUP_SIZE;
+
+    //      Reduces up to three levels per dispatch. Each invocation produces a
+    //      texel of the first destination level, and the sums of texels are
+    //      passed through shared memory to produce the texels of the next two
+    //      levels within the work group. The source texels are floored, which
+    //      strips the MC codes from the base level and is a no-op elsewhere.
+    src << "// generated by HPMCgenerateReductionComputeShader" << endl;
+    src << "layout(local_size_x=" << n << ", local_size_y=" << n << ") in;" << endl;
+    src << "layout(rgba32f) uniform readonly  image2D HPMC_src;" << endl;
+    src << "layout(rgba32f) uniform writeonly image2D HPMC_dst1;" << endl;
+    src << "layout(rgba32f) uniform writeonly image2D HPMC_dst2;" << endl;
+    src << "layout(rgba32f) uniform writeonly image2D HPMC_dst3;" << endl;
+    //      number of levels to produce, and the size of the first of them
+    src << "uniform int        HPMC_levels;" << endl;
+    src << "uniform int        HPMC_dst_size;" << endl;
+    src << "shared float       HPMC_sums1[" << n << "][" << n << "];" << endl;
+    src << "shared float       HPMC_sums2[" << n/2 << "][" << n/2 << "];" << endl;
+    src << "void" << endl;
+    src << "main()" << endl;
+    src << "{" << endl;
+    src << "    ivec2 l = ivec2( gl_LocalInvocationID.xy );" << endl;
+    src << "    ivec2 p = ivec2( gl_GlobalInvocationID.xy );" << endl;
+    src << "    vec4 sums = vec4( 0.0 );" << endl;
+    src << "    if( (p.x < HPMC_dst_size) && (p.y < HPMC_dst_size) ) {" << endl;
+    src << "        ivec2 tp = 2*p;" << endl;
+    src << "        sums = vec4(" << endl;
+    src << "            dot( vec4(1.0), floor( imageLoad( HPMC_src, tp + ivec2(0,0) ) ) )," << endl;
+    src << "            dot( vec4(1.0), floor( imageLoad( HPMC_src, tp + ivec2(1,0) ) ) )," << endl;
+    src << "            dot( vec4(1.0), floor( imageLoad( HPMC_src, tp + ivec2(0,1) ) ) )," << endl;
+    src << "            dot( vec4(1.0), floor( imageLoad( HPMC_src, tp + ivec2(1,1) ) ) )" << endl;
+    src << "        );" << endl;
+    src << "        imageStore( HPMC_dst1, p, sums );" << endl;
+    src << "    }" << endl;
+    src << "    HPMC_sums1[l.y][l.x] = dot( vec4(1.0), sums );" << endl;
+    src << "    barrier();" << endl;
+    src << "    if( (HPMC_levels > 1) && (l.x%2 == 0) && (l.y%2 == 0) ) {" << endl;
+    src << "        ivec2 q = p/2;" << endl;
+    src << "        sums = vec4( HPMC_sums1[l.y  ][l.x], HPMC_sums1[l.y  ][l.x+1]," << endl;
+    src << "                     HPMC_sums1[l.y+1][l.x], HPMC_sums1[l.y+1][l.x+1] );" << endl;
+    src << "        if( (q.x < HPMC_dst_size/2) && (q.y < HPMC_dst_size/2) ) {" << endl;
+    src << "            imageStore( HPMC_dst2, q, sums );" << endl;
+    src << "        }" << endl;
+    src << "        HPMC_sums2[l.y/2][l.x/2] = dot( vec4(1.0), sums );" << endl;
+    src << "    }" << endl;
+    src << "    barrier();" << endl;
+    src << "    if( (HPMC_levels > 2) && (l.x%4 == 0) && (l.y%4 == 0) ) {" << endl;
+    src << "        ivec2 r = p/4;" << endl;
+    src << "        ivec2 m = l/2;" << endl;
+    src << "        sums = vec4( HPMC_sums2[m.y  ][m.x], HPMC_sums2[m.y  ][m.x+1]," << endl;
+    src << "                     HPMC_sums2[m.y+1][m.x], HPMC_sums2[m.y+1][m.x+1] );" << endl;
+    src << "        if( (r.x < HPMC_dst_size/4) && (r.y < HPMC_dst_size/4) ) {" << endl;
+    src << "            imageStore( HPMC_dst3, r, sums );" << endl;
+    src << "        }" << endl;
+    src << "    }" << endl;
+    src << "}" << endl;
+    return src.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateMortonDecodeFunction()
+{
+    stringstream src;
+
+    //      The traversal of the four-to-one HP visits the children of a texel
+    //      in the order (0,0), (1,0), (0,1), (1,1), so the x and y bits of the
+    //      texel position are the even and odd bits of the Z-order index.
+    src << "// generated by HPMCgenerateMortonDecodeFunction" << endl;
+    src << "ivec2" << endl;
+    src << "HPMC_mortonDecode( int k )" << endl;
+    src << "{" << endl;
+    src << "    ivec2 p = ivec2( 0 );" << endl;
+    src << "    for( int i=0; i<HPMC_HP_SIZE_L2; i++ ) {" << endl;
+    src << "        p |= ivec2( (k>>(2*i))&1, (k>>(2*i+1))&1 ) << i;" << endl;
+    src << "    }" << endl;
+    src << "    return p;" << endl;
+    src << "}" << endl;
+    return src.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateHP5ReductionShader()
+{
+    stringstream src;
+
+    //      Produces one level of the HP5 layout, one invocation per element.
+    //      The children of the first level are the base level texels, which
+    //      are copied to the buffer in Z-order, the children of the upper
+    //      levels are the counts of the level below. The count of every
+    //      element is kept in HPMC_hp5_sums for the next level, and the count
+    //      of the single element of the top level is the total.
+    src << "// generated by HPMCgenerateHP5ReductionShader" << endl;
+    src << "layout(local_size_x=" << HPMC_HP5_GROUP_SIZE << ") in;" << endl;
+    src << "layout(rgba32f) uniform readonly  image2D     HPMC_base_level;" << endl;
+    src << "layout(rgba32f) uniform writeonly imageBuffer HPMC_hp5;" << endl;
+    src << "layout(r32f)    uniform           imageBuffer HPMC_hp5_sums;" << endl;
+    src << "layout(rgba32f) uniform writeonly image2D     HPMC_top;" << endl;
+    src << "uniform int        HPMC_level;" << endl;
+    //      offset and number of children, and offset and number of elements
+    src << "uniform int        HPMC_src_offset;" << endl;
+    src << "uniform int        HPMC_src_count;" << endl;
+    src << "uniform int        HPMC_dst_offset;" << endl;
+    src << "uniform int        HPMC_dst_count;" << endl;
+    src << HPMCgenerateMortonDecodeFunction();
+    src << "void" << endl;
+    src << "main()" << endl;
+    src << "{" << endl;
+    src << "    int j = int( gl_GlobalInvocationID.x );" << endl;
+    src << "    if( j < HPMC_dst_count ) {" << endl;
+    src << "        float c[5];" << endl;
+    src << "        for( int i=0; i<5; i++ ) {" << endl;
+    src << "            int k = 5*j + i;" << endl;
+    src << "            c[i] = 0.0;" << endl;
+    src << "            if( k < HPMC_src_count ) {" << endl;
+    src << "                if( HPMC_level == 1 ) {" << endl;
+    src << "                    vec4 t = imageLoad( HPMC_base_level, HPMC_mortonDecode( k ) );" << endl;
+    src << "                    imageStore( HPMC_hp5, HPMC_src_offset + k, t );" << endl;
+    src << "                    c[i] = dot( vec4(1.0), floor( t ) );" << endl;
+    src << "                }" << endl;
+    src << "                else {" << endl;
+    src << "                    c[i] = imageLoad( HPMC_hp5_sums, HPMC_src_offset + k ).x;" << endl;
+    src << "                }" << endl;
+    src << "            }" << endl;
+    src << "        }" << endl;
+    src << "        float n = c[0] + c[1] + c[2] + c[3] + c[4];" << endl;
+    src << "        imageStore( HPMC_hp5, HPMC_dst_offset + j, vec4( c[0], c[1], c[2], c[3] ) );" << endl;
+    src << "        imageStore( HPMC_hp5_sums, HPMC_dst_offset + j, vec4( n ) );" << endl;
+    src << "        if( HPMC_dst_count == 1 ) {" << endl;
+    src << "            imageStore( HPMC_hp5, 0, vec4( n, 0.0, 0.0, 0.0 ) );" << endl;
+    src << "            imageStore( HPMC_top, ivec2( 0 ), vec4( n, 0.0, 0.0, 0.0 ) );" << endl;
+    src << "        }" << endl;
+    src << "    }" << endl;
+    src << "}" << endl;
+    return src.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateGPGPUVertexPassThroughShader()
 {
     stringstream src;
 
@@ -241,6 +650,64 @@ HPMCgenerateGPGPUVertexPassThroughShader( struct HPMCHistoPyramid* h )
     return src.str();
 }
 
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateIndirectCommandShader()
+{
+    stringstream src;
+
+    src << "// generated by HPMCgenerateIndirectCommandShader" << endl;
+    src << "uniform sampler2D  HPMC_histopyramid;" << endl;
+    src << "uniform int        HPMC_src_level;" << endl;
+    src << "uniform float      HPMC_capacity;" << endl;
+    //      Vertices per batch, see HPMCHistoPyramid::Codegen.
+    src << "uniform float      HPMC_batch;" << endl;
+    //      Three DrawArraysIndirectCommand structs: full batches spawned as
+    //      instances, the tail batch, and drawing of the captured vertices
+    //      clamped to the capacity of the output buffer.
+    src << "flat out uvec4     HPMC_extract_batches;" << endl;
+    src << "flat out uvec4     HPMC_extract_tail;" << endl;
+    src << "flat out uvec4     HPMC_draw;" << endl;
+    //      A fourth command spawns one point per cluster of the output buffer,
+    //      see HPMCgenerateClusterShader.
+    src << "uniform float      HPMC_cluster_vertices;" << endl;
+    src << "flat out uvec4     HPMC_clusters;" << endl;
+    src << "void" << endl;
+    src << "main()" << endl;
+    src << "{" << endl;
+    src << "    float n = dot( vec4(1.0), floor( texelFetch( HPMC_histopyramid, ivec2(0,0), HPMC_src_level ) ) );" << endl;
+    src << "    float r = mod( n, HPMC_batch );" << endl;
+    src << "    HPMC_extract_batches = uvec4( uint( HPMC_batch ), uint( (n-r)/HPMC_batch + 0.5 ), 0u, 0u );" << endl;
+    src << "    HPMC_extract_tail    = uvec4( uint( r ), 1u, 0u, 0u );" << endl;
+    src << "    HPMC_draw            = uvec4( uint( min( n, HPMC_capacity ) ), 1u, 0u, 0u );" << endl;
+    src << "    HPMC_clusters        = uvec4( HPMC_cluster_vertices > 0.0 ?" << endl;
+    src << "                                  uint( ceil( min( n, HPMC_capacity )/HPMC_cluster_vertices ) ) : 0u," << endl;
+    src << "                                  1u, 0u, 0u );" << endl;
+    src << "    gl_Position = vec4( 0.0 );" << endl;
+    src << "}" << endl;
+    return src.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateLatticePosition( struct HPMCHistoPyramid* h, const std::string& p )
+{
+    stringstream src;
+
+    //      p.xy is normalized texture coordinates and p.z is the slice number,
+    //      relative to the lattice seen by the HistoPyramid. The result is
+    //      normalized coordinates of the lattice.
+    if( h->m_field.m_stride == 1 ) {
+        src << "vec3( " << p << ".xy, (" << p << ".z+0.5)*(1.0/float(HPMC_FUNC_Z)) )";
+    }
+    else {
+        src << "( vec3( " << p << ".xy*vec2( HPMC_FUNC_X_F, HPMC_FUNC_Y_F ) - vec2(0.5), "
+            << p << ".z )*HPMC_STRIDE + vec3(0.5) )*"
+            << "vec3( 1.0/HPMC_LATTICE_X_F, 1.0/HPMC_LATTICE_Y_F, 1.0/HPMC_LATTICE_Z_F )";
+    }
+    return src.str();
+}
+
 // -----------------------------------------------------------------------------
 std::string
 HPMCgenerateScalarFieldFetch( struct HPMCHistoPyramid* h )
@@ -248,21 +715,89 @@ HPMCgenerateScalarFieldFetch( struct HPMCHistoPyramid* h )
     stringstream src;
 
     src << "// generated by HPMCgenerateScalarFieldFetch" << endl;
+    //      the GLSL 1.10 texture functions are gone from the core profile
+    const char* tex = h->m_constants->m_core_profile ? "texture" : "texture3D";
     // -------------------------------------------------------------------------
     if( h->m_fetch.m_mode == HPMC_VOLUME_LAYOUT_TEXTURE_3D ) {
         src << "uniform sampler3D  HPMC_scalarfield;" << endl;
         src << "float" << endl;
         src << "HPMC_sample( vec3 p )" << endl;
         src << "{" << endl;
-        src << "    p.z = (p.z+0.5)*(1.0/float(HPMC_FUNC_Z));" << endl;
-        src << "    return texture3D( HPMC_scalarfield, p ).a;" << endl;
+        src << "    p = " << HPMCgenerateLatticePosition( h, "p" ) << ";" << endl;
+        src << "    return " << tex << "( HPMC_scalarfield, p ).a;" << endl;
+        src << "}" << endl;
+        if( h->m_fetch.m_gradient ) {
+            src << "vec4" << endl;
+            src << "HPMC_sampleGrad( vec3 p )" << endl;
+            src << "{" << endl;
+            src << "    p = " << HPMCgenerateLatticePosition( h, "p" ) << ";" << endl;
+            src << "    return " << tex << "( HPMC_scalarfield, p );" << endl;
+            src << "}" << endl;
+        }
+    }
+    // -------------------------------------------------------------------------
+    else if( h->m_fetch.m_mode == HPMC_VOLUME_LAYOUT_RADIAL_KERNELS ) {
+        const HPMCHistoPyramid::Fetch::RadialKernels& k = h->m_fetch.m_kernels;
+        src << "uniform sampler2D  HPMC_scalarfield;" << endl;
+        src << "#define HPMC_KERNEL_BINS   " << k.m_bins << endl;
+        src << "#define HPMC_KERNEL_TEX_W  " << HPMC_KERNEL_TEX_WIDTH << endl;
+        src << "#define HPMC_KERNEL_R2_INV float(" << 1.0f/(k.m_radius*k.m_radius) << ")" << endl;
+        //      Sum the kernels whose support overlap the bin of p. Returns the
+        //      gradient in xyz and the field value in w.
+        src << "vec4" << endl;
+        src << "HPMC_kernelSum( vec3 p )" << endl;
+        src << "{" << endl;
+        src << "    ivec3 bin = clamp( ivec3( floor( float(HPMC_KERNEL_BINS)*p ) )," << endl;
+        src << "                       ivec3(0), ivec3(HPMC_KERNEL_BINS-1) );" << endl;
+        src << "    int b = bin.x + HPMC_KERNEL_BINS*(bin.y + HPMC_KERNEL_BINS*bin.z);" << endl;
+        src << "    vec2 range = texelFetch( HPMC_scalarfield," << endl;
+        src << "                             ivec2( b % HPMC_KERNEL_TEX_W, b / HPMC_KERNEL_TEX_W ), 0 ).xy;" << endl;
+        src << "    int beg = int(range.x);" << endl;
+        src << "    int end = beg + int(range.y);" << endl;
+        src << "    vec4 s = vec4(0.0);" << endl;
+        src << "    for(int i=beg; i<end; i++) {" << endl;
+        src << "        vec4 c = texelFetch( HPMC_scalarfield," << endl;
+        src << "                             ivec2( i % HPMC_KERNEL_TEX_W, i / HPMC_KERNEL_TEX_W ), 0 );" << endl;
+        src << "        vec3 r = p - c.xyz;" << endl;
+        src << "        float q = 1.0 - HPMC_KERNEL_R2_INV*dot(r,r);" << endl;
+        src << "        if( q > 0.0 ) {" << endl;
+        src << "            s.w   += c.w*q*q*q;" << endl;
+        src << "            s.xyz -= (6.0*HPMC_KERNEL_R2_INV)*c.w*q*q*r;" << endl;
+        src << "        }" << endl;
+        src << "    }" << endl;
+        src << "    return s;" << endl;
+        src << "}" << endl;
+        src << "float" << endl;
+        src << "HPMC_sample( vec3 p )" << endl;
+        src << "{" << endl;
+        src << "    p = " << HPMCgenerateLatticePosition( h, "p" ) << ";" << endl;
+        src << "    return HPMC_kernelSum( p ).w;" << endl;
+        src << "}" << endl;
+        src << "vec4" << endl;
+        src << "HPMC_sampleGrad( vec3 p )" << endl;
+        src << "{" << endl;
+        src << "    p = " << HPMCgenerateLatticePosition( h, "p" ) << ";" << endl;
+        src << "    return HPMC_kernelSum( p );" << endl;
+        src << "}" << endl;
+    }
+    // -------------------------------------------------------------------------
+    else if( h->m_fetch.m_mode == HPMC_VOLUME_LAYOUT_CUSTOM_CACHED ) {
+        //      The cache is R32F, or RGBA32F with the value in w if gradients
+        //      are provided.
+        src << "uniform sampler3D  HPMC_scalarfield;" << endl;
+        src << "float" << endl;
+        src << "HPMC_sample( vec3 p )" << endl;
+        src << "{" << endl;
+        src << "    p = " << HPMCgenerateLatticePosition( h, "p" ) << ";" << endl;
+        src << "    return " << tex << "( HPMC_scalarfield, p )."
+            << (h->m_fetch.m_gradient ? "a" : "r") << ";" << endl;
         src << "}" << endl;
         if( h->m_fetch.m_gradient ) {
             src << "vec4" << endl;
             src << "HPMC_sampleGrad( vec3 p )" << endl;
             src << "{" << endl;
-            src << "    p.z = (p.z+0.5)*(1.0/float(HPMC_FUNC_Z));" << endl;
-            src << "    return texture3D( HPMC_scalarfield, p );" << endl;
+            src << "    p = " << HPMCgenerateLatticePosition( h, "p" ) << ";" << endl;
+            src << "    return " << tex << "( HPMC_scalarfield, p );" << endl;
             src << "}" << endl;
         }
     }
@@ -272,14 +807,14 @@ HPMCgenerateScalarFieldFetch( struct HPMCHistoPyramid* h )
         src << "float" << endl;
         src << "HPMC_sample( vec3 p )" << endl;
         src << "{" << endl;
-        src << "    p.z = (p.z+0.5)*(1.0/float(HPMC_FUNC_Z));" << endl;
+        src << "    p = " << HPMCgenerateLatticePosition( h, "p" ) << ";" << endl;
         src << "    return HPMC_fetch( p );" << endl;
         src << "}" << endl;
         if( h->m_fetch.m_gradient ) {
             src << "vec4" << endl;
             src << "HPMC_sampleGrad( vec3 p )" << endl;
             src << "{" << endl;
-            src << "    p.z = (p.z+0.5)*(1.0/float(HPMC_FUNC_Z));" << endl;
+            src << "    p = " << HPMCgenerateLatticePosition( h, "p" ) << ";" << endl;
             src << "    return HPMC_fetchGrad( p );" << endl;
             src << "}" << endl;
         }
@@ -295,57 +830,339 @@ HPMCgenerateScalarFieldFetch( struct HPMCHistoPyramid* h )
 }
 
 // -----------------------------------------------------------------------------
-std::string
-HPMCgenerateExtractVertexFunction( struct HPMCHistoPyramid* h )
+/** Position p and normal n of the intersection on the edge from pa to pb.
+  *
+  * With position_only, the edge parameter is found from the two edge
+  * end-point samples and n is left zero (except for binary fields), which
+  * skips the forward differences or gradients. With cached, the samples are
+  * taken from the corners of the cell fetched by extractCell, where ia and
+  * ib are the corner indices of pa and pb.
+  */
+static std::string
+HPMCgenerateEdgeIntersection( struct HPMCHistoPyramid* h, bool position_only, bool cached )
 {
     stringstream src;
 
-    if( h->m_constants->m_target < HPMC_TARGET_GL30_GLSL130 ) {
-        src << "// generated by HPMCgenerateExtractShaderFunctions"             << endl;
-        src << "uniform sampler2D  HPMC_histopyramid;"                          << endl;
-        src << "uniform sampler2D  HPMC_edge_table;"                            << endl;
-        src << "uniform float      HPMC_key_offset;"                            << endl;
-        src << "uniform float      HPMC_threshold;"                             << endl;
-        src << "void"                                                           << endl;
-        src << "extractVertex( out vec3 a, out vec3 b, out vec3 p, out vec3 n )"                        << endl;
-        src << "{"                                                              << endl;
-        //          The key index is determined from offset + x-value of vertex.
-        src << "    float key_ix = gl_Vertex.x + HPMC_key_offset;"              << endl;
-        //          Start traversal in the center of the top element texel.
-        src << "    vec2 texpos = vec2(0.5);"                                   << endl;
-        //          Texel shift incremental offsets, one element per interval.
-        //          These are updated during traversal.
-        src << "    vec4 delta_x = vec4( -0.5,  0.5, -0.5, 0.25 );"             << endl;
-        src << "    vec4 delta_y = vec4(  0.0, -0.5,  0.0, 0.25 );"             << endl;
-        //          First, traverse the upper levels containing only integers
-        src << "    vec4 sums,hist,mask;"                                       << endl;
-        src << "    for(int i=HPMC_HP_SIZE_L2; i>0; i--) {"                     << endl;
-        //              Fetch sub-pyramid sums for the four sub-pyramids.
-        src << "        vec4 sums = texture2DLod( HPMC_histopyramid, texpos, float(i) );" << endl;
-        //              Determine accummulative sums, refer to key intervals in paper.
-        //              hist.x = sums.x
-        //              hist.y = sums.x + sums.y
-        //              hist.z = sums.x + sums.y + sums.z
-        //              hist.w = sums.x + sums.y + hist.z + sums.w
-        src << "        vec4 hist = sums;"                                      << endl;
-        src << "        hist.w   += hist.z;"                                    << endl;
-        src << "        hist.zw  += hist.yy;"                                   << endl;
-        src << "        hist.yzw += hist.xxx;"                                  << endl;
-        //              Build a mask for next step.
-        //              0      <= key < hist.x  ->  mask = (1,1,1,1)
-        //              hist.x <= key < hist.y  ->  mask = (0,1,1,1)
-        //              hist.y <= key < hist.z  ->  mask = (0,0,1,1)
-        //              hist.z <= key < hist.w  ->  mask = (0,0,0,1)
-        src << "        vec4 mask = vec4( lessThan( vec4(key_ix), hist ) );"    << endl;
-        //              Combine mask with delta_x and delta_y to shift texcoord
-        //              0      <= key < hist.x  ->  tp += ( -0.25, -0.25 )
-        //              hist.x <= key < hist.y  ->  tp += (  0.25, -0.25 )
-        //              hist.y <= key < hist.z  ->  tp += ( -0.25,  0.25 )
-        //              hist.z <= key < hist.w  ->  tp += (  0.25,  0.25 )
-        src << "        texpos   += vec2( dot( mask, delta_x ), dot( mask, delta_y ) );" << endl;
-        //              Subtract start of interval from key index.
-        src << "        key_ix   -= dot( sums.xyz, vec3(1.0)-mask.xyz );"   << endl;
-        //              Scale texcoord shifts for next level
+    if( h->m_field.m_binary ) {
+        src << "    p = 0.5*(pa+pb);" << endl;
+    }
+    else if( cached ) {
+        if( position_only ) {
+            src << "    float va = HPMC_cell_v[ia];" << endl;
+            src << "    float vb = HPMC_cell_v[ib];" << endl;
+            src << "    float t = (va-HPMC_threshold)/(va-vb);" << endl;
+            src << "    p = mix(pa, pb, t );" << endl;
+            src << "    n = vec3(0.0);" << endl;
+        }
+        else {
+            if( !h->m_fetch.m_gradient ) {
+                src << "    float va = HPMC_cell_v[ia];" << endl;
+                src << "    vec3 na = HPMC_cell_f[ia];" << endl;
+                src << "    vec3 nb = HPMC_cell_f[ib];" << endl;
+                src << "    float t = (va-HPMC_threshold)/(va-dot(na,axis));" << endl;
+            }
+            else {
+                src << "    vec4 fa = HPMC_cell_g[ia];" << endl;
+                src << "    vec4 fb = HPMC_cell_g[ib];" << endl;
+                src << "    vec3 na = fa.xyz;" << endl;
+                src << "    vec3 nb = fb.xyz;" << endl;
+                src << "    float t = (fa.w-HPMC_threshold)/(fa.w-fb.w);" << endl;
+            }
+            src << "    p = mix(pa, pb, t );" << endl;
+            src << "    n = vec3(HPMC_threshold)-mix(na, nb,t);" << endl;
+        }
+    }
+    else if( position_only ) {
+        src << "    float va = HPMC_sample( pa );" << endl;
+        src << "    float vb = HPMC_sample( pb );" << endl;
+        src << "    float t = (va-HPMC_threshold)/(va-vb);" << endl;
+        src << "    p = mix(pa, pb, t );" << endl;
+        src << "    n = vec3(0.0);" << endl;
+    }
+    else {
+        if( !h->m_fetch.m_gradient ) {
+            //          If we don't have gradient info, we approximate the gradient using forward
+            //          differences. The sample at pb is one of the forward samples at pa, so we
+            //          save one texture lookup.
+            src << "    float va = HPMC_sample( pa );"                          << endl;
+            src << "    vec3 na = vec3( HPMC_sample( pa + vec3( 1.0/HPMC_FUNC_X_F, 0.0, 0.0 ) )," << endl;
+            src << "                    HPMC_sample( pa + vec3( 0.0, 1.0/HPMC_FUNC_Y_F, 0.0 ) )," << endl;
+            src << "                    HPMC_sample( pa + vec3( 0.0, 0.0, 1.0 ) ) );" << endl;
+            src << "    vec3 nb = vec3( HPMC_sample( pb + vec3( 1.0/HPMC_FUNC_X_F, 0.0, 0.0 ) )," << endl;
+            src << "                    HPMC_sample( pb + vec3( 0.0, 1.0/HPMC_FUNC_Y_F, 0.0 ) )," << endl;
+            src << "                    HPMC_sample( pb + vec3( 0.0, 0.0, 1.0 ) ) );" << endl;
+            //          Solve linear equation to approximate point that edge pierces iso-surface.
+            src << "    float t = (va-HPMC_threshold)/(va-dot(na,axis));"       << endl;
+        }
+        else {
+            //          If we have gradient info, sample pa and pb.
+            src << "    vec4 fa = HPMC_sampleGrad( pa );"                       << endl;
+            src << "    vec3 na = fa.xyz;"                                      << endl;
+            src << "    float va = fa.w;"                                       << endl;
+            src << "    vec4 fb = HPMC_sampleGrad( pb );"                       << endl;
+            src << "    vec3 nb = fb.xyz;"                                      << endl;
+            src << "    float vb = fb.w;"                                       << endl;
+            //          Solve linear equation to approximate point that edge pierces iso-surface.
+            src << "    float t = (va-HPMC_threshold)/(va-vb);"                 << endl;
+        }
+        src << "    p = mix(pa, pb, t );"                                       << endl;
+        src << "    n = vec3(HPMC_threshold)-mix(na, nb,t);"                    << endl;
+    }
+    //          p.xy is in normalized texture coordinates, but z is an integer slice number.
+    //          First, remove texel center offset
+    src << "    p.xy -= vec2(0.5/HPMC_FUNC_X_F, 0.5/HPMC_FUNC_Y_F );"       << endl;
+    //          And rescale such that domain fits extent.
+    src << "    p *= vec3( HPMC_GRID_EXT_X_F * HPMC_FUNC_X_F/(HPMC_CELLS_X_F-0.0)," << endl;
+    src << "               HPMC_GRID_EXT_Y_F * HPMC_FUNC_Y_F/(HPMC_CELLS_Y_F-0.0)," << endl;
+    src << "               HPMC_GRID_EXT_Z_F * 1.0/(HPMC_CELLS_Z_F) );"     << endl;
+    src << "    n *= vec3( HPMC_GRID_EXT_X_F/HPMC_CELLS_X_F,"               << endl;
+    src << "               HPMC_GRID_EXT_Y_F/HPMC_CELLS_Y_F,"               << endl;
+    src << "               HPMC_GRID_EXT_Z_F/HPMC_CELLS_Z_F );"             << endl;
+    return src.str();
+}
+
+static std::string
+HPMCgenerateExtractNormalFunction( struct HPMCHistoPyramid* h, bool position_only );
+
+// -----------------------------------------------------------------------------
+/** extractCell and extractCellTriangle, see HPMCsetTraversalHandleCells.
+  *
+  * Uses HPMC_traverse and the edge decode of HPMCgenerateExtractVertexFunction.
+  * The field at the corners of the cell (and the forward samples or the
+  * gradients when normals are needed) is fetched once by extractCell, and
+  * extractCellTriangle interpolates along the edges from these values. The
+  * sample positions are the same as in HPMC_edgeVertex, so the vertices are
+  * the same as those of extractTriangle.
+  */
+static std::string
+HPMCgenerateExtractCellFunctions( struct HPMCHistoPyramid* h, bool position_only )
+{
+    stringstream src;
+    const bool binary = h->m_field.m_binary;
+    const bool forward = !binary && !position_only && !h->m_fetch.m_gradient;
+    const bool gradient = !binary && !position_only && h->m_fetch.m_gradient;
+
+    src << "// generated by HPMCgenerateExtractCellFunctions" << endl;
+    //      State of the cell found by extractCell. Corner c is at offset
+    //      (c&1, (c>>1)&1, c>>2) from base.
+    src << "float HPMC_cell_val;" << endl;
+    src << "vec3  HPMC_cell_base;" << endl;
+    if( gradient ) {
+        src << "vec4  HPMC_cell_g[8];" << endl;
+    }
+    else if( !binary ) {
+        src << "float HPMC_cell_v[8];" << endl;
+    }
+    if( forward ) {
+        src << "vec3  HPMC_cell_f[8];" << endl;
+    }
+    src << "int" << endl;
+    src << "extractCell()" << endl;
+    src << "{" << endl;
+    src << "    float key_ix = 3.0*( float( gl_PrimitiveIDIn ) + HPMC_key_offset );" << endl;
+    src << "    float count;" << endl;
+    src << "    HPMC_traverse( key_ix, HPMC_cell_val, count, HPMC_cell_base );" << endl;
+    //          Only the invocation of the first triangle of a cell emits it.
+    src << "    if( key_ix > 0.0 ) {" << endl;
+    src << "        return 0;" << endl;
+    src << "    }" << endl;
+    if( !binary ) {
+        src << "    const vec3 d = vec3(1.0/HPMC_FUNC_X_F, 1.0/HPMC_FUNC_Y_F, 1.0);" << endl;
+        src << "    for(int c=0; c<8; c++) {" << endl;
+        src << "        vec3 pa = HPMC_cell_base + d*vec3( float(c&1), float((c>>1)&1), float(c>>2) );" << endl;
+        if( gradient ) {
+            src << "        HPMC_cell_g[c] = HPMC_sampleGrad( pa );" << endl;
+        }
+        else {
+            src << "        HPMC_cell_v[c] = HPMC_sample( pa );" << endl;
+        }
+        src << "    }" << endl;
+    }
+    if( forward ) {
+        //      The forward sample of a corner is the next corner, except on
+        //      the far faces of the cell.
+        src << "    for(int c=0; c<8; c++) {" << endl;
+        src << "        vec3 pa = HPMC_cell_base + d*vec3( float(c&1), float((c>>1)&1), float(c>>2) );" << endl;
+        src << "        HPMC_cell_f[c] = vec3( (c&1)==0 ? HPMC_cell_v[c+1] : HPMC_sample( pa + vec3( 1.0/HPMC_FUNC_X_F, 0.0, 0.0 ) )," << endl;
+        src << "                               (c&2)==0 ? HPMC_cell_v[c+2] : HPMC_sample( pa + vec3( 0.0, 1.0/HPMC_FUNC_Y_F, 0.0 ) )," << endl;
+        src << "                               (c&4)==0 ? HPMC_cell_v[c+4] : HPMC_sample( pa + vec3( 0.0, 0.0, 1.0 ) ) );" << endl;
+        src << "    }" << endl;
+    }
+    src << "    return int( count ) / 3;" << endl;
+    src << "}" << endl;
+    //      Vertex key_ix of the cell found by extractCell.
+    src << "void" << endl;
+    src << "HPMC_cellVertex( float key_ix, out vec3 p, out vec3 n )" << endl;
+    src << "{" << endl;
+    src << "    vec4 edge = HPMC_edge( HPMC_cell_val, key_ix );" << endl;
+    if( binary ) {
+        src << "    n = 2.0*fract(edge.xyz)-vec3(1.0);" << endl;
+        src << "    edge = floor(edge);" << endl;
+    }
+    src << "    vec3 shift = edge.xyz;" << endl;
+    src << "    vec3 axis = vec3( equal(vec3(0.0, 1.0, 2.0), vec3(edge.w)) );" << endl;
+    src << "    vec3 pa = HPMC_cell_base" << endl;
+    src << "            + vec3(1.0/HPMC_FUNC_X_F, 1.0/HPMC_FUNC_Y_F, 1.0)*shift;" << endl;
+    src << "    vec3 pb = pa" << endl;
+    src << "            + vec3(1.0/HPMC_FUNC_X_F, 1.0/HPMC_FUNC_Y_F, 1.0)*axis;" << endl;
+    if( !binary ) {
+        src << "    int ia = int( dot( shift, vec3(1.0, 2.0, 4.0) ) );" << endl;
+        src << "    int ib = ia + int( dot( axis, vec3(1.0, 2.0, 4.0) ) );" << endl;
+    }
+    src << HPMCgenerateEdgeIntersection( h, position_only, true );
+    src << "}" << endl;
+    src << "void" << endl;
+    src << "extractCellTriangle( int i, out vec3 p0, out vec3 n0, out vec3 p1, out vec3 n1, out vec3 p2, out vec3 n2 )" << endl;
+    src << "{" << endl;
+    src << "    float k = 3.0*float(i);" << endl;
+    src << "    HPMC_cellVertex( k,     p0, n0 );" << endl;
+    src << "    HPMC_cellVertex( k+1.0, p1, n1 );" << endl;
+    src << "    HPMC_cellVertex( k+2.0, p2, n2 );" << endl;
+    src << "}" << endl;
+    if( position_only ) {
+        src << "void" << endl;
+        src << "extractCellTriangle( int i, out vec3 p0, out vec3 p1, out vec3 p2 )" << endl;
+        src << "{" << endl;
+        src << "    vec3 n0, n1, n2;" << endl;
+        src << "    extractCellTriangle( i, p0, n0, p1, n1, p2, n2 );" << endl;
+        src << "}" << endl;
+    }
+    return src.str();
+}
+
+// -----------------------------------------------------------------------------
+/** Shared memory copy of the upper HistoPyramid levels for compute traversal.
+  *
+  * HPMC_loadCache must be called by all invocations of a work group before
+  * traversal. The levels are cached top-down as long as they fit in
+  * HPMC_TRAVERSAL_CACHE_SIZE texels, the remaining levels are fetched from
+  * the texture as usual.
+  */
+static std::string
+HPMCgenerateTraversalCache( struct HPMCHistoPyramid* h )
+{
+    stringstream src;
+    const GLsizei n = HPMC_COMPUTE_GROUP_SIZE*HPMC_COMPUTE_GROUP_SIZE;
+
+    if( h->m_hp5.m_enabled ) {
+        //      The HP5 levels above the base level are stored contiguously
+        //      from the top, starting at texel 1.
+        const HPMCHistoPyramid::HP5& hp5 = h->m_hp5;
+        GLsizei end = 1;
+        for( GLsizei k=(GLsizei)hp5.m_count.size()-1; k>0; k-- ) {
+            if( hp5.m_offset[k] + hp5.m_count[k] - 1 > HPMC_TRAVERSAL_CACHE_SIZE ) {
+                break;
+            }
+            end = hp5.m_offset[k] + hp5.m_count[k];
+        }
+        src << "shared vec4 HPMC_cache[" << std::max( end-1, 1 ) << "];" << endl;
+        src << "void" << endl;
+        src << "HPMC_loadCache()" << endl;
+        src << "{" << endl;
+        src << "    for( int i=int(gl_LocalInvocationIndex); i<" << (end-1) << "; i+=" << n << " ) {" << endl;
+        src << "        HPMC_cache[i] = texelFetch( HPMC_histopyramid, 1+i );" << endl;
+        src << "    }" << endl;
+        src << "    barrier();" << endl;
+        src << "}" << endl;
+        src << "vec4" << endl;
+        src << "HPMC_fetchHP5( int i )" << endl;
+        src << "{" << endl;
+        src << "    return i < " << end << " ? HPMC_cache[i-1] : texelFetch( HPMC_histopyramid, i );" << endl;
+        src << "}" << endl;
+    }
+    else {
+        //      Level i has 2^(l2-i) x 2^(l2-i) texels, the base level (which
+        //      holds the MC codes) is never cached.
+        const GLsizei l2 = h->m_histopyramid.m_size_l2;
+        GLsizei total = 0;
+        GLsizei lowest = l2+1;
+        for( GLsizei i=l2; i>0; i-- ) {
+            GLsizei d = 1<<(l2-i);
+            if( total + d*d > HPMC_TRAVERSAL_CACHE_SIZE ) {
+                break;
+            }
+            total += d*d;
+            lowest = i;
+        }
+        src << "shared vec3 HPMC_cache[" << std::max( total, 1 ) << "];" << endl;
+        src << "void" << endl;
+        src << "HPMC_loadCache()" << endl;
+        src << "{" << endl;
+        for( GLsizei i=l2, o=0; i>=lowest; i-- ) {
+            GLsizei d = 1<<(l2-i);
+            src << "    for( int t=int(gl_LocalInvocationIndex); t<" << d*d << "; t+=" << n << " ) {" << endl;
+            src << "        HPMC_cache[" << o << "+t] = texelFetch( HPMC_histopyramid, ivec2( t%" << d << ", t/" << d << " ), " << i << " ).xyz;" << endl;
+            src << "    }" << endl;
+            o += d*d;
+        }
+        src << "    barrier();" << endl;
+        src << "}" << endl;
+        src << "vec3" << endl;
+        src << "HPMC_fetchLevel( ivec2 texpos, int i )" << endl;
+        src << "{" << endl;
+        for( GLsizei i=l2, o=0; i>=lowest; i-- ) {
+            GLsizei d = 1<<(l2-i);
+            src << "    if( i == " << i << " ) return HPMC_cache[" << o << " + " << d << "*texpos.y + texpos.x];" << endl;
+            o += d*d;
+        }
+        src << "    return texelFetch( HPMC_histopyramid, texpos, i ).xyz;" << endl;
+        src << "}" << endl;
+    }
+    return src.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateExtractVertexFunction( struct HPMCHistoPyramid* h, bool position_only, bool triangles, bool cells, bool compute )
+{
+    stringstream src;
+
+    if( h->m_constants->m_target < HPMC_TARGET_GL30_GLSL130 ) {
+        src << "// generated by HPMCgenerateExtractShaderFunctions"             << endl;
+        src << "uniform sampler2D  HPMC_histopyramid;"                          << endl;
+        src << "uniform sampler2D  HPMC_edge_table;"                            << endl;
+        src << "uniform float      HPMC_key_offset;"                            << endl;
+        src << "uniform float      HPMC_threshold;"                             << endl;
+        src << "void"                                                           << endl;
+        src << "extractVertex( out vec3 a, out vec3 b, out vec3 p, out vec3 n )"                        << endl;
+        src << "{"                                                              << endl;
+        //          The key index is determined from offset + x-value of vertex.
+        src << "    float key_ix = gl_Vertex.x + HPMC_key_offset;"              << endl;
+        //          Start traversal in the center of the top element texel.
+        src << "    vec2 texpos = vec2(0.5);"                                   << endl;
+        //          Texel shift incremental offsets, one element per interval.
+        //          These are updated during traversal.
+        src << "    vec4 delta_x = vec4( -0.5,  0.5, -0.5, 0.25 );"             << endl;
+        src << "    vec4 delta_y = vec4(  0.0, -0.5,  0.0, 0.25 );"             << endl;
+        //          First, traverse the upper levels containing only integers
+        src << "    vec4 sums,hist,mask;"                                       << endl;
+        src << "    for(int i=HPMC_HP_SIZE_L2; i>0; i--) {"                     << endl;
+        //              Fetch sub-pyramid sums for the four sub-pyramids.
+        src << "        vec4 sums = texture2DLod( HPMC_histopyramid, texpos, float(i) );" << endl;
+        //              Determine accummulative sums, refer to key intervals in paper.
+        //              hist.x = sums.x
+        //              hist.y = sums.x + sums.y
+        //              hist.z = sums.x + sums.y + sums.z
+        //              hist.w = sums.x + sums.y + hist.z + sums.w
+        src << "        vec4 hist = sums;"                                      << endl;
+        src << "        hist.w   += hist.z;"                                    << endl;
+        src << "        hist.zw  += hist.yy;"                                   << endl;
+        src << "        hist.yzw += hist.xxx;"                                  << endl;
+        //              Build a mask for next step.
+        //              0      <= key < hist.x  ->  mask = (1,1,1,1)
+        //              hist.x <= key < hist.y  ->  mask = (0,1,1,1)
+        //              hist.y <= key < hist.z  ->  mask = (0,0,1,1)
+        //              hist.z <= key < hist.w  ->  mask = (0,0,0,1)
+        src << "        vec4 mask = vec4( lessThan( vec4(key_ix), hist ) );"    << endl;
+        //              Combine mask with delta_x and delta_y to shift texcoord
+        //              0      <= key < hist.x  ->  tp += ( -0.25, -0.25 )
+        //              hist.x <= key < hist.y  ->  tp += (  0.25, -0.25 )
+        //              hist.y <= key < hist.z  ->  tp += ( -0.25,  0.25 )
+        //              hist.z <= key < hist.w  ->  tp += (  0.25,  0.25 )
+        src << "        texpos   += vec2( dot( mask, delta_x ), dot( mask, delta_y ) );" << endl;
+        //              Subtract start of interval from key index.
+        src << "        key_ix   -= dot( sums.xyz, vec3(1.0)-mask.xyz );"   << endl;
+        //              Scale texcoord shifts for next level
         src << "        delta_x  *= 0.5;" << endl;
         src << "        delta_y  *= 0.5;" << endl;
         src << "    }" << endl;
@@ -370,7 +1187,8 @@ HPMCgenerateExtractVertexFunction( struct HPMCHistoPyramid* h )
         //          Scale tp from tile parameterization to scalar field parameterization
         src << "    vec2 tp = vec2( (2.0*HPMC_TILE_SIZE_X_F)/HPMC_FUNC_X_F," << endl;
         src << "                    (2.0*HPMC_TILE_SIZE_Y_F)/HPMC_FUNC_Y_F ) * fract(foo);" << endl;
-        src << "    float slice = dot( vec2(1.0,HPMC_TILES_X_F), floor(foo));" << endl;
+        src << "    vec2 tile = floor(foo);" << endl;
+        src << "    float slice = " << HPMCgenerateTileSlice( h, "tile" ) << ";" << endl;
         //          Now we have found the MC cell, next find which edge that this vertex lies on
         src << "    vec4 edge = texture2D( HPMC_edge_table, vec2((1.0/16.0)*(key_ix+0.5), val ) );" << endl;
         if( h->m_field.m_binary ) {
@@ -387,112 +1205,162 @@ HPMCgenerateExtractVertexFunction( struct HPMCHistoPyramid* h )
         src << "            + vec3(1.0/HPMC_FUNC_X_F, 1.0/HPMC_FUNC_Y_F, 1.0)*shift;" << endl;
         src << "    vec3 pb = pa" << endl;
         src << "            + vec3(1.0/HPMC_FUNC_X_F, 1.0/HPMC_FUNC_Y_F, 1.0)*axis;" << endl;
-        src << "    a = vec3(pa.x, pa.y, (pa.z+0.5)*(1.0/float(HPMC_FUNC_Z)) );" << endl;
-        src << "    b = vec3(pb.x, pb.y, (pb.z+0.5)*(1.0/float(HPMC_FUNC_Z)) );" << endl;
-        if( h->m_field.m_binary ) {
-            src << "    p = 0.5*(pa+pb);" << endl;
-        }
-        else {
-            if( !h->m_fetch.m_gradient ) {
-                //          If we don't have gradient info, we approximate the gradient using forward
-                //          differences. The sample at pb is one of the forward samples at pa, so we
-                //          save one texture lookup.
-                src << "    float va = HPMC_sample( pa );"                          << endl;
-                src << "    vec3 na = vec3( HPMC_sample( pa + vec3( 1.0/HPMC_FUNC_X_F, 0.0, 0.0 ) )," << endl;
-                src << "                    HPMC_sample( pa + vec3( 0.0, 1.0/HPMC_FUNC_Y_F, 0.0 ) )," << endl;
-                src << "                    HPMC_sample( pa + vec3( 0.0, 0.0, 1.0 ) ) );" << endl;
-                src << "    vec3 nb = vec3( HPMC_sample( pb + vec3( 1.0/HPMC_FUNC_X_F, 0.0, 0.0 ) )," << endl;
-                src << "                    HPMC_sample( pb + vec3( 0.0, 1.0/HPMC_FUNC_Y_F, 0.0 ) )," << endl;
-                src << "                    HPMC_sample( pb + vec3( 0.0, 0.0, 1.0 ) ) );" << endl;
-                //          Solve linear equation to approximate point that edge pierces iso-surface.
-                src << "    float t = (va-HPMC_threshold)/(va-dot(na,axis));"       << endl;
-            }
-            else {
-                //          If we have gradient info, sample pa and pb.
-                src << "    vec4 fa = HPMC_sampleGrad( pa );"                       << endl;
-                src << "    vec3 na = fa.xyz;"                                      << endl;
-                src << "    float va = fa.w;"                                       << endl;
-                src << "    vec4 fb = HPMC_sampleGrad( pb );"                       << endl;
-                src << "    vec3 nb = fb.xyz;"                                      << endl;
-                src << "    float vb = fb.w;"                                       << endl;
-                //          Solve linear equation to approximate point that edge pierces iso-surface.
-                src << "    float t = (va-HPMC_threshold)/(va-vb);"                 << endl;
-            }
-            src << "    p = mix(pa, pb, t );"                                       << endl;
-            src << "    n = vec3(HPMC_threshold)-mix(na, nb,t);"                    << endl;
-        }
-        //          p.xy is in normalized texture coordinates, but z is an integer slice number.
-        //          First, remove texel center offset
-        src << "    p.xy -= vec2(0.5/HPMC_FUNC_X_F, 0.5/HPMC_FUNC_Y_F );" << endl;
-        //          And rescale such that domain fits extent.
-        src << "    p *= vec3( HPMC_GRID_EXT_X_F * HPMC_FUNC_X_F/(HPMC_CELLS_X_F-0.0)," << endl;
-        src << "               HPMC_GRID_EXT_Y_F * HPMC_FUNC_Y_F/(HPMC_CELLS_Y_F-0.0)," << endl;
-        src << "               HPMC_GRID_EXT_Z_F * 1.0/(HPMC_CELLS_Z_F) );" << endl;
-        src << "    n *= vec3( HPMC_GRID_EXT_X_F/HPMC_CELLS_X_F,"  << endl;
-        src << "               HPMC_GRID_EXT_Y_F/HPMC_CELLS_Y_F,"  << endl;
-        src << "               HPMC_GRID_EXT_Z_F/HPMC_CELLS_Z_F );"<< endl;
+        src << "    a = " << HPMCgenerateLatticePosition( h, "pa" ) << ";" << endl;
+        src << "    b = " << HPMCgenerateLatticePosition( h, "pb" ) << ";" << endl;
+        src << HPMCgenerateEdgeIntersection( h, position_only, false );
         src << "}" << endl;
     }
     else {
+        const HPMCHistoPyramid::HP5& hp5 = h->m_hp5;
         src << "// generated by HPMCgenerateExtractShaderFunctions" << endl;
-        src << "uniform sampler2D  HPMC_histopyramid;" << endl;
-        src << "uniform sampler2D  HPMC_edge_table;" << endl;
+        if( hp5.m_enabled ) {
+            src << "uniform samplerBuffer HPMC_histopyramid;" << endl;
+        }
+        else {
+            src << "uniform sampler2D  HPMC_histopyramid;" << endl;
+        }
+        if( HPMCuseConstantEdgeTable( h ) ) {
+            src << HPMCgenerateConstantTables( h, true );
+        }
+        else {
+            src << "uniform sampler2D  HPMC_edge_table;" << endl;
+        }
         src << "uniform float      HPMC_key_offset;" << endl;
         src << "uniform float      HPMC_threshold;" << endl;
+        //      The number of vertices, i.e. the count of the top element.
+        src << "float" << endl;
+        src << "HPMC_vertexCount()" << endl;
+        src << "{" << endl;
+        if( hp5.m_enabled ) {
+            src << "    return texelFetch( HPMC_histopyramid, 0 ).x;" << endl;
+        }
+        else {
+            src << "    return dot( vec4(1.0), floor( texelFetch( HPMC_histopyramid, ivec2(0,0), HPMC_HP_SIZE_L2 ) ) );" << endl;
+        }
+        src << "}" << endl;
+        if( compute ) {
+            src << HPMCgenerateTraversalCache( h );
+        }
+        if( hp5.m_enabled ) {
+            //      One level of HP5 traversal. The children before the one
+            //      containing the key are those whose running sum of counts
+            //      is less or equal to the key, which requires no branching.
+            src << HPMCgenerateMortonDecodeFunction();
+            src << "void" << endl;
+            src << "HPMC_traverseHP5( inout float key_ix, inout int j, int offset )" << endl;
+            src << "{" << endl;
+            if( compute ) {
+                src << "    vec4 c = HPMC_fetchHP5( offset + j );" << endl;
+            }
+            else {
+                src << "    vec4 c = texelFetch( HPMC_histopyramid, offset + j );" << endl;
+            }
+            src << "    vec4 s = vec4( c.x, c.x+c.y, c.x+c.y+c.z, c.x+c.y+c.z+c.w );" << endl;
+            src << "    vec4 m = vec4( lessThanEqual( s, vec4( key_ix ) ) );" << endl;
+            src << "    key_ix -= dot( m, c );" << endl;
+            src << "    j = 5*j + int( dot( m, vec4(1.0) ) );" << endl;
+            src << "}" << endl;
+        }
+        const bool mask = h->m_codegen.m_mask_traversal;
+        if( mask ) {
+            //      Selects the child containing the key from the counts of
+            //      the first three children without branching, same as
+            //      HPMC_traverseHP5, and returns its index.
+            src << "int" << endl;
+            src << "HPMC_select( inout float key_ix, vec3 sums )" << endl;
+            src << "{" << endl;
+            src << "    vec3 m = vec3( lessThanEqual( vec3( sums.x, sums.x+sums.y, sums.x+sums.y+sums.z ), vec3( key_ix ) ) );" << endl;
+            src << "    key_ix -= dot( m, sums );" << endl;
+            src << "    return int( m.x+m.y+m.z );" << endl;
+            src << "}" << endl;
+        }
+        //      Walks the HistoPyramid down to the cell of a key index. On
+        //      return, key_ix is the index of the vertex within the cell, val
+        //      is the MC code, count is the vertex count of the cell and base
+        //      is the sample position of the cell.
         src << "void" << endl;
-        src << "extractVertex( out vec3 a, out vec3 b, out vec3 p, out vec3 n )" << endl;
+        src << "HPMC_traverse( inout float key_ix, out float val, out float count, out vec3 base )" << endl;
         src << "{" << endl;
-        src << "    float key_ix = gl_VertexID + HPMC_key_offset;"              << endl;
-        src << "    ivec2 texpos = ivec2(0,0);"                                 << endl;
-        // --- Traverse upper levels of histopyramid ---------------------------
-        src << "    for(int i=HPMC_HP_SIZE_L2; i>0; i--) {"                     << endl;
-        src << "        vec3 sums = texelFetch( HPMC_histopyramid, texpos, i ).xyz;"<< endl;
-        src << "        texpos = 2*texpos;"                                     << endl;
-        src << "        if( sums.x <= key_ix ) {"                               << endl;
-        src << "            key_ix -= sums.x;"                                  << endl;
-        src << "            if( sums.y <= key_ix ) {"                           << endl;
-        src << "                key_ix -= sums.y;"                              << endl;
-        src << "                if( sums.z <= key_ix ) {"                       << endl;
-        src << "                    key_ix -= sums.z;"                          << endl;
-        src << "                    texpos += ivec2(1,1);"                      << endl;
-        src << "                }"                                              << endl;
-        src << "                else {"                                         << endl;
-        src << "                    texpos += ivec2(0,1);"                      << endl;
-        src << "                }"                                              << endl;
-        src << "            }"                                                  << endl;
-        src << "            else {"                                             << endl;
-        src << "                texpos += ivec2(1,0);"                          << endl;
-        src << "            }"                                                  << endl;
-        src << "        }"                                                      << endl;
-        src << "    }"                                                          << endl;
+        if( hp5.m_enabled ) {
+            // --- Traverse HP5 levels down to a base level texel --------------
+            src << "    int j = 0;"                                             << endl;
+            for( GLsizei k=(GLsizei)hp5.m_count.size()-1; k>0; k-- ) {
+                src << "    HPMC_traverseHP5( key_ix, j, " << hp5.m_offset[k] << " );" << endl;
+            }
+            src << "    vec4 raw = texelFetch( HPMC_histopyramid, " << hp5.m_offset[0] << " + j );" << endl;
+            src << "    ivec2 texpos = HPMC_mortonDecode( j );"                 << endl;
+        }
+        else {
+            src << "    ivec2 texpos = ivec2(0,0);"                             << endl;
+            // --- Traverse upper levels of histopyramid -----------------------
+            src << "    for(int i=HPMC_HP_SIZE_L2; i>0; i--) {"                 << endl;
+            if( compute ) {
+                src << "        vec3 sums = HPMC_fetchLevel( texpos, i );"  << endl;
+            }
+            else {
+                src << "        vec3 sums = texelFetch( HPMC_histopyramid, texpos, i ).xyz;"<< endl;
+            }
+            src << "        texpos = 2*texpos;"                                 << endl;
+            if( mask ) {
+                src << "        int c = HPMC_select( key_ix, sums );"       << endl;
+                src << "        texpos += ivec2( c & 1, c >> 1 );"          << endl;
+            }
+            else {
+                src << "        if( sums.x <= key_ix ) {"                       << endl;
+                src << "            key_ix -= sums.x;"                          << endl;
+                src << "            if( sums.y <= key_ix ) {"                   << endl;
+                src << "                key_ix -= sums.y;"                      << endl;
+                src << "                if( sums.z <= key_ix ) {"               << endl;
+                src << "                    key_ix -= sums.z;"                  << endl;
+                src << "                    texpos += ivec2(1,1);"              << endl;
+                src << "                }"                                      << endl;
+                src << "                else {"                                 << endl;
+                src << "                    texpos += ivec2(0,1);"              << endl;
+                src << "                }"                                      << endl;
+                src << "            }"                                          << endl;
+                src << "            else {"                                     << endl;
+                src << "                texpos += ivec2(1,0);"                  << endl;
+                src << "            }"                                          << endl;
+                src << "        }"                                              << endl;
+            }
+            src << "    }"                                                      << endl;
+            src << "    vec4 raw = texelFetch( HPMC_histopyramid, texpos, 0 );" << endl;
+        }
         // --- Traverse base level of histopyramid -----------------------------
-        src << "    vec4 raw = texelFetch( HPMC_histopyramid, texpos, 0 );"     << endl;
         src << "    vec3 sums = floor(raw.xyz);"                                << endl;
         src << "    texpos = 2*texpos;"                                         << endl;
-        src << "    float nib;"                                                 << endl;
-        src << "    if( sums.x <= key_ix ) {"                                   << endl;
-        src << "        key_ix -= sums.x;"                                      << endl;
-        src << "        if( sums.y <= key_ix ) {"                               << endl;
-        src << "            key_ix -= sums.y;"                                  << endl;
-        src << "            if( sums.z <= key_ix ) {"                           << endl;
-        src << "                key_ix -= sums.z;"                              << endl;
-        src << "                texpos += ivec2(1,1);"                          << endl;
-        src << "                nib = raw.w;"                                   << endl;
-        src << "            }"                                                  << endl;
-        src << "            else {"                                             << endl;
-        src << "                texpos += ivec2(0,1);"                          << endl;
-        src << "                nib = raw.z;"                                   << endl;
-        src << "            }"                                                  << endl;
-        src << "        }"                                                      << endl;
-        src << "        else {"                                                 << endl;
-        src << "            texpos += ivec2(1,0);"                              << endl;
-        src << "            nib = raw.y;"                                       << endl;
-        src << "        }"                                                      << endl;
-        src << "    }"                                                          << endl;
-        src << "    else {"                                                     << endl;
-        src << "        nib = raw.x;"                                           << endl;
-        src << "    }"                                                          << endl;
-        src << "    float val = fract(nib);"                                    << endl;
+        if( mask ) {
+            src << "    int c = HPMC_select( key_ix, sums );"                   << endl;
+            src << "    texpos += ivec2( c & 1, c >> 1 );"                      << endl;
+            src << "    float nib = dot( raw, vec4( equal( ivec4(c), ivec4(0,1,2,3) ) ) );" << endl;
+        }
+        else {
+            src << "    float nib;"                                             << endl;
+            src << "    if( sums.x <= key_ix ) {"                               << endl;
+            src << "        key_ix -= sums.x;"                                  << endl;
+            src << "        if( sums.y <= key_ix ) {"                           << endl;
+            src << "            key_ix -= sums.y;"                              << endl;
+            src << "            if( sums.z <= key_ix ) {"                       << endl;
+            src << "                key_ix -= sums.z;"                          << endl;
+            src << "                texpos += ivec2(1,1);"                      << endl;
+            src << "                nib = raw.w;"                               << endl;
+            src << "            }"                                              << endl;
+            src << "            else {"                                         << endl;
+            src << "                texpos += ivec2(0,1);"                      << endl;
+            src << "                nib = raw.z;"                               << endl;
+            src << "            }"                                              << endl;
+            src << "        }"                                                  << endl;
+            src << "        else {"                                             << endl;
+            src << "            texpos += ivec2(1,0);"                          << endl;
+            src << "            nib = raw.y;"                                   << endl;
+            src << "        }"                                                  << endl;
+            src << "    }"                                                      << endl;
+            src << "    else {"                                                 << endl;
+            src << "        nib = raw.x;"                                       << endl;
+            src << "    }"                                                      << endl;
+        }
+        src << "    val = fract(nib);"                                          << endl;
+        src << "    count = floor(nib);"                                        << endl;
         // --- Determine position ----------------------------------------------
         src << "    vec2 baz = vec2(texpos) + vec2(0.5);"                       << endl;
         src << "    vec2 bar = " << (0.5f/(h->m_histopyramid.m_size)) << "*baz;"<<endl;
@@ -500,9 +1368,29 @@ HPMCgenerateExtractVertexFunction( struct HPMCHistoPyramid* h )
         //          Scale tp from tile parameterization to scalar field parameterization
         src << "    vec2 tp = vec2( (2.0*HPMC_TILE_SIZE_X_F)/HPMC_FUNC_X_F," << endl;
         src << "                    (2.0*HPMC_TILE_SIZE_Y_F)/HPMC_FUNC_Y_F ) * fract(foo);" << endl;
-        src << "    float slice = dot( vec2(1.0,HPMC_TILES_X_F), floor(foo));" << endl;
+        src << "    vec2 tile = floor(foo);" << endl;
+        src << "    float slice = " << HPMCgenerateTileSlice( h, "tile" ) << ";" << endl;
+        src << "    base = vec3(tp, slice);"                                    << endl;
+        src << "}"                                                              << endl;
+        //      The edge decode entry of vertex key_ix of a cell with MC code
+        //      val.
+        src << "vec4" << endl;
+        src << "HPMC_edge( float val, float key_ix )" << endl;
+        src << "{" << endl;
+        if( HPMCuseConstantEdgeTable( h ) ) {
+            src << "    return HPMC_cellEdge( val, key_ix );" << endl;
+        }
+        else {
+            src << "    return texture2D( HPMC_edge_table, vec2((1.0/16.0)*(key_ix+0.5), val ) );" << endl;
+        }
+        src << "}" << endl;
+        //      The vertex with index key_ix within the cell found by
+        //      HPMC_traverse.
+        src << "void" << endl;
+        src << "HPMC_edgeVertex( float key_ix, float val, vec3 base, out vec3 a, out vec3 b, out vec3 p, out vec3 n )" << endl;
+        src << "{" << endl;
         //          Now we have found the MC cell, next find which edge that this vertex lies on
-        src << "    vec4 edge = texture2D( HPMC_edge_table, vec2((1.0/16.0)*(key_ix+0.5), val ) );" << endl;
+        src << "    vec4 edge = HPMC_edge( val, key_ix );" << endl;
 
         if( h->m_field.m_binary ) {
             src << "n = 2.0*fract(edge.xyz)-vec3(1.0);" << endl;
@@ -512,57 +1400,86 @@ HPMCgenerateExtractVertexFunction( struct HPMCHistoPyramid* h )
         src << "    vec3 shift = edge.xyz;"                                     << endl;
         src << "    vec3 axis = vec3( equal(vec3(0.0, 1.0, 2.0), vec3(edge.w)) );" << endl;
         //          Calculate sample positions of the two end-points of the edge.
-        src << "    vec3 pa = vec3(tp, slice)"                                  << endl;
+        src << "    vec3 pa = base"                                             << endl;
         src << "            + vec3(1.0/HPMC_FUNC_X_F, 1.0/HPMC_FUNC_Y_F, 1.0)*shift;" << endl;
         src << "    vec3 pb = pa"                                               << endl;
         src << "            + vec3(1.0/HPMC_FUNC_X_F, 1.0/HPMC_FUNC_Y_F, 1.0)*axis;" << endl;
-        src << "    a = vec3(pa.x, pa.y, (pa.z+0.5)*(1.0/float(HPMC_FUNC_Z)) );" << endl;
-        src << "    b = vec3(pb.x, pb.y, (pb.z+0.5)*(1.0/float(HPMC_FUNC_Z)) );" << endl;
-        if( h->m_field.m_binary ) {
-            src << "    p = 0.5*(pa+pb);" << endl;
+        src << "    a = " << HPMCgenerateLatticePosition( h, "pa" ) << ";" << endl;
+        src << "    b = " << HPMCgenerateLatticePosition( h, "pb" ) << ";" << endl;
+        src << HPMCgenerateEdgeIntersection( h, position_only, false );
+        src << "}"                                                              << endl;
+        //      Extracts the vertex with a given key index, also used by
+        //      passes that visit several vertices per invocation.
+        src << "void" << endl;
+        src << "HPMC_extractVertexAt( float key_ix, out vec3 a, out vec3 b, out vec3 p, out vec3 n )" << endl;
+        src << "{" << endl;
+        src << "    float val, count;" << endl;
+        src << "    vec3 base;" << endl;
+        src << "    HPMC_traverse( key_ix, val, count, base );" << endl;
+        src << "    HPMC_edgeVertex( key_ix, val, base, a, b, p, n );" << endl;
+        src << "}" << endl;
+        //      Extracts the triangle whose first vertex has a given key index.
+        //      The vertex count of a cell is a multiple of three, so the three
+        //      vertices are in the same cell, and the walk is done once.
+        src << "void" << endl;
+        src << "HPMC_extractTriangleAt( float key_ix, out vec3 p0, out vec3 n0, out vec3 p1, out vec3 n1, out vec3 p2, out vec3 n2 )" << endl;
+        src << "{" << endl;
+        src << "    float val, count;" << endl;
+        src << "    vec3 base, a, b;" << endl;
+        src << "    HPMC_traverse( key_ix, val, count, base );" << endl;
+        src << "    HPMC_edgeVertex( key_ix,     val, base, a, b, p0, n0 );" << endl;
+        src << "    HPMC_edgeVertex( key_ix+1.0, val, base, a, b, p1, n1 );" << endl;
+        src << "    HPMC_edgeVertex( key_ix+2.0, val, base, a, b, p2, n2 );" << endl;
+        src << "}" << endl;
+        if( compute ) {
+            //      The compute extraction shader walks and decodes edges
+            //      directly, see HPMCgenerateComputeExtractionShader.
+            return src.str();
         }
-        else {
-            if( !h->m_fetch.m_gradient ) {
-                //          If we don't have gradient info, we approximate the gradient using forward
-                //          differences. The sample at pb is one of the forward samples at pa, so we
-                //          save one texture lookup.
-                src << "    float va = HPMC_sample( pa );"                          << endl;
-                src << "    vec3 na = vec3( HPMC_sample( pa + vec3( 1.0/HPMC_FUNC_X_F, 0.0, 0.0 ) )," << endl;
-                src << "                    HPMC_sample( pa + vec3( 0.0, 1.0/HPMC_FUNC_Y_F, 0.0 ) )," << endl;
-                src << "                    HPMC_sample( pa + vec3( 0.0, 0.0, 1.0 ) ) );" << endl;
-                src << "    vec3 nb = vec3( HPMC_sample( pb + vec3( 1.0/HPMC_FUNC_X_F, 0.0, 0.0 ) )," << endl;
-                src << "                    HPMC_sample( pb + vec3( 0.0, 1.0/HPMC_FUNC_Y_F, 0.0 ) )," << endl;
-                src << "                    HPMC_sample( pb + vec3( 0.0, 0.0, 1.0 ) ) );" << endl;
-                //          Solve linear equation to approximate point that edge pierces iso-surface.
-                src << "    float t = (va-HPMC_threshold)/(va-dot(na,axis));"       << endl;
-            }
-            else {
-                //          If we have gradient info, sample pa and pb.
-                src << "    vec4 fa = HPMC_sampleGrad( pa );"                       << endl;
-                src << "    vec3 na = fa.xyz;"                                      << endl;
-                src << "    float va = fa.w;"                                       << endl;
-                src << "    vec4 fb = HPMC_sampleGrad( pb );"                       << endl;
-                src << "    vec3 nb = fb.xyz;"                                      << endl;
-                src << "    float vb = fb.w;"                                       << endl;
-                //          Solve linear equation to approximate point that edge pierces iso-surface.
-                src << "    float t = (va-HPMC_threshold)/(va-vb);"                 << endl;
+        if( cells ) {
+            src << HPMCgenerateExtractCellFunctions( h, position_only );
+            return src.str() + HPMCgenerateExtractNormalFunction( h, position_only );
+        }
+        if( triangles ) {
+            //      One geometry shader invocation per input point and
+            //      triangle, see HPMCsetTraversalHandleTriangles.
+            src << "void" << endl;
+            src << "extractTriangle( out vec3 p0, out vec3 n0, out vec3 p1, out vec3 n1, out vec3 p2, out vec3 n2 )" << endl;
+            src << "{" << endl;
+            src << "    float key_ix = 3.0*( float( gl_PrimitiveIDIn ) + HPMC_key_offset );" << endl;
+            src << "    HPMC_extractTriangleAt( key_ix, p0, n0, p1, n1, p2, n2 );" << endl;
+            src << "}" << endl;
+            if( position_only ) {
+                src << "void" << endl;
+                src << "extractTriangle( out vec3 p0, out vec3 p1, out vec3 p2 )" << endl;
+                src << "{" << endl;
+                src << "    vec3 n0, n1, n2;" << endl;
+                src << "    extractTriangle( p0, n0, p1, n1, p2, n2 );" << endl;
+                src << "}" << endl;
             }
-            src << "    p = mix(pa, pb, t );"                                       << endl;
-            src << "    n = vec3(HPMC_threshold)-mix(na, nb,t);"                    << endl;
+            return src.str() + HPMCgenerateExtractNormalFunction( h, position_only );
         }
-        
-        //          p.xy is in normalized texture coordinates, but z is an integer slice number.
-        //          First, remove texel center offset
-        src << "    p.xy -= vec2(0.5/HPMC_FUNC_X_F, 0.5/HPMC_FUNC_Y_F );"       << endl;
-        //          And rescale such that domain fits extent.
-        src << "    p *= vec3( HPMC_GRID_EXT_X_F * HPMC_FUNC_X_F/(HPMC_CELLS_X_F-0.0)," << endl;
-        src << "               HPMC_GRID_EXT_Y_F * HPMC_FUNC_Y_F/(HPMC_CELLS_Y_F-0.0)," << endl;
-        src << "               HPMC_GRID_EXT_Z_F * 1.0/(HPMC_CELLS_Z_F) );"     << endl;
-        src << "    n *= vec3( HPMC_GRID_EXT_X_F/HPMC_CELLS_X_F,"               << endl;
-        src << "               HPMC_GRID_EXT_Y_F/HPMC_CELLS_Y_F,"               << endl;
-        src << "               HPMC_GRID_EXT_Z_F/HPMC_CELLS_Z_F );"             << endl;
+        src << "void" << endl;
+        src << "extractVertex( out vec3 a, out vec3 b, out vec3 p, out vec3 n )" << endl;
+        src << "{" << endl;
+        if( h->m_constants->m_target < HPMC_TARGET_GL40_GLSL400 ) {
+            src << "    float key_ix = gl_VertexID + HPMC_key_offset;"          << endl;
+        }
+        else {
+            //      Indirect extraction spawns full batches as instances, and
+            //      the remaining tail as a single batch tagged by a negative
+            //      key offset. The start of the tail is N - (N mod batch size),
+            //      where N is the vertex count in the top element.
+            src << "    float key_ix = float( gl_VertexID + "
+                << h->m_codegen.m_batch << "*gl_InstanceID ) + HPMC_key_offset;" << endl;
+            src << "    if( HPMC_key_offset < 0.0 ) {"                          << endl;
+            src << "        float n = HPMC_vertexCount();"                      << endl;
+            src << "        key_ix = float( gl_VertexID ) + n - mod( n, "
+                << h->m_codegen.m_batch << ".0 );"                              << endl;
+            src << "    }"                                                      << endl;
+        }
+        src << "    HPMC_extractVertexAt( key_ix, a, b, p, n );"                << endl;
         src << "}"                                                              << endl;
-
     }
     src << "void"                                                           << endl;
     src << "extractVertex( out vec3 p, out vec3 n )"                        << endl;
@@ -570,5 +1487,735 @@ HPMCgenerateExtractVertexFunction( struct HPMCHistoPyramid* h )
     src << "    vec3 a, b;"                                                 << endl;
     src << "    extractVertex( a, b, p, n );"                               << endl;
     src << "}"                                                              << endl;
+    if( position_only ) {
+        src << "void" << endl;
+        src << "extractVertex( out vec3 p )" << endl;
+        src << "{" << endl;
+        src << "    vec3 a, b, n;" << endl;
+        src << "    extractVertex( a, b, p, n );" << endl;
+        src << "}" << endl;
+    }
+    return src.str() + HPMCgenerateExtractNormalFunction( h, position_only );
+}
+
+// -----------------------------------------------------------------------------
+/** extractNormal, see HPMCsetTraversalHandlePositionOnly. */
+static std::string
+HPMCgenerateExtractNormalFunction( struct HPMCHistoPyramid* h, bool position_only )
+{
+    stringstream src;
+
+    if( position_only ) {
+        //      The normal at a vertex p of extractVertex. The edge of p is
+        //      recovered from the cell coordinates of p, where only the
+        //      coordinate along the edge is fractional, and the normal is
+        //      interpolated along the edge as in a full traversal.
+        src << "vec3" << endl;
+        src << "extractNormal( vec3 p )" << endl;
+        src << "{" << endl;
+        src << "    const vec3 scale = vec3( HPMC_GRID_EXT_X_F/HPMC_CELLS_X_F," << endl;
+        src << "                             HPMC_GRID_EXT_Y_F/HPMC_CELLS_Y_F," << endl;
+        src << "                             HPMC_GRID_EXT_Z_F/HPMC_CELLS_Z_F );" << endl;
+        src << "    vec3 q = p/scale;" << endl;
+        src << "    vec3 r = floor( q + vec3(0.5) );" << endl;
+        src << "    vec3 e = abs( q - r );" << endl;
+        src << "    vec3 axis = ( e.x >= max( e.y, e.z ) ) ? vec3( 1.0, 0.0, 0.0 ) :" << endl;
+        src << "                ( e.y >= e.z ) ? vec3( 0.0, 1.0, 0.0 ) : vec3( 0.0, 0.0, 1.0 );" << endl;
+        src << "    vec3 qa = mix( r, floor( q ), axis );" << endl;
+        src << "    float t = dot( q - qa, axis );" << endl;
+        src << "    vec3 pa = vec3( (qa.xy+vec2(0.5))*vec2( 1.0/HPMC_FUNC_X_F, 1.0/HPMC_FUNC_Y_F ), qa.z );" << endl;
+        src << "    vec3 pb = pa + vec3( 1.0/HPMC_FUNC_X_F, 1.0/HPMC_FUNC_Y_F, 1.0 )*axis;" << endl;
+        //      Binary fields do not set the threshold uniform.
+        std::string threshold = h->m_field.m_binary ? "0.5" : "HPMC_threshold";
+        if( h->m_fetch.m_gradient ) {
+            src << "    vec3 na = HPMC_sampleGrad( pa ).xyz;" << endl;
+            src << "    vec3 nb = HPMC_sampleGrad( pb ).xyz;" << endl;
+        }
+        else {
+            src << "    vec3 na = vec3( HPMC_sample( pa + vec3( 1.0/HPMC_FUNC_X_F, 0.0, 0.0 ) )," << endl;
+            src << "                    HPMC_sample( pa + vec3( 0.0, 1.0/HPMC_FUNC_Y_F, 0.0 ) )," << endl;
+            src << "                    HPMC_sample( pa + vec3( 0.0, 0.0, 1.0 ) ) );" << endl;
+            src << "    vec3 nb = vec3( HPMC_sample( pb + vec3( 1.0/HPMC_FUNC_X_F, 0.0, 0.0 ) )," << endl;
+            src << "                    HPMC_sample( pb + vec3( 0.0, 1.0/HPMC_FUNC_Y_F, 0.0 ) )," << endl;
+            src << "                    HPMC_sample( pb + vec3( 0.0, 0.0, 1.0 ) ) );" << endl;
+        }
+        src << "    vec3 n = vec3(" << threshold << ")-mix( na, nb, t );" << endl;
+        src << "    return n*scale;" << endl;
+        src << "}" << endl;
+    }
+    return src.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateRayCastFunction( struct HPMCHistoPyramid* h )
+{
+    stringstream src;
+
+    //      The levels where a texel covers a square of cells within a single
+    //      slice, i.e. not larger than a tile. With HP5, only the base level
+    //      of the HP tex is built.
+    int levels = 0;
+    while( !h->m_hp5.m_enabled &&
+           ((2<<levels) <= h->m_tiling.m_tile_size[0]) &&
+           ((2<<levels) <= h->m_tiling.m_tile_size[1]) )
+    {
+        levels++;
+    }
+    const HPMCHistoPyramid::Field::Sampled& sampled = h->m_field.m_sampled;
+    //      Every step leaves a box of cells through one of its faces.
+    int steps = 2*(sampled.m_cells[0] + sampled.m_cells[1] + sampled.m_cells[2]) + 8;
+
+    src << "// generated by HPMCgenerateRayCastFunction" << endl;
+    src << "uniform sampler2D  HPMC_histopyramid;" << endl;
+    if( h->m_field.m_binary ) {
+        src << "const float        HPMC_threshold = 0.5;" << endl;
+    }
+    else {
+        src << "uniform float      HPMC_threshold;" << endl;
+    }
+    src << "#define HPMC_RAY_LEVELS     " << levels << endl;
+    src << "#define HPMC_RAY_STEPS      " << steps << endl;
+    src << "#define HPMC_RAY_SUBSTEPS   4" << endl;
+    src << "#define HPMC_RAY_BISECTIONS 6" << endl;
+    //      The tile of a slice, the inverse of HPMCgenerateTileSlice.
+    src << "ivec2" << endl;
+    src << "HPMC_sliceTile( int slice )" << endl;
+    src << "{" << endl;
+    if( !h->m_tiling.m_morton ) {
+        src << "    return ivec2( slice % HPMC_TILES_X, slice / HPMC_TILES_X );" << endl;
+    }
+    else {
+        int p = 0;
+        int q = 0;
+        int a = 0;
+        int b = 0;
+        while( (1<<p) < h->m_tiling.m_tile_size[0] ) p++;
+        while( (1<<q) < h->m_tiling.m_tile_size[1] ) q++;
+        while( (1<<a) < h->m_tiling.m_layout[0] ) a++;
+        while( (1<<b) < h->m_tiling.m_layout[1] ) b++;
+        src << "    ivec2 tile = ivec2( 0 );" << endl;
+        for(int i=0; i<a; i++) {
+            int w = i + std::max( 0, i+p-q );
+            src << "    tile.x |= ((slice >> " << w << ") & 1) << " << i << ";" << endl;
+        }
+        for(int i=0; i<b; i++) {
+            int w = i + std::max( 0, i+q-p+1 );
+            src << "    tile.y |= ((slice >> " << w << ") & 1) << " << i << ";" << endl;
+        }
+        src << "    return tile;" << endl;
+    }
+    src << "}" << endl;
+    //      Sample position of corner k of cell c, where lattice sample
+    //      (i,j,k) is at (i,j,k) in cell coordinates. Bit 0, 1 and 2 of k
+    //      select the x, y and z side of the cell, as for extractCell.
+    src << "vec3" << endl;
+    src << "HPMC_rayCorner( ivec3 c, int k )" << endl;
+    src << "{" << endl;
+    src << "    vec3 q = vec3( c + ivec3( k & 1, (k>>1) & 1, (k>>2) & 1 ) );" << endl;
+    src << "    return vec3( (q.xy+vec2(0.5))*vec2( 1.0/HPMC_FUNC_X_F, 1.0/HPMC_FUNC_Y_F ), q.z );" << endl;
+    src << "}" << endl;
+    //      Field value relative to the iso-value at f in [0,1]^3 within a
+    //      cell, interpolated trilinearly from the corner values v. Along
+    //      the edges, this is the linear interpolation of extractVertex.
+    src << "float" << endl;
+    src << "HPMC_rayValue( float v[8], vec3 f )" << endl;
+    src << "{" << endl;
+    src << "    vec4 x = mix( vec4( v[0], v[2], v[4], v[6] ), vec4( v[1], v[3], v[5], v[7] ), f.x );" << endl;
+    src << "    vec2 y = mix( x.xz, x.yw, f.y );" << endl;
+    src << "    return mix( y.x, y.y, f.z );" << endl;
+    src << "}" << endl;
+    //      Ray parameter where the ray leaves the box [lo,hi].
+    src << "float" << endl;
+    src << "HPMC_rayExit( vec3 o, vec3 inv_d, vec3 lo, vec3 hi )" << endl;
+    src << "{" << endl;
+    src << "    vec3 t = ( mix( lo, hi, step( vec3(0.0), inv_d ) ) - o )*inv_d;" << endl;
+    src << "    return min( t.x, min( t.y, t.z ) );" << endl;
+    src << "}" << endl;
+    //      First crossing along origin + t*direction for t in [0,t_max].
+    src << "bool" << endl;
+    src << "HPMC_castRay( vec3 origin, vec3 direction, float t_max, out float t_hit, out vec3 p, out vec3 n )" << endl;
+    src << "{" << endl;
+    src << "    const vec3 cells = vec3( HPMC_CELLS_X_F, HPMC_CELLS_Y_F, HPMC_CELLS_Z_F );" << endl;
+    src << "    const vec3 scale = vec3( HPMC_GRID_EXT_X_F, HPMC_GRID_EXT_Y_F, HPMC_GRID_EXT_Z_F )/cells;" << endl;
+    src << "    const ivec2 tile_size = ivec2( HPMC_TILE_SIZE_X, HPMC_TILE_SIZE_Y );" << endl;
+    //          March in cell coordinates, clipped to the grid.
+    src << "    vec3 o = origin/scale;" << endl;
+    src << "    vec3 d = direction/scale;" << endl;
+    src << "    vec3 inv_d = 1.0/( d + 1e-20*vec3( equal( d, vec3(0.0) ) ) );" << endl;
+    src << "    vec3 ta = -o*inv_d;" << endl;
+    src << "    vec3 tb = (cells-o)*inv_d;" << endl;
+    src << "    vec3 tmin = min( ta, tb );" << endl;
+    src << "    vec3 tmax = max( ta, tb );" << endl;
+    src << "    float t = max( 0.0, max( tmin.x, max( tmin.y, tmin.z ) ) );" << endl;
+    src << "    float t_end = min( t_max, min( tmax.x, min( tmax.y, tmax.z ) ) );" << endl;
+    src << "    for(int i=0; (i<HPMC_RAY_STEPS) && (t<t_end); i++) {" << endl;
+    src << "        ivec3 c = clamp( ivec3( floor( o + (t+1e-4)*d ) ), ivec3(0)," << endl;
+    src << "                         ivec3( HPMC_CELLS_X-1, HPMC_CELLS_Y-1, HPMC_CELLS_Z-1 ) );" << endl;
+    src << "        ivec2 texel = tile_size*HPMC_sliceTile( c.z ) + c.xy/2;" << endl;
+    //              Find the coarsest level that is empty around the cell.
+    src << "        int l = HPMC_RAY_LEVELS;" << endl;
+    src << "        while( (l >= 0) &&" << endl;
+    src << "               (dot( vec4(1.0), floor( texelFetch( HPMC_histopyramid, texel >> l, l ) ) ) > 0.0) ) {" << endl;
+    src << "            l--;" << endl;
+    src << "        }" << endl;
+    src << "        vec3 lo = vec3( c );" << endl;
+    src << "        vec3 hi = lo + vec3( 1.0 );" << endl;
+    src << "        bool occupied = false;" << endl;
+    src << "        if( l >= 0 ) {" << endl;
+    //                  Skip the empty square of cells of this slice.
+    src << "            int s = 2 << l;" << endl;
+    src << "            lo.xy = vec2( s*(c.xy/s) );" << endl;
+    src << "            hi.xy = lo.xy + vec2( float(s) );" << endl;
+    src << "        }" << endl;
+    src << "        else {" << endl;
+    src << "            vec4 raw = texelFetch( HPMC_histopyramid, texel, 0 );" << endl;
+    src << "            occupied = floor( raw[ (c.x & 1) + 2*(c.y & 1) ] ) > 0.0;" << endl;
+    src << "        }" << endl;
+    src << "        float t_exit = min( t_end, HPMC_rayExit( o, inv_d, lo, hi ) );" << endl;
+    src << "        if( occupied ) {" << endl;
+    //                  The lattice is point sampled, so fetch the corners of
+    //                  the cell once, look for a sign change of their
+    //                  interpolant, and refine it by bisection and a final
+    //                  secant step.
+    src << "            float v[8];" << endl;
+    src << "            for(int k=0; k<8; k++) {" << endl;
+    src << "                v[k] = HPMC_sample( HPMC_rayCorner( c, k ) ) - HPMC_threshold;" << endl;
+    src << "            }" << endl;
+    src << "            float t0 = t;" << endl;
+    src << "            float f0 = HPMC_rayValue( v, o + t0*d - lo );" << endl;
+    src << "            for(int j=1; j<=HPMC_RAY_SUBSTEPS; j++) {" << endl;
+    src << "                float t1 = mix( t, t_exit, float(j)/float(HPMC_RAY_SUBSTEPS) );" << endl;
+    src << "                float f1 = HPMC_rayValue( v, o + t1*d - lo );" << endl;
+    src << "                if( (f0 < 0.0) != (f1 < 0.0) ) {" << endl;
+    src << "                    for(int k=0; k<HPMC_RAY_BISECTIONS; k++) {" << endl;
+    src << "                        float tm = 0.5*(t0+t1);" << endl;
+    src << "                        float fm = HPMC_rayValue( v, o + tm*d - lo );" << endl;
+    src << "                        if( (f0 < 0.0) != (fm < 0.0) ) {" << endl;
+    src << "                            t1 = tm;" << endl;
+    src << "                            f1 = fm;" << endl;
+    src << "                        }" << endl;
+    src << "                        else {" << endl;
+    src << "                            t0 = tm;" << endl;
+    src << "                            f0 = fm;" << endl;
+    src << "                        }" << endl;
+    src << "                    }" << endl;
+    src << "                    t_hit = mix( t0, t1, f0/(f0-f1) );" << endl;
+    src << "                    vec3 q = o + t_hit*d;" << endl;
+    //                          Normal as in extractVertex, interpolated
+    //                          trilinearly from the corners.
+    src << "                    vec3 f = q - lo;" << endl;
+    src << "                    n = vec3(HPMC_threshold);" << endl;
+    src << "                    for(int k=0; k<8; k++) {" << endl;
+    src << "                        vec3 w = mix( vec3(1.0)-f, f, vec3( ivec3( k & 1, (k>>1) & 1, (k>>2) & 1 ) ) );" << endl;
+    src << "                        vec3 pa = HPMC_rayCorner( c, k );" << endl;
+    if( h->m_fetch.m_gradient && !h->m_field.m_binary ) {
+        src << "                        n -= (w.x*w.y*w.z)*HPMC_sampleGrad( pa ).xyz;" << endl;
+    }
+    else {
+        //                      The forward differences reuse the corners.
+        src << "                        n -= (w.x*w.y*w.z)*vec3(" << endl;
+        src << "                            (k&1)==0 ? v[k+1]+HPMC_threshold : HPMC_sample( pa + vec3( 1.0/HPMC_FUNC_X_F, 0.0, 0.0 ) )," << endl;
+        src << "                            (k&2)==0 ? v[k+2]+HPMC_threshold : HPMC_sample( pa + vec3( 0.0, 1.0/HPMC_FUNC_Y_F, 0.0 ) )," << endl;
+        src << "                            (k&4)==0 ? v[k+4]+HPMC_threshold : HPMC_sample( pa + vec3( 0.0, 0.0, 1.0 ) ) );" << endl;
+    }
+    src << "                    }" << endl;
+    src << "                    p = q*scale;" << endl;
+    src << "                    n *= scale;" << endl;
+    src << "                    return true;" << endl;
+    src << "                }" << endl;
+    src << "                t0 = t1;" << endl;
+    src << "                f0 = f1;" << endl;
+    src << "            }" << endl;
+    src << "        }" << endl;
+    src << "        t = max( t_exit, t + 1e-4 );" << endl;
+    src << "    }" << endl;
+    src << "    return false;" << endl;
+    src << "}" << endl;
+    src << "bool" << endl;
+    src << "castRay( vec3 origin, vec3 direction, out vec3 p, out vec3 n )" << endl;
+    src << "{" << endl;
+    src << "    float t;" << endl;
+    src << "    return HPMC_castRay( origin, direction, 1e30, t, p, n );" << endl;
+    src << "}" << endl;
+    //      First crossing on the segment from a to b, t is in [0,1].
+    src << "bool" << endl;
+    src << "castSegment( vec3 a, vec3 b, out float t, out vec3 p, out vec3 n )" << endl;
+    src << "{" << endl;
+    src << "    return HPMC_castRay( a, b-a, 1.0, t, p, n );" << endl;
+    src << "}" << endl;
+    return src.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateCollisionQueryShader()
+{
+    stringstream src;
+
+    src << "// generated by HPMCgenerateCollisionQueryShader" << endl;
+    src << "in vec4            HPMC_segment_a;" << endl;
+    src << "in vec4            HPMC_segment_b;" << endl;
+    src << "flat out vec4      HPMC_hit_position;" << endl;
+    src << "flat out vec4      HPMC_hit_normal;" << endl;
+    src << "void" << endl;
+    src << "main()" << endl;
+    src << "{" << endl;
+    src << "    float t;" << endl;
+    src << "    vec3 p, n;" << endl;
+    src << "    if( castSegment( HPMC_segment_a.xyz, HPMC_segment_b.xyz, t, p, n ) ) {" << endl;
+    src << "        HPMC_hit_position = vec4( p, t );" << endl;
+    src << "        HPMC_hit_normal   = vec4( n, 1.0 );" << endl;
+    src << "    }" << endl;
+    src << "    else {" << endl;
+    src << "        HPMC_hit_position = vec4( HPMC_segment_b.xyz, 1.0 );" << endl;
+    src << "        HPMC_hit_normal   = vec4( 0.0 );" << endl;
+    src << "    }" << endl;
+    src << "    gl_Position = vec4( 0.0 );" << endl;
+    src << "}" << endl;
+    return src.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateComputeExtractionShader()
+{
+    stringstream src;
+
+    src << "// generated by HPMCgenerateComputeExtractionShader" << endl;
+    src << "layout(local_size_x=" << HPMC_COMPUTE_GROUP_SIZE*HPMC_COMPUTE_GROUP_SIZE << ") in;" << endl;
+    src << "layout(std430, binding=0) writeonly buffer HPMC_PositionBuffer {" << endl;
+    src << "    float HPMC_positions[];" << endl;
+    src << "};" << endl;
+    src << "layout(std430, binding=1) writeonly buffer HPMC_NormalBuffer {" << endl;
+    src << "    float HPMC_normals[];" << endl;
+    src << "};" << endl;
+    src << "layout(std430, binding=2) writeonly buffer HPMC_IndexBuffer {" << endl;
+    src << "    uint HPMC_indices[];" << endl;
+    src << "};" << endl;
+    src << "layout(std430, binding=3) writeonly buffer HPMC_IndirectBuffer {" << endl;
+    src << "    uint HPMC_command[5];" << endl;
+    src << "};" << endl;
+    src << "uniform float      HPMC_capacity;" << endl;
+    src << "uniform bool       HPMC_write_normals;" << endl;
+    src << "uniform bool       HPMC_write_indices;" << endl;
+    src << "uniform bool       HPMC_write_command;" << endl;
+    src << "void" << endl;
+    src << "main()" << endl;
+    src << "{" << endl;
+    //      All invocations take part in filling the cache before any returns.
+    src << "    HPMC_loadCache();" << endl;
+    src << "    float m = min( HPMC_capacity, HPMC_vertexCount() );" << endl;
+    //      The vertex count of the extraction, as a command for both
+    //      glDrawArraysIndirect and glDrawElementsIndirect.
+    src << "    if( HPMC_write_command && (gl_GlobalInvocationID.x == 0u) ) {" << endl;
+    src << "        HPMC_command[0] = 3u*uint( m/3.0 );" << endl;
+    src << "        HPMC_command[1] = 1u;" << endl;
+    src << "        HPMC_command[2] = 0u;" << endl;
+    src << "        HPMC_command[3] = 0u;" << endl;
+    src << "        HPMC_command[4] = 0u;" << endl;
+    src << "    }" << endl;
+    src << "    float k = 3.0*float( gl_GlobalInvocationID.x );" << endl;
+    src << "    if( k+3.0 > m ) {" << endl;
+    src << "        return;" << endl;
+    src << "    }" << endl;
+    src << "    float key_ix = k;" << endl;
+    src << "    float val, count;" << endl;
+    src << "    vec3 base, a, b, p[3], n[3];" << endl;
+    src << "    HPMC_traverse( key_ix, val, count, base );" << endl;
+    src << "    for( int i=0; i<3; i++ ) {" << endl;
+    src << "        HPMC_edgeVertex( key_ix+float(i), val, base, a, b, p[i], n[i] );" << endl;
+    src << "    }" << endl;
+    //      A vertex on the same edge as an earlier vertex of the cell gets the
+    //      index of the earlier vertex, which has the same position and
+    //      normal. Vertices on edges shared with other cells are not welded.
+    src << "    if( HPMC_write_indices ) {" << endl;
+    src << "        float first = k - key_ix;" << endl;
+    src << "        for( int i=0; i<3; i++ ) {" << endl;
+    src << "            float j = key_ix + float(i);" << endl;
+    src << "            vec4 e = HPMC_edge( val, j );" << endl;
+    src << "            float w = j;" << endl;
+    src << "            for( float q=0.0; q<j; q+=1.0 ) {" << endl;
+    src << "                if( HPMC_edge( val, q ) == e ) {" << endl;
+    src << "                    w = q;" << endl;
+    src << "                    break;" << endl;
+    src << "                }" << endl;
+    src << "            }" << endl;
+    src << "            HPMC_indices[ 3u*gl_GlobalInvocationID.x + uint(i) ] = uint( first + w );" << endl;
+    src << "        }" << endl;
+    src << "    }" << endl;
+    src << "    uint o = 9u*gl_GlobalInvocationID.x;" << endl;
+    src << "    for( int i=0; i<3; i++ ) {" << endl;
+    src << "        HPMC_positions[ o+0u ] = p[i].x;" << endl;
+    src << "        HPMC_positions[ o+1u ] = p[i].y;" << endl;
+    src << "        HPMC_positions[ o+2u ] = p[i].z;" << endl;
+    src << "        if( HPMC_write_normals ) {" << endl;
+    src << "            HPMC_normals[ o+0u ] = n[i].x;" << endl;
+    src << "            HPMC_normals[ o+1u ] = n[i].y;" << endl;
+    src << "            HPMC_normals[ o+2u ] = n[i].z;" << endl;
+    src << "        }" << endl;
+    src << "        o += 3u;" << endl;
+    src << "    }" << endl;
+    src << "}" << endl;
+    return src.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateVertexPackFunction( HPMCVertexFormat format )
+{
+    stringstream src;
+
+    src << "// generated by HPMCgenerateVertexPackFunction" << endl;
+    src << "uvec3" << endl;
+    src << "extractVertexPacked()" << endl;
+    src << "{" << endl;
+    src << "    vec3 p, n;" << endl;
+    src << "    extractVertex( p, n );" << endl;
+    if( format == HPMC_VERTEX_FORMAT_HALF ) {
+        src << "    return uvec3( packHalf2x16( p.xy )," << endl;
+        src << "                  packHalf2x16( vec2( p.z, n.x ) )," << endl;
+        src << "                  packHalf2x16( n.yz ) );" << endl;
+    }
+    else if( format == HPMC_VERTEX_FORMAT_QUANTIZED ) {
+        //      Position as 16-bit fixed point relative to the grid extent,
+        //      and normal as two 16-bit octahedron coordinates.
+        src << "    p *= vec3( 1.0/HPMC_GRID_EXT_X_F, 1.0/HPMC_GRID_EXT_Y_F, 1.0/HPMC_GRID_EXT_Z_F );" << endl;
+        src << "    n *= 1.0/max( 1e-20, abs(n.x) + abs(n.y) + abs(n.z) );" << endl;
+        src << "    vec2 o = n.xy;" << endl;
+        src << "    if( n.z < 0.0 ) {" << endl;
+        src << "        o = (1.0-abs(n.yx))*vec2( n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0 );" << endl;
+        src << "    }" << endl;
+        src << "    return uvec3( packUnorm2x16( p.xy )," << endl;
+        src << "                  packUnorm2x16( vec2( p.z, 0.0 ) )," << endl;
+        src << "                  packSnorm2x16( o ) );" << endl;
+    }
+    src << "}" << endl;
+    return src.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateVertexUnpackFunction( struct HPMCHistoPyramid* h, HPMCVertexFormat format )
+{
+    stringstream src;
+
+    src << "// generated by HPMCgenerateVertexUnpackFunction" << endl;
+    src << "void" << endl;
+    src << "unpackVertex( uvec3 v, out vec3 p, out vec3 n )" << endl;
+    src << "{" << endl;
+    if( format == HPMC_VERTEX_FORMAT_HALF ) {
+        src << "    vec2 b = unpackHalf2x16( v.y );" << endl;
+        src << "    p = vec3( unpackHalf2x16( v.x ), b.x );" << endl;
+        src << "    n = vec3( b.y, unpackHalf2x16( v.z ) );" << endl;
+    }
+    else if( format == HPMC_VERTEX_FORMAT_QUANTIZED ) {
+        //      The grid extent is baked in, as the HPMC defines are absent.
+        src << "    p = vec3( unpackUnorm2x16( v.x ), unpackUnorm2x16( v.y ).x )*" << endl;
+        src << "        vec3( float(" << h->m_field.m_sampled.m_extent[0] << "), "
+            << "float(" << h->m_field.m_sampled.m_extent[1] << "), "
+            << "float(" << h->m_field.m_sampled.m_extent[2] << ") );" << endl;
+        src << "    vec2 o = unpackSnorm2x16( v.z );" << endl;
+        src << "    n = vec3( o, 1.0 - abs(o.x) - abs(o.y) );" << endl;
+        src << "    if( n.z < 0.0 ) {" << endl;
+        src << "        n.xy = (1.0-abs(o.yx))*vec2( o.x >= 0.0 ? 1.0 : -1.0, o.y >= 0.0 ? 1.0 : -1.0 );" << endl;
+        src << "    }" << endl;
+        src << "    n = normalize( n );" << endl;
+    }
+    src << "}" << endl;
+    return src.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateClusterShader( GLsizei triangles )
+{
+    stringstream src;
+
+    src << "// generated by HPMCgenerateClusterShader" << endl;
+    src << "uniform float      HPMC_capacity;" << endl;
+    src << "flat out vec4      HPMC_cluster_min;" << endl;
+    src << "flat out vec4      HPMC_cluster_max;" << endl;
+    src << "flat out vec4      HPMC_cluster_cone;" << endl;
+    src << "void" << endl;
+    src << "main()" << endl;
+    src << "{" << endl;
+    src << "    float n = min( HPMC_capacity, HPMC_vertexCount() );" << endl;
+    src << "    float beg = float( " << 3*triangles << "*gl_VertexID );" << endl;
+    src << "    float end = min( beg + " << 3*triangles << ".0, n );" << endl;
+    src << "    vec3 lo = vec3( 1e30 );" << endl;
+    src << "    vec3 hi = vec3( -1e30 );" << endl;
+    src << "    vec3 nlo = vec3( 1.0 );" << endl;
+    src << "    vec3 nhi = vec3( -1.0 );" << endl;
+    src << "    for( float k=beg; k<end; k+=3.0 ) {" << endl;
+    src << "        vec3 p0, p1, p2, n0, n1, n2;" << endl;
+    src << "        HPMC_extractTriangleAt( k, p0, n0, p1, n1, p2, n2 );" << endl;
+    src << "        lo = min( lo, min( p0, min( p1, p2 ) ) );" << endl;
+    src << "        hi = max( hi, max( p0, max( p1, p2 ) ) );" << endl;
+    //              Face normal, oriented along the vertex normals.
+    src << "        vec3 f = cross( p1-p0, p2-p0 );" << endl;
+    src << "        float l = length( f );" << endl;
+    src << "        if( l > 0.0 ) {" << endl;
+    src << "            f *= ( dot( f, n0+n1+n2 ) < 0.0 ? -1.0 : 1.0 )/l;" << endl;
+    src << "            nlo = min( nlo, f );" << endl;
+    src << "            nhi = max( nhi, f );" << endl;
+    src << "        }" << endl;
+    src << "    }" << endl;
+    //          The cone axis is the center of the bounding box of the face
+    //          normals. All normals are inside the box, so the smallest dot
+    //          product between the axis and a point in the box bounds the
+    //          angle of the cone.
+    src << "    vec3 axis = 0.5*(nlo+nhi);" << endl;
+    src << "    float cutoff = -1.0;" << endl;
+    src << "    if( all( lessThanEqual( nlo, nhi ) ) && (length( axis ) > 1e-6) ) {" << endl;
+    src << "        axis = normalize( axis );" << endl;
+    src << "        vec3 m = min( nlo*axis, nhi*axis );" << endl;
+    src << "        cutoff = max( -1.0, m.x + m.y + m.z );" << endl;
+    src << "    }" << endl;
+    src << "    else {" << endl;
+    src << "        axis = vec3( 0.0, 0.0, 1.0 );" << endl;
+    src << "    }" << endl;
+    src << "    HPMC_cluster_min  = vec4( lo, max( 0.0, end-beg )*(1.0/3.0) );" << endl;
+    src << "    HPMC_cluster_max  = vec4( hi, 0.0 );" << endl;
+    src << "    HPMC_cluster_cone = vec4( axis, cutoff );" << endl;
+    src << "    gl_Position = vec4( 0.0 );" << endl;
+    src << "}" << endl;
+    return src.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateStatisticsVertexShader( struct HPMCHistoPyramid* h )
+{
+    stringstream src;
+
+    src << "// generated by HPMCgenerateStatisticsVertexShader" << endl;
+    src << "uniform sampler2D  HPMC_histopyramid;" << endl;
+    src << "uniform int        HPMC_bounds;" << endl;
+    src << "flat out vec4      HPMC_stat;" << endl;
+    src << "void" << endl;
+    src << "main()" << endl;
+    src << "{" << endl;
+    //          Four points per base level texel for the histogram, one per
+    //          cell, and two for the bounds, the maximum and the negated
+    //          minimum over the active cells of the texel.
+    src << "    int texel = HPMC_bounds == 0 ? gl_VertexID / 4 : gl_VertexID / 2;" << endl;
+    src << "    int c = gl_VertexID % 4;" << endl;
+    src << "    int which = gl_VertexID % 2;" << endl;
+    src << "    ivec2 tc = ivec2( texel & ((1<<HPMC_HP_SIZE_L2)-1), texel >> HPMC_HP_SIZE_L2 );" << endl;
+    src << "    vec4 v = texelFetch( HPMC_histopyramid, tc, 0 );" << endl;
+    //          Neighbouring texels blend into different rows, and points of
+    //          inactive cells are placed outside the viewport.
+    src << "    float row = float( texel % " << HPMC_STATISTICS_ROWS << " );" << endl;
+    src << "    gl_Position = vec4( 2.0, (2.0*row+1.0)*(1.0/" << HPMC_STATISTICS_ROWS << ".0) - 1.0, 0.0, 1.0 );" << endl;
+    src << "    HPMC_stat = vec4( 0.0 );" << endl;
+    src << "    if( HPMC_bounds == 0 ) {" << endl;
+    src << "        if( v[c] >= 1.0 ) {" << endl;
+    //                  The MC case is stored in the fractional part.
+    src << "            float code = floor( 256.0*fract( v[c] ) );" << endl;
+    src << "            gl_Position.x = (2.0*code+1.0)*(1.0/258.0) - 1.0;" << endl;
+    src << "            HPMC_stat = vec4( 1.0 );" << endl;
+    src << "        }" << endl;
+    src << "    }" << endl;
+    src << "    else if( any( greaterThanEqual( v, vec4( 1.0 ) ) ) ) {" << endl;
+    src << "        vec2 tile = floor( vec2(tc)*vec2( 1.0/HPMC_TILE_SIZE_X_F, 1.0/HPMC_TILE_SIZE_Y_F ) );" << endl;
+    src << "        float slice = " << HPMCgenerateTileSlice( h, "tile" ) << ";" << endl;
+    src << "        vec3 base = vec3( 2.0*( vec2(tc) - vec2( HPMC_TILE_SIZE_X_F, HPMC_TILE_SIZE_Y_F )*tile ), slice );" << endl;
+    src << "        vec3 hi = vec3( -1e30 );" << endl;
+    src << "        vec3 lo = vec3( -1e30 );" << endl;
+    src << "        for( int k=0; k<4; k++ ) {" << endl;
+    src << "            if( v[k] >= 1.0 ) {" << endl;
+    src << "                vec3 cell = base + vec3( float(k & 1), float(k >> 1), 0.0 );" << endl;
+    src << "                hi = max( hi, cell );" << endl;
+    src << "                lo = max( lo, -cell );" << endl;
+    src << "            }" << endl;
+    src << "        }" << endl;
+    src << "        gl_Position.x = (2.0*float(256+which)+1.0)*(1.0/258.0) - 1.0;" << endl;
+    src << "        HPMC_stat = vec4( which == 0 ? hi : lo, 0.0 );" << endl;
+    src << "    }" << endl;
+    src << "}" << endl;
+    return src.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateStatisticsFragmentShader()
+{
+    stringstream src;
+
+    src << "// generated by HPMCgenerateStatisticsFragmentShader" << endl;
+    src << "flat in vec4       HPMC_stat;" << endl;
+    src << "void" << endl;
+    src << "main()" << endl;
+    src << "{" << endl;
+    src << "    gl_FragColor = HPMC_stat;" << endl;
+    src << "}" << endl;
+    return src.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateStatisticsGatherShader()
+{
+    stringstream src;
+
+    src << "// generated by HPMCgenerateStatisticsGatherShader" << endl;
+    src << "uniform sampler2D  HPMC_statistics;" << endl;
+    src << "void" << endl;
+    src << "main()" << endl;
+    src << "{" << endl;
+    //          Histogram bins are summed, the bounds are maxima.
+    src << "    int x = int( gl_FragCoord.x );" << endl;
+    src << "    vec4 s = texelFetch( HPMC_statistics, ivec2( x, 0 ), 0 );" << endl;
+    src << "    for( int r=1; r<" << HPMC_STATISTICS_ROWS << "; r++ ) {" << endl;
+    src << "        vec4 t = texelFetch( HPMC_statistics, ivec2( x, r ), 0 );" << endl;
+    src << "        s = x < 256 ? s + t : max( s, t );" << endl;
+    src << "    }" << endl;
+    src << "    gl_FragColor = s;" << endl;
+    src << "}" << endl;
+    return src.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateStatisticsComputeShader( struct HPMCHistoPyramid* h )
+{
+    stringstream src;
+
+    src << "// generated by HPMCgenerateStatisticsComputeShader" << endl;
+    src << "layout(local_size_x=" << HPMC_STATISTICS_GROUP_SIZE
+        << ", local_size_y=" << HPMC_STATISTICS_GROUP_SIZE << ") in;" << endl;
+    src << "uniform sampler2D  HPMC_histopyramid;" << endl;
+    src << "layout(std430, binding=0) buffer HPMC_StatisticsBuffer {" << endl;
+    src << "    uint  HPMC_histogram[256];" << endl;
+    src << "    int   HPMC_max_cell[4];" << endl;
+    src << "    int   HPMC_neg_min_cell[4];" << endl;
+    src << "};" << endl;
+    src << "shared uint        HPMC_local_histogram[256];" << endl;
+    src << "shared int         HPMC_local_bounds[6];" << endl;
+    src << "void" << endl;
+    src << "main()" << endl;
+    src << "{" << endl;
+    //          The work group has one invocation per histogram bin.
+    src << "    uint i = gl_LocalInvocationIndex;" << endl;
+    src << "    HPMC_local_histogram[i] = 0u;" << endl;
+    src << "    if( i < 6u ) {" << endl;
+    src << "        HPMC_local_bounds[i] = -2147483647;" << endl;
+    src << "    }" << endl;
+    src << "    memoryBarrierShared();" << endl;
+    src << "    barrier();" << endl;
+    src << "    ivec2 tc = ivec2( gl_GlobalInvocationID.xy );" << endl;
+    src << "    if( all( lessThan( tc, ivec2( 1<<HPMC_HP_SIZE_L2 ) ) ) ) {" << endl;
+    src << "        vec4 v = texelFetch( HPMC_histopyramid, tc, 0 );" << endl;
+    src << "        if( any( greaterThanEqual( v, vec4( 1.0 ) ) ) ) {" << endl;
+    src << "            vec2 tile = floor( vec2(tc)*vec2( 1.0/HPMC_TILE_SIZE_X_F, 1.0/HPMC_TILE_SIZE_Y_F ) );" << endl;
+    src << "            float slice = " << HPMCgenerateTileSlice( h, "tile" ) << ";" << endl;
+    src << "            ivec3 base = ivec3( 2.0*( vec2(tc) - vec2( HPMC_TILE_SIZE_X_F, HPMC_TILE_SIZE_Y_F )*tile ), slice );" << endl;
+    src << "            ivec3 hi = ivec3( -2147483647 );" << endl;
+    src << "            ivec3 lo = ivec3( -2147483647 );" << endl;
+    src << "            for( int k=0; k<4; k++ ) {" << endl;
+    src << "                if( v[k] >= 1.0 ) {" << endl;
+    //                          The MC case is stored in the fractional part.
+    src << "                    atomicAdd( HPMC_local_histogram[ int( 256.0*fract( v[k] ) ) ], 1u );" << endl;
+    src << "                    ivec3 cell = base + ivec3( k & 1, k >> 1, 0 );" << endl;
+    src << "                    hi = max( hi, cell );" << endl;
+    src << "                    lo = max( lo, -cell );" << endl;
+    src << "                }" << endl;
+    src << "            }" << endl;
+    src << "            for( int j=0; j<3; j++ ) {" << endl;
+    src << "                atomicMax( HPMC_local_bounds[j], hi[j] );" << endl;
+    src << "                atomicMax( HPMC_local_bounds[3+j], lo[j] );" << endl;
+    src << "            }" << endl;
+    src << "        }" << endl;
+    src << "    }" << endl;
+    src << "    memoryBarrierShared();" << endl;
+    src << "    barrier();" << endl;
+    //          One global atomic per non-empty bin and work group.
+    src << "    if( HPMC_local_histogram[i] != 0u ) {" << endl;
+    src << "        atomicAdd( HPMC_histogram[i], HPMC_local_histogram[i] );" << endl;
+    src << "    }" << endl;
+    src << "    if( i < 3u ) {" << endl;
+    src << "        atomicMax( HPMC_max_cell[i], HPMC_local_bounds[i] );" << endl;
+    src << "        atomicMax( HPMC_neg_min_cell[i], HPMC_local_bounds[3u+i] );" << endl;
+    src << "    }" << endl;
+    src << "}" << endl;
+    return src.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateCompactionBaseShader( struct HPMCCompaction* c )
+{
+    stringstream src;
+
+    src << "// generated by HPMCgenerateCompactionBaseShader" << endl;
+    src << "#define HPMC_DOMAIN_X      " << c->m_domain[0] << endl;
+    src << "#define HPMC_DOMAIN_Y      " << c->m_domain[1] << endl;
+    src << c->m_count_source << endl;
+    //      Elements outside the domain have no outputs.
+    src << "float" << endl;
+    src << "HPMC_countElement( ivec2 p )" << endl;
+    src << "{" << endl;
+    src << "    if( all( lessThan( p, ivec2( HPMC_DOMAIN_X, HPMC_DOMAIN_Y ) ) ) ) {" << endl;
+    src << "        return float( max( 0, HPMC_count( p ) ) );" << endl;
+    src << "    }" << endl;
+    src << "    return 0.0;" << endl;
+    src << "}" << endl;
+    src << "void" << endl;
+    src << "main()" << endl;
+    src << "{" << endl;
+    src << "    ivec2 p = 2*ivec2( gl_FragCoord.xy );" << endl;
+    src << "    gl_FragColor = vec4( HPMC_countElement( p + ivec2(0,0) )," << endl;
+    src << "                         HPMC_countElement( p + ivec2(1,0) )," << endl;
+    src << "                         HPMC_countElement( p + ivec2(0,1) )," << endl;
+    src << "                         HPMC_countElement( p + ivec2(1,1) ) );" << endl;
+    src << "}" << endl;
+    return src.str();
+}
+
+// -----------------------------------------------------------------------------
+std::string
+HPMCgenerateCompactionTraversalFunctions( struct HPMCCompaction* c )
+{
+    stringstream src;
+
+    //      Same traversal as HPMC_extractVertexAt, except that the base level
+    //      holds counts of elements instead of cells, and the remainder of the
+    //      key is the index among the outputs of the element.
+    src << "// generated by HPMCgenerateCompactionTraversalFunctions" << endl;
+    src << "uniform sampler2D  HPMC_compaction;" << endl;
+    src << "int" << endl;
+    src << "HPMC_compactionCount()" << endl;
+    src << "{" << endl;
+    src << "    return int( dot( vec4(1.0), texelFetch( HPMC_compaction, ivec2(0,0), " << c->m_size_l2 << " ) ) );" << endl;
+    src << "}" << endl;
+    src << "void" << endl;
+    src << "HPMC_compactionLookup( int index, out ivec2 p, out int sub_index )" << endl;
+    src << "{" << endl;
+    src << "    float key_ix = float( index );" << endl;
+    src << "    ivec2 texpos = ivec2(0,0);" << endl;
+    src << "    for(int i=" << c->m_size_l2 << "; i>=0; i--) {" << endl;
+    src << "        vec3 sums = texelFetch( HPMC_compaction, texpos, i ).xyz;" << endl;
+    src << "        texpos = 2*texpos;" << endl;
+    src << "        if( sums.x <= key_ix ) {" << endl;
+    src << "            key_ix -= sums.x;" << endl;
+    src << "            if( sums.y <= key_ix ) {" << endl;
+    src << "                key_ix -= sums.y;" << endl;
+    src << "                if( sums.z <= key_ix ) {" << endl;
+    src << "                    key_ix -= sums.z;" << endl;
+    src << "                    texpos += ivec2(1,1);" << endl;
+    src << "                }" << endl;
+    src << "                else {" << endl;
+    src << "                    texpos += ivec2(0,1);" << endl;
+    src << "                }" << endl;
+    src << "            }" << endl;
+    src << "            else {" << endl;
+    src << "                texpos += ivec2(1,0);" << endl;
+    src << "            }" << endl;
+    src << "        }" << endl;
+    src << "    }" << endl;
+    src << "    p = texpos;" << endl;
+    src << "    sub_index = int( key_ix );" << endl;
+    src << "}" << endl;
     return src.str();
 }
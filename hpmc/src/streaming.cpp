@@ -0,0 +1,415 @@
+/* -*- mode: C++; tab-width:4; c-basic-offset: 4; indent-tabs-mode:nil -*-
+ ***********************************************************************
+ *
+ *  File: streaming.cpp
+ *
+ *  Created: 17. October 2026
+ *
+ *  Version: $Id: $
+ *
+ *  Authors: Christopher Dyken <christopher.dyken@sintef.no>
+ *
+ *  This file is part of the HPMC library.
+ *  Copyright (C) 2009 by SINTEF.  All rights reserved.
+ *
+ *  This library is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License
+ *  ("GPL") version 2 as published by the Free Software Foundation.
+ *  See the file LICENSE.GPL at the root directory of this source
+ *  distribution for additional information about the GNU GPL.
+ *
+ *  For using HPMC with software that can not be combined with the
+ *  GNU GPL, please contact SINTEF for aquiring a commercial license
+ *  and support.
+ *
+ *  SINTEF, Pb 124 Blindern, N-0314 Oslo, Norway
+ *  http://www.sintef.no
+ *********************************************************************/
+
+#include <cstdlib>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <hpmc.h>
+#include <hpmc_internal.h>
+
+using std::cerr;
+using std::endl;
+using std::min;
+using std::swap;
+using std::vector;
+
+namespace {
+
+/** Corners of a cell in the numbering used by HPMC_triangle_table.
+  *
+  * The table uses the classic numbering where y and z are swapped relative to
+  * the lattice, the same reordering that remapCode applies on the GPU side.
+  */
+const int corners[8][3] =
+{
+    { 0, 0, 0 }, { 1, 0, 0 }, { 1, 0, 1 }, { 0, 0, 1 },
+    { 0, 1, 0 }, { 1, 1, 0 }, { 1, 1, 1 }, { 0, 1, 1 }
+};
+
+/** Dimensions and parameters of the lattice being extracted. */
+struct Lattice
+{
+    GLsizei             m_size[3];
+    GLfloat             m_scale[3];
+    GLfloat             m_threshold;
+};
+
+/** Vertices and triangles of the cell layers [z0,z1).
+  *
+  * The vertices on plane z0 are emitted first and those on plane z1 last, in
+  * the same order, such that the planes between slabs can be welded.
+  */
+struct Slab
+{
+    vector<GLfloat>     m_vertices;
+    vector<GLuint>      m_indices;
+    /** Number of vertices on the bottom plane. */
+    GLuint              m_bottom_count;
+    /** Index of the first vertex on the top plane. */
+    GLuint              m_top_begin;
+};
+
+/** Vertex indices of the intersected edges of one plane of the lattice. */
+struct PlaneCache
+{
+    /** Edges along x and y, indexed by the sample at the start of the edge. */
+    vector<GLuint>      m_edges[2];
+};
+
+/** Samples slice s at (i,j), clamping to the lattice like the texture fetch. */
+inline GLfloat
+sample( const Lattice& l, const GLfloat* s, GLsizei i, GLsizei j )
+{
+    return s[ min( j, l.m_size[1]-1 )*l.m_size[0] + min( i, l.m_size[0]-1 ) ];
+}
+
+/** Computes the vertex where an edge intersects the iso-surface.
+  *
+  * Mirrors extractVertex of the GPU path without gradients: the normal is the
+  * forward difference interpolated along the edge, and is not normalized.
+  *
+  * \param s  The slice holding the start of the edge and the two slices above.
+  */
+GLuint
+emitVertex( vector<GLfloat>&    vertices,
+            const Lattice&      l,
+            const GLfloat*      s[3],
+            GLsizei             i,
+            GLsizei             j,
+            GLsizei             k,
+            int                 axis )
+{
+    GLsizei ib = i + (axis==0 ? 1 : 0);
+    GLsizei jb = j + (axis==1 ? 1 : 0);
+    const GLfloat* sb = s[ axis==2 ? 1 : 0 ];
+    const GLfloat* sb_up = s[ axis==2 ? 2 : 1 ];
+
+    GLfloat va = sample( l, s[0], i, j );
+    GLfloat vb = sample( l, sb, ib, jb );
+    GLfloat na[3] = { sample( l, s[0], i+1, j ),
+                      sample( l, s[0], i, j+1 ),
+                      sample( l, s[1], i, j ) };
+    GLfloat nb[3] = { sample( l, sb, ib+1, jb ),
+                      sample( l, sb, ib, jb+1 ),
+                      sample( l, sb_up, ib, jb ) };
+    GLfloat t = (va-l.m_threshold)/(va-vb);
+
+    GLfloat n[3];
+    for(int c=0; c<3; c++) {
+        n[c] = l.m_scale[c]*( l.m_threshold - ((1.0f-t)*na[c] + t*nb[c]) );
+    }
+    GLfloat p[3] = { static_cast<GLfloat>( i ),
+                     static_cast<GLfloat>( j ),
+                     static_cast<GLfloat>( k ) };
+    p[axis] += t;
+
+    GLuint ix = static_cast<GLuint>( vertices.size()/6 );
+    for(int c=0; c<3; c++) {
+        vertices.push_back( n[c] );
+    }
+    for(int c=0; c<3; c++) {
+        vertices.push_back( l.m_scale[c]*p[c] );
+    }
+    return ix;
+}
+
+/** Computes the vertices on the x- and y-edges of plane k.
+  *
+  * \param s  Slice k and the slice above.
+  */
+void
+processPlane( PlaneCache&       cache,
+              vector<GLfloat>&  vertices,
+              const Lattice&    l,
+              const GLfloat*    s[3],
+              GLsizei           k )
+{
+    const GLsizei nx = l.m_size[0];
+    const GLsizei ny = l.m_size[1];
+    for(GLsizei j=0; j<ny; j++) {
+        for(GLsizei i=0; i<nx; i++) {
+            bool in = s[0][ j*nx+i ] < l.m_threshold;
+            if( i+1 < nx && in != (s[0][ j*nx+i+1 ] < l.m_threshold) ) {
+                cache.m_edges[0][ j*nx+i ] = emitVertex( vertices, l, s, i, j, k, 0 );
+            }
+            if( j+1 < ny && in != (s[0][ (j+1)*nx+i ] < l.m_threshold) ) {
+                cache.m_edges[1][ j*nx+i ] = emitVertex( vertices, l, s, i, j, k, 1 );
+            }
+        }
+    }
+}
+
+/** Fetches slice z into dst, or copies src if z is beyond the lattice. */
+bool
+fetchSlice( vector<GLfloat>&         dst,
+            const vector<GLfloat>&   src,
+            const Lattice&           l,
+            GLsizei                  z,
+            HPMCSliceFetchFunc       fetch,
+            void*                    data )
+{
+    if( z < l.m_size[2] ) {
+        return fetch( &dst[0], z, data );
+    }
+    dst = src;
+    return true;
+}
+
+/** Extracts the cell layers [z0,z1) with a window of three slices. */
+bool
+extractSlab( Slab&              slab,
+             const Lattice&     l,
+             GLsizei            z0,
+             GLsizei            z1,
+             HPMCSliceFetchFunc fetch,
+             void*              data )
+{
+    const GLsizei nx = l.m_size[0];
+    const GLsizei ny = l.m_size[1];
+    const size_t plane = static_cast<size_t>( nx )*ny;
+    vector<GLfloat>& vertices = slab.m_vertices;
+    vector<GLuint>& indices = slab.m_indices;
+
+    vector<GLfloat> window[3];
+    PlaneCache caches[2];
+    vector<GLuint> z_edges( plane );
+    for(int i=0; i<3; i++) {
+        window[i].resize( plane );
+    }
+    for(int i=0; i<2; i++) {
+        caches[i].m_edges[0].resize( plane );
+        caches[i].m_edges[1].resize( plane );
+    }
+    PlaneCache* bottom = &caches[0];
+    PlaneCache* top = &caches[1];
+
+    if( !fetch( &window[0][0], z0, data ) ||
+        !fetch( &window[1][0], z0+1, data ) ||
+        !fetchSlice( window[2], window[1], l, z0+2, fetch, data ) )
+    {
+        return false;
+    }
+    const GLfloat* s[3] = { &window[0][0], &window[1][0], &window[2][0] };
+    processPlane( *bottom, vertices, l, s, z0 );
+    slab.m_bottom_count = static_cast<GLuint>( vertices.size()/6 );
+
+    for(GLsizei k=z0; k<z1; k++) {
+        if( k > z0 ) {
+            swap( window[0], window[1] );
+            swap( window[1], window[2] );
+            if( !fetchSlice( window[2], window[1], l, k+2, fetch, data ) ) {
+                return false;
+            }
+            swap( bottom, top );
+        }
+        s[0] = &window[0][0];
+        s[1] = &window[1][0];
+        s[2] = &window[2][0];
+
+        // --- vertices on the z-edges between slice k and k+1 ----------------
+        for(GLsizei j=0; j<ny; j++) {
+            for(GLsizei i=0; i<nx; i++) {
+                if( (s[0][ j*nx+i ] < l.m_threshold) != (s[1][ j*nx+i ] < l.m_threshold) ) {
+                    z_edges[ j*nx+i ] = emitVertex( vertices, l, s, i, j, k, 2 );
+                }
+            }
+        }
+
+        // --- vertices on the x- and y-edges of slice k+1 --------------------
+        slab.m_top_begin = static_cast<GLuint>( vertices.size()/6 );
+        const GLfloat* s_top[3] = { s[1], s[2], s[2] };
+        processPlane( *top, vertices, l, s_top, k+1 );
+
+        // --- triangles of the cells between slice k and k+1 -----------------
+        for(GLsizei j=0; j+1<ny; j++) {
+            for(GLsizei i=0; i+1<nx; i++) {
+                int code = 0;
+                for(int q=0; q<8; q++) {
+                    const int* c = corners[q];
+                    if( s[c[2]][ (j+c[1])*nx + i+c[0] ] < l.m_threshold ) {
+                        code |= 1<<q;
+                    }
+                }
+                if( code == 0 || code == 255 ) {
+                    continue;
+                }
+                for(int e=0; e<16 && HPMC_triangle_table[code][e] != -1; e++) {
+                    const GLfloat* edge = HPMC_edge_table[ HPMC_triangle_table[code][e] ];
+                    GLsizei ix = ( j + static_cast<GLsizei>( edge[1] ) )*nx
+                               + i + static_cast<GLsizei>( edge[0] );
+                    int axis = static_cast<int>( edge[3] );
+                    if( axis == 2 ) {
+                        indices.push_back( z_edges[ ix ] );
+                    }
+                    else {
+                        PlaneCache* p = edge[2] > 0.5f ? top : bottom;
+                        indices.push_back( p->m_edges[axis][ ix ] );
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+} // of anonymous namespace
+
+// -----------------------------------------------------------------------------
+struct HPMCStreamingMesh*
+HPMCextractStreaming( GLsizei             size_x,
+                      GLsizei             size_y,
+                      GLsizei             size_z,
+                      GLfloat             extent_x,
+                      GLfloat             extent_y,
+                      GLfloat             extent_z,
+                      GLfloat             threshold,
+                      HPMCSliceFetchFunc  fetch,
+                      void*               data,
+                      GLsizei             slabs )
+{
+    if( size_x < 2 || size_y < 2 || size_z < 2 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: extractStreaming called with lattice size less than 2." << endl;
+#endif
+        return NULL;
+    }
+    if( fetch == NULL ) {
+#ifdef DEBUG
+        cerr << "HPMC error: extractStreaming called with fetch == NULL." << endl;
+#endif
+        return NULL;
+    }
+
+    Lattice l;
+    l.m_size[0] = size_x;
+    l.m_size[1] = size_y;
+    l.m_size[2] = size_z;
+    l.m_scale[0] = extent_x/(size_x-1);
+    l.m_scale[1] = extent_y/(size_y-1);
+    l.m_scale[2] = extent_z/(size_z-1);
+    l.m_threshold = threshold;
+
+    // Divide the cell layers into slabs, each slab has its own slice window.
+    GLsizei layers = size_z-1;
+    slabs = std::max( 1, min( slabs, layers ) );
+    vector<Slab> slab( slabs );
+    bool failed = false;
+
+#pragma omp parallel for schedule(dynamic)
+    for(int i=0; i<slabs; i++) {
+        GLsizei z0 = static_cast<GLsizei>( (static_cast<long long>( layers )*i)/slabs );
+        GLsizei z1 = static_cast<GLsizei>( (static_cast<long long>( layers )*(i+1))/slabs );
+        if( !extractSlab( slab[i], l, z0, z1, fetch, data ) ) {
+#pragma omp critical
+            failed = true;
+        }
+    }
+    if( failed ) {
+#ifdef DEBUG
+        cerr << "HPMC error: extractStreaming failed to fetch a slice." << endl;
+#endif
+        return NULL;
+    }
+
+    // Concatenate the slabs, offsetting the vertex indices. The bottom plane
+    // of a slab is the top plane of the previous slab, and the vertices on it
+    // are computed from the same samples, so they are welded.
+    struct HPMCStreamingMesh* m = new HPMCStreamingMesh;
+    size_t vertex_count = 0, index_count = 0;
+    for(GLsizei i=0; i<slabs; i++) {
+        vertex_count += slab[i].m_vertices.size() - (i > 0 ? 6*slab[i].m_bottom_count : 0);
+        index_count += slab[i].m_indices.size();
+    }
+    m->m_vertices.reserve( vertex_count );
+    m->m_indices.reserve( index_count );
+    GLuint seam = 0;
+    for(GLsizei i=0; i<slabs; i++) {
+        GLuint shared = i > 0 ? slab[i].m_bottom_count : 0;
+        GLuint offset = static_cast<GLuint>( m->m_vertices.size()/6 );
+        m->m_vertices.insert( m->m_vertices.end(),
+                              slab[i].m_vertices.begin() + 6*shared,
+                              slab[i].m_vertices.end() );
+        for(size_t j=0; j<slab[i].m_indices.size(); j++) {
+            GLuint ix = slab[i].m_indices[j];
+            m->m_indices.push_back( ix < shared ? seam + ix : offset + ix - shared );
+        }
+        seam = offset + slab[i].m_top_begin - shared;
+        vector<GLfloat>().swap( slab[i].m_vertices );
+        vector<GLuint>().swap( slab[i].m_indices );
+    }
+    return m;
+}
+
+// -----------------------------------------------------------------------------
+void
+HPMCdestroyStreamingMesh( struct HPMCStreamingMesh* m )
+{
+    delete m;
+}
+
+// -----------------------------------------------------------------------------
+GLsizei
+HPMCgetStreamingMeshVertexCount( struct HPMCStreamingMesh* m )
+{
+    if( m == NULL ) {
+        return 0;
+    }
+    return static_cast<GLsizei>( m->m_vertices.size()/6 );
+}
+
+// -----------------------------------------------------------------------------
+const GLfloat*
+HPMCgetStreamingMeshVertices( struct HPMCStreamingMesh* m )
+{
+    if( m == NULL || m->m_vertices.empty() ) {
+        return NULL;
+    }
+    return &m->m_vertices[0];
+}
+
+// -----------------------------------------------------------------------------
+GLsizei
+HPMCgetStreamingMeshTriangleCount( struct HPMCStreamingMesh* m )
+{
+    if( m == NULL ) {
+        return 0;
+    }
+    return static_cast<GLsizei>( m->m_indices.size()/3 );
+}
+
+// -----------------------------------------------------------------------------
+const GLuint*
+HPMCgetStreamingMeshIndices( struct HPMCStreamingMesh* m )
+{
+    if( m == NULL || m->m_indices.empty() ) {
+        return NULL;
+    }
+    return &m->m_indices[0];
+}
@@ -45,35 +45,42 @@ using std::endl;
 #endif
 
 // -----------------------------------------------------------------------------
-bool
-HPMCsetupTexAndFBOs( struct HPMCHistoPyramid* h )
+/** Frees the HP5 buffers and buffer textures of a HP. */
+static void
+HPMCfreeHP5Buffers( HPMCHistoPyramid::HistoPyramid& hp )
 {
-    if( h == NULL ) {
-#ifdef DEBUG
-        std::cerr << "HPMC error: setupTexAndFBOs called with NULL pointer." << std::endl;
-#endif
-        return false;
+    if( hp.m_hp5_tex != 0 ) {
+        glDeleteTextures( 1, &hp.m_hp5_tex );
+        hp.m_hp5_tex = 0;
     }
-    // --- if errors on state, we fail -----------------------------------------
-    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
-#ifdef DEBUG
-        cerr << "HPMC error: setupTexAndFBOs called with GL errors." << endl;
-#endif
-        return false;
+    if( hp.m_hp5_buf != 0 ) {
+        glDeleteBuffers( 1, &hp.m_hp5_buf );
+        hp.m_hp5_buf = 0;
     }
-    HPMCTarget target = h->m_constants->m_target;
-    HPMCHistoPyramid::HistoPyramid& hp = h->m_histopyramid;
+    if( hp.m_hp5_sums_tex != 0 ) {
+        glDeleteTextures( 1, &hp.m_hp5_sums_tex );
+        hp.m_hp5_sums_tex = 0;
+    }
+    if( hp.m_hp5_sums_buf != 0 ) {
+        glDeleteBuffers( 1, &hp.m_hp5_sums_buf );
+        hp.m_hp5_sums_buf = 0;
+    }
+    hp.m_hp5_bytes = 0;
+}
 
+// -----------------------------------------------------------------------------
+/** Creates the HP texture and one FBO per level, for the size of hp. */
+static bool
+HPMCcreatePyramidStorage( HPMCTarget target, HPMCHistoPyramid::HistoPyramid& hp )
+{
     // --- create hp texture ---------------------------------------------------
-    if( h->m_histopyramid.m_tex == 0 ) {
-        glGenTextures( 1, &h->m_histopyramid.m_tex );
-    }
+    glGenTextures( 1, &hp.m_tex );
 
     glBindTexture( GL_TEXTURE_2D, hp.m_tex );
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0 );
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, hp.m_size_l2);
     GLsizei w = hp.m_size;
-    for( GLsizei i=0; i<=h->m_histopyramid.m_size_l2; i++ ) {
+    for( GLsizei i=0; i<=hp.m_size_l2; i++ ) {
         if( target < HPMC_TARGET_GL30_GLSL130 ) {
             glTexImage2D( GL_TEXTURE_2D, i,
                           GL_RGBA32F_ARB,
@@ -91,16 +98,13 @@ HPMCsetupTexAndFBOs( struct HPMCHistoPyramid* h )
         w = std::max(1,w/2);
     }
     //glGenerateMipmapEXT( GL_TEXTURE_2D );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP);
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP);
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST );
     glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
 
     // --- create hp framebuffer objects, one fbo per level --------------------
     if( target < HPMC_TARGET_GL30_GLSL130 ) {   // Pre GL 3.0 path
-        if( !hp.m_fbos.empty() ) {
-            glDeleteFramebuffersEXT( hp.m_fbos.size(), hp.m_fbos.data() );
-        }
         hp.m_fbos.resize( hp.m_size_l2+1 );
         glGenFramebuffersEXT( hp.m_fbos.size(), hp.m_fbos.data() );
 
@@ -147,9 +151,6 @@ HPMCsetupTexAndFBOs( struct HPMCHistoPyramid* h )
     }
     else {
         // GL 3.0 and up, doesn't use EXT_framebuffer_object
-        if( !hp.m_fbos.empty() ) {
-            glDeleteFramebuffers( hp.m_fbos.size(), hp.m_fbos.data() );
-        }
         hp.m_fbos.resize( hp.m_size_l2+1 );
         glGenFramebuffers( hp.m_fbos.size(), hp.m_fbos.data() );
         for( GLuint m=0; m<hp.m_fbos.size(); m++) {
@@ -196,9 +197,106 @@ HPMCsetupTexAndFBOs( struct HPMCHistoPyramid* h )
             }
         }
     }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCsetupTexAndFBOs( struct HPMCHistoPyramid* h )
+{
+    if( h == NULL ) {
+#ifdef DEBUG
+        std::cerr << "HPMC error: setupTexAndFBOs called with NULL pointer." << std::endl;
+#endif
+        return false;
+    }
+    // --- if errors on state, we fail -----------------------------------------
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setupTexAndFBOs called with GL errors." << endl;
+#endif
+        return false;
+    }
+    HPMCTarget target = h->m_constants->m_target;
+    HPMCHistoPyramid::HistoPyramid& hp = h->m_histopyramid;
+
+    // --- get hp texture and fbos from the pyramid pool -----------------------
+    if( (hp.m_tex != 0) && ((GLsizei)hp.m_fbos.size() != hp.m_size_l2+1) ) {
+        HPMCreleasePyramidStorage( h->m_constants, hp );
+    }
+    if( (hp.m_tex == 0) && !HPMCreusePyramidStorage( h, hp ) ) {
+        if( !HPMCreservePyramidStorage( h, HPMCpyramidStorageBytes( hp.m_size_l2 ) ) ) {
+            return false;
+        }
+        if( !HPMCcreatePyramidStorage( target, hp ) ) {
+            return false;
+        }
+    }
+
+    // --- create field cache texture and one fbo per slice --------------------
+    HPMCHistoPyramid::Fetch::FieldCache& cache = h->m_fetch.m_cache;
+    if( !cache.m_fbos.empty() ) {
+        glDeleteFramebuffers( cache.m_fbos.size(), cache.m_fbos.data() );
+        cache.m_fbos.clear();
+    }
+    if( h->m_fetch.m_mode != HPMC_VOLUME_LAYOUT_CUSTOM_CACHED ) {
+        if( cache.m_tex != 0 ) {
+            glDeleteTextures( 1, &cache.m_tex );
+            cache.m_tex = 0;
+        }
+        cache.m_bytes = 0;
+    }
+    else {
+        if( cache.m_tex == 0 ) {
+            glGenTextures( 1, &cache.m_tex );
+        }
+        glBindTexture( GL_TEXTURE_3D, cache.m_tex );
+        glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_BASE_LEVEL, 0 );
+        glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, 0 );
+        glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+        glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+        glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+        glTexParameteri( GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE );
+        glTexImage3D( GL_TEXTURE_3D, 0,
+                      h->m_fetch.m_gradient ? GL_RGBA32F : GL_R32F,
+                      h->m_field.m_size[0],
+                      h->m_field.m_size[1],
+                      h->m_field.m_size[2],
+                      0,
+                      h->m_fetch.m_gradient ? GL_RGBA : GL_RED,
+                      GL_FLOAT,
+                      NULL );
+        glBindTexture( GL_TEXTURE_3D, 0 );
+        cache.m_version = 0;
+        cache.m_bytes = (h->m_fetch.m_gradient ? 4 : 1)*sizeof(GLfloat)
+                      * GLsizeiptr( h->m_field.m_size[0] )
+                      * h->m_field.m_size[1]
+                      * h->m_field.m_size[2];
+
+        cache.m_fbos.resize( h->m_field.m_size[2] );
+        glGenFramebuffers( cache.m_fbos.size(), cache.m_fbos.data() );
+        for( GLuint z=0; z<cache.m_fbos.size(); z++ ) {
+            glBindFramebuffer( GL_FRAMEBUFFER, cache.m_fbos[z] );
+            glFramebufferTextureLayer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                       cache.m_tex, 0, z );
+            glDrawBuffer( GL_COLOR_ATTACHMENT0 );
+            GLenum status = glCheckFramebufferStatus( GL_FRAMEBUFFER );
+            if( status != GL_FRAMEBUFFER_COMPLETE ) {
+#ifdef DEBUG
+                std::cerr << "HPMC error: field cache framebuffer is incomplete, status = 0x"
+                          << std::hex << status << std::dec
+                          << "(" << __FILE__ << "@" << __LINE__<< ")" << std::endl;
+#endif
+                return false;
+            }
+        }
+    }
 
     // --- setup pbo to for async readback of top element ----------------------
-    glGenBuffers( 1, &h->m_histopyramid.m_top_pbo );
+    if( h->m_histopyramid.m_top_pbo == 0 ) {
+        glGenBuffers( 1, &h->m_histopyramid.m_top_pbo );
+    }
     glBindBuffer( GL_PIXEL_PACK_BUFFER, h->m_histopyramid.m_top_pbo );
     glBufferData( GL_PIXEL_PACK_BUFFER,
                   sizeof(GLfloat)*4,
@@ -206,6 +304,38 @@ HPMCsetupTexAndFBOs( struct HPMCHistoPyramid* h )
                   GL_DYNAMIC_READ );
     glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
 
+    // --- create HP5 buffer textures, the levels followed by the base copy ----
+    if( !h->m_hp5.m_enabled ) {
+        HPMCfreeHP5Buffers( hp );
+    }
+    else {
+        if( hp.m_hp5_buf == 0 ) {
+            glGenBuffers( 1, &hp.m_hp5_buf );
+            glGenBuffers( 1, &hp.m_hp5_sums_buf );
+            glGenTextures( 1, &hp.m_hp5_tex );
+            glGenTextures( 1, &hp.m_hp5_sums_tex );
+        }
+        GLsizei levels = h->m_hp5.m_offset[0];
+        GLsizei texels = levels + h->m_hp5.m_count[0];
+        glBindBuffer( GL_TEXTURE_BUFFER, hp.m_hp5_buf );
+        glBufferData( GL_TEXTURE_BUFFER,
+                      sizeof(GLfloat)*4*texels,
+                      NULL,
+                      GL_DYNAMIC_COPY );
+        glBindBuffer( GL_TEXTURE_BUFFER, hp.m_hp5_sums_buf );
+        glBufferData( GL_TEXTURE_BUFFER,
+                      sizeof(GLfloat)*levels,
+                      NULL,
+                      GL_DYNAMIC_COPY );
+        glBindBuffer( GL_TEXTURE_BUFFER, 0 );
+        glBindTexture( GL_TEXTURE_BUFFER, hp.m_hp5_tex );
+        glTexBuffer( GL_TEXTURE_BUFFER, GL_RGBA32F, hp.m_hp5_buf );
+        glBindTexture( GL_TEXTURE_BUFFER, hp.m_hp5_sums_tex );
+        glTexBuffer( GL_TEXTURE_BUFFER, GL_R32F, hp.m_hp5_sums_buf );
+        glBindTexture( GL_TEXTURE_BUFFER, 0 );
+        hp.m_hp5_bytes = sizeof(GLfloat)*(4*texels + levels);
+    }
+
     // --- if we have created errors, we fail ----------------------------------
     if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
 #ifdef DEBUG
@@ -215,3 +345,161 @@ HPMCsetupTexAndFBOs( struct HPMCHistoPyramid* h )
     }
     return true;
 }
+
+// -----------------------------------------------------------------------------
+bool
+HPMCsetupStatistics( struct HPMCHistoPyramid* h )
+{
+    HPMCHistoPyramid::Statistics& stats = h->m_statistics;
+    stats.m_compute = h->m_constants->m_target >= HPMC_TARGET_GL43_GLSL430;
+
+    // --- free resources if disabled, or not used by the compute shader ------
+    if( !stats.m_enabled || stats.m_compute ) {
+        if( stats.m_fbo != 0 ) {
+            glDeleteFramebuffers( 1, &stats.m_fbo );
+            stats.m_fbo = 0;
+        }
+        if( stats.m_tex != 0 ) {
+            glDeleteTextures( 1, &stats.m_tex );
+            stats.m_tex = 0;
+        }
+        if( stats.m_sum_fbo != 0 ) {
+            glDeleteFramebuffers( 1, &stats.m_sum_fbo );
+            stats.m_sum_fbo = 0;
+        }
+        if( stats.m_sum_tex != 0 ) {
+            glDeleteTextures( 1, &stats.m_sum_tex );
+            stats.m_sum_tex = 0;
+        }
+    }
+    if( !stats.m_enabled ) {
+        if( stats.m_pbo != 0 ) {
+            glDeleteBuffers( 1, &stats.m_pbo );
+            stats.m_pbo = 0;
+        }
+        return true;
+    }
+
+    // --- create textures with fbos for scattering and gathering the rows -----
+    if( !stats.m_compute ) {
+        if( stats.m_tex == 0 ) {
+            glGenTextures( 1, &stats.m_tex );
+        }
+        if( stats.m_sum_tex == 0 ) {
+            glGenTextures( 1, &stats.m_sum_tex );
+        }
+        if( stats.m_fbo == 0 ) {
+            glGenFramebuffers( 1, &stats.m_fbo );
+        }
+        if( stats.m_sum_fbo == 0 ) {
+            glGenFramebuffers( 1, &stats.m_sum_fbo );
+        }
+        GLuint texs[2] = { stats.m_tex, stats.m_sum_tex };
+        GLuint fbos[2] = { stats.m_fbo, stats.m_sum_fbo };
+        GLsizei rows[2] = { HPMC_STATISTICS_ROWS, 1 };
+        for( int i=0; i<2; i++ ) {
+            glBindTexture( GL_TEXTURE_2D, texs[i] );
+            glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0 );
+            glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0 );
+            glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+            glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+            glTexImage2D( GL_TEXTURE_2D, 0,
+                          GL_RGBA32F,
+                          256+2, rows[i], 0,
+                          GL_RGBA, GL_FLOAT,
+                          NULL );
+            glBindTexture( GL_TEXTURE_2D, 0 );
+
+            glBindFramebuffer( GL_FRAMEBUFFER, fbos[i] );
+            glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                    GL_TEXTURE_2D, texs[i], 0 );
+            glDrawBuffer( GL_COLOR_ATTACHMENT0 );
+            glReadBuffer( GL_COLOR_ATTACHMENT0 );
+            GLenum status = glCheckFramebufferStatus( GL_FRAMEBUFFER );
+            if( status != GL_FRAMEBUFFER_COMPLETE ) {
+#ifdef DEBUG
+                std::cerr << "HPMC error: statistics framebuffer is incomplete, status = 0x"
+                          << std::hex << status << std::dec
+                          << "(" << __FILE__ << "@" << __LINE__<< ")" << std::endl;
+#endif
+                return false;
+            }
+        }
+    }
+
+    // --- setup pbo for async readback, or counters of the compute shader -----
+    if( stats.m_pbo == 0 ) {
+        glGenBuffers( 1, &stats.m_pbo );
+    }
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, stats.m_pbo );
+    glBufferData( GL_PIXEL_PACK_BUFFER,
+                  sizeof(GLfloat)*4*(256+2),
+                  NULL,
+                  GL_DYNAMIC_READ );
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, 0 );
+    stats.m_empty = true;
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setupStatistics produced GL errors." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+void
+HPMCswapPipelineSet( struct HPMCHistoPyramid* h )
+{
+    std::swap( h->m_histopyramid, h->m_pipeline.m_histopyramid );
+    std::swap( h->m_fetch.m_cache, h->m_pipeline.m_cache );
+}
+
+// -----------------------------------------------------------------------------
+void
+HPMCfreePyramidSet( struct HPMCConstants* c,
+                    HPMCHistoPyramid::HistoPyramid& hp,
+                    HPMCHistoPyramid::Fetch::FieldCache& cache )
+{
+    HPMCreleasePyramidStorage( c, hp );
+    if( hp.m_top_pbo != 0 ) {
+        glDeleteBuffers( 1, &hp.m_top_pbo );
+        hp.m_top_pbo = 0;
+    }
+    HPMCfreeHP5Buffers( hp );
+    if( !cache.m_fbos.empty() ) {
+        glDeleteFramebuffers( cache.m_fbos.size(), cache.m_fbos.data() );
+        cache.m_fbos.clear();
+    }
+    if( cache.m_tex != 0 ) {
+        glDeleteTextures( 1, &cache.m_tex );
+        cache.m_tex = 0;
+    }
+    cache.m_bytes = 0;
+}
+
+// -----------------------------------------------------------------------------
+void
+HPMCfreeTexAndFBOs( struct HPMCHistoPyramid* h )
+{
+    HPMCfreePyramidSet( h->m_constants, h->m_histopyramid, h->m_fetch.m_cache );
+    HPMCfreePipelineSet( h );
+}
+
+// -----------------------------------------------------------------------------
+void
+HPMCfreePipelineSet( struct HPMCHistoPyramid* h )
+{
+    HPMCHistoPyramid::Pipeline& p = h->m_pipeline;
+    HPMCfreePyramidSet( h->m_constants, p.m_histopyramid, p.m_cache );
+    if( p.m_kernels_tex != 0 ) {
+        glDeleteTextures( 1, &p.m_kernels_tex );
+        p.m_kernels_tex = 0;
+        p.m_kernels_rows = 0;
+    }
+    if( p.m_parameters_buf != 0 ) {
+        glDeleteBuffers( 1, &p.m_parameters_buf );
+        p.m_parameters_buf = 0;
+    }
+}
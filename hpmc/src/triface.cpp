@@ -105,6 +105,26 @@ HPMCcreateTraversalHandle( struct HPMCHistoPyramid* h )
     struct HPMCTraversalHandle* th = new HPMCTraversalHandle;
     th->m_handle = h;
     th->m_program = 0;
+    th->m_vertex_format = HPMC_VERTEX_FORMAT_FLOAT;
+    th->m_ray_cast = false;
+    th->m_position_only = false;
+    th->m_triangles = false;
+    th->m_cells = false;
+    th->m_output.m_vertex_size = 0;
+    th->m_output.m_capacity = 0;
+    th->m_output.m_buf = 0;
+    th->m_output.m_indirect_buf = 0;
+    th->m_output.m_query = 0;
+    th->m_output.m_query_pending = false;
+    th->m_clusters.m_triangles = 0;
+    th->m_clusters.m_capacity = 0;
+    th->m_clusters.m_buf = 0;
+    th->m_clusters.m_vertex_shader = 0;
+    th->m_clusters.m_program = 0;
+    th->m_collisions.m_vertex_shader = 0;
+    th->m_collisions.m_program = 0;
+    th->m_compute.m_compute_shader = 0;
+    th->m_compute.m_program = 0;
     return th;
 }
 
@@ -118,6 +138,36 @@ HPMCdestroyTraversalHandle( struct HPMCTraversalHandle* th )
 #endif
         return;
     }
+    if( th->m_output.m_buf != 0 ) {
+        glDeleteBuffers( 1, &th->m_output.m_buf );
+    }
+    if( th->m_output.m_indirect_buf != 0 ) {
+        glDeleteBuffers( 1, &th->m_output.m_indirect_buf );
+    }
+    if( th->m_output.m_query != 0 ) {
+        glDeleteQueries( 1, &th->m_output.m_query );
+    }
+    if( th->m_clusters.m_buf != 0 ) {
+        glDeleteBuffers( 1, &th->m_clusters.m_buf );
+    }
+    if( th->m_clusters.m_program != 0 ) {
+        glDeleteProgram( th->m_clusters.m_program );
+    }
+    if( th->m_clusters.m_vertex_shader != 0 ) {
+        glDeleteShader( th->m_clusters.m_vertex_shader );
+    }
+    if( th->m_collisions.m_program != 0 ) {
+        glDeleteProgram( th->m_collisions.m_program );
+    }
+    if( th->m_collisions.m_vertex_shader != 0 ) {
+        glDeleteShader( th->m_collisions.m_vertex_shader );
+    }
+    if( th->m_compute.m_program != 0 ) {
+        glDeleteProgram( th->m_compute.m_program );
+    }
+    if( th->m_compute.m_compute_shader != 0 ) {
+        glDeleteShader( th->m_compute.m_compute_shader );
+    }
     delete th;
 }
 
@@ -186,8 +236,153 @@ HPMCgetTraversalShaderFunctions( struct HPMCTraversalHandle* th )
 
     // -------------------------------------------------------------------------
     std::string ret = HPMCgenerateDefines( th->m_handle )
-                    + HPMCgenerateScalarFieldFetch( th->m_handle )
-                    + HPMCgenerateExtractVertexFunction( th->m_handle );
+                    + HPMCgenerateScalarFieldFetch( th->m_handle );
+    if( th->m_ray_cast ) {
+        return strdup( (ret + HPMCgenerateRayCastFunction( th->m_handle )).c_str() );
+    }
+    ret += HPMCgenerateExtractVertexFunction( th->m_handle, th->m_position_only, th->m_triangles, th->m_cells, false );
+    if( th->m_vertex_format != HPMC_VERTEX_FORMAT_FLOAT ) {
+        ret += HPMCgenerateVertexPackFunction( th->m_vertex_format );
+    }
+    return strdup( ret.c_str() );
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCsetTraversalHandleVertexFormat( struct HPMCTraversalHandle*  th,
+                                    GLenum                       type )
+{
+    if( th == NULL ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setTraversalHandleVertexFormat called with th == NULL." << endl;
+#endif
+        return false;
+    }
+    if( type == GL_FLOAT ) {
+        th->m_vertex_format = HPMC_VERTEX_FORMAT_FLOAT;
+        return true;
+    }
+    // packHalf2x16 and packSnorm2x16 are GLSL 4.20
+    if( th->m_handle->m_constants->m_target < HPMC_TARGET_GL42_GLSL420 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: packed vertex formats require OpenGL 4.2." << endl;
+#endif
+        return false;
+    }
+    if( type == GL_HALF_FLOAT ) {
+        th->m_vertex_format = HPMC_VERTEX_FORMAT_HALF;
+    }
+    else if( type == GL_UNSIGNED_SHORT ) {
+        th->m_vertex_format = HPMC_VERTEX_FORMAT_QUANTIZED;
+    }
+    else {
+#ifdef DEBUG
+        cerr << "HPMC error: setTraversalHandleVertexFormat called with unsupported type 0x"
+             << std::hex << type << std::dec << "." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCsetTraversalHandleRayCasting( struct HPMCTraversalHandle*  th,
+                                  GLboolean                    enable )
+{
+    if( th == NULL ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setTraversalHandleRayCasting called with th == NULL." << endl;
+#endif
+        return false;
+    }
+    bool ray_cast = ( enable==GL_TRUE? true : false );
+    if( ray_cast && (th->m_handle->m_constants->m_target < HPMC_TARGET_GL30_GLSL130) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: ray casting requires OpenGL 3.0." << endl;
+#endif
+        return false;
+    }
+    th->m_ray_cast = ray_cast;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCsetTraversalHandlePositionOnly( struct HPMCTraversalHandle*  th,
+                                    GLboolean                    enable )
+{
+    if( th == NULL ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setTraversalHandlePositionOnly called with th == NULL." << endl;
+#endif
+        return false;
+    }
+    th->m_position_only = ( enable==GL_TRUE? true : false );
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCsetTraversalHandleTriangles( struct HPMCTraversalHandle*  th,
+                                 GLboolean                    enable )
+{
+    if( th == NULL ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setTraversalHandleTriangles called with th == NULL." << endl;
+#endif
+        return false;
+    }
+    bool triangles = ( enable==GL_TRUE? true : false );
+    if( triangles && (th->m_handle->m_constants->m_target < HPMC_TARGET_GL32_GLSL150) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: triangle traversal requires OpenGL 3.2." << endl;
+#endif
+        return false;
+    }
+    th->m_triangles = triangles;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCsetTraversalHandleCells( struct HPMCTraversalHandle*  th,
+                             GLboolean                    enable )
+{
+    if( th == NULL ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setTraversalHandleCells called with th == NULL." << endl;
+#endif
+        return false;
+    }
+    bool cells = ( enable==GL_TRUE? true : false );
+    if( cells && (th->m_handle->m_constants->m_target < HPMC_TARGET_GL32_GLSL150) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: cell traversal requires OpenGL 3.2." << endl;
+#endif
+        return false;
+    }
+    th->m_cells = cells;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+char*
+HPMCgetVertexUnpackShaderFunctions( struct HPMCTraversalHandle* th )
+{
+    if( th == NULL ) {
+#ifdef DEBUG
+        cerr << "HPMC error: getVertexUnpackShaderFunctions called with th == NULL." << endl;
+#endif
+        return NULL;
+    }
+    if( th->m_vertex_format == HPMC_VERTEX_FORMAT_FLOAT ) {
+#ifdef DEBUG
+        cerr << "HPMC error: getVertexUnpackShaderFunctions called on traversal handle with float vertex format." << endl;
+#endif
+        return NULL;
+    }
+    std::string ret = HPMCgenerateVertexUnpackFunction( th->m_handle, th->m_vertex_format );
     return strdup( ret.c_str() );
 }
 
@@ -236,8 +431,10 @@ HPMCsetTraversalHandleProgram( struct  HPMCTraversalHandle *th,
 #endif
         return false;
     }
+    // ray casting uses neither the edge table nor the key offset, and the
+    // edge table may be a constant array
     GLint et_loc = glGetUniformLocation( program, "HPMC_edge_table" );
-    if( et_loc == -1 ) {
+    if( (et_loc == -1) && !th->m_ray_cast && !HPMCuseConstantEdgeTable( th->m_handle ) ) {
 #ifdef DEBUG
         cerr << "HPMC error: cannot find edge table sampler uniform." << endl;
 #endif
@@ -277,7 +474,7 @@ HPMCsetTraversalHandleProgram( struct  HPMCTraversalHandle *th,
 
     // --- get locations of uniform variables ----------------------------------
     th->m_offset_loc = glGetUniformLocation( program, "HPMC_key_offset" );
-    if( th->m_offset_loc == -1 ) {
+    if( (th->m_offset_loc == -1) && !th->m_ray_cast ) {
 #ifdef DEBUG
         cerr << "HPMC error: cannot find key offset uniform variable." << endl;
 #endif
@@ -308,11 +505,21 @@ HPMCsetTraversalHandleProgram( struct  HPMCTraversalHandle *th,
 
     // --- Configure program ---------------------------------------------------
     glUseProgram( th->m_program );
-    glUniform1i( et_loc, th->m_edge_decode_unit );
+    if( et_loc != -1 ) {
+        glUniform1i( et_loc, th->m_edge_decode_unit );
+    }
     glUniform1i( hp_loc, th->m_histopyramid_unit );
     if( th->m_handle->m_fetch.m_mode != HPMC_VOLUME_LAYOUT_CUSTOM ) {
         glUniform1i( sf_loc, th->m_scalarfield_unit );
     }
+    // the parameter block is absent if the custom fetch is cached
+    if( th->m_handle->m_fetch.m_parameters.m_binding >= 0 ) {
+        GLuint block = glGetUniformBlockIndex( th->m_program, "HPMC_FetchParameters" );
+        if( block != GL_INVALID_INDEX ) {
+            glUniformBlockBinding( th->m_program, block,
+                                   th->m_handle->m_fetch.m_parameters.m_binding );
+        }
+    }
 
     // --- restore state -------------------------------------------------------
     glUseProgram( prog );
@@ -328,6 +535,58 @@ HPMCsetTraversalHandleProgram( struct  HPMCTraversalHandle *th,
 
 
 
+// -----------------------------------------------------------------------------
+/** Uses the program of th and binds the HP, scalar field and edge table.
+  *
+  * \sideeffect GL_CURRENT_PROGRAM, the active texture unit and the texture
+  *             units of th.
+  */
+static void
+HPMCbindTraversalState( struct HPMCTraversalHandle* th )
+{
+    glUseProgram( th->m_program );
+
+    glActiveTextureARB( GL_TEXTURE0_ARB + th->m_histopyramid_unit );
+    glBindTexture( GL_TEXTURE_2D, th->m_handle->m_histopyramid.m_tex );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0 );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
+                                    th->m_handle->m_histopyramid.m_size_l2 );
+    if( th->m_handle->m_hp5.m_enabled ) {
+        glBindTexture( GL_TEXTURE_BUFFER, th->m_handle->m_histopyramid.m_hp5_tex );
+    }
+
+    if( th->m_handle->m_fetch.m_mode == HPMC_VOLUME_LAYOUT_TEXTURE_3D ) {
+        glActiveTextureARB( GL_TEXTURE0_ARB + th->m_scalarfield_unit );
+        glBindTexture( GL_TEXTURE_3D, th->m_handle->m_histopyramid.m_field_tex );
+    }
+    else if( th->m_handle->m_fetch.m_mode == HPMC_VOLUME_LAYOUT_CUSTOM_CACHED ) {
+        glActiveTextureARB( GL_TEXTURE0_ARB + th->m_scalarfield_unit );
+        glBindTexture( GL_TEXTURE_3D, th->m_handle->m_fetch.m_cache.m_tex );
+    }
+    else if( th->m_handle->m_fetch.m_mode == HPMC_VOLUME_LAYOUT_RADIAL_KERNELS ) {
+        glActiveTextureARB( GL_TEXTURE0_ARB + th->m_scalarfield_unit );
+        glBindTexture( GL_TEXTURE_2D, th->m_handle->m_histopyramid.m_kernels_tex );
+    }
+
+    if( th->m_handle->m_field.m_binary ) {
+        glActiveTextureARB( GL_TEXTURE0_ARB + th->m_edge_decode_unit );
+        glBindTexture( GL_TEXTURE_2D, th->m_handle->m_constants->m_edge_decode_normal_tex );
+    }
+    else {
+        glUniform1f( th->m_threshold_loc, th->m_handle->m_histopyramid.m_threshold );
+        if( !HPMCuseConstantEdgeTable( th->m_handle ) ) {
+            glActiveTextureARB( GL_TEXTURE0_ARB + th->m_edge_decode_unit );
+            glBindTexture( GL_TEXTURE_2D, th->m_handle->m_constants->m_edge_decode_tex );
+        }
+    }
+
+    if( th->m_handle->m_fetch.m_parameters.m_binding >= 0 ) {
+        glBindBufferBase( GL_UNIFORM_BUFFER,
+                          th->m_handle->m_fetch.m_parameters.m_binding,
+                          th->m_handle->m_histopyramid.m_parameters_buf );
+    }
+}
+
 // -----------------------------------------------------------------------------
 static bool
 HPMCextractVerticesHelper( struct HPMCTraversalHandle*  th,
@@ -351,6 +610,29 @@ HPMCextractVerticesHelper( struct HPMCTraversalHandle*  th,
 #endif
         return false;
     }
+    if( th->m_ray_cast ) {
+#ifdef DEBUG
+        cerr << "HPMC error: extractVertices called on traversal handle set up for ray casting." << endl;
+#endif
+        return false;
+    }
+    if( (th->m_triangles || th->m_cells) && (transform_feedback_mode == 4) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: output buffer extraction does not support triangle or cell traversal." << endl;
+#endif
+        return false;
+    }
+    HPMCtouchPyramid( th->m_handle );
+
+    // --- nothing to do if the HP is known to be empty ------------------------
+    // Extraction into the output buffer must still update the indirect
+    // commands.
+    if( (transform_feedback_mode != 4) &&
+        (th->m_handle->m_histopyramid.m_top_count_updated) &&
+        (th->m_handle->m_histopyramid.m_top_count == 0) )
+    {
+        return true;
+    }
 
     // --- store current state -------------------------------------------------
     GLint curr_prog;
@@ -359,7 +641,11 @@ HPMCextractVerticesHelper( struct HPMCTraversalHandle*  th,
     glPushAttrib( GL_TEXTURE_BIT );
 
     // --- retrieve number of vertices -----------------------------------------
-    if( !th->m_handle->m_histopyramid.m_top_count_updated ) {
+    // Extraction into the output buffer is driven by indirect draws, and
+    // doesn't need the number of vertices on the CPU.
+    if( (transform_feedback_mode != 4) &&
+        (!th->m_handle->m_histopyramid.m_top_count_updated) )
+    {
         GLfloat mem[4];
         glBindBuffer( GL_PIXEL_PACK_BUFFER,
                       th->m_handle->m_histopyramid.m_top_pbo );
@@ -377,31 +663,60 @@ HPMCextractVerticesHelper( struct HPMCTraversalHandle*  th,
     }
 
     // --- setup state ---------------------------------------------------------
-    glUseProgram( th->m_program );
-
-    glActiveTextureARB( GL_TEXTURE0_ARB + th->m_histopyramid_unit );
-    glBindTexture( GL_TEXTURE_2D, th->m_handle->m_histopyramid.m_tex );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0 );
-    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL,
-                                    th->m_handle->m_histopyramid.m_size_l2 );
+    HPMCbindTraversalState( th );
 
-    glActiveTextureARB( GL_TEXTURE0_ARB + th->m_scalarfield_unit );
-    glBindTexture( GL_TEXTURE_3D, th->m_handle->m_fetch.m_tex );
-
-    if( th->m_handle->m_field.m_binary ) {
-        glActiveTextureARB( GL_TEXTURE0_ARB + th->m_edge_decode_unit );
-        glBindTexture( GL_TEXTURE_2D, th->m_handle->m_constants->m_edge_decode_normal_tex );
-    }
-    else {
-        glUniform1f( th->m_threshold_loc, th->m_handle->m_threshold );
-        glActiveTextureARB( GL_TEXTURE0_ARB + th->m_edge_decode_unit );
-        glBindTexture( GL_TEXTURE_2D, th->m_handle->m_constants->m_edge_decode_tex );
+    // --- grow output buffer if previous extraction overflowed ----------------
+    HPMCTraversalHandle::OutputBuffer& out = th->m_output;
+    if( (transform_feedback_mode == 4) && out.m_query_pending ) {
+        GLuint available;
+        glGetQueryObjectuiv( out.m_query, GL_QUERY_RESULT_AVAILABLE, &available );
+        if( available == GL_TRUE ) {
+            GLuint primitives;
+            glGetQueryObjectuiv( out.m_query, GL_QUERY_RESULT, &primitives );
+            out.m_query_pending = false;
+            if( out.m_capacity < 3*(GLsizei)primitives ) {
+                out.m_capacity = std::max( 2*out.m_capacity, 3*(GLsizei)primitives );
+#ifdef DEBUG
+                cerr << "HPMC info: output buffer overflow, growing to "
+                     << out.m_capacity << " vertices." << endl;
+#endif
+                glBindBuffer( GL_ARRAY_BUFFER, out.m_buf );
+                glBufferData( GL_ARRAY_BUFFER,
+                              (GLsizeiptr)out.m_capacity * out.m_vertex_size,
+                              NULL,
+                              GL_DYNAMIC_COPY );
+            }
+        }
     }
 
     glBindBuffer( GL_ARRAY_BUFFER, th->m_handle->m_constants->m_enumerate_vbo );
     glVertexPointer( 3, GL_FLOAT, 0, NULL );
     glEnableClientState( GL_VERTEX_ARRAY );
 
+    // --- write indirect draw commands from top element -----------------------
+    if( transform_feedback_mode == 4 ) {
+        HPMCConstants::IndirectCommands& ic = th->m_handle->m_constants->m_indirect;
+        GLboolean discard = glIsEnabled( GL_RASTERIZER_DISCARD );
+        glUseProgram( ic.m_program );
+        glUniform1i( ic.m_loc_histopyramid, th->m_histopyramid_unit );
+        glUniform1i( ic.m_loc_src_level, th->m_handle->m_histopyramid.m_size_l2 );
+        glUniform1f( ic.m_loc_capacity, static_cast<GLfloat>( out.m_capacity ) );
+        glUniform1f( ic.m_loc_batch,
+                     static_cast<GLfloat>( th->m_handle->m_codegen.m_batch ) );
+        glUniform1f( ic.m_loc_cluster_vertices,
+                     static_cast<GLfloat>( 3*th->m_clusters.m_triangles ) );
+        glBindBufferBase( GL_TRANSFORM_FEEDBACK_BUFFER, 0, out.m_indirect_buf );
+        glEnable( GL_RASTERIZER_DISCARD );
+        glBeginTransformFeedback( GL_POINTS );
+        glDrawArrays( GL_POINTS, 0, 1 );
+        glEndTransformFeedback();
+        if( discard == GL_FALSE ) {
+            glDisable( GL_RASTERIZER_DISCARD );
+        }
+        glUseProgram( th->m_program );
+        glBindBufferBase( GL_TRANSFORM_FEEDBACK_BUFFER, 0, out.m_buf );
+    }
+
 
     // --- render triangles ----------------------------------------------------
     if( transform_feedback_mode == 1 ) {
@@ -419,13 +734,44 @@ HPMCextractVerticesHelper( struct HPMCTraversalHandle*  th,
         glBeginTransformFeedbackEXT( GL_TRIANGLES );
 #endif
     }
+    else if( transform_feedback_mode == 4 ) {
+        if( !out.m_query_pending ) {
+            glBeginQuery( GL_PRIMITIVES_GENERATED, out.m_query );
+        }
+        glBeginTransformFeedback( GL_TRIANGLES );
+    }
 
-    GLsizei N = th->m_handle->m_histopyramid.m_top_count;
-    for(GLsizei i=0; i<N; i+= th->m_handle->m_constants->m_enumerate_vbo_n) {
-        glUniform1f( th->m_offset_loc, static_cast<GLfloat>( i ) );
-        glDrawArrays( GL_TRIANGLES, 0, min( N-i,
-                                            th->m_handle->m_constants->m_enumerate_vbo_n ) );
+    if( transform_feedback_mode == 4 ) {
+        // full batches as instances, followed by the tail batch
+        GLint old_indirect;
+        glGetIntegerv( GL_DRAW_INDIRECT_BUFFER_BINDING, &old_indirect );
+        glBindBuffer( GL_DRAW_INDIRECT_BUFFER, out.m_indirect_buf );
+        glUniform1f( th->m_offset_loc, 0.0f );
+        glDrawArraysIndirect( GL_TRIANGLES,
+                              reinterpret_cast<const GLvoid*>( 0*sizeof(GLuint) ) );
+        glUniform1f( th->m_offset_loc, -1.0f );
+        glDrawArraysIndirect( GL_TRIANGLES,
+                              reinterpret_cast<const GLvoid*>( 4*sizeof(GLuint) ) );
+        glBindBuffer( GL_DRAW_INDIRECT_BUFFER, old_indirect );
     }
+    else if( th->m_triangles || th->m_cells ) {
+        // one point per triangle, expanded by the geometry shader
+        GLsizei T = th->m_handle->m_histopyramid.m_top_count/3;
+        for(GLsizei i=0; i<T; i+= th->m_handle->m_codegen.m_batch) {
+            glUniform1f( th->m_offset_loc, static_cast<GLfloat>( i ) );
+            glDrawArrays( GL_POINTS, 0, min( T-i,
+                                             th->m_handle->m_codegen.m_batch ) );
+        }
+    }
+    else {
+        GLsizei N = th->m_handle->m_histopyramid.m_top_count;
+        for(GLsizei i=0; i<N; i+= th->m_handle->m_codegen.m_batch) {
+            glUniform1f( th->m_offset_loc, static_cast<GLfloat>( i ) );
+            glDrawArrays( GL_TRIANGLES, 0, min( N-i,
+                                                th->m_handle->m_codegen.m_batch ) );
+        }
+    }
+
     if( transform_feedback_mode == 1 ) {
 #ifdef GL_VERSION_3_0
         glEndTransformFeedback( );
@@ -441,6 +787,55 @@ HPMCextractVerticesHelper( struct HPMCTraversalHandle*  th,
         glEndTransformFeedbackEXT( );
 #endif
     }
+    else if( transform_feedback_mode == 4 ) {
+        glEndTransformFeedback( );
+        if( !out.m_query_pending ) {
+            glEndQuery( GL_PRIMITIVES_GENERATED );
+            out.m_query_pending = true;
+        }
+    }
+
+    // --- bound the clusters of the output buffer -----------------------------
+    if( (transform_feedback_mode == 4) && (th->m_clusters.m_triangles > 0) ) {
+        HPMCTraversalHandle::OutputClusters& cl = th->m_clusters;
+        GLsizei needed = (out.m_capacity/3 + cl.m_triangles - 1)/cl.m_triangles;
+        if( cl.m_capacity < needed ) {
+            cl.m_capacity = needed;
+            glBindBuffer( GL_ARRAY_BUFFER, cl.m_buf );
+            glBufferData( GL_ARRAY_BUFFER,
+                          (GLsizeiptr)cl.m_capacity * 12*sizeof(GLfloat),
+                          NULL,
+                          GL_DYNAMIC_COPY );
+        }
+        GLboolean discard = glIsEnabled( GL_RASTERIZER_DISCARD );
+        glUseProgram( cl.m_program );
+        glUniform1i( cl.m_loc_histopyramid, th->m_histopyramid_unit );
+        if( cl.m_loc_edge_table != -1 ) {
+            glUniform1i( cl.m_loc_edge_table, th->m_edge_decode_unit );
+        }
+        if( cl.m_loc_scalarfield != -1 ) {
+            glUniform1i( cl.m_loc_scalarfield, th->m_scalarfield_unit );
+        }
+        if( cl.m_loc_threshold != -1 ) {
+            glUniform1f( cl.m_loc_threshold, th->m_handle->m_histopyramid.m_threshold );
+        }
+        glUniform1f( cl.m_loc_capacity, static_cast<GLfloat>( out.m_capacity ) );
+        // one point per cluster, the count may exceed the enumeration vbo
+        glDisableClientState( GL_VERTEX_ARRAY );
+        glBindBufferBase( GL_TRANSFORM_FEEDBACK_BUFFER, 0, cl.m_buf );
+        glEnable( GL_RASTERIZER_DISCARD );
+        glBeginTransformFeedback( GL_POINTS );
+        GLint old_indirect;
+        glGetIntegerv( GL_DRAW_INDIRECT_BUFFER_BINDING, &old_indirect );
+        glBindBuffer( GL_DRAW_INDIRECT_BUFFER, out.m_indirect_buf );
+        glDrawArraysIndirect( GL_POINTS,
+                              reinterpret_cast<const GLvoid*>( 12*sizeof(GLuint) ) );
+        glBindBuffer( GL_DRAW_INDIRECT_BUFFER, old_indirect );
+        glEndTransformFeedback();
+        if( discard == GL_FALSE ) {
+            glDisable( GL_RASTERIZER_DISCARD );
+        }
+    }
 
     // --- restore state -------------------------------------------------------
     glPopAttrib();
@@ -498,3 +893,879 @@ HPMCextractVerticesTransformFeedbackEXT( struct HPMCTraversalHandle* th )
     return false;
 #endif
 }
+
+// -----------------------------------------------------------------------------
+bool
+HPMCrayCast( struct HPMCTraversalHandle* th )
+{
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: rayCast called with GL errors." << endl;
+#endif
+        return false;
+    }
+    if( th == NULL || th->m_program == 0 || !th->m_ray_cast ) {
+#ifdef DEBUG
+        cerr << "HPMC error: rayCast called without a ray casting program." << endl;
+#endif
+        return false;
+    }
+
+    // --- nothing to do if the HP is known to be empty ------------------------
+    const HPMCHistoPyramid::HistoPyramid& hp = th->m_handle->m_histopyramid;
+    if( hp.m_top_count_updated && (hp.m_top_count == 0) ) {
+        return true;
+    }
+
+    // --- store current state -------------------------------------------------
+    GLint curr_prog;
+    GLint old_vbo;
+    glGetIntegerv( GL_CURRENT_PROGRAM, &curr_prog );
+    glGetIntegerv( GL_ARRAY_BUFFER_BINDING, &old_vbo );
+    glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+    glPushAttrib( GL_TEXTURE_BIT | GL_ENABLE_BIT | GL_POLYGON_BIT );
+
+    // --- setup state ---------------------------------------------------------
+    HPMCbindTraversalState( th );
+
+    // --- render back faces of the grid bounding box --------------------------
+    // Back faces cover the grid also when the eye is inside it.
+    const GLfloat* e = th->m_handle->m_field.m_sampled.m_extent;
+    static const GLfloat faces[6*4*3] = {
+        0,0,0,  0,0,1,  0,1,1,  0,1,0,
+        1,0,0,  1,1,0,  1,1,1,  1,0,1,
+        0,0,0,  1,0,0,  1,0,1,  0,0,1,
+        0,1,0,  0,1,1,  1,1,1,  1,1,0,
+        0,0,0,  0,1,0,  1,1,0,  1,0,0,
+        0,0,1,  1,0,1,  1,1,1,  0,1,1
+    };
+    GLfloat box[6*4*3];
+    for(int i=0; i<6*4*3; i++) {
+        box[i] = e[i%3]*faces[i];
+    }
+    glBindBuffer( GL_ARRAY_BUFFER, 0 );
+    glVertexPointer( 3, GL_FLOAT, 0, box );
+    glEnableClientState( GL_VERTEX_ARRAY );
+    glEnable( GL_CULL_FACE );
+    glCullFace( GL_FRONT );
+    glDrawArrays( GL_QUADS, 0, 6*4 );
+
+    // --- restore state -------------------------------------------------------
+    glPopAttrib();
+    glPopClientAttrib();
+    glBindBuffer( GL_ARRAY_BUFFER, old_vbo );
+    glUseProgram( curr_prog );
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: rayCast produced OpenGL errors." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+static bool
+HPMCbuildIndirectCommandProgram( struct HPMCConstants* c )
+{
+    HPMCConstants::IndirectCommands& ic = c->m_indirect;
+
+    ic.m_vertex_shader = HPMCcompileShader( HPMCgenerateIndirectCommandShader(),
+                                            GL_VERTEX_SHADER );
+    if( ic.m_vertex_shader == 0 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: Failed to build indirect command vertex shader." << endl;
+#endif
+        return false;
+    }
+    ic.m_program = glCreateProgram();
+    glAttachShader( ic.m_program, ic.m_vertex_shader );
+    const char* varyings[4] =
+    {
+        "HPMC_extract_batches",
+        "HPMC_extract_tail",
+        "HPMC_draw",
+        "HPMC_clusters"
+    };
+    glTransformFeedbackVaryings( ic.m_program, 4, varyings, GL_INTERLEAVED_ATTRIBS );
+    if( !HPMClinkProgram( ic.m_program ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: Failed to link indirect command program." << endl;
+#endif
+        glDeleteProgram( ic.m_program );
+        ic.m_program = 0;
+        return false;
+    }
+    ic.m_loc_histopyramid = HPMCgetUniformLocation( ic.m_program, "HPMC_histopyramid" );
+    ic.m_loc_src_level = HPMCgetUniformLocation( ic.m_program, "HPMC_src_level" );
+    ic.m_loc_capacity = HPMCgetUniformLocation( ic.m_program, "HPMC_capacity" );
+    ic.m_loc_batch = HPMCgetUniformLocation( ic.m_program, "HPMC_batch" );
+    ic.m_loc_cluster_vertices = HPMCgetUniformLocation( ic.m_program, "HPMC_cluster_vertices" );
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCsetTraversalHandleOutputBuffer( struct HPMCTraversalHandle*  th,
+                                    GLsizei                      vertex_size,
+                                    GLsizei                      initial_vertices )
+{
+    if( th == NULL ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setTraversalHandleOutputBuffer called with th == NULL." << endl;
+#endif
+        return false;
+    }
+    if( th->m_handle->m_constants->m_target < HPMC_TARGET_GL40_GLSL400 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: output buffers require OpenGL 4.0." << endl;
+#endif
+        return false;
+    }
+    if( vertex_size <= 0 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setTraversalHandleOutputBuffer called with vertex_size <= 0." << endl;
+#endif
+        return false;
+    }
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setTraversalHandleOutputBuffer called with GL errors." << endl;
+#endif
+        return false;
+    }
+    HPMCTraversalHandle::OutputBuffer& out = th->m_output;
+
+    // --- build indirect command program if not done already ------------------
+    if( th->m_handle->m_constants->m_indirect.m_program == 0 ) {
+        if( !HPMCbuildIndirectCommandProgram( th->m_handle->m_constants ) ) {
+            return false;
+        }
+    }
+
+    // --- create buffers ------------------------------------------------------
+    if( out.m_buf == 0 ) {
+        glGenBuffers( 1, &out.m_buf );
+    }
+    if( out.m_indirect_buf == 0 ) {
+        glGenBuffers( 1, &out.m_indirect_buf );
+    }
+    if( out.m_query == 0 ) {
+        glGenQueries( 1, &out.m_query );
+    }
+    out.m_vertex_size = vertex_size;
+    out.m_capacity = 3*std::max( (GLsizei)1, (initial_vertices+2)/3 );
+    out.m_query_pending = false;
+
+    GLuint old_vbo;
+    glGetIntegerv( GL_ARRAY_BUFFER_BINDING,
+                   reinterpret_cast<GLint*>(&old_vbo) );
+    glBindBuffer( GL_ARRAY_BUFFER, out.m_buf );
+    glBufferData( GL_ARRAY_BUFFER,
+                  (GLsizeiptr)out.m_capacity * out.m_vertex_size,
+                  NULL,
+                  GL_DYNAMIC_COPY );
+    GLuint commands[16] = { 0, 0, 0, 0,  0, 0, 0, 0,  0, 0, 0, 0,  0, 0, 0, 0 };
+    glBindBuffer( GL_ARRAY_BUFFER, out.m_indirect_buf );
+    glBufferData( GL_ARRAY_BUFFER,
+                  sizeof(commands),
+                  commands,
+                  GL_DYNAMIC_COPY );
+    glBindBuffer( GL_ARRAY_BUFFER, old_vbo );
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setTraversalHandleOutputBuffer produced GL errors." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCextractVerticesToOutputBuffer( struct HPMCTraversalHandle* th )
+{
+    if( th == NULL || th->m_output.m_vertex_size == 0 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: extractVerticesToOutputBuffer called without output buffer." << endl;
+#endif
+        return false;
+    }
+    return HPMCextractVerticesHelper( th, 4 );
+}
+
+// -----------------------------------------------------------------------------
+GLuint
+HPMCgetOutputBuffer( struct HPMCTraversalHandle* th )
+{
+    if( th == NULL ) {
+#ifdef DEBUG
+        cerr << "HPMC error: getOutputBuffer called with th == NULL." << endl;
+#endif
+        return 0;
+    }
+    return th->m_output.m_buf;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCdrawOutputBuffer( struct HPMCTraversalHandle*  th,
+                      GLenum                       mode )
+{
+    if( th == NULL || th->m_output.m_vertex_size == 0 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: drawOutputBuffer called without output buffer." << endl;
+#endif
+        return false;
+    }
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: drawOutputBuffer called with GL errors." << endl;
+#endif
+        return false;
+    }
+    GLint old_indirect;
+    glGetIntegerv( GL_DRAW_INDIRECT_BUFFER_BINDING, &old_indirect );
+    glBindBuffer( GL_DRAW_INDIRECT_BUFFER, th->m_output.m_indirect_buf );
+    glDrawArraysIndirect( mode,
+                          reinterpret_cast<const GLvoid*>( 8*sizeof(GLuint) ) );
+    glBindBuffer( GL_DRAW_INDIRECT_BUFFER, old_indirect );
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: drawOutputBuffer produced GL errors." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+static void
+HPMCfreeClusterProgram( struct HPMCTraversalHandle* th )
+{
+    HPMCTraversalHandle::OutputClusters& cl = th->m_clusters;
+    if( cl.m_program != 0 ) {
+        glDeleteProgram( cl.m_program );
+        cl.m_program = 0;
+    }
+    if( cl.m_vertex_shader != 0 ) {
+        glDeleteShader( cl.m_vertex_shader );
+        cl.m_vertex_shader = 0;
+    }
+    cl.m_triangles = 0;
+}
+
+// -----------------------------------------------------------------------------
+static bool
+HPMCbuildClusterProgram( struct HPMCTraversalHandle* th, GLsizei triangles )
+{
+    struct HPMCHistoPyramid* h = th->m_handle;
+    HPMCTraversalHandle::OutputClusters& cl = th->m_clusters;
+
+    cl.m_vertex_shader = HPMCcompileShader( HPMCgenerateDefines( h ) +
+                                            HPMCgenerateScalarFieldFetch( h ) +
+                                            HPMCgenerateExtractVertexFunction( h, false, false, false, false ) +
+                                            HPMCgenerateClusterShader( triangles ),
+                                            GL_VERTEX_SHADER );
+    if( cl.m_vertex_shader == 0 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: Failed to build cluster vertex shader." << endl;
+#endif
+        return false;
+    }
+    cl.m_program = glCreateProgram();
+    glAttachShader( cl.m_program, cl.m_vertex_shader );
+    const char* varyings[3] =
+    {
+        "HPMC_cluster_min",
+        "HPMC_cluster_max",
+        "HPMC_cluster_cone"
+    };
+    glTransformFeedbackVaryings( cl.m_program, 3, varyings, GL_INTERLEAVED_ATTRIBS );
+    if( !HPMClinkProgram( cl.m_program ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: Failed to link cluster program." << endl;
+#endif
+        HPMCfreeClusterProgram( th );
+        return false;
+    }
+    cl.m_loc_histopyramid = HPMCgetUniformLocation( cl.m_program, "HPMC_histopyramid" );
+    cl.m_loc_capacity = HPMCgetUniformLocation( cl.m_program, "HPMC_capacity" );
+    // absent for custom fetch, binary fields and constant tables, respectively
+    cl.m_loc_scalarfield = glGetUniformLocation( cl.m_program, "HPMC_scalarfield" );
+    cl.m_loc_threshold = glGetUniformLocation( cl.m_program, "HPMC_threshold" );
+    cl.m_loc_edge_table = glGetUniformLocation( cl.m_program, "HPMC_edge_table" );
+    if( h->m_fetch.m_parameters.m_binding >= 0 ) {
+        GLuint block = glGetUniformBlockIndex( cl.m_program, "HPMC_FetchParameters" );
+        if( block != GL_INVALID_INDEX ) {
+            glUniformBlockBinding( cl.m_program, block, h->m_fetch.m_parameters.m_binding );
+        }
+    }
+    cl.m_triangles = triangles;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCsetTraversalHandleOutputClusters( struct HPMCTraversalHandle*  th,
+                                      GLsizei                      triangles_per_cluster )
+{
+    if( th == NULL || th->m_output.m_vertex_size == 0 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setTraversalHandleOutputClusters called without output buffer." << endl;
+#endif
+        return false;
+    }
+    if( triangles_per_cluster < 0 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setTraversalHandleOutputClusters called with triangles_per_cluster < 0." << endl;
+#endif
+        return false;
+    }
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setTraversalHandleOutputClusters called with GL errors." << endl;
+#endif
+        return false;
+    }
+    HPMCTraversalHandle::OutputClusters& cl = th->m_clusters;
+
+    HPMCfreeClusterProgram( th );
+    if( triangles_per_cluster == 0 ) {
+        return true;
+    }
+
+    // --- make sure HP is set up before generating traversal code -------------
+    GLint old_pbo;
+    GLint old_prog;
+    GLint old_fbo;
+    glGetIntegerv( GL_PIXEL_PACK_BUFFER_BINDING, &old_pbo );
+    glGetIntegerv( GL_CURRENT_PROGRAM, &old_prog );
+    glGetIntegerv( GL_FRAMEBUFFER_BINDING, &old_fbo );
+    glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+    glPushAttrib( GL_VIEWPORT_BIT | GL_TEXTURE_BIT );
+    bool ok = HPMCsetup( th->m_handle ) &&
+              HPMCbuildClusterProgram( th, triangles_per_cluster );
+    glPopAttrib();
+    glPopClientAttrib();
+    glBindFramebuffer( GL_FRAMEBUFFER, old_fbo );
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, old_pbo );
+    glUseProgram( old_prog );
+    if( !ok ) {
+        return false;
+    }
+
+    // --- create cluster buffer -----------------------------------------------
+    if( cl.m_buf == 0 ) {
+        glGenBuffers( 1, &cl.m_buf );
+    }
+    cl.m_capacity = (th->m_output.m_capacity/3 + triangles_per_cluster - 1)/triangles_per_cluster;
+
+    GLuint old_vbo;
+    glGetIntegerv( GL_ARRAY_BUFFER_BINDING,
+                   reinterpret_cast<GLint*>(&old_vbo) );
+    glBindBuffer( GL_ARRAY_BUFFER, cl.m_buf );
+    glBufferData( GL_ARRAY_BUFFER,
+                  (GLsizeiptr)cl.m_capacity * 12*sizeof(GLfloat),
+                  NULL,
+                  GL_DYNAMIC_COPY );
+    glBindBuffer( GL_ARRAY_BUFFER, old_vbo );
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setTraversalHandleOutputClusters produced GL errors." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+GLuint
+HPMCgetOutputClusterBuffer( struct HPMCTraversalHandle* th )
+{
+    if( th == NULL ) {
+#ifdef DEBUG
+        cerr << "HPMC error: getOutputClusterBuffer called with th == NULL." << endl;
+#endif
+        return 0;
+    }
+    return th->m_clusters.m_buf;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCdrawOutputClusters( struct HPMCTraversalHandle* th )
+{
+    if( th == NULL || th->m_clusters.m_triangles == 0 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: drawOutputClusters called without output clusters." << endl;
+#endif
+        return false;
+    }
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: drawOutputClusters called with GL errors." << endl;
+#endif
+        return false;
+    }
+    GLint old_indirect;
+    glGetIntegerv( GL_DRAW_INDIRECT_BUFFER_BINDING, &old_indirect );
+    glBindBuffer( GL_DRAW_INDIRECT_BUFFER, th->m_output.m_indirect_buf );
+    glDrawArraysIndirect( GL_POINTS,
+                          reinterpret_cast<const GLvoid*>( 12*sizeof(GLuint) ) );
+    glBindBuffer( GL_DRAW_INDIRECT_BUFFER, old_indirect );
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: drawOutputClusters produced GL errors." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+static void
+HPMCfreeCollisionProgram( struct HPMCTraversalHandle* th )
+{
+    HPMCTraversalHandle::CollisionQueries& cq = th->m_collisions;
+    if( cq.m_program != 0 ) {
+        glDeleteProgram( cq.m_program );
+        cq.m_program = 0;
+    }
+    if( cq.m_vertex_shader != 0 ) {
+        glDeleteShader( cq.m_vertex_shader );
+        cq.m_vertex_shader = 0;
+    }
+}
+
+// -----------------------------------------------------------------------------
+static bool
+HPMCbuildCollisionProgram( struct HPMCTraversalHandle* th )
+{
+    struct HPMCHistoPyramid* h = th->m_handle;
+    HPMCTraversalHandle::CollisionQueries& cq = th->m_collisions;
+
+    cq.m_vertex_shader = HPMCcompileShader( HPMCgenerateDefines( h ) +
+                                            HPMCgenerateScalarFieldFetch( h ) +
+                                            HPMCgenerateRayCastFunction( h ) +
+                                            HPMCgenerateCollisionQueryShader(),
+                                            GL_VERTEX_SHADER );
+    if( cq.m_vertex_shader == 0 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: Failed to build collision query vertex shader." << endl;
+#endif
+        return false;
+    }
+    cq.m_program = glCreateProgram();
+    glAttachShader( cq.m_program, cq.m_vertex_shader );
+    glBindAttribLocation( cq.m_program, 0, "HPMC_segment_a" );
+    glBindAttribLocation( cq.m_program, 1, "HPMC_segment_b" );
+    const char* varyings[2] =
+    {
+        "HPMC_hit_position",
+        "HPMC_hit_normal"
+    };
+    glTransformFeedbackVaryings( cq.m_program, 2, varyings, GL_INTERLEAVED_ATTRIBS );
+    if( !HPMClinkProgram( cq.m_program ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: Failed to link collision query program." << endl;
+#endif
+        HPMCfreeCollisionProgram( th );
+        return false;
+    }
+    cq.m_loc_histopyramid = HPMCgetUniformLocation( cq.m_program, "HPMC_histopyramid" );
+    // absent for custom fetch and binary fields, respectively
+    cq.m_loc_scalarfield = glGetUniformLocation( cq.m_program, "HPMC_scalarfield" );
+    cq.m_loc_threshold = glGetUniformLocation( cq.m_program, "HPMC_threshold" );
+    if( h->m_fetch.m_parameters.m_binding >= 0 ) {
+        GLuint block = glGetUniformBlockIndex( cq.m_program, "HPMC_FetchParameters" );
+        if( block != GL_INVALID_INDEX ) {
+            glUniformBlockBinding( cq.m_program, block, h->m_fetch.m_parameters.m_binding );
+        }
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCsetTraversalHandleCollisionQueries( struct HPMCTraversalHandle*  th,
+                                        GLboolean                    enable )
+{
+    if( th == NULL || th->m_program == 0 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setTraversalHandleCollisionQueries called without program." << endl;
+#endif
+        return false;
+    }
+    if( th->m_handle->m_constants->m_target < HPMC_TARGET_GL30_GLSL130 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setTraversalHandleCollisionQueries requires target GL 3.0 or better." << endl;
+#endif
+        return false;
+    }
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setTraversalHandleCollisionQueries called with GL errors." << endl;
+#endif
+        return false;
+    }
+
+    HPMCfreeCollisionProgram( th );
+    if( enable == GL_FALSE ) {
+        return true;
+    }
+
+    // --- make sure HP is set up before generating the query code -------------
+    GLint old_pbo;
+    GLint old_prog;
+    GLint old_fbo;
+    glGetIntegerv( GL_PIXEL_PACK_BUFFER_BINDING, &old_pbo );
+    glGetIntegerv( GL_CURRENT_PROGRAM, &old_prog );
+    glGetIntegerv( GL_FRAMEBUFFER_BINDING, &old_fbo );
+    glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+    glPushAttrib( GL_VIEWPORT_BIT | GL_TEXTURE_BIT );
+    bool ok = HPMCsetup( th->m_handle ) &&
+              HPMCbuildCollisionProgram( th );
+    glPopAttrib();
+    glPopClientAttrib();
+    glBindFramebuffer( GL_FRAMEBUFFER, old_fbo );
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, old_pbo );
+    glUseProgram( old_prog );
+    if( !ok ) {
+        return false;
+    }
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setTraversalHandleCollisionQueries produced GL errors." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+GLuint
+HPMCgetCollisionQueryProgram( struct HPMCTraversalHandle* th )
+{
+    if( th == NULL ) {
+#ifdef DEBUG
+        cerr << "HPMC error: getCollisionQueryProgram called with th == NULL." << endl;
+#endif
+        return 0;
+    }
+    return th->m_collisions.m_program;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCqueryCollisions( struct HPMCTraversalHandle*  th,
+                     GLuint                       segment_buffer,
+                     GLuint                       result_buffer,
+                     GLsizei                      count )
+{
+    if( th == NULL || th->m_collisions.m_program == 0 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: queryCollisions called without collision queries." << endl;
+#endif
+        return false;
+    }
+    if( segment_buffer == 0 || result_buffer == 0 || count < 0 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: queryCollisions called with invalid buffers or count." << endl;
+#endif
+        return false;
+    }
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: queryCollisions called with GL errors." << endl;
+#endif
+        return false;
+    }
+    if( count == 0 ) {
+        return true;
+    }
+    HPMCTraversalHandle::CollisionQueries& cq = th->m_collisions;
+
+    // --- store state ---------------------------------------------------------
+    GLint old_prog;
+    GLint old_vbo;
+    glGetIntegerv( GL_CURRENT_PROGRAM, &old_prog );
+    glGetIntegerv( GL_ARRAY_BUFFER_BINDING, &old_vbo );
+    glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+    glPushAttrib( GL_TEXTURE_BIT );
+    GLboolean discard = glIsEnabled( GL_RASTERIZER_DISCARD );
+
+    // --- setup state ---------------------------------------------------------
+    HPMCbindTraversalState( th );
+    glUseProgram( cq.m_program );
+    glUniform1i( cq.m_loc_histopyramid, th->m_histopyramid_unit );
+    if( cq.m_loc_scalarfield != -1 ) {
+        glUniform1i( cq.m_loc_scalarfield, th->m_scalarfield_unit );
+    }
+    if( cq.m_loc_threshold != -1 ) {
+        glUniform1f( cq.m_loc_threshold, th->m_handle->m_histopyramid.m_threshold );
+    }
+    glBindBuffer( GL_ARRAY_BUFFER, segment_buffer );
+    glVertexAttribPointer( 0, 4, GL_FLOAT, GL_FALSE, 8*sizeof(GLfloat),
+                           reinterpret_cast<const GLvoid*>( 0 ) );
+    glVertexAttribPointer( 1, 4, GL_FLOAT, GL_FALSE, 8*sizeof(GLfloat),
+                           reinterpret_cast<const GLvoid*>( 4*sizeof(GLfloat) ) );
+    glEnableVertexAttribArray( 0 );
+    glEnableVertexAttribArray( 1 );
+
+    // --- cast one segment per point ------------------------------------------
+    glBindBufferBase( GL_TRANSFORM_FEEDBACK_BUFFER, 0, result_buffer );
+    glEnable( GL_RASTERIZER_DISCARD );
+    glBeginTransformFeedback( GL_POINTS );
+    glDrawArrays( GL_POINTS, 0, count );
+    glEndTransformFeedback();
+
+    // --- restore state -------------------------------------------------------
+    if( discard == GL_FALSE ) {
+        glDisable( GL_RASTERIZER_DISCARD );
+    }
+    glPopAttrib();
+    glPopClientAttrib();
+    glBindBuffer( GL_ARRAY_BUFFER, old_vbo );
+    glUseProgram( old_prog );
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: queryCollisions produced GL errors." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+static void
+HPMCfreeComputeExtractionProgram( struct HPMCTraversalHandle* th )
+{
+    HPMCTraversalHandle::ComputeExtraction& ce = th->m_compute;
+    if( ce.m_program != 0 ) {
+        glDeleteProgram( ce.m_program );
+        ce.m_program = 0;
+    }
+    if( ce.m_compute_shader != 0 ) {
+        glDeleteShader( ce.m_compute_shader );
+        ce.m_compute_shader = 0;
+    }
+}
+
+// -----------------------------------------------------------------------------
+static bool
+HPMCbuildComputeExtractionProgram( struct HPMCTraversalHandle* th )
+{
+    struct HPMCHistoPyramid* h = th->m_handle;
+    HPMCTraversalHandle::ComputeExtraction& ce = th->m_compute;
+
+    // compute shaders need an explicit version, see HPMCgenerateComputeVersion
+    ce.m_compute_shader = HPMCcompileShader( HPMCgenerateComputeVersion( h->m_constants ) +
+                                             HPMCgenerateDefines( h ) +
+                                             HPMCgenerateScalarFieldFetch( h ) +
+                                             HPMCgenerateExtractVertexFunction( h, false, false, false, true ) +
+                                             HPMCgenerateComputeExtractionShader(),
+                                             GL_COMPUTE_SHADER );
+    if( ce.m_compute_shader == 0 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: Failed to build compute extraction shader." << endl;
+#endif
+        return false;
+    }
+    ce.m_program = glCreateProgram();
+    glAttachShader( ce.m_program, ce.m_compute_shader );
+    if( !HPMClinkProgram( ce.m_program ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: Failed to link compute extraction program." << endl;
+#endif
+        HPMCfreeComputeExtractionProgram( th );
+        return false;
+    }
+    ce.m_loc_histopyramid = HPMCgetUniformLocation( ce.m_program, "HPMC_histopyramid" );
+    ce.m_loc_capacity = HPMCgetUniformLocation( ce.m_program, "HPMC_capacity" );
+    ce.m_loc_write_normals = HPMCgetUniformLocation( ce.m_program, "HPMC_write_normals" );
+    ce.m_loc_write_indices = HPMCgetUniformLocation( ce.m_program, "HPMC_write_indices" );
+    ce.m_loc_write_command = HPMCgetUniformLocation( ce.m_program, "HPMC_write_command" );
+    // absent for custom fetch, binary fields and constant tables, respectively
+    ce.m_loc_scalarfield = glGetUniformLocation( ce.m_program, "HPMC_scalarfield" );
+    ce.m_loc_threshold = glGetUniformLocation( ce.m_program, "HPMC_threshold" );
+    ce.m_loc_edge_table = glGetUniformLocation( ce.m_program, "HPMC_edge_table" );
+    if( h->m_fetch.m_parameters.m_binding >= 0 ) {
+        GLuint block = glGetUniformBlockIndex( ce.m_program, "HPMC_FetchParameters" );
+        if( block != GL_INVALID_INDEX ) {
+            glUniformBlockBinding( ce.m_program, block, h->m_fetch.m_parameters.m_binding );
+        }
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCsetTraversalHandleComputeExtraction( struct HPMCTraversalHandle*  th,
+                                         GLboolean                    enable )
+{
+    if( th == NULL || th->m_program == 0 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setTraversalHandleComputeExtraction called without program." << endl;
+#endif
+        return false;
+    }
+    if( th->m_handle->m_constants->m_target < HPMC_TARGET_GL43_GLSL430 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setTraversalHandleComputeExtraction requires target GL 4.3 or better." << endl;
+#endif
+        return false;
+    }
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setTraversalHandleComputeExtraction called with GL errors." << endl;
+#endif
+        return false;
+    }
+
+    HPMCfreeComputeExtractionProgram( th );
+    if( enable == GL_FALSE ) {
+        return true;
+    }
+
+    // --- make sure HP is set up before generating the extraction code --------
+    GLint old_pbo;
+    GLint old_prog;
+    GLint old_fbo;
+    glGetIntegerv( GL_PIXEL_PACK_BUFFER_BINDING, &old_pbo );
+    glGetIntegerv( GL_CURRENT_PROGRAM, &old_prog );
+    glGetIntegerv( GL_FRAMEBUFFER_BINDING, &old_fbo );
+    glPushClientAttrib( GL_CLIENT_VERTEX_ARRAY_BIT );
+    glPushAttrib( GL_VIEWPORT_BIT | GL_TEXTURE_BIT );
+    bool ok = HPMCsetup( th->m_handle ) &&
+              HPMCbuildComputeExtractionProgram( th );
+    glPopAttrib();
+    glPopClientAttrib();
+    glBindFramebuffer( GL_FRAMEBUFFER, old_fbo );
+    glBindBuffer( GL_PIXEL_PACK_BUFFER, old_pbo );
+    glUseProgram( old_prog );
+    if( !ok ) {
+        return false;
+    }
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: setTraversalHandleComputeExtraction produced GL errors." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+GLuint
+HPMCgetComputeExtractionProgram( struct HPMCTraversalHandle* th )
+{
+    if( th == NULL ) {
+#ifdef DEBUG
+        cerr << "HPMC error: getComputeExtractionProgram called with th == NULL." << endl;
+#endif
+        return 0;
+    }
+    return th->m_compute.m_program;
+}
+
+// -----------------------------------------------------------------------------
+bool
+HPMCextractVerticesCompute( struct HPMCTraversalHandle*  th,
+                            GLuint                       position_buffer,
+                            GLuint                       normal_buffer,
+                            GLuint                       index_buffer,
+                            GLuint                       indirect_buffer,
+                            GLsizei                      capacity )
+{
+    if( th == NULL || th->m_compute.m_program == 0 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: extractVerticesCompute called without compute extraction." << endl;
+#endif
+        return false;
+    }
+    if( position_buffer == 0 || capacity < 0 ) {
+#ifdef DEBUG
+        cerr << "HPMC error: extractVerticesCompute called with invalid buffer or capacity." << endl;
+#endif
+        return false;
+    }
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: extractVerticesCompute called with GL errors." << endl;
+#endif
+        return false;
+    }
+    HPMCTraversalHandle::ComputeExtraction& ce = th->m_compute;
+    const HPMCHistoPyramid::HistoPyramid& hp = th->m_handle->m_histopyramid;
+    HPMCtouchPyramid( th->m_handle );
+
+    // --- one invocation per triangle that fits -------------------------------
+    GLsizei triangles = capacity/3;
+    if( hp.m_top_count_updated ) {
+        triangles = std::min( triangles, hp.m_top_count/3 );
+    }
+    if( triangles == 0 ) {
+        if( indirect_buffer == 0 ) {
+            return true;
+        }
+        // the first invocation still writes the (empty) command
+        triangles = 1;
+    }
+
+    // --- store state ---------------------------------------------------------
+    GLint old_prog;
+    glGetIntegerv( GL_CURRENT_PROGRAM, &old_prog );
+    glPushAttrib( GL_TEXTURE_BIT );
+
+    // --- setup state ---------------------------------------------------------
+    HPMCbindTraversalState( th );
+    glUseProgram( ce.m_program );
+    glUniform1i( ce.m_loc_histopyramid, th->m_histopyramid_unit );
+    if( ce.m_loc_edge_table != -1 ) {
+        glUniform1i( ce.m_loc_edge_table, th->m_edge_decode_unit );
+    }
+    if( ce.m_loc_scalarfield != -1 ) {
+        glUniform1i( ce.m_loc_scalarfield, th->m_scalarfield_unit );
+    }
+    if( ce.m_loc_threshold != -1 ) {
+        glUniform1f( ce.m_loc_threshold, hp.m_threshold );
+    }
+    glUniform1f( ce.m_loc_capacity, static_cast<GLfloat>( capacity ) );
+    glUniform1i( ce.m_loc_write_normals, normal_buffer != 0 ? 1 : 0 );
+    glUniform1i( ce.m_loc_write_indices, index_buffer != 0 ? 1 : 0 );
+    glUniform1i( ce.m_loc_write_command, indirect_buffer != 0 ? 1 : 0 );
+    glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 0, position_buffer );
+    glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 1, normal_buffer != 0 ? normal_buffer : position_buffer );
+    glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 2, index_buffer != 0 ? index_buffer : position_buffer );
+    glBindBufferBase( GL_SHADER_STORAGE_BUFFER, 3, indirect_buffer != 0 ? indirect_buffer : position_buffer );
+
+    // --- extract -------------------------------------------------------------
+    const GLsizei n = HPMC_COMPUTE_GROUP_SIZE*HPMC_COMPUTE_GROUP_SIZE;
+    glDispatchCompute( (triangles+n-1)/n, 1, 1 );
+    glMemoryBarrier( GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT |
+                     GL_ELEMENT_ARRAY_BARRIER_BIT |
+                     GL_COMMAND_BARRIER_BIT |
+                     GL_SHADER_STORAGE_BARRIER_BIT |
+                     GL_BUFFER_UPDATE_BARRIER_BIT );
+
+    // --- restore state -------------------------------------------------------
+    glPopAttrib();
+    glUseProgram( old_prog );
+
+    if( !HPMCcheckGL( __FILE__, __LINE__ ) ) {
+#ifdef DEBUG
+        cerr << "HPMC error: extractVerticesCompute produced GL errors." << endl;
+#endif
+        return false;
+    }
+    return true;
+}
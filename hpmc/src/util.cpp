@@ -200,7 +200,14 @@ HPMCgetUniformLocation( GLuint program, const std::string& name )
 void
 HPMCrenderGPGPUQuad( struct HPMCHistoPyramid* h )
 {
-    glBindBuffer( GL_ARRAY_BUFFER, h->m_constants->m_gpgpu_quad_vbo );
+    HPMCrenderGPGPUQuad( h->m_constants );
+}
+
+// -----------------------------------------------------------------------------
+void
+HPMCrenderGPGPUQuad( struct HPMCConstants* c )
+{
+    glBindBuffer( GL_ARRAY_BUFFER, c->m_gpgpu_quad_vbo );
     glVertexPointer( 3, GL_FLOAT, 0, NULL );
     glEnableClientState( GL_VERTEX_ARRAY );
     glDrawArrays( GL_QUADS, 0, 4 );